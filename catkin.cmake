@@ -6,7 +6,7 @@ find_package(catkin REQUIRED)
 find_package(orocos_kdl REQUIRED)
 find_package(cmake_modules REQUIRED)
 find_package(Eigen3 REQUIRED)
-find_package(Boost REQUIRED COMPONENTS random)
+find_package(Boost REQUIRED COMPONENTS random thread system atomic)
 catkin_package(
   INCLUDE_DIRS include
   LIBRARIES ${PROJECT_NAME}
@@ -36,6 +36,14 @@ set(EXPRESSIONTREE_SRCS
     src/expressiontree_double.cpp  
     src/expressiontree_mimo.cpp         
     src/expressiontree_vector.cpp    
+    src/expressiontree_compiled.cpp
+    src/expressiontree_jacobian.cpp
+    src/expressiontree_graph.cpp
+    src/expressiontree_batch.cpp
+    src/expressiontree_pool.cpp
+    src/expressiontree_staging.cpp
+    src/expressiontree_realtime.cpp
+    src/expressiontree_arena.cpp
     )
 
 add_library(${PROJECT_NAME} ${EXPRESSIONTREE_SRCS})
@@ -0,0 +1,111 @@
+/*
+ * expressiontree_compiled.cpp
+ *
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+
+#include <kdl/expressiontree.hpp>
+#include <boost/timer.hpp>
+#include <iostream>
+
+/*
+ * Compares the computation time of the expression graph (derivative by derivative and
+ * with jacobian(..)) with the computation time of the same graph compiled to a flat tape
+ * (see CompiledExpression).
+ * The expression is the MonsterExpression of tests/expressiongraph_test.cpp.
+ */
+
+int main(int argc, char* argv[]) {
+    using namespace KDL;
+    using namespace std;
+
+    Expression<double>::Ptr s  = input(0)*Constant(0.3) + input(2)*Constant(-0.2) + input(3)*Constant(0.1) + Constant(0.5);
+    Expression<double>::Ptr s1 = cached<double>( -sin(s)*cos(s)+tan(s)   );
+    Expression<double>::Ptr s2 = cached<double>( sin(s)+tan(s) )/s;
+    Expression<double>::Ptr s3 = s*cached<double>( s  );
+    Expression<Vector>::Ptr v1 = cached<Vector>(KDL::vector(s1,s2,s3));
+    Expression<Vector>::Ptr v2 = cached<Frame>(frame(rot_x(s3)*rot_z(s3)))*cached<Vector>(KDL::vector(s3,s2*s2,s1));
+    Expression<double>::Ptr expr = Constant(0.0001)*norm(v1*v2*dot(v1,v2));
+
+    CompiledExpression<double> compiled = compile(expr);
+    compiled.tape->print(cout);
+
+    int N = 1000000;
+    int nd = expr->number_of_derivatives();
+    double check = 0.0;
+    boost::timer timer;
+    for (int n=0;n<N;++n) {
+        expr->setInputValue(0, n*0.8/N);
+        check += expr->value();
+        for (int i=0;i<nd;++i) {
+            check += expr->derivative(i);
+        }
+    }
+    double t_graph = timer.elapsed()*1000000.0/N;
+
+    timer.restart();
+    for (int n=0;n<N;++n) {
+        compiled.setInputValue(0, n*0.8/N);
+        check -= compiled.value();
+        for (int i=0;i<nd;++i) {
+            check -= compiled.derivative(i);
+        }
+    }
+    double t_compiled = timer.elapsed()*1000000.0/N;
+
+    // all derivatives in one traversal of the expression graph
+    VarIndexSet ndx;
+    for (int i=0;i<nd;++i) {
+        ndx.push_back(i);
+    }
+    std::vector<double> jac(nd);
+    timer.restart();
+    for (int n=0;n<N;++n) {
+        expr->setInputValue(0, n*0.8/N);
+        expr->value();
+        expr->jacobian(ndx,&jac[0]);
+    }
+    double t_jacobian = timer.elapsed()*1000000.0/N;
+
+    // compiled, ExpressionTape::lanes derivatives in each pass over the tape
+    timer.restart();
+    for (int n=0;n<N;++n) {
+        compiled.setInputValue(0, n*0.8/N);
+        compiled.value();
+        compiled.jacobian(ndx,&jac[0]);
+    }
+    double t_lanes = timer.elapsed()*1000000.0/N;
+
+    // reverse mode: all derivatives in one backward sweep
+    Eigen::VectorXd grad;
+    timer.restart();
+    for (int n=0;n<N;++n) {
+        compiled.setInputValue(0, n*0.8/N);
+        compiled.value();
+        compiled.gradient(grad);
+    }
+    double t_gradient = timer.elapsed()*1000000.0/N;
+
+    cout << "expression graph    : " << t_graph << " us per evaluation" << endl;
+    cout << "graph, jacobian()   : " << t_jacobian << " us per evaluation" << endl;
+    cout << "compiled expression : " << t_compiled << " us per evaluation" << endl;
+    cout << "compiled, jacobian(): " << t_lanes << " us per evaluation ("<< ExpressionTape::lanes << " lanes)" << endl;
+    cout << "compiled, gradient  : " << t_gradient << " us per evaluation" << endl;
+    cout << "difference between results (should be zero) : " << check << endl;
+    return 0;
+}
@@ -81,6 +81,10 @@ int main(int argc,char* argv[]) {
     chain.addSegment(Segment("Segment 5", Joint("Joint 5", Joint::RotX),Frame(Vector(0,0,L4))));
     chain.addSegment(Segment("Segment 6", Joint("Joint 6", Joint::RotZ),Frame(Vector(0,0,0))));
 
+    // while the builder exists, structurally identical subexpressions (e.g. coord_x(tmp) below)
+    // are only created once.  They are still evaluated once for each parent, unless they are
+    // cached (see cached(..) and auto_cache(..)):
+    GraphBuilder builder;
     Expression<Frame>::Ptr kinchain = cached<Frame>(
          Constant(Frame(Vector(0,0,0.5))) * kinematic_chain( chain, 0 ) * Constant(Frame(Vector(0,0,0.3)))
     );
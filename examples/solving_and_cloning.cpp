@@ -53,15 +53,21 @@ void solve( std::vector<Expression<double>::Ptr> list,  int time_ndx, const std:
     Eigen::JacobiSVD<Eigen::MatrixXd> svd(m, n );
     Eigen::VectorXd  d_sol(n);
 
+    // the sparsity pattern of the Jacobian is determined once, each measurement only
+    // contributes derivatives towards the variables it depends on:
+    JacobianAssembler assembler(ndx);
+    for (int i=0;i<m;++i) {
+        assembler.add(list[i]);
+    }
+    assembler.initialize(Jac);
+
     for (int it=0;it<10;++it) {
         for (int i=0;i<m;++i) {
             list[i]->setInputValues(ndx,solution);
             list[i]->setInputValue(time_ndx,0); // to force the variable expr to be read (that depend on time_ndx).
             err(i) = list[i]->value();
-            for (int j=0;j<n;++j) {
-                Jac(i,j) = list[i]->derivative(ndx[j]);
-            }
         }
+        assembler.jacobian(Jac);
         //cout << "error " << err.transpose() << endl;
         //cout << "Jacobian " << endl << Jac << endl;
         svd.compute(Jac,Eigen::ComputeThinU| Eigen::ComputeThinV );
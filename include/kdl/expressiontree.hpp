@@ -29,6 +29,14 @@
 #include "expressiontree_chain.hpp"
 #include "expressiontree_var.hpp"
 #include "expressiontree_mimo.hpp"
+#include "expressiontree_compiled.hpp"
+#include "expressiontree_pool.hpp"
+#include "expressiontree_jacobian.hpp"
+#include "expressiontree_graph.hpp"
+#include "expressiontree_batch.hpp"
+#include "expressiontree_staging.hpp"
+#include "expressiontree_realtime.hpp"
+#include "expressiontree_arena.hpp"
 
 #endif
 
@@ -0,0 +1,310 @@
+/**
+ * @file expressiontree_arena.hpp
+ * @brief arena allocation of the nodes of expression graphs.
+*
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#ifndef KDL_EXPRESSIONTREE_ARENA_HPP
+#define KDL_EXPRESSIONTREE_ARENA_HPP
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/atomic.hpp>
+#include <vector>
+#include <cstddef>
+#include <new>
+#include <typeinfo>
+
+namespace KDL {
+
+/**
+ * Opt-in arena allocation of expression graphs.
+ *
+ * While a GraphArena exists, the functions that build expressions (input, Constant, operator*, sin,
+ * cached, kinematic_chain, ..., and clone()) allocate their nodes (together with the reference count
+ * of their shared pointer) consecutively in large chunks of memory, instead of one heap allocation per node.
+ * Since the arguments of a node are created before the node itself, the nodes are laid out in
+ * (roughly) topological order, which improves the locality of the evaluation of large graphs.
+ *
+ * @code
+ *   Expression<double>::Ptr e;
+ *   {
+ *       GraphArena arena;
+ *       e = ... build a large expression ...
+ *   }
+ *   // e remains valid
+ * @endcode
+ *
+ * The individual nodes are never returned to the arena: the chunks are freed all at once,
+ * when the GraphArena is destroyed and the last node allocated from it is destroyed.
+ * The nodes do not hold a reference to the arena, the arena only counts the nodes that are not yet destroyed.
+ *
+ * Arenas can be nested, the most recently constructed arena is used.  Nodes created outside
+ * the scope of an arena are allocated on the heap, as usual.
+ *
+ * The current arena is kept per thread: an arena is only used by the thread that constructed it.
+ */
+class GraphArena {
+public:
+    /**
+     * memory of an arena, shared by the nodes that are allocated from it.  Deletes itself when
+     * its GraphArena is destroyed and all memory allocated from it is returned.
+     */
+    class Storage {
+    public:
+        explicit Storage(size_t chunk_size);
+
+        /**
+         * returns n bytes, aligned for any type.  Only to be called by the thread of the GraphArena,
+         * while the GraphArena exists.
+         */
+        void* allocate(size_t n);
+
+        /**
+         * returns the memory p of one call to allocate(..).  Can be called by any thread.
+         */
+        void deallocate(void* p);
+
+        /**
+         * called by the GraphArena when it is destroyed.
+         */
+        void close();
+
+        /**
+         * number of bytes allocated from this storage.
+         */
+        size_t allocated() const {
+            return nr_of_bytes;
+        }
+
+        /**
+         * number of chunks requested from the heap.
+         */
+        size_t chunks() const {
+            return blocks.size();
+        }
+
+    private:
+        Storage(const Storage&);
+        Storage& operator=(const Storage&);
+        ~Storage();
+
+        char* allocateBlock(size_t n);
+
+        std::vector<char*> blocks;      ///< memory as returned by operator new
+        char*              next;
+        size_t             left;
+        size_t             chunk_size;
+        size_t             nr_of_bytes;
+        long               nr_of_allocations; ///< number of calls to allocate(..), only changed by the thread of the arena
+        boost::atomic<long> live;       ///< allocations not yet returned, plus a large count while the arena exists
+    };
+
+    /**
+     * \param chunk_size size (in bytes) of the chunks of memory that are requested from the heap.
+     */
+    explicit GraphArena(size_t chunk_size=65536);
+
+    /**
+     * the storage of the arena that is currently in scope in this thread, or a null pointer.
+     */
+    static Storage* current();
+
+    Storage* storage() const {
+        return memory;
+    }
+
+    size_t allocated() const {
+        return memory->allocated();
+    }
+
+    size_t chunks() const {
+        return memory->chunks();
+    }
+
+    ~GraphArena();
+private:
+    GraphArena(const GraphArena&);
+    GraphArena& operator=(const GraphArena&);
+
+    Storage*                   memory;
+    GraphArena*                previous;
+};
+
+/**
+ * allocator that takes its memory from a GraphArena::Storage, or from the heap if it has no storage.
+ * Used by make_node(..) inside a GraphArena.
+ */
+template <typename T>
+class NodeAllocator {
+public:
+    typedef T              value_type;
+    typedef T*             pointer;
+    typedef const T*       const_pointer;
+    typedef T&             reference;
+    typedef const T&       const_reference;
+    typedef size_t         size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef NodeAllocator<U> other;
+    };
+
+    GraphArena::Storage* storage;
+
+    NodeAllocator():
+        storage(0) {}
+
+    explicit NodeAllocator(GraphArena::Storage* _storage):
+        storage(_storage) {}
+
+    template <typename U>
+    NodeAllocator(const NodeAllocator<U>& other):
+        storage(other.storage) {}
+
+    T* allocate(size_t n, const void* hint=0) {
+        if (storage) {
+            return static_cast<T*>(storage->allocate(n*sizeof(T)));
+        }
+        return static_cast<T*>(::operator new(n*sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        // memory of an arena is released all at once.
+        if (storage) {
+            storage->deallocate(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    void construct(T* p, const T& v) {
+        ::new(static_cast<void*>(p)) T(v);
+    }
+
+    void destroy(T* p) {
+        p->~T();
+    }
+
+    T* address(T& v) const {
+        return &v;
+    }
+
+    const T* address(const T& v) const {
+        return &v;
+    }
+
+    size_t max_size() const {
+        return size_t(-1)/sizeof(T);
+    }
+};
+
+template <typename T, typename U>
+inline bool operator==(const NodeAllocator<T>& a, const NodeAllocator<U>& b) {
+    return a.storage==b.storage;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const NodeAllocator<T>& a, const NodeAllocator<U>& b) {
+    return a.storage!=b.storage;
+}
+
+/**
+ * records the size of the nodes of the given type, such that the size of a node can be found
+ * from its dynamic type (see memory_report(..)).
+ */
+bool register_node_size(const std::type_info& type, size_t size);
+
+/**
+ * size in bytes of a node of the given type, or 0 if no node of this type was created by make_node(..).
+ */
+size_t node_size(const std::type_info& type);
+
+template <typename T>
+inline void register_node_type() {
+    static const bool registered = register_node_size(typeid(T), sizeof(T));
+    (void)registered;
+}
+
+/**
+ * creates a node of an expression graph, in the current GraphArena if there is one.
+ * Outside an arena, this is boost::make_shared(..).
+ */
+template <typename T>
+inline boost::shared_ptr<T> make_node() {
+    register_node_type<T>();
+    GraphArena::Storage* storage = GraphArena::current();
+    if (storage==0) {
+        return boost::make_shared<T>();
+    }
+    return boost::allocate_shared<T>(NodeAllocator<T>(storage));
+}
+
+template <typename T, typename A1>
+inline boost::shared_ptr<T> make_node(const A1& a1) {
+    register_node_type<T>();
+    GraphArena::Storage* storage = GraphArena::current();
+    if (storage==0) {
+        return boost::make_shared<T>(a1);
+    }
+    return boost::allocate_shared<T>(NodeAllocator<T>(storage), a1);
+}
+
+template <typename T, typename A1, typename A2>
+inline boost::shared_ptr<T> make_node(const A1& a1, const A2& a2) {
+    register_node_type<T>();
+    GraphArena::Storage* storage = GraphArena::current();
+    if (storage==0) {
+        return boost::make_shared<T>(a1, a2);
+    }
+    return boost::allocate_shared<T>(NodeAllocator<T>(storage), a1, a2);
+}
+
+template <typename T, typename A1, typename A2, typename A3>
+inline boost::shared_ptr<T> make_node(const A1& a1, const A2& a2, const A3& a3) {
+    register_node_type<T>();
+    GraphArena::Storage* storage = GraphArena::current();
+    if (storage==0) {
+        return boost::make_shared<T>(a1, a2, a3);
+    }
+    return boost::allocate_shared<T>(NodeAllocator<T>(storage), a1, a2, a3);
+}
+
+template <typename T, typename A1, typename A2, typename A3, typename A4>
+inline boost::shared_ptr<T> make_node(const A1& a1, const A2& a2, const A3& a3, const A4& a4) {
+    register_node_type<T>();
+    GraphArena::Storage* storage = GraphArena::current();
+    if (storage==0) {
+        return boost::make_shared<T>(a1, a2, a3, a4);
+    }
+    return boost::allocate_shared<T>(NodeAllocator<T>(storage), a1, a2, a3, a4);
+}
+
+template <typename T, typename A1, typename A2, typename A3, typename A4, typename A5>
+inline boost::shared_ptr<T> make_node(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5) {
+    register_node_type<T>();
+    GraphArena::Storage* storage = GraphArena::current();
+    if (storage==0) {
+        return boost::make_shared<T>(a1, a2, a3, a4, a5);
+    }
+    return boost::allocate_shared<T>(NodeAllocator<T>(storage), a1, a2, a3, a4, a5);
+}
+
+} // namespace KDL
+#endif
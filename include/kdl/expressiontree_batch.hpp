@@ -0,0 +1,85 @@
+/**
+ * @file expressiontree_batch.hpp
+ * @brief evaluation of an expression at many input vectors, using multiple threads.
+*
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#ifndef KDL_EXPRESSIONTREE_BATCH_HPP
+#define KDL_EXPRESSIONTREE_BATCH_HPP
+
+#include <kdl/expressiontree_compiled.hpp>
+#include <kdl/expressiontree_pool.hpp>
+#include <Eigen/Dense>
+
+namespace KDL {
+
+/**
+ * Evaluates output number output of tape for each column of inputs, see evaluate_batch(expr,...).
+ * \param jacobians can be 0, in which case no derivatives are computed.
+ */
+void evaluate_batch(const ExpressionTape& tape, int output, const Eigen::MatrixXd& inputs,
+                    Eigen::MatrixXd& values, Eigen::MatrixXd* jacobians, int nthreads);
+
+/**
+ * idem, using the workers of an existing pool.
+ */
+void evaluate_batch(const ExpressionTape& tape, int output, const Eigen::MatrixXd& inputs,
+                    Eigen::MatrixXd& values, Eigen::MatrixXd* jacobians, TaskPool& pool);
+
+/**
+ * Evaluates the value and the Jacobian of expr for each column of inputs.
+ *
+ * The expression is compiled once to an ExpressionTape.  The samples are divided in small
+ * chunks that are executed by a TaskPool, such that the load remains balanced when samples
+ * have a different cost.  Each
+ * worker has its own EvalContext and writes its results directly into its own columns of the
+ * outputs, without locking.
+ *
+ * \param [in]  expr      expression to evaluate.
+ * \param [in]  inputs    matrix with one sample per column, row i is the value of (scalar) variable i.
+ * \param [out] values    column k is the value of expr at sample k, laid out as TapeTrait<T>
+ *                        (e.g. 12 rows for a Frame).
+ * \param [out] jacobians column k is the Jacobian of expr at sample k towards the variables 0..inputs.rows()-1,
+ *                        stored column by column: row c + d*i is component c of the derivative towards variable i,
+ *                        with d the size of AutoDiffTrait<T>::DerivType (e.g. 6 for a Frame).
+ * \param [in]  nthreads  number of worker threads, 0 to use one thread per core.
+ *
+ * The outputs are only resized when they do not have the right size.
+ * \warning only scalar input variables can be set in this way.
+ */
+template <typename T>
+inline void evaluate_batch(const boost::shared_ptr< Expression<T> >& expr, const Eigen::MatrixXd& inputs,
+                           Eigen::MatrixXd& values, Eigen::MatrixXd& jacobians, int nthreads=0) {
+    ExpressionTape tape;
+    int output = tape.addOutput(expr);
+    evaluate_batch(tape, output, inputs, values, &jacobians, nthreads);
+}
+
+/**
+ * Evaluates the value of expr for each column of inputs, without derivatives.
+ */
+template <typename T>
+inline void evaluate_batch(const boost::shared_ptr< Expression<T> >& expr, const Eigen::MatrixXd& inputs,
+                           Eigen::MatrixXd& values, int nthreads=0) {
+    ExpressionTape tape;
+    int output = tape.addOutput(expr);
+    evaluate_batch(tape, output, inputs, values, 0, nthreads);
+}
+
+} // namespace KDL
+#endif
@@ -122,13 +122,15 @@ public:
 
     virtual  Expression_Chain::Ptr clone();
 
+    virtual size_t cacheBytes() const;
+
     //virtual void write_dotfile_helper(std::ostream& of, size_t& thisnode, size_t& counter);
 
 
 };
 
 inline Expression<Frame>::Ptr kinematic_chain(const Chain& chain, int index_of_first_joint ) {
-	Expression<Frame>::Ptr expr( new Expression_Chain( chain, index_of_first_joint ) );
+	Expression<Frame>::Ptr expr = make_node<Expression_Chain>( chain, index_of_first_joint );
     return expr;
 }
 
@@ -0,0 +1,581 @@
+/**
+ * @file expressiontree_compiled.hpp
+ * @brief flat ("tape") representation of expression graphs.
+*
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#ifndef KDL_EXPRESSIONTREE_COMPILED_HPP
+#define KDL_EXPRESSIONTREE_COMPILED_HPP
+
+#include <kdl/expressiontree_expressions.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <map>
+
+namespace KDL {
+
+/**
+ * Types that can be stored on an ExpressionTape.
+ */
+enum TapeType {
+    TAPE_DOUBLE=0,
+    TAPE_VECTOR,
+    TAPE_ROTATION,
+    TAPE_FRAME,
+    TAPE_TWIST,
+    TAPE_WRENCH
+};
+
+/**
+ * Describes how a value of type T is laid out in the (flat) value buffer of an ExpressionTape:
+ *  - double   : 1 number
+ *  - Vector   : 3 numbers
+ *  - Rotation : 9 numbers, row-major (the same layout as Rotation::data)
+ *  - Frame    : 9 numbers for M, followed by 3 numbers for p
+ *  - Twist    : vel followed by rot
+ *  - Wrench   : force followed by torque
+ * Derivatives are stored using the layout of AutoDiffTrait<T>::DerivType.
+ */
+template <typename T>
+struct TapeTrait {
+};
+
+template <>
+struct TapeTrait<double> {
+    static const int type  = TAPE_DOUBLE;
+    static const int size  = 1;
+    static void store(double* p, double v) {
+        p[0] = v;
+    }
+    static double load(const double* p) {
+        return p[0];
+    }
+};
+
+template <>
+struct TapeTrait<Vector> {
+    static const int type  = TAPE_VECTOR;
+    static const int size  = 3;
+    static void store(double* p, const Vector& v) {
+        p[0] = v[0]; p[1] = v[1]; p[2] = v[2];
+    }
+    static Vector load(const double* p) {
+        return Vector(p[0],p[1],p[2]);
+    }
+};
+
+template <>
+struct TapeTrait<Rotation> {
+    static const int type  = TAPE_ROTATION;
+    static const int size  = 9;
+    static void store(double* p, const Rotation& R) {
+        for (int i=0;i<9;++i) {
+            p[i] = R.data[i];
+        }
+    }
+    static Rotation load(const double* p) {
+        return Rotation(p[0],p[1],p[2],p[3],p[4],p[5],p[6],p[7],p[8]);
+    }
+};
+
+template <>
+struct TapeTrait<Frame> {
+    static const int type  = TAPE_FRAME;
+    static const int size  = 12;
+    static void store(double* p, const Frame& F) {
+        TapeTrait<Rotation>::store(p,   F.M);
+        TapeTrait<Vector>::store(p+9, F.p);
+    }
+    static Frame load(const double* p) {
+        return Frame(TapeTrait<Rotation>::load(p), TapeTrait<Vector>::load(p+9));
+    }
+};
+
+template <>
+struct TapeTrait<Twist> {
+    static const int type  = TAPE_TWIST;
+    static const int size  = 6;
+    static void store(double* p, const Twist& t) {
+        TapeTrait<Vector>::store(p,   t.vel);
+        TapeTrait<Vector>::store(p+3, t.rot);
+    }
+    static Twist load(const double* p) {
+        return Twist(TapeTrait<Vector>::load(p), TapeTrait<Vector>::load(p+3));
+    }
+};
+
+template <>
+struct TapeTrait<Wrench> {
+    static const int type  = TAPE_WRENCH;
+    static const int size  = 6;
+    static void store(double* p, const Wrench& w) {
+        TapeTrait<Vector>::store(p,   w.force);
+        TapeTrait<Vector>::store(p+3, w.torque);
+    }
+    static Wrench load(const double* p) {
+        return Wrench(TapeTrait<Vector>::load(p), TapeTrait<Vector>::load(p+3));
+    }
+};
+
+/**
+ * One instruction of an ExpressionTape.  All locations are offsets into the
+ * value buffer (result, arg, aux) or into the derivative buffer (dresult, darg)
+ * of the tape.
+ */
+struct TapeInstruction {
+    int opcode;
+    int vsize;             ///< number of doubles in the value of the result
+    int dsize;             ///< number of doubles in the derivative of the result
+    int result;            ///< location of the value of the result
+    int dresult;           ///< location of the derivative of the result
+    int arg[3];            ///< location of the values of the arguments
+    int darg[3];           ///< location of the derivatives of the arguments
+    int aux;               ///< location of parameters and intermediate results of this instruction
+    int index;             ///< variable number for input instructions, number of the opaque node for opaque instructions
+    ExpressionBase* node;  ///< original node, only used by instructions that call back into the expression graph
+};
+
+/**
+ * Location of the value and derivative of a node on the tape
+ */
+struct TapeSlot {
+    int type;
+    int value;
+    int deriv;
+};
+
+class ExpressionTape;
+
+/**
+ * Per-evaluation state of an ExpressionTape.
+ *
+ * All numbers that are written during evaluation (input values, values and derivatives of the
+ * instructions, adjoints and lane derivatives) are stored in one contiguous block.  The instructions
+ * of the tape itself are only read during evaluation.  Each thread can therefore evaluate the same
+ * tape using its own EvalContext (see ExpressionTape::createContext()), without cloning the
+ * expression graph.
+ *
+ * Opaque instructions call back into the expression graph; each context has its own clone of these
+ * nodes, except for the default context of the tape, that uses the original nodes.
+ */
+class EvalContext {
+public:
+    typedef boost::shared_ptr<EvalContext> Ptr;
+
+    std::vector<double>              data;     ///< values, derivatives, adjoints and lane derivatives
+    int                              nvalues;  ///< size of the value buffer
+    int                              nderivs;  ///< size of the derivative buffer
+    std::vector<ExpressionBase*>     nodes;    ///< opaque nodes used by this context
+    std::vector<ExpressionBase::Ptr> clones;   ///< keeps the clones of the opaque nodes alive
+    std::vector<char>                dirty;    ///< instructions whose value is recomputed by the next evaluate()
+    std::vector<int>                 pending;  ///< work list of ExpressionTape::markDirty(..)
+
+    EvalContext():
+        nvalues(0),
+        nderivs(0) {}
+
+    double* values() {
+        return &data[0];
+    }
+    const double* values() const {
+        return &data[0];
+    }
+    double* derivs() {
+        return &data[nvalues];
+    }
+    const double* derivs() const {
+        return &data[nvalues];
+    }
+    double* adjoints() {
+        return &data[nvalues + nderivs];
+    }
+    /**
+     * derivatives towards ExpressionTape::lanes variables, see ExpressionTape::evaluateDerivatives(..)
+     */
+    double* lane_derivs() {
+        return &data[nvalues + 2*nderivs];
+    }
+    const double* lane_derivs() const {
+        return &data[nvalues + 2*nderivs];
+    }
+};
+
+/**
+ * A flat, compiled representation of an expression graph.
+ *
+ * The graph is topologically sorted once, nodes that are shared are only evaluated once,
+ * cached nodes are removed (their result is already shared), constant nodes are
+ * stored only once in the value buffer and every remaining node is lowered to a
+ * TapeInstruction that reads and writes its results in one contiguous value buffer
+ * and one contiguous derivative buffer.  Evaluation is a loop over the instruction array,
+ * without virtual calls or pointer chasing through the graph.
+ *
+ * All node types in expressiontree_double/vector/rotation/frame/twist/wrench.hpp are
+ * lowered to their own instructions.  Other nodes (e.g. VariableType, chain and mimo nodes,
+ * initial_value, ...) are kept as "opaque" instructions that call value() and derivative(i) on
+ * the original node. setInputValue(..) calls are passed to these nodes.
+ *
+ * The tape has its own copy of the input values: the original expression graph is not affected by
+ * setInputValue(..) calls on the tape (except for the opaque nodes mentioned above).
+ *
+ * Evaluation is incremental: each instruction knows the instructions that read its value (parents).
+ * Changing an input value marks the input and its ancestors dirty, and evaluate() only recomputes the dirty
+ * instructions, in the order of the tape.  When only the inputs of one branch change, only that
+ * branch (and the path to the outputs) is recomputed.  Opaque instructions are marked dirty when a variable
+ * they depend on is set; call invalidate(..) when an opaque node is changed in another way (e.g. VariableType::setValue(..)).
+ *
+ * The state of an evaluation is kept in an EvalContext.  The methods without an EvalContext argument
+ * use the default context of the tape, see context().  Contexts created by createContext() can be used
+ * concurrently by different threads, all outputs have to be added before creating them.
+ *
+ * Typical usage is by means of CompiledExpression.
+ *
+ * \warning as for the expression graph itself, evaluate() always has to be called before
+ *          evaluateDerivative(i).
+ */
+class ExpressionTape {
+public:
+    typedef boost::shared_ptr<ExpressionTape> Ptr;
+
+    /**
+     * number of derivatives computed by one call to evaluateDerivatives(..).
+     * Fixed when the library is built (EXPRESSIONGRAPH_TAPE_LANES in expressiontree_compiled.cpp),
+     * such that the layout of lane_derivs can not differ between the library and its clients.
+     */
+    static const int lanes;
+
+    std::vector<TapeInstruction>   instructions;
+    std::vector<double>            values;        ///< initial value buffer: constants, parameters and default input values
+    int                            nr_of_dvalues; ///< size of the derivative buffer (towards one variable)
+    std::vector<TapeSlot>          outputs;       ///< location of the results of the compiled expressions
+    std::vector<ExpressionBase*>   opaque;        ///< nodes that are evaluated by calling back into the expression graph
+    std::vector<int>               scalar_inputs; ///< instructions corresponding to scalar inputs
+    std::vector<int>               rot_inputs;    ///< instructions corresponding to rotational inputs
+    std::vector<int>               opaque_instructions; ///< instructions corresponding to the opaque nodes
+    std::vector< std::vector<int> > scalar_inputs_of; ///< for each variable number, its scalar input instructions
+    std::vector< std::vector<int> > rot_inputs_of; ///< for each variable number, its rotational input instructions
+    std::vector< std::vector<int> > opaque_of;    ///< for each variable number, the opaque instructions that depend on it
+    std::vector< std::vector<int> > opaque_rot_of; ///< idem, for the three variable numbers of a rotational input
+    std::vector< std::vector<int> > parents;      ///< for each instruction, the instructions that read its value
+    std::vector<int>               producer;      ///< instruction that computes each location of the value buffer, or -1
+    std::vector<ExpressionBase::Ptr> roots;       ///< keeps the compiled expression graphs alive
+    std::map<ExpressionBase*,TapeSlot> slots;     ///< location of every node that is already on the tape
+    int                            nr_of_derivs;
+
+    ExpressionTape();
+
+    /**
+     * adds an expression to the tape.  Subexpressions that are already on the tape are reused.
+     * \param [in] e expression to add.
+     * \return index of the output corresponding to e.
+     */
+    int addOutput(ExpressionBase::Ptr e);
+
+    /**
+     * creates a new evaluation context for this tape, with the default input values and with
+     * its own clones of the opaque nodes.
+     */
+    EvalContext::Ptr createContext() const;
+
+    /**
+     * the default evaluation context, used by the methods without an EvalContext argument.
+     */
+    EvalContext& context();
+
+    void setInputValue(int variable_number, double val);
+    void setInputValue(int variable_number, const Rotation& val);
+    void setInputValues(const std::vector<double>& values);
+    void setInputValues(const std::vector<int>& ndx, const std::vector<double>& values);
+
+    void setInputValue(EvalContext& ctx, int variable_number, double val) const;
+    void setInputValue(EvalContext& ctx, int variable_number, const Rotation& val) const;
+    void setInputValues(EvalContext& ctx, const std::vector<double>& values) const;
+    void setInputValues(EvalContext& ctx, const std::vector<int>& ndx, const std::vector<double>& values) const;
+
+    /**
+     * marks instruction k and all instructions that depend on it dirty, such that the
+     * next evaluate() recomputes them.  Does not allocate memory.
+     */
+    void markDirty(EvalContext& ctx, int k) const;
+
+    /**
+     * marks all instructions dirty, e.g. after writing directly into the value buffer of ctx.
+     */
+    void invalidate(EvalContext& ctx) const;
+
+    /**
+     * evaluates the value of all outputs, only the dirty instructions are recomputed.
+     */
+    void evaluate();
+    void evaluate(EvalContext& ctx) const;
+
+    /**
+     * evaluates the derivative of all outputs towards variable i.
+     * evaluate() should be called before.
+     */
+    void evaluateDerivative(int i);
+    void evaluateDerivative(EvalContext& ctx, int i) const;
+
+    /**
+     * evaluates the derivatives of all outputs towards n variables at once (n <= lanes).
+     * The derivatives are stored in lane_derivs in a structure-of-arrays layout:
+     * number c of the derivative towards variable vars[l] of a slot with derivative offset o is at
+     * lane_derivs[(o+c)*lanes + l].  Each instruction applies its linear map to all lanes in
+     * one fixed length loop, that the compiler can vectorize.
+     * evaluate() should be called before.
+     * \param [in] vars array of n variable numbers.
+     * \param [in] n number of variables, n <= lanes.
+     */
+    void evaluateDerivatives(const int* vars, int n);
+    void evaluateDerivatives(EvalContext& ctx, const int* vars, int n) const;
+
+    /**
+     * seeded forward mode: evaluates the derivatives of all outputs along n seed directions at once
+     * (n <= lanes).  The seed of lane l is the sum of the unit vectors of the variables in
+     * groups[first+l], lane l thus contains the sum of the derivatives towards these variables.
+     * This is used to compute compressed Jacobians (see JacobianAssembler::compress()).
+     * The results are stored in lane_derivs, as for evaluateDerivatives(..).
+     * evaluate() should be called before.
+     * \param [in] colour colour[i] is the group number of variable i (or -1), variables >= colour.size()
+     *                    are not in any group.
+     * \param [in] groups the variables of each group.
+     * \param [in] first  group number of the first lane.
+     * \param [in] n      number of lanes, n <= lanes.
+     */
+    void evaluateSeededDerivatives(const std::vector<int>& colour, const std::vector<VarIndexSet>& groups,
+                                   int first, int n);
+    void evaluateSeededDerivatives(EvalContext& ctx, const std::vector<int>& colour, const std::vector<VarIndexSet>& groups,
+                                   int first, int n) const;
+
+    /**
+     * copies the derivative in lane l of slot s, computed by evaluateDerivatives(..), to d
+     * (laid out as TapeTrait<DerivType>).
+     */
+    static void laneDerivative(const EvalContext& ctx, const TapeSlot& s, int l, double* d) {
+        const double* p = ctx.lane_derivs() + s.deriv*lanes + l;
+        int n = (s.type==TAPE_DOUBLE) ? 1 : ((s.type==TAPE_VECTOR)||(s.type==TAPE_ROTATION)) ? 3 : 6;
+        for (int c=0;c<n;++c) {
+            d[c] = p[c*lanes];
+        }
+    }
+
+    void laneDerivative(const TapeSlot& s, int l, double* d) {
+        laneDerivative(context(), s, l, d);
+    }
+
+    /**
+     * reverse mode: computes seed^T * J, with J the Jacobian of output towards all variables,
+     * in one backward sweep over the tape.  The cost is independent of the number of variables.
+     * evaluate() should be called before.
+     * \param [in] output index of the output.
+     * \param [in] seed  adjoint of the output, laid out as AutoDiffTrait<T>::DerivType of the output
+     *                   (see TapeTrait).
+     * \param [out] result vector of size number_of_derivatives().
+     */
+    void adjoint(int output, const double* seed, Eigen::VectorXd& result);
+    void adjoint(EvalContext& ctx, int output, const double* seed, Eigen::VectorXd& result) const;
+
+    /**
+     * reverse mode gradient of a scalar output towards all variables.
+     * evaluate() should be called before.
+     */
+    void gradient(int output, Eigen::VectorXd& result) {
+        gradient(context(), output, result);
+    }
+
+    void gradient(EvalContext& ctx, int output, Eigen::VectorXd& result) const {
+        assert( outputs[output].type == TAPE_DOUBLE );
+        double seed = 1.0;
+        adjoint(ctx, output, &seed, result);
+    }
+
+    /**
+     * returns towards how many variables the derivative is computed.
+     */
+    int number_of_derivatives() const {
+        return nr_of_derivs;
+    }
+
+    /**
+     * Writes out a human readable listing of the tape.
+     */
+    void print(std::ostream& os) const;
+private:
+    TapeSlot lower(ExpressionBase* e);
+    TapeSlot allocate(int type);
+    void     layout(EvalContext& ctx) const;
+
+    EvalContext::Ptr default_context;
+};
+
+/**
+ * An expression that is compiled to an ExpressionTape.  It has the same
+ * value(), derivative(i) and setInputValue(..) interface as Expression<T>.
+ * Copies of a CompiledExpression share the same tape.
+ *
+ * @code
+ *   Expression<double>::Ptr e = ...
+ *   CompiledExpression<double> c = compile(e);
+ *   c.setInputValues(ndx,q);
+ *   double val = c.value();
+ *   double d0  = c.derivative(0);
+ * @endcode
+ */
+template <typename T>
+class CompiledExpression {
+public:
+    typedef typename AutoDiffTrait<T>::DerivType DerivType;
+
+    ExpressionTape::Ptr tape;
+    int                 output;
+    TapeSlot            slot;
+
+    CompiledExpression() {}
+
+    /**
+     * compiles the given expression to a new tape.
+     */
+    CompiledExpression(const typename Expression<T>::Ptr& e):
+        tape( new ExpressionTape() ) {
+        output = tape->addOutput(e);
+        slot   = tape->outputs[output];
+    }
+
+    /**
+     * refers to output nr. _output of an existing tape.
+     */
+    CompiledExpression(ExpressionTape::Ptr _tape, int _output):
+        tape(_tape),
+        output(_output),
+        slot(_tape->outputs[_output]) {
+        assert( slot.type == TapeTrait<T>::type );
+    }
+
+    /**
+     * creates an evaluation context, such that several threads can evaluate this expression
+     * at the same time, each with its own context.
+     */
+    EvalContext::Ptr createContext() const {
+        return tape->createContext();
+    }
+
+    void setInputValue(int variable_number, double val) {
+        tape->setInputValue(variable_number,val);
+    }
+    void setInputValue(int variable_number, const Rotation& val) {
+        tape->setInputValue(variable_number,val);
+    }
+    void setInputValues(const std::vector<double>& values) {
+        tape->setInputValues(values);
+    }
+    void setInputValues(const std::vector<int>& ndx, const std::vector<double>& values) {
+        tape->setInputValues(ndx,values);
+    }
+
+    void setInputValue(EvalContext& ctx, int variable_number, double val) const {
+        tape->setInputValue(ctx,variable_number,val);
+    }
+    void setInputValue(EvalContext& ctx, int variable_number, const Rotation& val) const {
+        tape->setInputValue(ctx,variable_number,val);
+    }
+    void setInputValues(EvalContext& ctx, const std::vector<double>& values) const {
+        tape->setInputValues(ctx,values);
+    }
+    void setInputValues(EvalContext& ctx, const std::vector<int>& ndx, const std::vector<double>& values) const {
+        tape->setInputValues(ctx,ndx,values);
+    }
+
+    T value() {
+        return value(tape->context());
+    }
+
+    T value(EvalContext& ctx) const {
+        tape->evaluate(ctx);
+        return TapeTrait<T>::load(ctx.values() + slot.value);
+    }
+
+    DerivType derivative(int i) {
+        return derivative(tape->context(), i);
+    }
+
+    DerivType derivative(EvalContext& ctx, int i) const {
+        tape->evaluateDerivative(ctx, i);
+        return TapeTrait<DerivType>::load(ctx.derivs() + slot.deriv);
+    }
+
+    /**
+     * computes the derivatives towards all variables in ndx, ExpressionTape::lanes
+     * variables in each pass over the tape.  value() should be called before.
+     * \param [in] ndx list of variable numbers.
+     * \param [out] jac array of at least ndx.size() elements, jac[k] is the derivative towards ndx[k].
+     */
+    void jacobian(const VarIndexSet& ndx, DerivType* jac) {
+        jacobian(tape->context(), ndx, jac);
+    }
+
+    void jacobian(EvalContext& ctx, const VarIndexSet& ndx, DerivType* jac) const {
+        double d[6];
+        for (size_t k=0;k<ndx.size();k+=ExpressionTape::lanes) {
+            int n = std::min<int>(ExpressionTape::lanes, ndx.size()-k);
+            tape->evaluateDerivatives(ctx, &ndx[k], n);
+            for (int l=0;l<n;++l) {
+                ExpressionTape::laneDerivative(ctx, slot, l, d);
+                jac[k+l] = TapeTrait<DerivType>::load(d);
+            }
+        }
+    }
+
+    int number_of_derivatives() const {
+        return tape->number_of_derivatives();
+    }
+
+    /**
+     * reverse mode gradient towards all variables (only for scalar expressions).
+     * value() should be called before.
+     */
+    void gradient(Eigen::VectorXd& result) {
+        tape->gradient(output, result);
+    }
+
+    void gradient(EvalContext& ctx, Eigen::VectorXd& result) const {
+        tape->gradient(ctx, output, result);
+    }
+};
+
+/**
+ * compiles an expression graph to a flat tape.
+ */
+template <typename T>
+inline CompiledExpression<T> compile( const boost::shared_ptr< Expression<T> >& e ) {
+    return CompiledExpression<T>(e);
+}
+
+/**
+ * computes the gradient of a scalar expression towards all of its variables
+ * with one forward and one reverse (adjoint) sweep, for the input values that are
+ * currently set in the expression.
+ *
+ * \param [in]  e expression
+ * \param [out] result vector of size e->number_of_derivatives()
+ * \warning the expression is compiled at each call.  When the gradient is
+ *          needed repeatedly, compile the expression once and use CompiledExpression::gradient.
+ */
+void gradient( const Expression<double>::Ptr& e, Eigen::VectorXd& result );
+
+} // namespace KDL
+#endif
@@ -0,0 +1,194 @@
+/**
+ * @file expressiontree_dependencies.hpp
+ * @brief compact representation of the set of variables an expression depends on.
+*
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#ifndef KDL_EXPRESSIONTREE_DEPENDENCIES_HPP
+#define KDL_EXPRESSIONTREE_DEPENDENCIES_HPP
+
+#include <stdint.h>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <iterator>
+
+namespace KDL {
+
+/**
+ * Set of variable numbers.
+ *
+ * Variable numbers smaller than DependencySet::dense_size are stored in a dense bitset,
+ * without any memory allocation.  Larger variable numbers are stored in a sorted vector.
+ * contains(i) is O(1) for the dense part, and union is O(words) + O(sparse part).
+ *
+ * Every expression graph node keeps the DependencySet of its subtree (see ExpressionBase::dependencies()),
+ * such that dependency queries do not have to traverse the subtree.
+ */
+class DependencySet {
+public:
+    enum { words = 2, dense_size = 64*words };
+
+    DependencySet() {
+        std::fill(bits, bits+words, uint64_t(0));
+    }
+
+    /**
+     * constructs a DependencySet containing the variables in varset.
+     */
+    explicit DependencySet(const std::set<int>& varset) {
+        std::fill(bits, bits+words, uint64_t(0));
+        for (std::set<int>::const_iterator it=varset.begin();it!=varset.end();++it) {
+            insert(*it);
+        }
+    }
+
+    void insert(int i) {
+        if (i < dense_size) {
+            bits[i/64] |= uint64_t(1) << (i%64);
+        } else {
+            std::vector<int>::iterator it = std::lower_bound(sparse.begin(),sparse.end(),i);
+            if ((it==sparse.end()) || (*it!=i)) {
+                sparse.insert(it,i);
+            }
+        }
+    }
+
+    /**
+     * returns true if variable i is in the set.
+     */
+    bool contains(int i) const {
+        if (i < 0) {
+            return false;
+        } else if (i < dense_size) {
+            return (bits[i/64] >> (i%64)) & 1;
+        } else {
+            return std::binary_search(sparse.begin(),sparse.end(),i);
+        }
+    }
+
+    bool empty() const {
+        for (int k=0;k<words;++k) {
+            if (bits[k]!=0) {
+                return false;
+            }
+        }
+        return sparse.empty();
+    }
+
+    /**
+     * adds all variables of other to this set.
+     */
+    DependencySet& operator|=(const DependencySet& other) {
+        for (int k=0;k<words;++k) {
+            bits[k] |= other.bits[k];
+        }
+        if (!other.sparse.empty()) {
+            if (sparse.empty()) {
+                sparse = other.sparse;
+            } else {
+                std::vector<int> result;
+                result.reserve(sparse.size()+other.sparse.size());
+                std::set_union(sparse.begin(),sparse.end(),other.sparse.begin(),other.sparse.end(),
+                               std::back_inserter(result));
+                sparse.swap(result);
+            }
+        }
+        return *this;
+    }
+
+    /**
+     * returns true if both sets have at least one variable in common.
+     */
+    bool intersects(const DependencySet& other) const {
+        for (int k=0;k<words;++k) {
+            if (bits[k] & other.bits[k]) {
+                return true;
+            }
+        }
+        std::vector<int>::const_iterator a = sparse.begin();
+        std::vector<int>::const_iterator b = other.sparse.begin();
+        while ((a!=sparse.end()) && (b!=other.sparse.end())) {
+            if (*a < *b) {
+                ++a;
+            } else if (*b < *a) {
+                ++b;
+            } else {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * returns true if at least one of the variables in ndx is in the set.
+     */
+    bool intersects(const std::vector<int>& ndx) const {
+        for (std::vector<int>::const_iterator it=ndx.begin();it!=ndx.end();++it) {
+            if (contains(*it)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool operator==(const DependencySet& other) const {
+        return std::equal(bits, bits+words, other.bits) && (sparse==other.sparse);
+    }
+
+    bool operator!=(const DependencySet& other) const {
+        return !(*this==other);
+    }
+
+    /**
+     * appends the variables of this set to ndx, in increasing order.
+     */
+    void getVariables(std::vector<int>& ndx) const {
+        for (int k=0;k<words;++k) {
+            uint64_t w = bits[k];
+            for (int j=0; w!=0; ++j, w>>=1) {
+                if (w & 1) {
+                    ndx.push_back(64*k+j);
+                }
+            }
+        }
+        ndx.insert(ndx.end(), sparse.begin(), sparse.end());
+    }
+
+    /**
+     * adds the variables of this set to varset.
+     */
+    void getVariables(std::set<int>& varset) const {
+        std::vector<int> ndx;
+        getVariables(ndx);
+        varset.insert(ndx.begin(),ndx.end());
+    }
+
+    /**
+     * heap memory used by the sparse part of the set.
+     */
+    size_t heapBytes() const {
+        return sparse.capacity()*sizeof(int);
+    }
+private:
+    uint64_t         bits[words];
+    std::vector<int> sparse;
+};
+
+} // namespace KDL
+#endif
@@ -78,28 +78,33 @@ public:
 	}
 
 	virtual double derivative(int i){
-		return (argument1->derivative(i) + argument2->derivative(i));
+		return (argument1_derivative(i) + argument2_derivative(i));
+	}
+
+	virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+		argument_jacobian(ndx);
+		for (size_t k=0;k<ndx.size();++k) {
+			jac[k] = argjac1[k] + argjac2[k];
+		}
 	}
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Addition_DoubleDouble( argument1->clone(), argument2->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Addition_DoubleDouble>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr operator+ ( Expression<double>::Ptr a1, Expression<double>::Ptr a2 ) {
+inline Expression<double>::Ptr operator+ ( const Expression<double>::Ptr& a1, const Expression<double>::Ptr& a2 ) {
     if (isConstantZero(a1)) {
         return checkConstant<double>(a2);
     } 
     if (isConstantZero(a2)) {
         return checkConstant<double>(a1);
     } 
-	Expression<double>::Ptr expr(new Addition_DoubleDouble( a1, a2 ));
-    return expr;
+	Expression<double>::Ptr expr = make_node<Addition_DoubleDouble>( a1, a2 );
+    return interned(expr);
 }
 
 // -
@@ -122,15 +127,20 @@ public:
 	}
 
 	virtual double derivative(int i){
-		return (argument1->derivative(i) - argument2->derivative(i));
+		return (argument1_derivative(i) - argument2_derivative(i));
+	}
+
+	virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+		argument_jacobian(ndx);
+		for (size_t k=0;k<ndx.size();++k) {
+			jac[k] = argjac1[k] - argjac2[k];
+		}
 	}
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Subtraction_DoubleDouble( argument1->clone(), argument2->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Subtraction_DoubleDouble>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
@@ -159,20 +169,25 @@ public:
 	}
 
 	virtual double derivative(int i){
-		return (arg1value * argument2->derivative(i) + argument1->derivative(i) * arg2value);
+		return (arg1value * argument2_derivative(i) + argument1_derivative(i) * arg2value);
+	}
+
+	virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+		argument_jacobian(ndx);
+		for (size_t k=0;k<ndx.size();++k) {
+			jac[k] = arg1value * argjac2[k] + argjac1[k] * arg2value;
+		}
 	}
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Multiplication_DoubleDouble( argument1->clone(), argument2->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Multiplication_DoubleDouble>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr operator* ( Expression<double>::Ptr a1, Expression<double>::Ptr a2 ) {
+inline Expression<double>::Ptr operator* ( const Expression<double>::Ptr& a1, const Expression<double>::Ptr& a2 ) {
     if (isConstantZero(a1)) {
         return Constant<double>(0);
     } 
@@ -185,8 +200,8 @@ inline Expression<double>::Ptr operator* ( Expression<double>::Ptr a1, Expressio
     if (isConstantOne(a2)) {
         return a1;
     }
-	Expression<double>::Ptr expr(new Multiplication_DoubleDouble( a1, a2 ));
-	return expr;
+	Expression<double>::Ptr expr = make_node<Multiplication_DoubleDouble>( a1, a2 );
+	return interned(expr);
 }
 
 // /
@@ -214,25 +229,31 @@ public:
 	}
 
 	virtual double derivative(int i){
-		return ((arg2value*argument1->derivative(i) - arg1value * argument2->derivative(i))/arg2value/arg2value);
+		return ((arg2value*argument1_derivative(i) - arg1value * argument2_derivative(i))/arg2value/arg2value);
+	}
+
+	virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+		argument_jacobian(ndx);
+		double f = 1.0/(arg2value*arg2value);
+		for (size_t k=0;k<ndx.size();++k) {
+			jac[k] = (arg2value*argjac1[k] - arg1value*argjac2[k])*f;
+		}
 	}
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Division_DoubleDouble( argument1->clone(), argument2->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Division_DoubleDouble>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr operator/ ( Expression<double>::Ptr a1, Expression<double>::Ptr a2 ) {
+inline Expression<double>::Ptr operator/ ( const Expression<double>::Ptr& a1, const Expression<double>::Ptr& a2 ) {
     if (isConstantZero(a1)) {
         return Constant<double>(0);
     } 
-	Expression<double>::Ptr expr(new Division_DoubleDouble( a1, a2 ));
-	return expr;
+	Expression<double>::Ptr expr = make_node<Division_DoubleDouble>( a1, a2 );
+	return interned(expr);
 }
 
 // atan2
@@ -259,24 +280,30 @@ public:
 	}
 
 	virtual double derivative(int i){
-		double numerator = -arg1value*argument2->derivative(i)+arg2value*argument1->derivative(i);
+		double numerator = -arg1value*argument2_derivative(i)+arg2value*argument1_derivative(i);
 		double denominator = arg1value * arg1value + arg2value * arg2value;
 		return numerator/denominator;
 	}
 
+	virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+		argument_jacobian(ndx);
+		double f = 1.0/(arg1value * arg1value + arg2value * arg2value);
+		for (size_t k=0;k<ndx.size();++k) {
+			jac[k] = (-arg1value*argjac2[k] + arg2value*argjac1[k])*f;
+		}
+	}
+
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Atan2_DoubleDouble( argument1->clone(), argument2->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Atan2_DoubleDouble>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr atan2 ( Expression<double>::Ptr a1, Expression<double>::Ptr a2 ) {
-	Expression<double>::Ptr expr(new Atan2_DoubleDouble( a1, a2 ));
-	return expr;
+inline Expression<double>::Ptr atan2 ( const Expression<double>::Ptr& a1, const Expression<double>::Ptr& a2 ) {
+	Expression<double>::Ptr expr = make_node<Atan2_DoubleDouble>( a1, a2 );
+	return interned(expr);
 }
 
 // -
@@ -298,35 +325,38 @@ public:
     }
 
     virtual double derivative(int i) {
-        return -(argument->derivative(i));
+        return -(argument_derivative(i));
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = -argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Negate_Double(argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Negate_Double>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr operator-( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Negate_Double(a)
-    );
-    return expr;
+inline Expression<double>::Ptr operator-( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Negate_Double>(a);
+    return interned(expr);
 }
 
-inline Expression<double>::Ptr operator- ( Expression<double>::Ptr a1, Expression<double>::Ptr a2 ) {
+inline Expression<double>::Ptr operator- ( const Expression<double>::Ptr& a1, const Expression<double>::Ptr& a2 ) {
     if (isConstantZero(a1)) {
         return checkConstant<double>(-a2);
     } 
     if (isConstantZero(a2)) {
         return checkConstant<double>(a1);
     } 
-	Expression<double>::Ptr expr(new Subtraction_DoubleDouble( a1, a2 ));
-	return expr;
+	Expression<double>::Ptr expr = make_node<Subtraction_DoubleDouble>( a1, a2 );
+	return interned(expr);
 }
 
 // sin
@@ -350,24 +380,28 @@ public:
     }
 
     virtual double derivative(int i) {
-        return cos(val) * argument->derivative(i);
+        return cos(val) * argument_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        double c = cos(val);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = c * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Sin_Double( argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Sin_Double>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr sin( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Sin_Double( a )
-    );
-    return expr;
+inline Expression<double>::Ptr sin( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Sin_Double>( a );
+    return interned(expr);
 }
 
 // cos
@@ -390,24 +424,28 @@ public:
     }
 
     virtual double derivative(int i) {
-         return -sin(val) * argument->derivative(i);
+         return -sin(val) * argument_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        double s = -sin(val);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = s * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Cos_Double( argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Cos_Double>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr cos( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Cos_Double( a )
-    );
-    return expr;
+inline Expression<double>::Ptr cos( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Cos_Double>( a );
+    return interned(expr);
 }
 
 //tan
@@ -433,25 +471,30 @@ public:
 
     virtual double derivative(int i) {
     	double c = cos(val);
-        return argument->derivative(i)/c/c;
+        return argument_derivative(i)/c/c;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        double c = cos(val);
+        double f = 1.0/(c*c);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = f * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Tan_Double(argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Tan_Double>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr tan (Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Tan_Double(a)
-    );
-    return expr;
+inline Expression<double>::Ptr tan (const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Tan_Double>(a);
+    return interned(expr);
 }
 
 // asin
@@ -474,24 +517,28 @@ public:
     }
 
     virtual double derivative(int i) {
-        return (argument->derivative(i))/sqrt(1- val * val);
+        return (argument_derivative(i))/sqrt(1- val * val);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        double f = 1.0/sqrt(1- val * val);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = f * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Asin_Double( argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Asin_Double>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr asin( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Asin_Double( a )
-    );
-    return expr;
+inline Expression<double>::Ptr asin( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Asin_Double>( a );
+    return interned(expr);
 }
 
 // acos
@@ -515,24 +562,28 @@ public:
     }
 
     virtual double derivative(int i) {
-    	return -(argument->derivative(i))/sqrt(1- val*val);
+    	return -(argument_derivative(i))/sqrt(1- val*val);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        double f = -1.0/sqrt(1- val * val);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = f * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Acos_Double(argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Acos_Double>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr acos( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Acos_Double(a)
-    );
-    return expr;
+inline Expression<double>::Ptr acos( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Acos_Double>(a);
+    return interned(expr);
 }
 
 // exp
@@ -555,24 +606,27 @@ public:
     }
 
     virtual double derivative(int i) {
-    	return val * argument->derivative(i);
+    	return val * argument_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = val * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Exp_Double(argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Exp_Double>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr exp( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Exp_Double(a)
-    );
-    return expr;
+inline Expression<double>::Ptr exp( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Exp_Double>(a);
+    return interned(expr);
 }
 
 // log
@@ -595,24 +649,27 @@ public:
     }
 
     virtual double derivative(int i) {
-    	return argument->derivative(i)/val;
+    	return argument_derivative(i)/val;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k]/val;
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Log_Double( argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Log_Double>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr log( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Log_Double( a )
-    );
-    return expr;
+inline Expression<double>::Ptr log( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Log_Double>( a );
+    return interned(expr);
 }
 
 //sqrt
@@ -634,24 +691,28 @@ public:
     }
 
     virtual double derivative(int i) {
-        return 0.5/val*argument->derivative(i);
+        return 0.5/val*argument_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        double f = 0.5/val;
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = f * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Sqrt_Double(argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Sqrt_Double>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr sqrt( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Sqrt_Double( a )
-    );
-    return expr;
+inline Expression<double>::Ptr sqrt( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Sqrt_Double>( a );
+    return interned(expr);
 }
 
 // atan
@@ -673,24 +734,28 @@ public:
     }
 
     virtual double derivative(int i) {
-        return argument->derivative(i)/(1+val*val);
+        return argument_derivative(i)/(1+val*val);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        double f = 1.0/(1+val*val);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = f * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Atan_Double(argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Atan_Double>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr atan( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Atan_Double( a )
-    );
-    return expr;
+inline Expression<double>::Ptr atan( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Atan_Double>( a );
+    return interned(expr);
 }
 
 // abs
@@ -712,24 +777,28 @@ public:
     }
 
     virtual double derivative(int i) {
-        return (KDL::sign(val)*argument->derivative(i));
+        return (KDL::sign(val)*argument_derivative(i));
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        double s = KDL::sign(val);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = s * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Abs_Double( argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Abs_Double>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr abs( Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Abs_Double( a )
-    );
-    return expr;
+inline Expression<double>::Ptr abs( const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Abs_Double>( a );
+    return interned(expr);
 }
 
 // fmod
@@ -753,24 +822,30 @@ public:
     virtual double derivative(int i) {
         // Note: This is a simplified version of the derivative which
         // ignores that fmod(x,b)=infinity for x=n*b with n being an integer.
-        return argument->derivative(i);
+        return argument_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument->jacobian(ndx,jac);
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Fmod_Double(argument->clone(), denominator)
-        );
+        Expression<double>::Ptr expr = make_node<Fmod_Double>(cloned(argument), denominator);
         return expr;
     }
+
+    virtual bool getStructuralKey(StructuralKey& key) {
+        UnExpr::getStructuralKey(key);
+        appendBytesToKey(key, denominator);
+        return true;
+    }
 };
 
-inline Expression<double>::Ptr fmod( Expression<double>::Ptr a, double b) {
-    Expression<double>::Ptr expr(
-        new Fmod_Double( a, b )
-    );
-    return expr;
+inline Expression<double>::Ptr fmod( const Expression<double>::Ptr& a, double b) {
+    Expression<double>::Ptr expr = make_node<Fmod_Double>( a, b );
+    return interned(expr);
 }
 
 //sqrt
@@ -792,24 +867,28 @@ public:
     }
 
     virtual double derivative(int i) {
-        return 2*val*argument->derivative(i);
+        return 2*val*argument_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        double f = 2*val;
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = f * argjac[k];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Sqr_Double(argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Sqr_Double>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr sqr(Expression<double>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Sqr_Double( a )
-    );
-    return expr;
+inline Expression<double>::Ptr sqr(const Expression<double>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Sqr_Double>( a );
+    return interned(expr);
 }
 
 
@@ -822,9 +901,9 @@ public:
 
     Conditional_double() {}
 
-    Conditional_double(  typename Expression<double>::Ptr a1, 
-                         typename Expression<R>::Ptr a2,
-                         typename Expression<R>::Ptr a3):
+    Conditional_double(  const typename Expression<double>::Ptr& a1, 
+                         const typename Expression<R>::Ptr& a2,
+                         const typename Expression<R>::Ptr& a3):
         TernaryExpression<R,double,R,R>("conditional",a1,a2,a3) {
         }
 
@@ -839,26 +918,30 @@ public:
 
     virtual typename AutoDiffTrait<R>::DerivType derivative(int i) {
         if (condition) {
-            return this->argument2->derivative(i);
+            return this->argument2_derivative(i);
         } else {
-            return this->argument3->derivative(i);
+            return this->argument3_derivative(i);
         }
     } 
 
+    virtual void jacobian(const VarIndexSet& ndx, typename AutoDiffTrait<R>::DerivType* jac) {
+        if (condition) {
+            this->argument2->jacobian(ndx,jac);
+        } else {
+            this->argument3->jacobian(ndx,jac);
+        }
+    }
+
     virtual typename Expression<typename AutoDiffTrait<R>::DerivType >::Ptr derivativeExpression(int i) {
-        typename Expression<typename AutoDiffTrait<R>::DerivType>::Ptr expr( 
-            new Conditional_double<typename AutoDiffTrait<R>::DerivType>( 
+        typename Expression<typename AutoDiffTrait<R>::DerivType>::Ptr expr = make_node< Conditional_double<typename AutoDiffTrait<R>::DerivType> >( 
                 this->argument1, 
                 this->argument2->derivativeExpression(i), 
-                this->argument3->derivativeExpression(i) )
-        );
+                this->argument3->derivativeExpression(i) );
         return expr;
     }
 
     virtual typename Expression<R>::Ptr clone() {
-        typename Expression<R>::Ptr expr(
-            new Conditional_double(this->argument1->clone(), this->argument2->clone(), this->argument3->clone())
-        );
+        typename Expression<R>::Ptr expr = make_node<Conditional_double>(cloned(this->argument1), cloned(this->argument2), cloned(this->argument3));
         return expr;
     } 
 };
@@ -874,15 +957,13 @@ public:
  * first argument == 0.
  */
 template <typename R>
-inline typename Expression<R>::Ptr conditional( typename Expression<double>::Ptr a1, 
-                                       typename Expression<R>::Ptr a2,
-                                       typename Expression<R>::Ptr a3) {
+inline typename Expression<R>::Ptr conditional( const typename Expression<double>::Ptr& a1, 
+                                       const typename Expression<R>::Ptr& a2,
+                                       const typename Expression<R>::Ptr& a3) {
     if (!a1 || !a2 || !a3) {
         throw std::out_of_range("conditional: null pointer is given as one of the arguments");
     }
-    std::set<int> vset;
-    a1->getDependencies(vset);
-    if (vset.empty()) {
+    if (a1->dependencies().empty()) {
         double value = a1->value();
         if (value >= 0) {
             return a2;
@@ -890,10 +971,8 @@ inline typename Expression<R>::Ptr conditional( typename Expression<double>::Ptr
             return a3;
         }
     } else {
-        typename Expression<R>::Ptr expr(
-            new Conditional_double<R>( a1, a2, a3 )
-        );
-        return expr;
+        typename Expression<R>::Ptr expr = make_node< Conditional_double<R> >( a1, a2, a3 );
+        return interned(expr);
     }
 }
 
@@ -911,9 +990,9 @@ public:
 
     NearZero_double() {}
 
-    NearZero_double(  typename Expression<double>::Ptr a1, 
-                         typename Expression<R>::Ptr a2,
-                         typename Expression<R>::Ptr a3,
+    NearZero_double(  const typename Expression<double>::Ptr& a1, 
+                         const typename Expression<R>::Ptr& a2,
+                         const typename Expression<R>::Ptr& a3,
                          double _tolerance):
         TernaryExpression<R,double,R,R>("near_zero",a1,a2,a3),
         tolerance(_tolerance) {
@@ -931,29 +1010,39 @@ public:
 
     virtual typename AutoDiffTrait<R>::DerivType derivative(int i) {
         if (condition) {
-            return this->argument2->derivative(i);
+            return this->argument2_derivative(i);
         } else {
-            return this->argument3->derivative(i);
+            return this->argument3_derivative(i);
         }
     } 
 
+    virtual void jacobian(const VarIndexSet& ndx, typename AutoDiffTrait<R>::DerivType* jac) {
+        if (condition) {
+            this->argument2->jacobian(ndx,jac);
+        } else {
+            this->argument3->jacobian(ndx,jac);
+        }
+    }
+
     virtual typename Expression<typename AutoDiffTrait<R>::DerivType>::Ptr derivativeExpression(int i) {
-        typename Expression<typename AutoDiffTrait<R>::DerivType>::Ptr expr( 
-            new NearZero_double<typename AutoDiffTrait<R>::DerivType>( 
+        typename Expression<typename AutoDiffTrait<R>::DerivType>::Ptr expr = make_node< NearZero_double<typename AutoDiffTrait<R>::DerivType> >( 
                 this->argument1, 
                 this->argument2->derivativeExpression(i), 
                 this->argument3->derivativeExpression(i),
-                tolerance )
-        );
+                tolerance );
         return expr;
     }
 
     virtual typename Expression<R>::Ptr clone() {
-        typename Expression<R>::Ptr expr(
-            new NearZero_double(this->argument1->clone(), this->argument2->clone(), this->argument3->clone(), tolerance)
-        );
+        typename Expression<R>::Ptr expr = make_node<NearZero_double>(cloned(this->argument1), cloned(this->argument2), cloned(this->argument3), tolerance);
         return expr;
     } 
+
+    virtual bool getStructuralKey(StructuralKey& key) {
+        TernaryExpression<R,double,R,R>::getStructuralKey(key);
+        appendBytesToKey(key, tolerance);
+        return true;
+    }
 };
 
 
@@ -971,14 +1060,12 @@ public:
  * the condition is true. 
  */
 template <typename R>
-inline typename Expression<R>::Ptr near_zero( typename Expression<double>::Ptr a1, 
+inline typename Expression<R>::Ptr near_zero( const typename Expression<double>::Ptr& a1, 
                                               double tolerance,
-                                       typename Expression<R>::Ptr a2,
-                                       typename Expression<R>::Ptr a3) {
-    typename Expression<R>::Ptr expr(
-        new NearZero_double<R>( a1, a2, a3,tolerance )
-    );
-    return expr;
+                                       const typename Expression<R>::Ptr& a2,
+                                       const typename Expression<R>::Ptr& a3) {
+    typename Expression<R>::Ptr expr = make_node< NearZero_double<R> >( a1, a2, a3,tolerance );
+    return interned(expr);
 }
 
 
@@ -986,21 +1073,21 @@ inline typename Expression<R>::Ptr near_zero( typename Expression<double>::Ptr a
 /**
  * return the largest of the two expressions
  */
-inline Expression<double>::Ptr maximum( Expression<double>::Ptr a1, Expression<double>::Ptr a2) {
+inline Expression<double>::Ptr maximum( const Expression<double>::Ptr& a1, const Expression<double>::Ptr& a2) {
     return conditional<double>(a2-a1, a2, a1);
 }
 
 /**
  * return the smallest of the two expressions
  */
-inline Expression<double>::Ptr minimum( Expression<double>::Ptr a1, Expression<double>::Ptr a2) {
+inline Expression<double>::Ptr minimum( const Expression<double>::Ptr& a1, const Expression<double>::Ptr& a2) {
     return conditional<double>(a1-a2, a2, a1);
 }
 
 /**
  * returns the expression a, saturated between lower and upper values.
  */
-inline Expression<double>::Ptr saturate( Expression<double>::Ptr a, double lower, double upper) {
+inline Expression<double>::Ptr saturate( const Expression<double>::Ptr& a, double lower, double upper) {
     return minimum( Constant<double>(upper), maximum(Constant<double>(lower), a) );
 }
 
@@ -1017,7 +1104,7 @@ public:
 
     BlockWave() {}
 
-    BlockWave(  typename Expression<double>::Ptr a1, double _period, const R& _level1, const R& _level2):
+    BlockWave(  const typename Expression<double>::Ptr& a1, double _period, const R& _level1, const R& _level2):
         UnaryExpression<R,double>("BlockWave",a1),period(_period),level1(_level1),level2(_level2) {
         }
 
@@ -1036,16 +1123,26 @@ public:
         return AutoDiffTrait<R>::zeroDerivative();
     } 
 
+    virtual void jacobian(const VarIndexSet& ndx, typename AutoDiffTrait<R>::DerivType* jac) {
+        std::fill(jac, jac+ndx.size(), AutoDiffTrait<R>::zeroDerivative());
+    }
+
     virtual typename Expression<typename AutoDiffTrait<R>::DerivType>::Ptr derivativeExpression(int i) {
         return Constant(AutoDiffTrait<R>::zeroDerivative());
     }
 
     virtual typename Expression<R>::Ptr clone() {
-        typename Expression<R>::Ptr expr(
-            new BlockWave<R>(this->argument->clone(), period, level1, level2 )
-        );
+        typename Expression<R>::Ptr expr = make_node< BlockWave<R> >(cloned(this->argument), period, level1, level2 );
         return expr;
     } 
+
+    virtual bool getStructuralKey(StructuralKey& key) {
+        UnaryExpression<R,double>::getStructuralKey(key);
+        appendBytesToKey(key, period);
+        appendBytesToKey(key, level1);
+        appendBytesToKey(key, level2);
+        return true;
+    }
 };
 
 class BlockWave_double:
@@ -1059,7 +1156,7 @@ public:
 
     BlockWave_double() {}
 
-    BlockWave_double(   Expression<double>::Ptr a1, double _period, double _level1, double _level2):
+    BlockWave_double(   const Expression<double>::Ptr& a1, double _period, double _level1, double _level2):
         UnaryExpression<double,double>("BlockWave",a1),period(_period),level1(_level1),level2(_level2) {
         }
 
@@ -1078,16 +1175,26 @@ public:
         return 0.0;
     } 
 
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        std::fill(jac, jac+ndx.size(), 0.0);
+    }
+
     virtual  Expression<double>::Ptr derivativeExpression(int i) {
         return Constant(0.0);
     }
 
     virtual  Expression<double>::Ptr clone() {
-         Expression<double>::Ptr expr(
-            new BlockWave_double(this->argument->clone(), period, level1, level2 )
-        );
+         Expression<double>::Ptr expr = make_node<BlockWave_double>(cloned(this->argument), period, level1, level2 );
         return expr;
     } 
+
+    virtual bool getStructuralKey(StructuralKey& key) {
+        UnaryExpression<double,double>::getStructuralKey(key);
+        appendBytesToKey(key, period);
+        appendBytesToKey(key, level1);
+        appendBytesToKey(key, level2);
+        return true;
+    }
 };
 
 /**
@@ -1107,11 +1214,9 @@ public:
  *
  */
 template <class R>
-inline typename Expression<R>::Ptr blockwave( typename Expression<double>::Ptr a1,double period, const R& level1, const R& level2) {
-    typename Expression<R>::Ptr expr(
-        new BlockWave<R>( a1, period, level1, level2 )
-    );
-    return expr;
+inline typename Expression<R>::Ptr blockwave( const typename Expression<double>::Ptr& a1,double period, const R& level1, const R& level2) {
+    typename Expression<R>::Ptr expr = make_node< BlockWave<R> >( a1, period, level1, level2 );
+    return interned(expr);
 }
 
 
@@ -1131,7 +1236,7 @@ public:
 
     NormalDistributedNoise_double():stddev(1.0),nd(0.0,1.0), noise(rng, nd) {}
 
-    NormalDistributedNoise_double( Expression<double>::Ptr a1, double _stddev):
+    NormalDistributedNoise_double( const Expression<double>::Ptr& a1, double _stddev):
         UnaryExpression<double,double>("normal_distributed_noise",a1), 
         stddev(_stddev), 
         nd(0.0,_stddev),
@@ -1149,16 +1254,22 @@ public:
     virtual double derivative(int i) {
         return 0.0;
     }
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        std::fill(jac, jac+ndx.size(), 0.0);
+    }
+
     virtual  Expression<double>::Ptr derivativeExpression(int i) {
         return Constant(0.0);
     }
 
     virtual  Expression<double>::Ptr clone() {
-         Expression<double>::Ptr expr(
-            new NormalDistributedNoise_double(this->argument->clone(), stddev )
-        );
+         Expression<double>::Ptr expr = make_node<NormalDistributedNoise_double>(cloned(this->argument), stddev );
         return expr;
     } 
+
+    virtual bool getStructuralKey(StructuralKey& key) {
+        return false;   // each noise node draws its own samples
+    }
 };
 /**
  * An expression tree node for normal-distributed random noise
@@ -1172,11 +1283,9 @@ public:
  * if time == 0, then the noise is also zero ( such that the convergence criteria for the initialization procedure
  * still works).
  */
-inline typename Expression<double>::Ptr normaldistributednoise( typename Expression<double>::Ptr a1,double stddev) {
-    typename Expression<double>::Ptr expr(
-        new NormalDistributedNoise_double( a1, stddev )
-    );
-    return expr;
+inline typename Expression<double>::Ptr normaldistributednoise( const typename Expression<double>::Ptr& a1,double stddev) {
+    typename Expression<double>::Ptr expr = make_node<NormalDistributedNoise_double>( a1, stddev );
+    return interned(expr);
 }
 
 
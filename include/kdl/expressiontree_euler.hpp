@@ -58,9 +58,9 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        double da = argument1->derivative(i);
-        double db = argument2->derivative(i);
-        double dc = argument3->derivative(i);
+        double da = argument1_derivative(i);
+        double db = argument2_derivative(i);
+        double dc = argument3_derivative(i);
         return KDL::Vector( -sa*db + ca*cb*dc ,
                              ca*db + cb*sa*dc ,
                              da - sb*dc );
@@ -72,9 +72,7 @@ public:
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual typename TernExpr::Ptr clone() {
-        Expression<KDL::Rotation>::Ptr expr(
-            new EulerZYX(argument1->clone(),argument2->clone(),argument3->clone())
-        );
+        Expression<KDL::Rotation>::Ptr expr = make_node<EulerZYX>(cloned(argument1),cloned(argument2),cloned(argument3));
         return expr;
     }
 };
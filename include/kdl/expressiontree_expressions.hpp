@@ -27,6 +27,7 @@
 #include <kdl/stiffness.hpp>
 #include <kdl/frames_io.hpp>
 #include <boost/smart_ptr.hpp>
+#include <kdl/expressiontree_arena.hpp>
 #include <kdl/utilities/utility.h>
 #include <vector>
 #include <Eigen/Dense>
@@ -34,10 +35,16 @@
 #include <ostream>
 #include <assert.h>
 #include <set>
+#include <map>
 #include <list>
 #include <cmath>
 #include <stdexcept>
+#include <typeinfo>
+#include <cstring>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
 #include <kdl/expressiontree_traits.hpp>
+#include <kdl/expressiontree_dependencies.hpp>
 
 // colorscheme:
 #define COLOR_OPERATION "\"#5CCCCC\""
@@ -53,6 +60,24 @@ namespace KDL {
 class ExpressionOptimizer;
 
 
+namespace detail {
+/**
+ * marks node as written to the .dot file that is written by this thread, returns false if it was
+ * already marked.  Replaces a flag in every node, since it is only used while writing a .dot file.
+ */
+bool dotfile_mark_written(const void* node);
+
+/**
+ * removes the mark of node, to be called by write_dotfile_init().
+ */
+void dotfile_clear_written(const void* node);
+
+/**
+ * removes all marks of this thread, called at the start and the end of a .dot file.
+ */
+void dotfile_clear_all();
+} // namespace detail
+
 /**
  * start a dotfile 
  *
@@ -70,6 +95,7 @@ class ExpressionOptimizer;
  * 
  */
 inline void write_dotfile_start(std::ostream& of) {
+     detail::dotfile_clear_all();
      of << "digraph expressiontree { \n"
        << "rankdir=BT\n\n"; // rev
 }
@@ -80,11 +106,139 @@ inline void write_dotfile_start(std::ostream& of) {
  */
 inline void write_dotfile_end(std::ostream& of) {
     of << "}";
+    detail::dotfile_clear_all();
 }
 
 template <typename T>
 class Expression;
 
+class ArgumentVisitor;
+
+class MIMO;
+
+/**
+ * list of variable numbers towards which a Jacobian is requested (see Expression<T>::jacobian)
+ */
+typedef std::vector<int> VarIndexSet;
+
+/**
+ * identifies a node by its type, its parameters and the identity of its arguments (see GraphBuilder).
+ */
+typedef std::vector<uint64_t> StructuralKey;
+
+inline void appendToKey(StructuralKey& key, const void* p) {
+    key.push_back((uint64_t)(uintptr_t)p);
+}
+
+inline void appendToKey(StructuralKey& key, int v) {
+    key.push_back((uint64_t)(int64_t)v);
+}
+
+/**
+ * appends the bit pattern of v to key.
+ */
+template <typename T>
+inline void appendBytesToKey(StructuralKey& key, const T& v) {
+    size_t n = key.size();
+    key.resize(n + (sizeof(T)+7)/8, 0);
+    memcpy(&key[n], &v, sizeof(T));
+}
+
+/**
+ * name of an expression graph node.
+ *
+ * Names are interned in one symbol table, shared by all nodes: a node only stores the
+ * number of its name, and nodes with the same name share one copy of the string.
+ * The symbol table is never shrunk, it holds one entry per distinct name (e.g. per operation,
+ * per input variable and per name given to cached(..)).  Reading a name does not lock the table.
+ */
+class NodeName {
+public:
+    NodeName():
+        id(0) {}
+
+    explicit NodeName(const std::string& s):
+        id(intern(s)) {}
+
+    explicit NodeName(const char* s):
+        id(intern(s)) {}
+
+    /**
+     * renames, as for the std::string name of the nodes before names were interned (e.g. e->name = "q1").
+     */
+    NodeName& operator=(const std::string& s) {
+        id = intern(s);
+        return *this;
+    }
+
+    NodeName& operator=(const char* s) {
+        id = intern(s);
+        return *this;
+    }
+
+    const std::string& str() const {
+        return lookup(id);
+    }
+
+    operator const std::string&() const {
+        return lookup(id);
+    }
+
+    size_t size() const {
+        return str().size();
+    }
+
+    /**
+     * number of the name in the symbol table, 0 for the empty name.
+     */
+    unsigned int symbol() const {
+        return id;
+    }
+
+    bool operator==(const NodeName& other) const {
+        return id==other.id;
+    }
+
+    bool operator!=(const NodeName& other) const {
+        return id!=other.id;
+    }
+
+    /**
+     * number of distinct names in the symbol table.
+     */
+    static size_t numberOfSymbols();
+
+    /**
+     * memory used by the string of name with number symbol (shared by all nodes with this name).
+     */
+    static size_t symbolBytes(unsigned int symbol);
+private:
+    static unsigned int intern(const std::string& s);
+    static const std::string& lookup(unsigned int id);
+
+    unsigned int id;
+};
+
+inline bool operator==(const NodeName& a, const std::string& b) {
+    return a.str()==b;
+}
+
+inline bool operator==(const std::string& a, const NodeName& b) {
+    return a==b.str();
+}
+
+inline bool operator!=(const NodeName& a, const std::string& b) {
+    return a.str()!=b;
+}
+
+inline bool operator!=(const std::string& a, const NodeName& b) {
+    return a!=b.str();
+}
+
+inline std::ostream& operator<<(std::ostream& os, const NodeName& n) {
+    return os << n.str();
+}
+
 /**
  * Definition of all methods of Expression<T> whose interface does not depend on T.
  */
@@ -92,6 +246,8 @@ class ExpressionBase {
 public:
    typedef boost::shared_ptr< ExpressionBase > Ptr;
 
+    NodeName name;   ///< name of the operation, used by print(..), write_dotfile(..) and memory_report(..)
+
 
    /**
      * Fills in the input values for this expression. 
@@ -200,6 +356,22 @@ public:
      */
     virtual void getDependencies(std::set<int>& varset) = 0;
 
+    /**
+     * returns the set of variables this expression depends on, i.e. the same variables as
+     * getDependencies(..).  Nodes with arguments compute this set once, during construction, from
+     * the sets of their arguments, other nodes compute it using getDependencies(..) at the first call.
+     * The cost of a query is therefore independent of the size of the expression.
+     */
+    const DependencySet& dependencies() {
+        if (!dependencies_valid) {
+            std::set<int> varset;
+            getDependencies(varset);
+            dependency_set     = DependencySet(varset);
+            dependencies_valid = true;
+        }
+        return dependency_set;
+    }
+
     /**
      * adds the dependencies on scalar input variables numbers to the given set of variables.
      * rotational input variables are ignored
@@ -252,9 +424,60 @@ public:
      */
     virtual int isScalarVariable() = 0;
 
+    /**
+     * appends the type, the parameters and the addresses of the arguments of this node to key.
+     * Two nodes with the same key compute the same result and can be shared (see GraphBuilder).
+     * Returns false if this node can not be shared, e.g. because it has an internal state.
+     * The default implementation returns false.
+     */
+    virtual bool getStructuralKey(StructuralKey& key) {
+        return false;
+    }
+
+    /**
+     * returns true if the evaluation of this node never writes to the node, such that it can be
+     * evaluated by several threads at the same time (see CloneContext).  Nodes that store the
+     * values of their arguments are not stateless.  The default implementation returns false.
+     */
+    virtual bool isStateless() const {
+        return false;
+    }
+
+    /**
+     * calls v for each of the arguments of this node, v can replace an argument by an
+     * expression with the same value (see ArgumentVisitor).
+     * The default implementation has no arguments.
+     */
+    virtual void visitArguments(ArgumentVisitor& v) {
+    }
+
+    /**
+     * number of bytes of heap memory allocated by this node to cache results (see memory_report(..)).
+     * The memory of the node object itself is not included.  The default implementation returns 0.
+     */
+    virtual size_t cacheBytes() const {
+        return 0;
+    }
+
+    ExpressionBase():
+        dependencies_valid(false) {}
 
+    explicit ExpressionBase(const std::string& _name):
+        name(_name),
+        dependencies_valid(false) {}
 
     virtual ~ExpressionBase() {}
+protected:
+    /**
+     * sets the result of dependencies(), to be called by the constructor of a node.
+     */
+    void setDependencies(const DependencySet& d) {
+        dependency_set     = d;
+        dependencies_valid = true;
+    }
+private:
+    DependencySet dependency_set;
+    bool          dependencies_valid;
 };
 
 
@@ -304,14 +527,12 @@ public:
 template< typename ResultType >
 class Expression: public ExpressionBase {
 public:
-    std::string name;
-
     typedef typename boost::shared_ptr< Expression<ResultType> > Ptr;
     typedef typename AutoDiffTrait<ResultType>::DerivType DerivType;
 
     Expression() {}
 
-    Expression(const std::string& _name) : name(_name) {};
+    Expression(const std::string& _name) : ExpressionBase(_name) {};
     /**
      * returns the value of the expression tree.
      */
@@ -333,6 +554,22 @@ public:
      */
     virtual int number_of_derivatives() = 0;
 
+    /**
+     * computes the derivatives towards all variables in ndx in one traversal of the
+     * expression graph.  Each node computes the derivative blocks of its arguments and combines
+     * them into its own block.  As for derivative(i), value() should be called before.
+     * \param [in] ndx list of variable numbers.
+     * \param [out] jac array of at least ndx.size() elements,
+     *                  on return jac[k] is equal to derivative(ndx[k]).
+     *
+     * The default implementation calls derivative(i) for each of the variables.
+     */
+    virtual void jacobian(const VarIndexSet& ndx, DerivType* jac) {
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = derivative(ndx[k]);
+        }
+    }
+
 
     virtual typename Expression<DerivType>::Ptr derivativeExpression(int i) = 0;
     /*{
@@ -342,7 +579,8 @@ public:
 
    
     /**
-     * makes a deep copy of the expression.
+     * makes a deep copy of the expression.  The arguments are copied with cloned(..), use cloned(e)
+     * instead of e->clone() to clone a graph such that a node with several parents is cloned once.
      */
     virtual boost::shared_ptr<Expression<ResultType> > clone() = 0;
 
@@ -360,9 +598,11 @@ public:
         of << "digraph expressiontree { \n"
            << "rankdir=BT\n\n"; // rev
         pnumber argnode;
+        detail::dotfile_clear_all();
         write_dotfile_init();
         write_dotfile_update(of,argnode);  
         of << "}";
+        detail::dotfile_clear_all();
     }
 
     /** 
@@ -397,8 +637,222 @@ public:
     }
 };
 
+/**
+ * Visits the arguments of an expression graph node, see ExpressionBase::visitArguments(..).
+ *
+ * The visit(..) methods receive a reference to the argument stored in the node and can replace it
+ * by an expression with the same value and the same dependencies (e.g. a cached version of the
+ * argument).  Their default implementation calls visitNode(..).  Arguments of other types than
+ * double, Vector, Rotation, Frame, Twist or Wrench are only passed to visitNode(..) and can not
+ * be replaced.
+ */
+class ArgumentVisitor {
+public:
+    virtual void visitNode(const ExpressionBase::Ptr& arg) {}
+    virtual void visit(boost::shared_ptr< Expression<double> >& arg)   { visitNode(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Vector> >& arg)   { visitNode(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Rotation> >& arg) { visitNode(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Frame> >& arg)    { visitNode(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Twist> >& arg)    { visitNode(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Wrench> >& arg)   { visitNode(arg); }
+    virtual ~ArgumentVisitor() {}
+};
+
+template <typename T>
+inline void visitArgument(ArgumentVisitor& v, boost::shared_ptr< Expression<T> >& arg) {
+    v.visitNode(arg);
+}
+
+inline void visitArgument(ArgumentVisitor& v, boost::shared_ptr< Expression<double> >& arg)   { v.visit(arg); }
+inline void visitArgument(ArgumentVisitor& v, boost::shared_ptr< Expression<Vector> >& arg)   { v.visit(arg); }
+inline void visitArgument(ArgumentVisitor& v, boost::shared_ptr< Expression<Rotation> >& arg) { v.visit(arg); }
+inline void visitArgument(ArgumentVisitor& v, boost::shared_ptr< Expression<Frame> >& arg)    { v.visit(arg); }
+inline void visitArgument(ArgumentVisitor& v, boost::shared_ptr< Expression<Twist> >& arg)    { v.visit(arg); }
+inline void visitArgument(ArgumentVisitor& v, boost::shared_ptr< Expression<Wrench> >& arg)   { v.visit(arg); }
+
+/**
+ * Opt-in hash-consing of expression graphs.
+ *
+ * While a GraphBuilder exists, the functions that build expressions (operator+, operator*, sin, dot,
+ * rot_x, frame, Constant, input, ...) return an existing, structurally identical node instead of
+ * a new one:  nodes with the same type, the same parameters and the same arguments are only
+ * created once.  Since the arguments are shared in the same way, common subexpressions are
+ * automatically shared, e.g. in
+ * @code
+ *   GraphBuilder builder;
+ *   Expression<double>::Ptr e = coord_x(tmp)*coord_x(tmp) + coord_y(tmp)*coord_y(tmp);
+ * @endcode
+ * coord_x(tmp) and coord_y(tmp) are only created once.  Sharing a node does not mean it is evaluated
+ * once: a node without a cache is still evaluated for each of its parents.  Use cached(..) or
+ * auto_cache(..) to evaluate shared nodes only once.
+ *
+ * Builders can be nested, the most recently constructed builder is used.  Nodes with an internal
+ * state (cached, Variable, initial_value, make_constant, noise,...) are never shared.
+ * Each thread has its own current builder: a GraphBuilder only affects the expressions built
+ * by the thread that constructed it.
+ *
+ * \warning expressions created with the same GraphBuilder share nodes: setting input values on
+ *          one of these expressions also sets them for the others.
+ */
+class GraphBuilder {
+public:
+    GraphBuilder();
+
+    /**
+     * returns the node registered with the same structural key as e, or registers and
+     * returns e if there is no such node.
+     */
+    ExpressionBase::Ptr intern(const ExpressionBase::Ptr& e);
+
+    /**
+     * number of distinct nodes registered.
+     */
+    size_t size() const {
+        return table.size();
+    }
+
+    /**
+     * number of times an existing node was returned instead of a new one.
+     */
+    size_t hits() const {
+        return nr_of_hits;
+    }
+
+    /**
+     * the GraphBuilder currently in use by this thread, or 0.
+     */
+    static GraphBuilder* current();
+
+    ~GraphBuilder();
+private:
+    typedef boost::unordered_map<StructuralKey, ExpressionBase::Ptr, boost::hash<StructuralKey> > Table;
+
+    GraphBuilder(const GraphBuilder&);
+    GraphBuilder& operator=(const GraphBuilder&);
+
+    Table                table;
+    StructuralKey        key;
+    size_t               nr_of_hits;
+    GraphBuilder*        previous;
+};
+
+/**
+ * returns e, or a structurally identical node when a GraphBuilder is in use.
+ */
+template <typename T>
+inline boost::shared_ptr< Expression<T> > interned(const boost::shared_ptr< Expression<T> >& e) {
+    GraphBuilder* builder = GraphBuilder::current();
+    if (builder==0) {
+        return e;
+    }
+    return boost::static_pointer_cast< Expression<T> >( builder->intern(e) );
+}
+
+/**
+ * Memo table for cloning expression graphs (see cloned(..)).
+ *
+ * While a CloneContext exists, each node (and each MIMO) is cloned only once: a node that is
+ * referenced by several parents is cloned once and the clone is shared by the cloned parents.
+ * The clone of a graph is therefore isomorphic to the original, with the same sharing and the
+ * same placement of caches.  All graphs cloned with cloned(..) within the same CloneContext share
+ * their common nodes, e.g. to clone a set of constraints for another thread:
+ * @code
+ *   {
+ *       CloneContext ctx;
+ *       e1b = cloned(e1);
+ *       e2b = cloned(e2);
+ *   }
+ * @endcode
+ * Contexts can be nested, the most recently constructed context is used.
+ *
+ * When share_constants is true, stateless nodes (see ExpressionBase::isStateless(), i.e. the
+ * ConstantType nodes) are not cloned but shared between the original and its clones.  Only the
+ * other nodes (inputs, operations that keep the values of their arguments, caches, VariableType,
+ * CallbackNode, MIMO's) are duplicated, such that the memory of many clones of a graph (e.g. one
+ * for each worker thread) grows only with the nodes that are written to during evaluation.
+ *
+ * The current context is kept per thread: each thread that clones expressions uses its own contexts.
+ */
+class CloneContext {
+public:
+    explicit CloneContext(bool share_constants=false);
+
+    /**
+     * returns true if e is shared instead of cloned in this context.
+     */
+    bool isShared(ExpressionBase* e);
+
+    /**
+     * returns the clone of e, or a null pointer if e is not yet cloned.
+     */
+    ExpressionBase::Ptr lookup(ExpressionBase* e) const;
+
+    void insert(ExpressionBase* e, const ExpressionBase::Ptr& clone);
+
+    /**
+     * returns the clone of m, or a null pointer if m is not yet cloned.
+     */
+    boost::shared_ptr<MIMO> lookup(MIMO* m) const;
+
+    void insert(MIMO* m, const boost::shared_ptr<MIMO>& clone);
+
+    /**
+     * number of nodes cloned or shared.
+     */
+    size_t size() const {
+        return nodes.size();
+    }
+
+    /**
+     * number of nodes shared instead of cloned.
+     */
+    size_t shared() const {
+        return nr_of_shared;
+    }
+
+    /**
+     * the CloneContext currently in use by this thread, or 0.
+     */
+    static CloneContext* current();
+
+    ~CloneContext();
+private:
+    CloneContext(const CloneContext&);
+    CloneContext& operator=(const CloneContext&);
+
+    boost::unordered_map<ExpressionBase*, ExpressionBase::Ptr>  nodes;
+    boost::unordered_map<MIMO*, boost::shared_ptr<MIMO> >       mimos;
+    bool                 share_constants;
+    size_t               nr_of_shared;
+    CloneContext*        previous;
+};
+
+/**
+ * returns a clone of e that preserves the sharing of nodes within e, i.e. a node with several
+ * parents is cloned only once.  Uses the current CloneContext, or a temporary one if there is none.
+ * The clone() methods of the nodes use cloned(..) for their arguments.
+ */
+template <typename T>
+inline boost::shared_ptr< Expression<T> > cloned(const boost::shared_ptr< Expression<T> >& e) {
+    CloneContext* ctx = CloneContext::current();
+    if (ctx==0) {
+        CloneContext local;
+        return cloned(e);
+    }
+    ExpressionBase::Ptr c = ctx->lookup(e.get());
+    if (!c) {
+        if (ctx->isShared(e.get())) {
+            c = e;
+        } else {
+            c = e->clone();
+        }
+        ctx->insert(e.get(), c);
+    }
+    return boost::static_pointer_cast< Expression<T> >(c);
+}
+
 template<typename T>
-typename Expression<T>::Ptr checkConstant( typename Expression<T>::Ptr a );
+typename Expression<T>::Ptr checkConstant( const typename Expression<T>::Ptr& a );
  
 
 template< typename ResultType, typename T>
@@ -406,7 +860,9 @@ class UnaryExpression: public Expression<ResultType> {
 public:
     typedef T ArgumentType;
     typedef Expression<ArgumentType> ArgumentExpr;
+    typedef typename AutoDiffTrait<T>::DerivType ArgumentDerivType;
     typename ArgumentExpr::Ptr argument;
+    std::vector<ArgumentDerivType> argjac;   ///< Jacobian of the argument, filled in by argument_jacobian()
 
     UnaryExpression() {}
 
@@ -414,6 +870,7 @@ public:
             Expression<ResultType>(name)
     {
         argument = checkConstant<T>(ptr);
+        this->setDependencies(argument->dependencies());
     }
 
     virtual void setInputValues(const std::vector<double>& values) {
@@ -431,6 +888,31 @@ public:
         return argument->number_of_derivatives();
     } 
 
+    /**
+     * fills in argjac with the Jacobian of the argument towards the variables in ndx.
+     * (used by the implementations of jacobian(..) )
+     */
+    void argument_jacobian(const VarIndexSet& ndx) {
+        argjac.resize(ndx.size());
+        if (argument->dependencies().intersects(ndx)) {
+            argument->jacobian(ndx,&argjac[0]);
+        } else {
+            std::fill(argjac.begin(),argjac.end(),AutoDiffTrait<T>::zeroDerivative());
+        }
+    }
+
+    /**
+     * derivative of the argument towards variable i. The argument is not traversed when it
+     * does not depend on variable i.
+     */
+    ArgumentDerivType argument_derivative(int i) {
+        if (argument->dependencies().contains(i)) {
+            return argument->derivative(i);
+        } else {
+            return AutoDiffTrait<T>::zeroDerivative();
+        }
+    }
+
     virtual Expression<Frame>::Ptr subExpression_Frame(const std::string& name) {
         return argument->subExpression_Frame(name);
     }
@@ -453,6 +935,17 @@ public:
     virtual void addToOptimizer(ExpressionOptimizer& opt) {
         argument->addToOptimizer(opt);
     }
+
+    virtual bool getStructuralKey(StructuralKey& key) {
+        appendToKey(key, &typeid(*this));
+        appendToKey(key, argument.get());
+        return true;
+    }
+
+    virtual void visitArguments(ArgumentVisitor& v) {
+        visitArgument(v, argument);
+    }
+
     virtual void getDependencies(std::set<int>& varset) {
         argument->getDependencies(varset);
     }
@@ -497,9 +990,13 @@ class BinaryExpression: public Expression<ResultType> {
 public:
     typedef Expression<T1>                      Argument1Expr;
     typedef Expression<T2>                      Argument2Expr;
+    typedef typename AutoDiffTrait<T1>::DerivType Argument1DerivType;
+    typedef typename AutoDiffTrait<T2>::DerivType Argument2DerivType;
 
     typename Argument1Expr::Ptr argument1;
     typename Argument2Expr::Ptr argument2;
+    std::vector<Argument1DerivType> argjac1;  ///< Jacobian of argument1, filled in by argument_jacobian()
+    std::vector<Argument2DerivType> argjac2;  ///< Jacobian of argument2, filled in by argument_jacobian()
 
     BinaryExpression() {}
 
@@ -509,6 +1006,9 @@ public:
             Expression<ResultType>(name),
             argument1(checkConstant<T1>(arg1ptr)),
             argument2(checkConstant<T2>(arg2ptr)) {
+        DependencySet d(argument1->dependencies());
+        d |= argument2->dependencies();
+        this->setDependencies(d);
     }
 
     virtual void setInputValues(const std::vector<double>& values) {
@@ -532,6 +1032,45 @@ public:
         return n1 > n2 ? n1 : n2;
     } 
 
+    /**
+     * fills in argjac1 and argjac2 with the Jacobian of the arguments towards the variables in ndx.
+     * (used by the implementations of jacobian(..) )
+     */
+    void argument_jacobian(const VarIndexSet& ndx) {
+        argjac1.resize(ndx.size());
+        argjac2.resize(ndx.size());
+        if (argument1->dependencies().intersects(ndx)) {
+            argument1->jacobian(ndx,&argjac1[0]);
+        } else {
+            std::fill(argjac1.begin(),argjac1.end(),AutoDiffTrait<T1>::zeroDerivative());
+        }
+        if (argument2->dependencies().intersects(ndx)) {
+            argument2->jacobian(ndx,&argjac2[0]);
+        } else {
+            std::fill(argjac2.begin(),argjac2.end(),AutoDiffTrait<T2>::zeroDerivative());
+        }
+    }
+
+    /**
+     * derivatives of the arguments towards variable i. An argument is not traversed when it
+     * does not depend on variable i.
+     */
+    Argument1DerivType argument1_derivative(int i) {
+        if (argument1->dependencies().contains(i)) {
+            return argument1->derivative(i);
+        } else {
+            return AutoDiffTrait<T1>::zeroDerivative();
+        }
+    }
+
+    Argument2DerivType argument2_derivative(int i) {
+        if (argument2->dependencies().contains(i)) {
+            return argument2->derivative(i);
+        } else {
+            return AutoDiffTrait<T2>::zeroDerivative();
+        }
+    }
+
     virtual Expression<Frame>::Ptr subExpression_Frame(const std::string& name) {
         typename Expression<Frame>::Ptr a;
         a = argument1->subExpression_Frame(name);
@@ -587,6 +1126,18 @@ public:
         argument2->addToOptimizer(opt);
     }
 
+    virtual bool getStructuralKey(StructuralKey& key) {
+        appendToKey(key, &typeid(*this));
+        appendToKey(key, argument1.get());
+        appendToKey(key, argument2.get());
+        return true;
+    }
+
+    virtual void visitArguments(ArgumentVisitor& v) {
+        visitArgument(v, argument1);
+        visitArgument(v, argument2);
+    }
+
     virtual void getDependencies(std::set<int>& varset) {
         argument1->getDependencies(varset);
         argument2->getDependencies(varset);
@@ -646,10 +1197,16 @@ public:
     typedef Expression<T1>                      Argument1Expr;
     typedef Expression<T2>                      Argument2Expr;
     typedef Expression<T3>                      Argument3Expr;
+    typedef typename AutoDiffTrait<T1>::DerivType Argument1DerivType;
+    typedef typename AutoDiffTrait<T2>::DerivType Argument2DerivType;
+    typedef typename AutoDiffTrait<T3>::DerivType Argument3DerivType;
 
     typename Argument1Expr::Ptr argument1;
     typename Argument2Expr::Ptr argument2;
     typename Argument3Expr::Ptr argument3;
+    std::vector<Argument1DerivType> argjac1;  ///< Jacobian of argument1, filled in by argument_jacobian()
+    std::vector<Argument2DerivType> argjac2;  ///< Jacobian of argument2, filled in by argument_jacobian()
+    std::vector<Argument3DerivType> argjac3;  ///< Jacobian of argument3, filled in by argument_jacobian()
 
 
 
@@ -664,6 +1221,10 @@ public:
         argument1(checkConstant<T1>(arg1ptr)),
         argument2(checkConstant<T2>(arg2ptr)),
         argument3(checkConstant<T3>(arg3ptr)) {
+        DependencySet d(argument1->dependencies());
+        d |= argument2->dependencies();
+        d |= argument3->dependencies();
+        this->setDependencies(d);
     }
 
     virtual void setInputValues(const std::vector<double>& values) {
@@ -692,6 +1253,59 @@ public:
  
     } 
 
+    /**
+     * fills in argjac1, argjac2 and argjac3 with the Jacobian of the arguments towards the variables in ndx.
+     * (used by the implementations of jacobian(..) )
+     */
+    void argument_jacobian(const VarIndexSet& ndx) {
+        argjac1.resize(ndx.size());
+        argjac2.resize(ndx.size());
+        argjac3.resize(ndx.size());
+        if (argument1->dependencies().intersects(ndx)) {
+            argument1->jacobian(ndx,&argjac1[0]);
+        } else {
+            std::fill(argjac1.begin(),argjac1.end(),AutoDiffTrait<T1>::zeroDerivative());
+        }
+        if (argument2->dependencies().intersects(ndx)) {
+            argument2->jacobian(ndx,&argjac2[0]);
+        } else {
+            std::fill(argjac2.begin(),argjac2.end(),AutoDiffTrait<T2>::zeroDerivative());
+        }
+        if (argument3->dependencies().intersects(ndx)) {
+            argument3->jacobian(ndx,&argjac3[0]);
+        } else {
+            std::fill(argjac3.begin(),argjac3.end(),AutoDiffTrait<T3>::zeroDerivative());
+        }
+    }
+
+    /**
+     * derivatives of the arguments towards variable i. An argument is not traversed when it
+     * does not depend on variable i.
+     */
+    Argument1DerivType argument1_derivative(int i) {
+        if (argument1->dependencies().contains(i)) {
+            return argument1->derivative(i);
+        } else {
+            return AutoDiffTrait<T1>::zeroDerivative();
+        }
+    }
+
+    Argument2DerivType argument2_derivative(int i) {
+        if (argument2->dependencies().contains(i)) {
+            return argument2->derivative(i);
+        } else {
+            return AutoDiffTrait<T2>::zeroDerivative();
+        }
+    }
+
+    Argument3DerivType argument3_derivative(int i) {
+        if (argument3->dependencies().contains(i)) {
+            return argument3->derivative(i);
+        } else {
+            return AutoDiffTrait<T3>::zeroDerivative();
+        }
+    }
+
     virtual typename Expression<Frame>::Ptr subExpression_Frame(const std::string& name) {
         typename Expression<Frame>::Ptr a;
         a = argument1->subExpression_Frame(name);
@@ -776,6 +1390,20 @@ public:
         argument3->addToOptimizer(opt);
     }
 
+    virtual bool getStructuralKey(StructuralKey& key) {
+        appendToKey(key, &typeid(*this));
+        appendToKey(key, argument1.get());
+        appendToKey(key, argument2.get());
+        appendToKey(key, argument3.get());
+        return true;
+    }
+
+    virtual void visitArguments(ArgumentVisitor& v) {
+        visitArgument(v, argument1);
+        visitArgument(v, argument2);
+        visitArgument(v, argument3);
+    }
+
 
     virtual void getDependencies(std::set<int>& varset) {
         argument1->getDependencies(varset);
@@ -842,11 +1470,10 @@ public:
 template <typename _ResultType>
 class FunctionType: public Expression<_ResultType> {
 public:
-    bool dot_already_written;
     typedef _ResultType ResultType;
     typedef typename AutoDiffTrait<_ResultType>::DerivType DerivType;
 
-    FunctionType():dot_already_written(false) {}
+    FunctionType() {}
     FunctionType(const std::string& name):
         Expression<_ResultType>(name) {}
 
@@ -889,14 +1516,13 @@ public:
     }
 
     virtual void write_dotfile_init() {
-        dot_already_written = false;
+        detail::dotfile_clear_written(this);
     }
 
 
 
     void write_dotfile_update(std::ostream& of, pnumber& thisnode) {
-        if (!dot_already_written) {
-            dot_already_written = true;
+        if (detail::dotfile_mark_written(this)) {
             thisnode=(size_t)this;
             of << "S"<<thisnode<<"[label=\"" << Expression<ResultType>::name << "\",shape=box,style=filled,fillcolor="
                << COLOR_LEAF << ",color=black]\n";
@@ -956,6 +1582,7 @@ public:
     ConstantType() {}
     ConstantType(const ResultType& _val):
         FunctionType<ResultType>("constant"),val(_val) {
+        this->setDependencies(DependencySet());
     }
 
     virtual void setInputValues(const std::vector<double>& values) {
@@ -975,6 +1602,10 @@ public:
         return AutoDiffTrait<ResultType>::zeroDerivative();
     }
 
+    virtual void jacobian(const VarIndexSet& ndx, DerivType* jac) {
+        std::fill(jac, jac+ndx.size(), AutoDiffTrait<ResultType>::zeroDerivative());
+    }
+
     virtual int number_of_derivatives() {
         return 0;
     }
@@ -983,10 +1614,18 @@ public:
     }
     virtual void update_variabletype_from_original() {}
 
+    virtual bool getStructuralKey(StructuralKey& key) {
+        appendToKey(key, &typeid(*this));
+        appendBytesToKey(key, val);
+        return true;
+    }
+
+    virtual bool isStateless() const {
+        return true;
+    }
+
     virtual typename Expression<ResultType>::Ptr clone() {
-        typename Expression<ResultType>::Ptr expr(
-            new ConstantType( val )
-        );
+        typename Expression<ResultType>::Ptr expr = make_node<ConstantType>( val );
         return expr;
     }
     virtual typename Expression<DerivType>::Ptr derivativeExpression(int i) {
@@ -998,20 +1637,19 @@ public:
 /** utility function to create ConstantType */
 template<typename ResultType>
 inline typename Expression<ResultType>::Ptr Constant( const ResultType& _val ) {
-   typename Expression<ResultType>::Ptr cnst(
-        new ConstantType<ResultType>( _val )
-   );
-   return cnst;
+   typename Expression<ResultType>::Ptr cnst = make_node< ConstantType<ResultType> >( _val );
+   return interned(cnst);
 }
 
 
 
 class InputType : public FunctionType<double> {
 public:
-    char name_buffer[32];
     int    variable_number;
     double val;
-    InputType() {}
+    const double* binding;  ///< if not null, the value is read from *binding instead of val (see ExpressionOptimizer::bind(..))
+    InputType():
+        binding(0) {}
     /**
      * defaultvalue specifies the initial value of the variable "value".  The value
      * when it is not filled in using setInputValues() method ( because it is not called, or
@@ -1021,10 +1659,15 @@ public:
     InputType(int _variable_number, double _defaultvalue):
         FunctionType<double>("input"),
         variable_number(_variable_number),
-        val(_defaultvalue) {
+        val(_defaultvalue),
+        binding(0) {
             assert( variable_number >= 0);
+            char name_buffer[32];
             sprintf(name_buffer,"input(%d)",variable_number);
-            name = name_buffer;
+            name = NodeName(name_buffer);
+            DependencySet d;
+            d.insert(variable_number);
+            setDependencies(d);
     }
 
     virtual void setInputValues(const std::vector<double>& values) {
@@ -1043,11 +1686,18 @@ public:
     }
 
     virtual double value() {
-        return val;
+        return binding ? *binding : val;
     } 
 
     virtual void addToOptimizer(ExpressionOptimizer& opt);
 
+    virtual bool getStructuralKey(StructuralKey& key) {
+        appendToKey(key, &typeid(*this));
+        appendToKey(key, variable_number);
+        appendBytesToKey(key, val);
+        return true;
+    }
+
     virtual void getDependencies(std::set<int>& varset) {
         varset.insert( variable_number);
     }
@@ -1067,6 +1717,12 @@ public:
             return 0.0;
         }
     } 
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = (ndx[k]==variable_number) ? 1.0 : 0.0;
+        }
+    }
  
     virtual Expression<DerivType>::Ptr derivativeExpression(int i) {
         if (variable_number== i) {
@@ -1084,12 +1740,11 @@ public:
         return variable_number;
     }
     /**
-     * \warn  Default value for the cloned object will be the value of the original InputType object.
+     * \warn  Default value for the cloned object will be the value of the original InputType object
+     *        (also when it reads its value from a buffer bound by an ExpressionOptimizer).  The clone is not bound.
      */
     virtual Expression<ResultType>::Ptr clone() {
-        Expression<ResultType>::Ptr expr(
-            new InputType( variable_number, val)
-        );
+        Expression<ResultType>::Ptr expr = make_node<InputType>( variable_number, value());
         return expr;
     }
 
@@ -1100,26 +1755,23 @@ public:
  * and whose derivative with number derivative_number is equal to 1.
  */
 inline Expression<double>::Ptr input(int variable_number, double default_value  ) {
-   Expression<double>::Ptr var(
-        new InputType( variable_number,default_value )
-   );
-   return var;
+   Expression<double>::Ptr var = make_node<InputType>( variable_number,default_value );
+   return interned(var);
 }
 
 inline Expression<double>::Ptr input(int variable_number ) {
-   Expression<double>::Ptr var(
-        new InputType( variable_number, 0.0 )
-   );
-   return var;
+   Expression<double>::Ptr var = make_node<InputType>( variable_number, 0.0 );
+   return interned(var);
 }
 
 
 class InputRotationType : public FunctionType<Rotation> {
 public:
-    char name_buffer[32];
     int    variable_number;
     Rotation  val;
-    InputRotationType() {}
+    const Rotation* binding;  ///< if not null, the value is read from *binding instead of val (see ExpressionOptimizer::bind(..))
+    InputRotationType():
+        binding(0) {}
     /**
      * defaultvalue specifies the initial value of the variable "value".  The value
      * when it is not filled in using setInputValues() method ( because it is not called, or
@@ -1129,10 +1781,17 @@ public:
     InputRotationType(int _variable_number, const Rotation& _defaultvalue):
         FunctionType<Rotation>("input"),
         variable_number(_variable_number),
-        val(_defaultvalue) {
+        val(_defaultvalue),
+        binding(0) {
             assert( variable_number >= 0);
+            char name_buffer[32];
             sprintf(name_buffer,"input(%d)",variable_number);
-            name = name_buffer;
+            name = NodeName(name_buffer);
+            DependencySet d;
+            d.insert(variable_number);
+            d.insert(variable_number+1);
+            d.insert(variable_number+2);
+            setDependencies(d);
     }
 
     virtual void setInputValues(const std::vector<double>& values) {
@@ -1148,11 +1807,18 @@ public:
     }
 
     virtual Rotation value() {
-        return val;
+        return binding ? *binding : val;
     } 
 
     virtual void addToOptimizer(ExpressionOptimizer& opt);
 
+    virtual bool getStructuralKey(StructuralKey& key) {
+        appendToKey(key, &typeid(*this));
+        appendToKey(key, variable_number);
+        appendBytesToKey(key, val);
+        return true;
+    }
+
     virtual void getDependencies(std::set<int>& varset) {
         varset.insert( variable_number);
         varset.insert( variable_number+1);
@@ -1180,6 +1846,16 @@ public:
             return Vector(0,0,0);
         }
     } 
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = Vector::Zero();
+            int j  = ndx[k] - variable_number;
+            if ((0<=j)&&(j<3)) {
+                jac[k](j) = 1.0;
+            }
+        }
+    }
  
     virtual Expression<DerivType>::Ptr derivativeExpression(int i) {
         if (variable_number == i) {
@@ -1199,12 +1875,11 @@ public:
     };
 
     /**
-     * \warn  Default value for the cloned object will be the value of the original InputType object.
+     * \warn  Default value for the cloned object will be the value of the original InputRotationType object
+     *        (also when it reads its value from a buffer bound by an ExpressionOptimizer).  The clone is not bound.
      */
     virtual Expression<ResultType>::Ptr clone() {
-        Expression<ResultType>::Ptr expr(
-            new InputRotationType( variable_number, val)
-        );
+        Expression<ResultType>::Ptr expr = make_node<InputRotationType>( variable_number, value());
         return expr;
     }
 
@@ -1222,10 +1897,8 @@ public:
  */
 
 inline Expression<Rotation>::Ptr inputRot(int variable_number, const Rotation& default_value  ) {
-   Expression<Rotation>::Ptr var(
-        new InputRotationType( variable_number,default_value )
-   );
-   return var;
+   Expression<Rotation>::Ptr var = make_node<InputRotationType>( variable_number,default_value );
+   return interned(var);
 }
 /**
  * creates a variable for which the value returns a Rotation, with the given variable number
@@ -1238,21 +1911,47 @@ inline Expression<Rotation>::Ptr inputRot(int variable_number, const Rotation& d
  * \return an expression graph of type rotation. 
  */
 inline Expression<Rotation>::Ptr inputRot(int variable_number ) {
-   Expression<Rotation>::Ptr var(
-        new InputRotationType( variable_number, Rotation::Identity() )
-   );
-   return var;
+   Expression<Rotation>::Ptr var = make_node<InputRotationType>( variable_number, Rotation::Identity() );
+   return interned(var);
 }
 
 
 //#define CHECK_CACHE
 
 
+/**
+ * A counter shared by a set of caches: advancing it invalidates all of them at once,
+ * without visiting them (see ExpressionOptimizer and CachedType).
+ * A cache stores, with each cached result, the epoch in which it was computed.
+ */
+class CacheEpoch {
+public:
+    typedef boost::shared_ptr<CacheEpoch> Ptr;
+    unsigned long value;
+    const void*   owner;   ///< object that manages the epoch, a cache can move between epochs of the same owner
+
+    explicit CacheEpoch(const void* _owner=0):
+        value(0), owner(_owner) {}
+
+    void advance() {
+        ++value;
+    }
+};
+
 class CachedExpression {
     public:
         virtual void getDependencies(std::set<int>& varset)=0;
         virtual void invalidate_cache() = 0;
         virtual void addToOptimizer(ExpressionOptimizer& opt);
+        /**
+         * asks the cache to be invalidated by advancing epoch, instead of by calls to invalidate_cache().
+         * Returns false if the cache does not support this (the default), or if it is already attached
+         * to another epoch.
+         */
+        virtual bool attachEpoch(const CacheEpoch::Ptr& epoch) {
+            return false;
+        }
+        virtual ~CachedExpression() {}
 };
 
 
@@ -1260,6 +1959,13 @@ class CachedExpression {
  * caches the first max_number_of_var results for derivative(i) and value()
  * such that needless computation is avoided when expressions are reused.
  * derivatives of variables with variable number > max_number_of_var are not cached.
+ * jacobian(ndx,..) uses the same cache: it only calls the argument when one of the requested
+ * derivatives is not cached, and then stores all of them.
+ *
+ * Each cached result stores the epoch in which it was computed, and is valid as long as the
+ * current epoch did not change.  The current epoch is the sum of a local counter, advanced by
+ * invalidate_cache() and setInputValue(s), and of the CacheEpoch of an ExpressionOptimizer (when
+ * attached), such that invalidation is O(1), independent of the number of derivatives.
  */
 template <typename ResultType>
 class CachedType: public Expression<ResultType>, public CachedExpression {
@@ -1268,47 +1974,81 @@ public:
     typename Expression<ResultType>::Ptr argument;
     ResultType val;
     std::vector<DerivType> deriv;
-    bool dot_already_written;
-    std::vector<bool> cached_deriv;
-    bool cached_value;
-    std::string cached_name;
+    std::vector<unsigned long> deriv_epoch;  ///< epoch in which deriv[i] was computed
+    unsigned long value_epoch;               ///< epoch in which val was computed
+    NodeName cached_name;
+    unsigned long local_value_epoch;         ///< advanced when the value becomes invalid
+    unsigned long local_deriv_epoch;         ///< advanced when the derivatives become invalid
+    CacheEpoch::Ptr shared_epoch;            ///< epoch of an ExpressionOptimizer, can be null
 
     CachedType() {}
     /**
      * caches the first the results for derivative(i) and value()
      * (to avoid unnecessary computations)
      */
-    CachedType(typename Expression<ResultType>::Ptr _argument, const std::string& _name):
+    CachedType(const typename Expression<ResultType>::Ptr& _argument, const std::string& _name):
         Expression<ResultType>("cached"),
         argument(checkConstant<ResultType>(_argument)),
         deriv(_argument->number_of_derivatives()), 
-        cached_deriv(_argument->number_of_derivatives()),
-        cached_value(false),
-        cached_name(_name) {
+        deriv_epoch(_argument->number_of_derivatives(),0),
+        value_epoch(0),
+        cached_name(_name),
+        local_value_epoch(1),
+        local_deriv_epoch(1) {
+        this->setDependencies(argument->dependencies());
+    }
+
+    /**
+     * current epoch for the value.
+     */
+    unsigned long valueEpoch() const {
+        return shared_epoch ? local_value_epoch + shared_epoch->value : local_value_epoch;
+    }
+
+    /**
+     * current epoch for the derivatives.
+     */
+    unsigned long derivEpoch() const {
+        return shared_epoch ? local_deriv_epoch + shared_epoch->value : local_deriv_epoch;
     }
 
     virtual ResultType value() {
-        if (cached_value) {
+        unsigned long epoch = valueEpoch();
+        if (value_epoch==epoch) {
             #ifdef CHECK_CACHE
             assert( val == argument->value() );
             #endif
             return val;
         } else {
             val          = argument->value();
-            cached_value = true;
+            value_epoch  = epoch;
             return val;
         }
     }
 
     virtual void invalidate_cache() {
         //std::cout << "invalidate cache of " << cached_name << std::endl;
-        cached_value = false;
-        fill_n(cached_deriv.begin(), deriv.size(), false);
+        ++local_value_epoch;
+        ++local_deriv_epoch;
     }
 
-    virtual void addToOptimizer(ExpressionOptimizer& opt) {
-        CachedExpression::addToOptimizer(opt);
-        argument->addToOptimizer(opt);
+    virtual bool attachEpoch(const CacheEpoch::Ptr& epoch) {
+        if (shared_epoch && (shared_epoch!=epoch) && (shared_epoch->owner!=epoch->owner)) {
+            return false;
+        }
+        if (shared_epoch && (shared_epoch!=epoch)) {
+            // the current epochs have to exceed all epochs stored with the old shared epoch:
+            local_value_epoch += shared_epoch->value + 1;
+            local_deriv_epoch += shared_epoch->value + 1;
+        }
+        shared_epoch = epoch;
+        return true;
+    }
+
+    virtual void addToOptimizer(ExpressionOptimizer& opt);
+
+    virtual void visitArguments(ArgumentVisitor& v) {
+        visitArgument(v, argument);
     }
 
     virtual void getDependencies(std::set<int>& varset) {
@@ -1329,15 +2069,19 @@ public:
 
     virtual DerivType derivative(int i) {
         assert(i>=0);
+        if (!argument->dependencies().contains(i)) {
+            return AutoDiffTrait<ResultType>::zeroDerivative();
+        }
         if (i < (int)deriv.size() ) {
-            if (cached_deriv[i]) {
+            unsigned long epoch = derivEpoch();
+            if (deriv_epoch[i]==epoch) {
                 #ifdef CHECK_CACHE
                 assert( deriv[i] == argument->derivative(i) );
                 #endif
                 return deriv[i];
             } else {
                 deriv[i] = argument->derivative(i);
-                cached_deriv[i] = true; 
+                deriv_epoch[i] = epoch;
                 return deriv[i];
             }
         } else {
@@ -1352,13 +2096,49 @@ public:
         }
     }
 
+    /**
+     * returns true if derivative i is zero or cached.
+     */
+    bool isCached(int i, unsigned long epoch) {
+        return (i<0) || (i>=(int)deriv.size()) || !argument->dependencies().contains(i) || (deriv_epoch[i]==epoch);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, DerivType* jac) {
+        unsigned long epoch = derivEpoch();
+        bool cached = true;
+        for (size_t k=0;k<ndx.size();++k) {
+            if (!isCached(ndx[k],epoch)) {
+                cached = false;
+                break;
+            }
+        }
+        if (!cached) {
+            argument->jacobian(ndx,jac);
+            for (size_t k=0;k<ndx.size();++k) {
+                if ((0<=ndx[k])&&(ndx[k]<(int)deriv.size())) {
+                    deriv[ndx[k]]       = jac[k];
+                    deriv_epoch[ndx[k]] = epoch;
+                }
+            }
+            return;
+        }
+        for (size_t k=0;k<ndx.size();++k) {
+            int i = ndx[k];
+            if ((0<=i) && (i<(int)deriv.size()) && argument->dependencies().contains(i)) {
+                jac[k] = deriv[i];
+            } else {
+                jac[k] = AutoDiffTrait<ResultType>::zeroDerivative();
+            }
+        }
+    }
+
     virtual typename Expression<DerivType>::Ptr derivativeExpression(int i) {
         // or should it be cached(...)
         if (this->name.size()==0) {
-            typename Expression<DerivType>::Ptr retval( new CachedType<DerivType>(argument->derivativeExpression(i),""));
+            typename Expression<DerivType>::Ptr retval = make_node< CachedType<DerivType> >(argument->derivativeExpression(i),"");
             return retval;
         } else {
-            typename Expression<DerivType>::Ptr retval( new CachedType<DerivType>(argument->derivativeExpression(i),std::string(this->name)+"(deriv)" ));
+            typename Expression<DerivType>::Ptr retval = make_node< CachedType<DerivType> >(argument->derivativeExpression(i),this->name.str()+"(deriv)" );
             return retval;
         }
     }
@@ -1367,6 +2147,10 @@ public:
         return argument->number_of_derivatives();
     }
 
+    virtual size_t cacheBytes() const {
+        return deriv.capacity()*sizeof(DerivType) + deriv_epoch.capacity()*sizeof(unsigned long);
+    }
+
     virtual typename Expression<Frame>::Ptr subExpression_Frame(const std::string& name) {
         if (cached_name == name) { 
             //std::cout << "matched"<< std::endl;
@@ -1427,29 +2211,27 @@ public:
 
 
     virtual typename Expression<ResultType>::Ptr clone() {
-        typename Expression<ResultType>::Ptr expr(
-            new CachedType<ResultType>( argument->clone(),this->cached_name)
-        );
+        typename Expression<ResultType>::Ptr expr = make_node< CachedType<ResultType> >( cloned(argument),this->cached_name.str());
         return expr;
     }
 
     virtual void setInputValues(const std::vector<double>& values) {
-        cached_value=false;
-        fill_n(cached_deriv.begin(), deriv.size(), false);
+        ++local_value_epoch;
+        ++local_deriv_epoch;
         argument->setInputValues(values);
     } 
 
     virtual void setInputValue(int variable_number, double val) {
-        cached_value=false;
+        ++local_value_epoch;
         if (variable_number < (int)deriv.size()) {
-            fill_n(cached_deriv.begin(), deriv.size(), false);
+            ++local_deriv_epoch;
         }
         argument->setInputValue(variable_number,val);
     } 
     virtual void setInputValue(int variable_number, const Rotation& val) {
-        cached_value=false;
+        ++local_value_epoch;
         if (variable_number < (int)deriv.size()) {
-            fill_n(cached_deriv.begin(), deriv.size(), false);
+            ++local_deriv_epoch;
         }
         argument->setInputValue(variable_number,val);
     }
@@ -1466,13 +2248,12 @@ public:
         os << ")";
     }
     virtual void write_dotfile_init() {
-        dot_already_written = false;
+        detail::dotfile_clear_written(this);
         argument->write_dotfile_init();
     }
 
     virtual void write_dotfile_update(std::ostream& of, pnumber& thisnode) {
-        if (!dot_already_written) {
-            dot_already_written=true;
+        if (detail::dotfile_mark_written(this)) {
             thisnode=(size_t)this;
             of << "S"<<thisnode<<"[label=\"cached("
                << cached_name
@@ -1502,22 +2283,30 @@ inline typename Expression<Frame>::Ptr CachedType<Frame>::subExpression_Frame(co
 
 /** utility function to create VariableType */
 template<typename ResultType>
-inline typename Expression<ResultType>::Ptr cached( typename Expression<ResultType>::Ptr argument ) {
-   typename Expression<ResultType>::Ptr cach(
-        new CachedType<ResultType>( argument,"" )
-   );
+inline typename Expression<ResultType>::Ptr cached( const typename Expression<ResultType>::Ptr& argument ) {
+   typename Expression<ResultType>::Ptr cach = make_node< CachedType<ResultType> >( argument,"" );
    return cach;
 }
 
 /** utility function to create VariableType */
 template<typename ResultType>
-inline typename Expression<ResultType>::Ptr cached( const std::string& name,typename Expression<ResultType>::Ptr argument ) {
-   typename Expression<ResultType>::Ptr cach(
-        new CachedType<ResultType>( argument,name )
-   );
+inline typename Expression<ResultType>::Ptr cached( const std::string& name,const typename Expression<ResultType>::Ptr& argument ) {
+   typename Expression<ResultType>::Ptr cach = make_node< CachedType<ResultType> >( argument,name );
    return cach;
 }
 
+/**
+ * computes the structural sparsity pattern of the Jacobian of a set of expressions.
+ * Row r corresponds to exprs[r], column c corresponds to variable number ndx[c].
+ * (r,c) is in the pattern if exprs[r] depends on variable ndx[c], the derivatives
+ * of exprs[r] towards all other variables are always zero.
+ * \param exprs [in] the expressions, one row of the Jacobian each.
+ * \param ndx [in] the variable numbers, one column of the Jacobian each.
+ * \param pattern [out] the (row,column) pairs of the structural non-zeros, sorted by row and column.
+ */
+void jacobian_sparsity(const std::vector<ExpressionBase::Ptr>& exprs, const VarIndexSet& ndx,
+                       std::vector< std::pair<int,int> >& pattern);
+
 /**
  * computing the numerical derivative for an expression tree
  * ( not using the derivative() function )
@@ -1528,7 +2317,7 @@ inline typename Expression<ResultType>::Ptr cached( const std::string& name,type
  */
 template<typename ResultType>
 typename AutoDiffTrait<ResultType>::DerivType
-inline numerical_derivative( typename Expression<ResultType>::Ptr expr, int towards_var, double value, double h=1E-7) {
+inline numerical_derivative( const typename Expression<ResultType>::Ptr& expr, int towards_var, double value, double h=1E-7) {
     ResultType a,b;
     double val;
     val = value - h;
@@ -1548,7 +2337,7 @@ inline numerical_derivative( typename Expression<ResultType>::Ptr expr, int towa
  * output to an ostream:
  */
 template<typename ResultType>
-inline std::ostream& display( std::ostream& os, typename Expression<ResultType>::Ptr expr ) {
+inline std::ostream& display( std::ostream& os, const typename Expression<ResultType>::Ptr& expr ) {
    os << "Value : ";
    os << expr->value() << "\n";
    for (int i=0;i<expr->number_of_derivatives();++i) {
@@ -1575,22 +2364,21 @@ public:
     virtual DerivType derivative(int i) {
         return AutoDiffTrait<R>::zeroDerivative();
     }
+    virtual void jacobian(const VarIndexSet& ndx, DerivType* jac) {
+        std::fill(jac, jac+ndx.size(), AutoDiffTrait<R>::zeroDerivative());
+    }
     virtual typename Expression<DerivType>::Ptr derivativeExpression(int i) {
         return Constant(  AutoDiffTrait<R>::zeroDerivative());
     }
     virtual typename Expression<R>::Ptr clone() {
-        typename Expression<R>::Ptr expr(
-            new MakeConstantType( this->argument->clone() )
-        );
+        typename Expression<R>::Ptr expr = make_node<MakeConstantType>( cloned(this->argument) );
         return expr;
     }
 };
 
 template<typename R>
 inline typename Expression<R>::Ptr make_constant( const typename Expression<R>::Ptr& arg ) {
-   typename Expression<R>::Ptr cnst(
-        new MakeConstantType<R>( arg )
-   );
+   typename Expression<R>::Ptr cnst = make_node< MakeConstantType<R> >( arg );
    return cnst;
 }
 
@@ -1612,10 +2400,10 @@ class InitialValueType: public BinaryExpression<T,double,T> {
 
         InitialValueType() {}
 
-        InitialValueType(Expression<double>::Ptr time_var, typename Expression<T>::Ptr arg):
+        InitialValueType(const Expression<double>::Ptr& time_var, const typename Expression<T>::Ptr& arg):
             BinExpr("initial_value", time_var, arg) {}
 
-        InitialValueType(Expression<double>::Ptr time_var, typename Expression<T>::Ptr arg, const T& _initial_value):
+        InitialValueType(const Expression<double>::Ptr& time_var, const typename Expression<T>::Ptr& arg, const T& _initial_value):
             BinExpr("initial_value", time_var, arg), initial_value(_initial_value) {}
 
         virtual T value() {
@@ -1629,22 +2417,25 @@ class InitialValueType: public BinaryExpression<T,double,T> {
         virtual DerivType derivative(int i) {
             return AutoDiffTrait<T>::zeroDerivative();
         }
+        virtual void jacobian(const VarIndexSet& ndx, DerivType* jac) {
+            std::fill(jac, jac+ndx.size(), AutoDiffTrait<T>::zeroDerivative());
+        }
         virtual typename Expression<DerivType>::Ptr derivativeExpression(int i) {
             return Constant(  AutoDiffTrait<T>::zeroDerivative());
         }
         virtual typename Expression<T>::Ptr clone() {
-            typename Expression<T>::Ptr expr(
-                new InitialValueType(this->argument1->clone(), this->argument2->clone(), initial_value)
-            );
+            typename Expression<T>::Ptr expr = make_node<InitialValueType>(cloned(this->argument1), cloned(this->argument2), initial_value);
             return expr;
         }
+
+        virtual bool getStructuralKey(StructuralKey& key) {
+            return false;   // has an internal state
+        }
 };
 
 template<typename R>
-inline typename Expression<R>::Ptr initial_value( const typename Expression<double>::Ptr time, const typename Expression<R>::Ptr& arg ) {
-   typename Expression<R>::Ptr e(
-        new InitialValueType<R>( time,arg )
-   );
+inline typename Expression<R>::Ptr initial_value( const typename Expression<double>::Ptr& time, const typename Expression<R>::Ptr& arg ) {
+   typename Expression<R>::Ptr e = make_node< InitialValueType<R> >( time,arg );
    return e;
 }
 
@@ -1684,8 +2475,19 @@ inline typename Expression<R>::Ptr initial_value( const typename Expression<doub
  * The ExpressionOptimizer works as follows:
  *  - all Input objects that are relevant inside the expressions are registered.
  *  - all relevant Cached objects are also registered.
- *  - during setInputValue, all registered input values are set to the appropriate value
- *    and all registered Cached objects are invalidated.
+ *  - during setInputValue, the registered input objects of the variables whose value changed since the previous
+ *    call are set to their new value, and only the Cached objects that depend on one of these variables are invalidated.
+ *    Cached objects are grouped by the set of prepared variables they depend on.  The CachedType objects of a group are
+ *    attached to one CacheEpoch, and are all invalidated by one increment of this epoch.  Other cached
+ *    objects (e.g. MIMO) are invalidated one by one.
+ *  - nodes with a state that is not determined by the input variables (VariableType, MIMO) call addVolatile()
+ *    during addToOptimizer(..).  The Cached objects above such a node, and the MIMO objects themselves, are put
+ *    in a separate group that is invalidated by every setInputValues(..) and update().
+ *
+ *  - alternatively, bind(..) lets the input objects read their value directly from a buffer of the caller, and
+ *    update() invalidates the caches that depend on the values that changed in this buffer.
+ *
+ * @warning: since unchanged values are skipped, the input values should only be set through the optimizer.
  */
 class ExpressionOptimizer {
     typedef std::list<InputType*>  ListInput;
@@ -1705,9 +2507,36 @@ class ExpressionOptimizer {
     InputSet                              inputset;        ///< std::set that contains all involved variable numbers (for scalar + Rotation)
 
     std::set<CachedExpression*>             cached;        ///< set of cached of objects that will have to be invalidated
-    std::vector<CachedExpression*>          v_cached;      ///< list of cached of objects that will have to be invalidated
+
+    /**
+     * cached objects that depend on the same prepared variables.
+     */
+    struct CacheGroup {
+        std::vector<int>                    positions;     ///< positions of the variables in inputvarnr (followed by rotinputvarnr)
+        CacheEpoch::Ptr                     epoch;         ///< invalidates the cached objects that are attached to it
+        std::vector<CachedExpression*>      v_cached;      ///< objects that are invalidated by invalidate_cache()
+        unsigned long                       last_update;   ///< update in which the group was last invalidated
+    };
+    std::vector<CacheGroup>                 groups;
+    CacheGroup                              always_group;  ///< cached objects that are invalidated by every call
+    unsigned long                           volatile_nodes;///< number of calls to addVolatile()
+    std::map<std::vector<int>, int>         group_index;   ///< group with the given positions
+    std::vector<std::vector<int> >          position_groups; ///< for each position, the groups that depend on it
+    unsigned long                           updates;       ///< number of calls to invalidateChanged()
+    std::vector<double>                     last_values;   ///< values of the previous setInputValues(..)
+    std::vector<Rotation>                   last_rotvalues;
+    std::vector<char>                       changed;       ///< for each position, value changed since the previous call
+    bool                                    initialized;   ///< setInputValues(..) was called since prepare(..)
+    const double*                           bound_values;  ///< buffer read by the inputs, see bind(..)
+    const Rotation*                         bound_rotvalues;
+
+    void setInputValue(size_t i, double value);
+    void setInputValue(size_t i, const Rotation& value);
+    void invalidateChanged();
 
 public:
+        ExpressionOptimizer();
+
         /**
          * configure the optimizer for input of these variable numbers.
          * @param inputvarnr a list of (integer) variable numbers (corresponding to scalar variables)
@@ -1733,8 +2562,28 @@ public:
          */
         void addInput(InputRotationType* obj);
 
-        /// registers a Cached object
-        void addCached( CachedExpression* obj); 
+        /**
+         * registers a Cached object
+         * \param always if true, the object is invalidated by every setInputValues(..) and update(), 
+         *               otherwise only when one of the variables it depends on changed.
+         */
+        void addCached( CachedExpression* obj, bool always=false); 
+
+        /**
+         * called by a node whose value can change without a change of its input variables,
+         * e.g. by VariableType::setValue(..) or by a callback.
+         */
+        void addVolatile() {
+            ++volatile_nodes;
+        }
+
+        /**
+         * number of calls to addVolatile() up to now. A node that registers itself after its arguments
+         * compares this number before and after registering the arguments.
+         */
+        unsigned long volatileNodes() const {
+            return volatile_nodes;
+        }
 
         /**
          * set the input values for all of the involved expressions, the values given correspond to the
@@ -1758,6 +2607,41 @@ public:
          * inputvarnr and rotinputvarnr given with the prepare method.
          */
         void setInputValues(const Eigen::VectorXd& values, const std::vector<Rotation>& rotvalues);
+
+        /**
+         * binds the registered input objects to a buffer owned by the caller: the input objects of inputvarnr[i]
+         * read their value directly from values[i], and those of rotinputvarnr[i] from rotvalues[i].
+         * After writing new values into the buffer, call update() instead of setInputValues(..).
+         * Input objects that are registered later are also bound.
+         * \param values   array of inputvarnr.size() values.
+         * \param rotvalues array of rotinputvarnr.size() rotations (can be null if there are no Rotation variables).
+         * \warning the buffer has to outlive the binding (see unbind()), and should not be reallocated.
+         *          setInputValue(s)(..) on the bound input objects has no effect.
+         */
+        void bind(const double* values, const Rotation* rotvalues=0);
+
+        void bind(const Eigen::VectorXd& values, const Rotation* rotvalues=0) {
+            assert( values.size() == (int)inputvarnr.size() );
+            bind(values.data(), rotvalues);
+        }
+
+        /**
+         * the input objects read their value again from their own value, see bind(..).
+         */
+        void unbind();
+
+        /**
+         * invalidates the cached objects that depend on values of the bound buffer that changed
+         * since the previous update().  Does not copy any input value.
+         * \pre the optimizer is bound to a buffer, see bind(..).
+         */
+        void update();
+
+        /**
+         * unbinds the input objects, such that they do not keep reading from the buffer.
+         * \warning when the optimizer is bound, the registered input objects have to outlive it.
+         */
+        ~ExpressionOptimizer();
 };
 
 inline void InputType::addToOptimizer(ExpressionOptimizer& opt) {
@@ -1774,14 +2658,23 @@ inline void CachedExpression::addToOptimizer(ExpressionOptimizer& opt) {
     opt.addCached(this);
 }
 
+template <typename T>
+inline void CachedType<T>::addToOptimizer(ExpressionOptimizer& opt) {
+    // the arguments first, to know whether the cache lies above a volatile node:
+    unsigned long n = opt.volatileNodes();
+    argument->addToOptimizer(opt);
+    opt.addCached(this, opt.volatileNodes()!=n);
+}
+
 template<typename T>
-inline typename Expression<T>::Ptr checkConstant( typename Expression<T>::Ptr a ) {
+inline typename Expression<T>::Ptr checkConstant( const typename Expression<T>::Ptr& a ) {
         if (!a) {
             throw std::out_of_range("checkConstant: null pointer is given as an argument");
         }
-        std::set<int> vset;
-        a->getDependencies(vset);
-        if (vset.empty()) {
+        if (a->dependencies().empty()) {
+            if (dynamic_cast<ConstantType<T>*>(a.get())!=0) {
+                return a;   // no need to copy, constants can be shared
+            }
             return Constant( a->value() );
         } else {
             return a;
@@ -1789,32 +2682,26 @@ inline typename Expression<T>::Ptr checkConstant( typename Expression<T>::Ptr a
 }
 
 template<typename T>
-inline bool isConstant( typename Expression<T>::Ptr a) {
+inline bool isConstant( const typename Expression<T>::Ptr& a) {
     if (!a) {
         throw std::out_of_range("null pointer is given as an argument");
     }
-    std::set<int> vset;
-    a->getDependencies(vset);
-    return vset.empty();
+    return a->dependencies().empty();
 }
 
-inline bool isConstantZero( Expression<double>::Ptr a) {
+inline bool isConstantZero( const Expression<double>::Ptr& a) {
     if (!a) {
         throw std::out_of_range("null pointer is given as an argument");
     }
-    std::set<int> vset;
-    a->getDependencies(vset);
-    return vset.empty() && (a->value()==0);
+    return a->dependencies().empty() && (a->value()==0);
 }
 
-inline bool isConstantOne( Expression<double>::Ptr a) {
+inline bool isConstantOne( const Expression<double>::Ptr& a) {
     if (!a) {
         throw std::out_of_range("null pointer is given as an argument");
     }
-    std::set<int> vset;
-    a->getDependencies(vset);
     double eps = 1E-16;
-    return vset.empty() && (1-eps <= a->value()) && (a->value() <= 1+eps);
+    return a->dependencies().empty() && (1-eps <= a->value()) && (a->value() <= 1+eps);
 }
 
 
@@ -63,8 +63,8 @@ class ChangeCoordinateFrame_FrameRotation:
 {
 public:
 
-    ChangeCoordinateFrame_FrameRotation(  Expression<Frame>::Ptr a1, 
-                           Expression<Rotation>::Ptr a2):
+    ChangeCoordinateFrame_FrameRotation(  const Expression<Frame>::Ptr& a1, 
+                           const Expression<Rotation>::Ptr& a2):
         BinaryExpression<Frame,Rotation,Vector>("change coordinate frame",a1,a2) {}
 
     virtual Frame value() {
@@ -75,27 +75,23 @@ public:
     virtual Twist derivative(int i) {
         xxx
         return Twist(
-            argument2->derivative(i),
-            argument1->derivative(i)
+            argument2_derivative(i),
+            argument1_derivative(i)
         );
     } 
 
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual typename Expression<Frame>::Ptr clone() {
-        typename Expression<Frame>::Ptr expr(
-            new ChangeCoordinateFrame_FrameRotation(argument1->clone(), argument2->clone())
-        );
+        typename Expression<Frame>::Ptr expr = make_node<ChangeCoordinateFrame_FrameRotation>(cloned(argument1), cloned(argument2));
         return expr;
     } 
 };
 
-inline Expression<Frame>::Ptr change_coordinate_frame( Expression<Frame>::Ptr a1, 
-                                Expression<Rotation>::Ptr a2) {
-    Expression<Frame>::Ptr expr(
-        new ChangeCoordinateFrame_FrameRotation( a1, a2 )
-    );
-    return expr;
+inline Expression<Frame>::Ptr change_coordinate_frame( const Expression<Frame>::Ptr& a1, 
+                                const Expression<Rotation>::Ptr& a2) {
+    Expression<Frame>::Ptr expr = make_node<ChangeCoordinateFrame_FrameRotation>( a1, a2 );
+    return interned(expr);
 }
 */
 class Frame_RotationVector:
@@ -104,8 +100,8 @@ class Frame_RotationVector:
 public:
 
     Frame_RotationVector(){}
-    Frame_RotationVector(  Expression<Rotation>::Ptr a1, 
-                           Expression<Vector>::Ptr a2):
+    Frame_RotationVector(  const Expression<Rotation>::Ptr& a1, 
+                           const Expression<Vector>::Ptr& a2):
         BinaryExpression<Frame,Rotation,Vector>("frame",a1,a2) {}
 
     virtual Frame value() {
@@ -114,41 +110,40 @@ public:
 
     virtual Twist derivative(int i) {
         return Twist(
-            argument2->derivative(i),
-            argument1->derivative(i)
+            argument2_derivative(i),
+            argument1_derivative(i)
         );
     } 
 
+    virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = Twist(argjac2[k],argjac1[k]);
+        }
+    }
+
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual Expression<Frame>::Ptr clone() {
-         Expression<Frame>::Ptr expr(
-            new Frame_RotationVector(argument1->clone(), argument2->clone())
-        );
+         Expression<Frame>::Ptr expr = make_node<Frame_RotationVector>(cloned(argument1), cloned(argument2));
         return expr;
     } 
 };
 
-inline Expression<Frame>::Ptr frame( Expression<Rotation>::Ptr a1, 
-                                Expression<Vector>::Ptr a2) {
-    Expression<Frame>::Ptr expr(
-        new Frame_RotationVector( a1, a2 )
-    );
-    return expr;
+inline Expression<Frame>::Ptr frame( const Expression<Rotation>::Ptr& a1, 
+                                const Expression<Vector>::Ptr& a2) {
+    Expression<Frame>::Ptr expr = make_node<Frame_RotationVector>( a1, a2 );
+    return interned(expr);
 }
 
-inline Expression<Frame>::Ptr frame( Expression<Rotation>::Ptr a1 ) {
-    Expression<Frame>::Ptr expr(
-        new Frame_RotationVector( a1, Constant(Vector::Zero() ))
-    );
-    return expr;
+inline Expression<Frame>::Ptr frame( const Expression<Rotation>::Ptr& a1 ) {
+    Expression<Frame>::Ptr expr = make_node<Frame_RotationVector>( a1, Constant(Vector::Zero() ));
+    return interned(expr);
 }
 
-inline Expression<Frame>::Ptr frame(  Expression<Vector>::Ptr a2) {
-    Expression<Frame>::Ptr expr(
-        new Frame_RotationVector( Constant(Rotation::Identity()), a2 )
-    );
-    return expr;
+inline Expression<Frame>::Ptr frame(  const Expression<Vector>::Ptr& a2) {
+    Expression<Frame>::Ptr expr = make_node<Frame_RotationVector>( Constant(Rotation::Identity()), a2 );
+    return interned(expr);
 }
 
 
@@ -172,25 +167,29 @@ public:
     }
 
     virtual KDL::Twist derivative(int i) {
-    	KDL::Twist da = argument->derivative(i);
+    	KDL::Twist da = argument_derivative(i);
         return KDL::Twist(val.M.Inverse(da.rot*val.p-da.vel), -val.M.Inverse(da.rot));
     }
 
+    virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            const KDL::Twist& da = argjac[k];
+            jac[k] = KDL::Twist(val.M.Inverse(da.rot*val.p-da.vel), -val.M.Inverse(da.rot));
+        }
+    }
+
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<KDL::Frame>::Ptr expr(
-            new Inverse_Frame( argument->clone())
-        );
+        Expression<KDL::Frame>::Ptr expr = make_node<Inverse_Frame>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Frame>::Ptr inv ( Expression<KDL::Frame>::Ptr a) {
-    Expression<KDL::Frame>::Ptr expr(
-        new Inverse_Frame(a)
-    );
-    return expr;
+inline Expression<KDL::Frame>::Ptr inv ( const Expression<KDL::Frame>::Ptr& a) {
+    Expression<KDL::Frame>::Ptr expr = make_node<Inverse_Frame>(a);
+    return interned(expr);
 }
 
 //Composition Frame Frame
@@ -216,27 +215,38 @@ public:
 	}
 
 	virtual KDL::Twist derivative(int i){
-		KDL::Twist da = argument1->derivative(i);
-		KDL::Twist db = argument2->derivative(i);
+		KDL::Twist da = argument1_derivative(i);
+		KDL::Twist db = argument2_derivative(i);
 		return KDL::Twist(
 					da.rot*(arg1value.M*arg2value.p)+arg1value.M * db.vel + da.vel,
 					da.rot + arg1value.M * db.rot
 		);
 	}
 
+	virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+		argument_jacobian(ndx);
+		KDL::Vector p = arg1value.M*arg2value.p;
+		for (size_t k=0;k<ndx.size();++k) {
+			const KDL::Twist& da = argjac1[k];
+			const KDL::Twist& db = argjac2[k];
+			jac[k] = KDL::Twist(
+						da.rot*p + arg1value.M * db.vel + da.vel,
+						da.rot + arg1value.M * db.rot
+			);
+		}
+	}
+
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<KDL::Frame>::Ptr expr(
-            new Composition_FrameFrame( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Frame>::Ptr expr = make_node<Composition_FrameFrame>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Frame>::Ptr operator* ( Expression<KDL::Frame>::Ptr a1, Expression<KDL::Frame>::Ptr a2 ) {
-	Expression<KDL::Frame>::Ptr expr(new Composition_FrameFrame( a1, a2 ));
-	return expr;
+inline Expression<KDL::Frame>::Ptr operator* ( const Expression<KDL::Frame>::Ptr& a1, const Expression<KDL::Frame>::Ptr& a2 ) {
+	Expression<KDL::Frame>::Ptr expr = make_node<Composition_FrameFrame>( a1, a2 );
+	return interned(expr);
 }
 
 //Composition Frame Vector
@@ -262,22 +272,28 @@ public:
 	}
 
 	virtual KDL::Vector derivative(int i){
-		KDL::Twist da = argument1->derivative(i);
-		return da.rot*(arg1value.M*arg2value)+arg1value.M*argument2->derivative(i)+da.vel;
+		KDL::Twist da = argument1_derivative(i);
+		return da.rot*(arg1value.M*arg2value)+arg1value.M*argument2_derivative(i)+da.vel;
+	}
+
+	virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+		argument_jacobian(ndx);
+		KDL::Vector p = arg1value.M*arg2value;
+		for (size_t k=0;k<ndx.size();++k) {
+			jac[k] = argjac1[k].rot*p + arg1value.M*argjac2[k] + argjac1[k].vel;
+		}
 	}
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
     virtual  BinExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Composition_FrameVector( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Composition_FrameVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr operator* ( Expression<KDL::Frame>::Ptr a1, Expression<KDL::Vector>::Ptr a2 ) {
-	Expression<KDL::Vector>::Ptr expr(new Composition_FrameVector( a1, a2 ));
-	return expr;
+inline Expression<KDL::Vector>::Ptr operator* ( const Expression<KDL::Frame>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2 ) {
+	Expression<KDL::Vector>::Ptr expr = make_node<Composition_FrameVector>( a1, a2 );
+	return interned(expr);
 }
 
 //Origin Frame
@@ -297,24 +313,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-    	return argument->derivative(i).vel;
+    	return argument_derivative(i).vel;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k].vel;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Origin_Frame( argument->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Origin_Frame>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr origin ( Expression<KDL::Frame>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Origin_Frame( a )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr origin ( const Expression<KDL::Frame>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Origin_Frame>( a );
+    return interned(expr);
 }
 
 //Rotation Frame
@@ -334,24 +353,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-    	return argument->derivative(i).rot;
+    	return argument_derivative(i).rot;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k].rot;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<KDL::Rotation>::Ptr expr(
-            new Rotation_Frame( argument->clone())
-        );
+        Expression<KDL::Rotation>::Ptr expr = make_node<Rotation_Frame>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Rotation>::Ptr rotation( Expression<KDL::Frame>::Ptr a) {
-    Expression<KDL::Rotation>::Ptr expr(
-        new Rotation_Frame(a)
-    );
-    return expr;
+inline Expression<KDL::Rotation>::Ptr rotation( const Expression<KDL::Frame>::Ptr& a) {
+    Expression<KDL::Rotation>::Ptr expr = make_node<Rotation_Frame>(a);
+    return interned(expr);
 }
 
 }; // namespace KDL
@@ -0,0 +1,211 @@
+/**
+ * @file expressiontree_graph.hpp
+ * @brief passes that analyse and rewrite complete expression graphs.
+*
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#ifndef KDL_EXPRESSIONTREE_GRAPH_HPP
+#define KDL_EXPRESSIONTREE_GRAPH_HPP
+
+#include <kdl/expressiontree_expressions.hpp>
+#include <kdl/expressiontree_pool.hpp>
+#include <vector>
+#include <map>
+#include <string>
+
+namespace KDL {
+
+/**
+ * result of auto_cache(..).
+ *
+ * The number of evaluations is the number of times the value() of a node (other than a
+ * cache) is computed when value() is called once on each of the roots.  derivative(i) is
+ * called along the same paths, for each variable i the node depends on.
+ */
+struct AutoCacheReport {
+    size_t nodes;              ///< number of distinct nodes in the graph (before the pass)
+    size_t shared_nodes;       ///< nodes with more than one parent
+    size_t expensive_nodes;    ///< kinematic chains and MIMO outputs
+    size_t inserted;           ///< number of CachedType nodes inserted
+    double evaluations_before; ///< number of evaluations before the pass
+    double evaluations_after;  ///< number of evaluations after the pass
+
+    AutoCacheReport():
+        nodes(0), shared_nodes(0), expensive_nodes(0), inserted(0),
+        evaluations_before(0), evaluations_after(0) {}
+
+    /**
+     * number of evaluations that are avoided by the inserted caches.
+     */
+    double redundantEvaluationsRemoved() const {
+        return evaluations_before - evaluations_after;
+    }
+};
+
+std::ostream& operator << (std::ostream& os, const AutoCacheReport& r);
+
+/**
+ * Inserts CachedType nodes in the expression graph spanned by roots, such that shared
+ * subexpressions are computed only once.
+ *
+ * A node is cached when it has more than one parent (and is not a leaf such as an input or a constant),
+ * or when it is expensive to compute (kinematic_chain, MIMO outputs).  When a node already has a
+ * CachedType parent, that cache is reused for its other parents.  The roots themselves are
+ * never replaced, and the arguments of MIMO's are not visited.
+ *
+ * \warning The graph is modified in place: all expressions that share nodes with roots see the
+ *          inserted caches.
+ * \warning The inserted caches are only invalidated by setInputValue(s); when an ExpressionOptimizer
+ *          is used, call addToOptimizer(..) after auto_cache(..).
+ */
+AutoCacheReport auto_cache(const std::vector<ExpressionBase::Ptr>& roots);
+
+AutoCacheReport auto_cache(const ExpressionBase::Ptr& root);
+
+/**
+ * result of memory_report(..): the memory used by the nodes of an expression graph.
+ */
+struct MemoryReport {
+    struct TypeUsage {
+        size_t nodes;   ///< number of nodes of this type
+        size_t bytes;   ///< memory of these nodes (0 if the size of the type is unknown)
+        TypeUsage():
+            nodes(0), bytes(0) {}
+    };
+
+    size_t nodes;            ///< number of distinct nodes in the graph
+    size_t node_bytes;       ///< memory of the node objects
+    size_t cache_bytes;      ///< heap memory allocated by the nodes to cache results (see ExpressionBase::cacheBytes())
+    size_t metadata_bytes;   ///< memory of the names and dependency sets, both inside the nodes (also counted
+                             ///< in node_bytes) and on the heap.  A name is counted once, since the nodes share it.
+    size_t unknown_nodes;    ///< nodes of a type that was never created by make_node(..), not counted in node_bytes
+    std::map<std::string, TypeUsage> types;  ///< memory per node type
+
+    MemoryReport():
+        nodes(0), node_bytes(0), cache_bytes(0), metadata_bytes(0), unknown_nodes(0) {}
+};
+
+std::ostream& operator << (std::ostream& os, const MemoryReport& r);
+
+/**
+ * reports the memory used by the expression graph spanned by roots.  Shared nodes are counted once.
+ * The size of a node is found from its type, as recorded by make_node(..) (see node_size(..)).
+ */
+MemoryReport memory_report(const std::vector<ExpressionBase::Ptr>& roots);
+
+MemoryReport memory_report(const ExpressionBase::Ptr& root);
+
+/**
+ * estimated cost of evaluating the value of a node, used by ParallelEvaluator.
+ * Inputs, constants and caches have no cost.
+ */
+struct ParallelCostModel {
+    double node;       ///< an ordinary operation
+    double chain;      ///< a kinematic_chain expression
+    double mimo;       ///< a MIMO block (counted once for all its outputs)
+    double callback;   ///< another node without arguments that caches its value (e.g. a callback node)
+
+    ParallelCostModel():
+        node(1), chain(50), mimo(50), callback(100) {}
+};
+
+/**
+ * Evaluates independent heavy subgraphs of an expression graph concurrently.
+ *
+ * At construction, the graph spanned by roots (including the inputs of MIMO blocks) is analysed.
+ * A subgraph, spanned by one of its nodes, is independent when all the nodes in it (except
+ * inputs, constants and other nodes without arguments and without state) are only referenced from
+ * within that subgraph.  The value of two independent subgraphs can then be computed by two
+ * threads, since they do not share any mutable state.  Starting from the roots, a heavy subgraph
+ * (with an estimated cost of at least threshold) is split into the largest heavy independent subgraphs
+ * it contains, as long as there are at least two of them.  The roots themselves are always split.
+ * The resulting subgraphs are the tasks, their top node is cached (a CachedType is inserted when it
+ * does not cache its value by itself).
+ *
+ * Each cycle, after setting the input values, evaluate() computes the tasks on the TaskPool, in order
+ * of decreasing cost.  The value() and derivative(i) calls on the roots that follow, are computed
+ * serially, and find the results of the tasks in their caches.  When there are less than two tasks,
+ * evaluate() does nothing, such that small graphs never pay for the synchronisation.
+ *
+ * \warning The graph is modified in place (as by auto_cache(..)), and should not be referenced by
+ *          other expressions than roots.  As for auto_cache(..), call addToOptimizer(..) afterwards
+ *          when an ExpressionOptimizer is used.
+ * \warning evaluate() and the serial evaluation of the roots should not run concurrently.
+ */
+class ParallelEvaluator {
+public:
+    typedef boost::shared_ptr<ParallelEvaluator> Ptr;
+
+    /**
+     * \param roots     expressions that are evaluated after evaluate().
+     * \param pool      workers that execute the tasks.
+     * \param threshold minimal estimated cost of a task.
+     * \param cost      cost of the different types of nodes.
+     */
+    ParallelEvaluator(const std::vector<ExpressionBase::Ptr>& roots, const TaskPool::Ptr& pool,
+                      double threshold=100, const ParallelCostModel& cost=ParallelCostModel());
+
+    /**
+     * computes the value of the tasks concurrently.
+     */
+    void evaluate();
+
+    int numberOfTasks() const {
+        return (int)tasks.size();
+    }
+
+    /**
+     * estimated cost of the complete graph.
+     */
+    double totalCost() const {
+        return total_cost;
+    }
+
+    /**
+     * estimated cost of task k, tasks are sorted by decreasing cost.
+     */
+    double taskCost(int k) const {
+        return task_cost[k];
+    }
+
+    /**
+     * top node of task k (a node that caches its value).
+     */
+    ExpressionBase::Ptr task(int k) const;
+
+    virtual ~ParallelEvaluator() {}
+
+    /**
+     * internal: evaluates the value of the top node of a task.
+     */
+    class Evaluation {
+    public:
+        typedef boost::shared_ptr<Evaluation> Ptr;
+        virtual void run() = 0;
+        virtual ExpressionBase::Ptr expression() const = 0;
+        virtual ~Evaluation() {}
+    };
+private:
+    TaskPool::Ptr                   pool;
+    std::vector<Evaluation::Ptr>    tasks;
+    std::vector<double>             task_cost;
+    double                          total_cost;
+};
+
+} // namespace KDL
+#endif
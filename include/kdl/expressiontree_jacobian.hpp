@@ -0,0 +1,246 @@
+/**
+ * @file expressiontree_jacobian.hpp
+ * @brief assembly of the (sparse) Jacobian of a set of constraint expressions.
+*
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#ifndef KDL_EXPRESSIONTREE_JACOBIAN_HPP
+#define KDL_EXPRESSIONTREE_JACOBIAN_HPP
+
+#include <kdl/expressiontree_expressions.hpp>
+#include <kdl/expressiontree_compiled.hpp>
+#include <kdl/expressiontree_pool.hpp>
+#include <Eigen/Sparse>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace KDL {
+
+/**
+ * Row-major (CSR) sparse matrix, as filled in by JacobianAssembler.
+ */
+typedef Eigen::SparseMatrix<double,Eigen::RowMajor> SparseJacobian;
+
+/**
+ * Assembles the Jacobian of a set of constraint expressions towards a list of variables.
+ *
+ * Each constraint corresponds to one or more rows of the Jacobian:
+ *  - Expression<double>   : 1 row
+ *  - Expression<Vector>   : 3 rows
+ *  - Expression<Rotation> : 3 rows (rotational velocity)
+ *  - Expression<Frame>    : 6 rows (translational velocity followed by rotational velocity)
+ * Column c corresponds to variable number ndx[c].
+ *
+ * The sparsity pattern follows from the dependencies of the constraints and is determined
+ * once, when a constraint is added.  Every call to jacobian(..) computes the derivatives of
+ * each constraint only towards the variables it depends on and writes the non-zeros in place,
+ * without memory allocation.
+ *
+ * Usage:
+ *   - add(..) all constraints
+ *   - optionally compress()
+ *   - initialize(J) once, to size J and to set its sparsity pattern
+ *   - each cycle: setInputValues(..), evaluate() and jacobian(J)
+ *
+ * When the assembler is not compressed, the input values can also be set directly on the constraints,
+ * and evaluate() can be replaced by calling value() on each of the constraints.
+ *
+ * compress() compiles all constraints to one ExpressionTape and colours the columns of the
+ * Jacobian such that no two columns of the same colour have a non-zero in the same row
+ * (Curtis-Powell-Reid compression).  One seeded forward pass over the tape then computes the
+ * derivatives towards all variables of a colour, ExpressionTape::lanes colours at once.  When each
+ * constraint depends on only a few of many variables, the number of colours is much smaller
+ * than the number of variables.
+ *
+ * A compressed assembler can compute the seeded forward passes in parallel, see setTaskPool(..).
+ *
+ * \warning as for derivative(i), evaluate() should be called before jacobian(J).
+ * \warning ndx should not contain duplicate variable numbers.
+ */
+class JacobianAssembler {
+public:
+    typedef boost::shared_ptr<JacobianAssembler> Ptr;
+
+    /**
+     * internal: a constraint and the columns it depends on.
+     */
+    class Block {
+    public:
+        int         row;      ///< first row of the block in the Jacobian
+        int         nrows;    ///< number of rows of the block
+        int         offset;   ///< index of the first non-zero of the block in the row-major order.
+        VarIndexSet vars;     ///< variable numbers the constraint depends on
+        std::vector<int> cols;///< columns corresponding to vars
+        ExpressionBase::Ptr expression;
+        /**
+         * evaluates the value of the constraint.
+         */
+        virtual void evaluate() = 0;
+        /**
+         * computes the derivatives of the constraint towards vars.
+         */
+        virtual void compute() = 0;
+        /**
+         * writes the derivatives in the rows of the block and in the columns cols.
+         */
+        virtual void write(Eigen::MatrixXd& J) const = 0;
+        /**
+         * writes the derivatives row by row to nz (nrows*vars.size() numbers).
+         */
+        virtual void write(double* nz) const = 0;
+        virtual ~Block() {}
+    };
+
+    /**
+     * \param ndx variable numbers corresponding to the columns of the Jacobian.
+     */
+    explicit JacobianAssembler(const VarIndexSet& ndx);
+
+    /**
+     * adds a constraint, returns the index of its first row.
+     * Adding a constraint undoes compress().
+     */
+    int add(const Expression<double>::Ptr& e);
+    int add(const Expression<Vector>::Ptr& e);
+    int add(const Expression<Rotation>::Ptr& e);
+    int add(const Expression<Frame>::Ptr& e);
+
+    int rows() const {
+        return nrows;
+    }
+
+    int cols() const {
+        return (int)ndx.size();
+    }
+
+    /**
+     * number of structural non-zeros of the Jacobian.
+     */
+    int nonZeros() const {
+        return nnz;
+    }
+
+    /**
+     * returns the (row,column) pairs of the structural non-zeros, in row-major order.
+     */
+    void sparsity(std::vector< std::pair<int,int> >& pattern) const;
+
+    /**
+     * compiles all constraints to one ExpressionTape and colours the columns of the Jacobian,
+     * further computations use seeded forward passes over the tape.
+     * After compress(), the input values have to be set using the setInputValue(s) methods of
+     * the assembler, since the tape keeps its own copy of the input values.
+     */
+    void compress();
+
+    bool isCompressed() const {
+        return tape.get()!=0;
+    }
+
+    /**
+     * number of colours (seeded forward passes) of the compressed Jacobian.
+     */
+    int numberOfColours() const {
+        return (int)groups.size();
+    }
+
+    /**
+     * distributes the seeded forward passes of a compressed assembler over the workers of pool.
+     *
+     * Each task computes ExpressionTape::lanes colours, in its own EvalContext: worker 0 (the calling
+     * thread) uses the default context of the tape, the other workers use contexts created by the
+     * assembler, that receive a copy of the values computed by evaluate().  The derivatives in the
+     * graph (e.g. CachedType) are not used.  The tasks and the arithmetic for each column do not depend on
+     * the number of workers, such that the result is bit-identical to a computation without pool.
+     *
+     * Only used when the assembler is compressed, the contexts are (re)created by compress().
+     * A null pointer switches back to sequential computation.
+     * \warning when the tape contains opaque nodes, their clones in the other contexts only see the
+     *          setInputValue(s) calls made after setTaskPool(..) and compress().
+     */
+    void setTaskPool(const TaskPool::Ptr& pool);
+
+    /**
+     * the tape of a compressed assembler. Output k of the tape corresponds to the k-th constraint,
+     * its value can be obtained using e.g. CompiledExpression<Vector>(getTape(),k).
+     */
+    ExpressionTape::Ptr getTape() {
+        return tape;
+    }
+
+    /**
+     * sets input values of all constraints (or of the tape, when compressed).
+     */
+    void setInputValue(int variable_number, double val);
+    void setInputValue(int variable_number, const Rotation& val);
+    void setInputValues(const std::vector<double>& values);
+    void setInputValues(const std::vector<int>& ndx, const std::vector<double>& values);
+
+    /**
+     * evaluates the value of all constraints (or of the tape, when compressed).
+     */
+    void evaluate();
+
+    /**
+     * sizes J and sets all its elements to zero.
+     */
+    void initialize(Eigen::MatrixXd& J) const;
+
+    /**
+     * sizes J and sets its sparsity pattern, all non-zeros are set to zero.
+     */
+    void initialize(SparseJacobian& J) const;
+
+    /**
+     * computes the derivatives of all constraints and writes the structural non-zeros into J.
+     * \warning J should be initialized by initialize(J), the other elements of J are not touched.
+     */
+    void jacobian(Eigen::MatrixXd& J);
+
+    /**
+     * computes the derivatives of all constraints and writes the non-zeros into J.
+     * \warning J should be initialized by initialize(J)
+     */
+    void jacobian(SparseJacobian& J);
+
+    virtual ~JacobianAssembler() {}
+private:
+    friend class ColourTask;
+
+    void addBlock(const boost::shared_ptr<Block>& b, ExpressionBase::Ptr e, int blockrows);
+    void createWorkers();
+    EvalContext& worker(int w);
+    void computeColours(EvalContext& ctx, int first, int n, Eigen::MatrixXd* J, double* nz);
+    void decompress(const EvalContext& ctx, int first, int n, Eigen::MatrixXd* J, double* nz);
+    void compressedJacobian(Eigen::MatrixXd* J, double* nz);
+
+    VarIndexSet ndx;
+    std::vector< boost::shared_ptr<Block> > blocks;
+    int nrows;
+    int nnz;
+    ExpressionTape::Ptr      tape;       ///< all constraints, only when compressed
+    std::vector<int>         colour;     ///< colour of each column, or -1
+    std::vector<int>         var_colour; ///< colour of each variable number, or -1
+    std::vector<VarIndexSet> groups;     ///< variable numbers of each colour
+    TaskPool::Ptr            pool;       ///< workers for the seeded forward passes, can be null
+    std::vector<EvalContext::Ptr> contexts; ///< contexts of workers 1..pool->size()-1
+    std::vector<char>        synced;     ///< synced[w] if worker w has the values of the last evaluate()
+};
+
+} // namespace KDL
+#endif
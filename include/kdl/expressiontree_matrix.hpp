@@ -30,17 +30,17 @@ namespace KDL {
 
 template< int n, int m>
 typename Expression<Eigen::Matrix<double, n,m> >::Ptr 
-addition( typename Expression< Eigen::Matrix<double,n,m> >::Ptr a1, 
-            typename Expression< Eigen::Matrix<double,n,m> >::Ptr a2 );
+addition( const typename Expression< Eigen::Matrix<double,n,m> >::Ptr& a1, 
+            const typename Expression< Eigen::Matrix<double,n,m> >::Ptr& a2 );
 
 template< int n, int m, int k>
 typename Expression<Eigen::Matrix<double, n,k> >::Ptr 
-multiply ( typename Expression< Eigen::Matrix<double,n,m> >::Ptr a1, 
-            typename Expression< Eigen::Matrix<double,m,k> >::Ptr a2 );
+multiply ( const typename Expression< Eigen::Matrix<double,n,m> >::Ptr& a1, 
+            const typename Expression< Eigen::Matrix<double,m,k> >::Ptr& a2 );
 	
 
 template<int n, int m>
-Expression<double>::Ptr get_element( int i,int j, Expression<KDL::Vector>::Ptr a);
+Expression<double>::Ptr get_element( int i,int j, const Expression<KDL::Vector>::Ptr& a);
 
 
 
@@ -68,8 +68,8 @@ public:
 	}
 
 	virtual typename Eigen::Matrix<double,n,k> derivative(int i){
-        result = this->argument1->derivative(i) * arg2value;
-        result += arg1value*this->argument2->derivative(i);
+        result = this->argument1_derivative(i) * arg2value;
+        result += arg1value*this->argument2_derivative(i);
         return result;
 	}
 
@@ -79,9 +79,9 @@ public:
     }
 
     virtual typename BinExpr::Ptr clone() {
-            return boost::make_shared< Matrix_Multiplication<n,m,k> >( 
-                this->argument1->clone(), 
-                this->argument2->clone() 
+            return make_node< Matrix_Multiplication<n,m,k> >( 
+                cloned(this->argument1), 
+                cloned(this->argument2) 
             );
     }
 };
@@ -93,9 +93,9 @@ public:
  */
 template< int n, int m, int k>
 inline typename Expression<Eigen::Matrix<double, n,k> >::Ptr 
-multiply ( typename Expression< Eigen::Matrix<double,n,m> >::Ptr a1, 
-            typename Expression< Eigen::Matrix<double,m,k> >::Ptr a2 ) {
-	return boost::make_shared< Matrix_Multiplication<n,m,k>  >(a1,a2);
+multiply ( const typename Expression< Eigen::Matrix<double,n,m> >::Ptr& a1, 
+            const typename Expression< Eigen::Matrix<double,m,k> >::Ptr& a2 ) {
+	return make_node< Matrix_Multiplication<n,m,k>  >(a1,a2);
 }
 
 template< int n, int m>
@@ -120,7 +120,7 @@ public:
 	}
 
 	virtual typename Eigen::Matrix<double,n,m> derivative(int i){
-        result = this->argument1->derivative(i) + this->argument2->derivative(i);
+        result = this->argument1_derivative(i) + this->argument2_derivative(i);
         return result;
 	}
 
@@ -129,9 +129,9 @@ public:
     }
 
     virtual typename BinExpr::Ptr clone() {
-            return boost::make_shared< Matrix_Addition<n,m> >( 
-                this->argument1->clone(), 
-                this->argument2->clone() 
+            return make_node< Matrix_Addition<n,m> >( 
+                cloned(this->argument1), 
+                cloned(this->argument2) 
             );
     }
 };
@@ -143,9 +143,9 @@ public:
  */
 template< int n, int m>
 inline typename Expression<Eigen::Matrix<double, n,m> >::Ptr 
-addition( typename Expression< Eigen::Matrix<double,n,m> >::Ptr a1, 
-            typename Expression< Eigen::Matrix<double,n,m> >::Ptr a2 ) {
-	return boost::make_shared< Matrix_Addition<n,m>  >(a1,a2);
+addition( const typename Expression< Eigen::Matrix<double,n,m> >::Ptr& a1, 
+            const typename Expression< Eigen::Matrix<double,n,m> >::Ptr& a2 ) {
+	return make_node< Matrix_Addition<n,m>  >(a1,a2);
 }
 
 
@@ -172,7 +172,7 @@ public:
     }
 
     virtual double derivative(int i) {
-    	return this->argument->derivative(i)(i,j);
+    	return this->argument_derivative(i)(i,j);
     }
 
     virtual typename Expression<double>::Ptr derivativeExpression(int c) {
@@ -180,14 +180,14 @@ public:
     }
 
     virtual  typename UnExpr::Ptr clone() {
-        return boost::make_shared< MatrixElement >(this->argument->clone(), i, j);
+        return make_node< MatrixElement >(cloned(this->argument), i, j);
     }
 };
 
 template<int n, int m>
-inline Expression<double>::Ptr get_element( int i,int j, typename Expression<Eigen::Matrix<double,n,m> >::Ptr a) {
+inline Expression<double>::Ptr get_element( int i,int j, const typename Expression<Eigen::Matrix<double,n,m> >::Ptr& a) {
     if ((0<=i)&&(i<n)&&(0<=j)&&(j<m)) {
-        return boost::make_shared<MatrixElement<n,m> >(a,i,j);
+        return make_node<MatrixElement<n,m> >(a,i,j);
     } else {
         return Expression<double>::Ptr();
     }
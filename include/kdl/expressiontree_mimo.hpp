@@ -28,10 +28,12 @@ namespace KDL {
  * This node deals correctly with the expression optimizer.
  * \caveat If you override one of the methods, be sure to call the MIMO methods also
  * \caveat the overriding class is responsible for filling inputDouble/inputFrame/inputTwist with the correct input expression graphs.
+ * \caveat the inputs cannot change anymore after the first MIMO_Output is created, see checkInputsMutable(..).
  */
 class MIMO: public CachedExpression {
     std::vector<boost::weak_ptr<MIMO> >  queue_of_clones;
     bool                                          dot_already_written;
+    bool                                          has_outputs;
 public:
 
     typedef boost::shared_ptr<MIMO> Ptr;
@@ -52,6 +54,19 @@ public:
     
     virtual int number_of_derivatives();
 
+    /**
+     * to be called by a derived class before it changes inputDouble/inputFrame/inputTwist.
+     * Throws std::logic_error when an output of this MIMO already exists: the dependency set of
+     * an output, and of the expressions built on top of it, is determined once.
+     * \param method name of the calling method, used in the error message.
+     */
+    void checkInputsMutable(const std::string& method) const;
+
+    /// only to be called by the MIMO_Output constructor.
+    void outputCreated() {
+        has_outputs = true;
+    }
+
     virtual Expression<Frame>::Ptr subExpression_Frame(const std::string& name);
     virtual  Expression<Rotation>::Ptr subExpression_Rotation(const std::string& name);
     virtual  Expression<Vector>::Ptr subExpression_Vector(const std::string& name);
@@ -81,7 +96,9 @@ public:
     virtual MIMO::Ptr clone() = 0;
 
 
-    // only to be called by MIMO_Output, typically not overridden
+    // only to be called by MIMO_Output, typically not overridden.
+    // Within a CloneContext, all outputs share the one clone of this MIMO in that context;
+    // the first output cloned in a context gets the count-th clone.
     virtual MIMO::Ptr getClone(int count);
 
     virtual ~MIMO();
@@ -102,7 +119,9 @@ public:
                     Expression<double>(name),
                     nr_of_clones(-1),
                     mimo(_mimo)
-                {}
+                {
+                    mimo->outputCreated();
+                }
  
     virtual void setInputValues(const std::vector<double>& values) {
         mimo->setInputValues(values);
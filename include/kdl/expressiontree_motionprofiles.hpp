@@ -122,25 +122,25 @@ class MotionProfileTrapezoidalOutput : public MIMO_Output<double> {
  *      and maxacc will not be propagated into the computations of the derivative.
  * 
  * After this, you can call get_output_profile(...) to get an expression for the different outputs you had
- * defined.      
+ * defined.  Once such an expression exists, setProgressExpression(..) and addOutput(..) throw std::logic_error.
  */
-MotionProfileTrapezoidal::Ptr create_motionprofile_trapezoidal() {
-    return boost::make_shared< MotionProfileTrapezoidal>();
+inline MotionProfileTrapezoidal::Ptr create_motionprofile_trapezoidal() {
+    return make_node< MotionProfileTrapezoidal>();
 }
 
 /**
  * \brief gets an expression representing the motion profile for a given output
  * \param idx index of the output for which the expression is returned.
  */
-Expression<double>::Ptr get_output_profile(MotionProfileTrapezoidal::Ptr& m,int output) {
-    return boost::make_shared<MotionProfileTrapezoidalOutput>( m,output);
+inline Expression<double>::Ptr get_output_profile(MotionProfileTrapezoidal::Ptr& m,int output) {
+    return make_node<MotionProfileTrapezoidalOutput>( m,output);
 }
 
 /**
  * \brief gets an expression representing the duration 
  */
-Expression<double>::Ptr get_duration(MotionProfileTrapezoidal::Ptr& m) {
-    return boost::make_shared<MotionProfileTrapezoidalOutput>( m,-1);
+inline Expression<double>::Ptr get_duration(MotionProfileTrapezoidal::Ptr& m) {
+    return make_node<MotionProfileTrapezoidalOutput>( m,-1);
 }
 
 
@@ -0,0 +1,99 @@
+/**
+ * @file expressiontree_pool.hpp
+ * @brief a small pool of worker threads for the parallel evaluation of expression graphs.
+*
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#ifndef KDL_EXPRESSIONTREE_POOL_HPP
+#define KDL_EXPRESSIONTREE_POOL_HPP
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace KDL {
+
+/**
+ * A fixed set of worker threads that execute numbered tasks.
+ *
+ * run(task,n) executes task.run(k,w) for k=0..n-1 and returns when all of them are finished.
+ * The calling thread takes part as worker 0, the background threads are workers 1..size()-1.
+ * Idle workers take the next task number from a shared counter, such that the load remains
+ * balanced when tasks have a different cost.  The worker number w can be used to select
+ * per-worker scratch memory (e.g. an EvalContext), since a worker executes one task at a time.
+ *
+ * The threads are created once, in the constructor, and wait between calls to run(..).
+ *
+ * \warning run(..) should only be called by one thread at a time.
+ */
+class TaskPool {
+public:
+    typedef boost::shared_ptr<TaskPool> Ptr;
+
+    /**
+     * numbered tasks to be executed by the pool.
+     */
+    class Task {
+    public:
+        /**
+         * executes task number k on worker w.
+         */
+        virtual void run(int k, int w) = 0;
+        virtual ~Task() {}
+    };
+
+    /**
+     * \param nthreads total number of workers, including the calling thread.
+     *                 0 uses one worker per core.
+     */
+    explicit TaskPool(int nthreads=0);
+
+    /**
+     * number of workers, including the calling thread.
+     */
+    int size() const {
+        return nworkers;
+    }
+
+    /**
+     * executes task.run(k,w) for k=0..n-1 and waits until all tasks are finished.
+     */
+    void run(Task& task, int n);
+
+    ~TaskPool();
+private:
+    TaskPool(const TaskPool&);
+    TaskPool& operator=(const TaskPool&);
+
+    void worker(int w);
+    void work(int w);
+
+    int                       nworkers;
+    boost::thread_group       threads;
+    boost::mutex              mutex;
+    boost::condition_variable start;
+    boost::condition_variable done;
+    Task*                     task;
+    int                       ntasks;
+    int                       next;        ///< next task number to execute
+    int                       busy;        ///< number of background workers that work on the current job
+    unsigned int              generation;  ///< incremented for each call to run(..)
+    bool                      stop;
+};
+
+} // namespace KDL
+#endif
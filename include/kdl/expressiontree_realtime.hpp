@@ -0,0 +1,163 @@
+/**
+ * @file expressiontree_realtime.hpp
+ * @brief preparation of expressions for allocation-free (real-time) evaluation,
+ *        and a guard to detect memory allocations.
+*
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#ifndef KDL_EXPRESSIONTREE_REALTIME_HPP
+#define KDL_EXPRESSIONTREE_REALTIME_HPP
+
+#include <kdl/expressiontree_expressions.hpp>
+#include <cstdlib>
+#include <new>
+
+namespace KDL {
+
+/**
+ * Counts (or forbids) the memory allocations of the current thread while it is in scope.
+ *
+ * The allocations are only seen when the program installs the allocation hook, by expanding
+ * EXPRESSIONGRAPH_ALLOCATION_HOOK once, at global scope, in one of its translation units
+ * (typically a test program).  With glibc, the hook replaces malloc, calloc and realloc, such that
+ * also the allocations of Eigen and of the C library are seen.  Otherwise it replaces the global
+ * operator new and delete.
+ *
+ * \code
+ *   {
+ *       AllocationGuard guard;
+ *       optimizer.setInputValues(q);
+ *       e->value(); e->derivative(i); ...
+ *       assert( guard.allocations()==0 );
+ *   }
+ * \endcode
+ *
+ * Guards can be nested; an allocation is counted by all guards of the thread that allocates.
+ */
+class AllocationGuard {
+public:
+    enum Mode {
+        COUNT,   ///< count the allocations
+        ABORT    ///< call abort() at the first allocation
+    };
+
+    explicit AllocationGuard(Mode mode=COUNT);
+
+    /**
+     * number of allocations since the construction of this guard.
+     */
+    unsigned long allocations() const;
+
+    /**
+     * true if the program installed the allocation hook.
+     */
+    static bool hooked();
+
+    /**
+     * internal: called by the allocation hook.
+     */
+    static void notify();
+
+    /**
+     * internal: called once when the allocation hook is installed.
+     */
+    static bool install();
+
+    ~AllocationGuard();
+private:
+    AllocationGuard(const AllocationGuard&);
+    AllocationGuard& operator=(const AllocationGuard&);
+
+    Mode             mode;
+    unsigned long    count;
+    AllocationGuard* previous;
+};
+
+/**
+ * Prepares expr for real-time evaluation towards the variables ndx: after this call, and after a
+ * first evaluation, setInputValue(s), value(), derivative(i) and jacobian(ndx,..) do not allocate memory.
+ *
+ * Nodes that allocate memory lazily, when they are evaluated for the first time, do so during
+ * prepare_realtime(..): it evaluates the value and the Jacobian towards ndx of expr once, with the current input values.
+ * The nodes keep scratch buffers for jacobian(ndx,..) that are sized to ndx: calling jacobian(..) afterwards with more
+ * variables than ndx allocates memory again.
+ * derivativeExpression(i), clone() and the construction of expressions are not real-time.
+ */
+void prepare_realtime(const ExpressionBase::Ptr& expr, const VarIndexSet& ndx);
+
+/**
+ * idem, towards all variables that expr depends on.
+ */
+void prepare_realtime(const ExpressionBase::Ptr& expr);
+
+} // namespace KDL
+
+#if defined(__GLIBC__)
+
+extern "C" void* __libc_malloc(std::size_t n);
+extern "C" void* __libc_calloc(std::size_t n, std::size_t size);
+extern "C" void* __libc_realloc(void* p, std::size_t n);
+
+/**
+ * replaces malloc, calloc and realloc by versions that report to AllocationGuard,
+ * expand once at global scope.  operator new uses malloc.
+ */
+#define EXPRESSIONGRAPH_ALLOCATION_HOOK \
+    static const bool expressiongraph_allocation_hook = KDL::AllocationGuard::install(); \
+    extern "C" void* malloc(std::size_t n) __THROW { \
+        KDL::AllocationGuard::notify(); \
+        return __libc_malloc(n); \
+    } \
+    extern "C" void* calloc(std::size_t n, std::size_t size) __THROW { \
+        KDL::AllocationGuard::notify(); \
+        return __libc_calloc(n, size); \
+    } \
+    extern "C" void* realloc(void* p, std::size_t n) __THROW { \
+        KDL::AllocationGuard::notify(); \
+        return __libc_realloc(p, n); \
+    }
+
+#else
+
+/**
+ * replaces the global operator new/delete by versions that report to AllocationGuard,
+ * expand once at global scope.
+ */
+#define EXPRESSIONGRAPH_ALLOCATION_HOOK \
+    static const bool expressiongraph_allocation_hook = KDL::AllocationGuard::install(); \
+    void* operator new(std::size_t n) { \
+        KDL::AllocationGuard::notify(); \
+        void* p = std::malloc(n==0 ? 1 : n); \
+        if (p==0) { \
+            throw std::bad_alloc(); \
+        } \
+        return p; \
+    } \
+    void* operator new[](std::size_t n) { \
+        return operator new(n); \
+    } \
+    void operator delete(void* p) throw() { \
+        std::free(p); \
+    } \
+    void operator delete[](void* p) throw() { \
+        std::free(p); \
+    }
+
+#endif
+
+#endif
@@ -62,7 +62,7 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return axis*argument->derivative(i);
+        return axis*argument_derivative(i);
     }
 
     virtual void print(std::ostream& os) const {
@@ -70,21 +70,30 @@ public:
         argument->print(os);
         os << ")";  
     }
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = axis*argjac[k];
+        }
+    }
+
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<KDL::Rotation>::Ptr expr(
-            new Rot_Double(axis, argument->clone())
-        );
+        Expression<KDL::Rotation>::Ptr expr = make_node<Rot_Double>(axis, cloned(argument));
         return expr;
     }
+
+    virtual bool getStructuralKey(StructuralKey& key) {
+        UnExpr::getStructuralKey(key);
+        appendBytesToKey(key, axis);
+        return true;
+    }
 };
 
-inline Expression<KDL::Rotation>::Ptr rot(const KDL::Vector& axis, Expression<double>::Ptr a) {
-    Expression<KDL::Rotation>::Ptr expr(
-        new Rot_Double(axis, a )
-    );
-    return expr;
+inline Expression<KDL::Rotation>::Ptr rot(const KDL::Vector& axis, const Expression<double>::Ptr& a) {
+    Expression<KDL::Rotation>::Ptr expr = make_node<Rot_Double>(axis, a );
+    return interned(expr);
 }
 
 /**
@@ -119,23 +128,26 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return axis_value*argument2->derivative(i) + argument1->derivative(i)*angle_value;
+        return axis_value*argument2_derivative(i) + argument1_derivative(i)*angle_value;
     }
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = axis_value*argjac2[k] + argjac1[k]*angle_value;
+        }
+    }
+
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<KDL::Rotation>::Ptr expr(
-            new RotVec_Double(argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Rotation>::Ptr expr = make_node<RotVec_Double>(cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Rotation>::Ptr rotVec(Expression<Vector>::Ptr a, Expression<double>::Ptr b) {
-    Expression<KDL::Rotation>::Ptr expr(
-        new RotVec_Double(a, b )
-    );
-    return expr;
+inline Expression<KDL::Rotation>::Ptr rotVec(const Expression<Vector>::Ptr& a, const Expression<double>::Ptr& b) {
+    Expression<KDL::Rotation>::Ptr expr = make_node<RotVec_Double>(a, b );
+    return interned(expr);
 }
 
 
@@ -157,24 +169,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return KDL::Vector(argument->derivative(i),0,0);
+        return KDL::Vector(argument_derivative(i),0,0);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = KDL::Vector(argjac[k],0,0);
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<KDL::Rotation>::Ptr expr(
-            new RotX_Double( argument->clone())
-        );
+        Expression<KDL::Rotation>::Ptr expr = make_node<RotX_Double>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Rotation>::Ptr rot_x( Expression<double>::Ptr a) {
-    Expression<KDL::Rotation>::Ptr expr(
-        new RotX_Double( a )
-    );
-    return expr;
+inline Expression<KDL::Rotation>::Ptr rot_x( const Expression<double>::Ptr& a) {
+    Expression<KDL::Rotation>::Ptr expr = make_node<RotX_Double>( a );
+    return interned(expr);
 }
 
 // RotY Double
@@ -194,24 +209,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return KDL::Vector(0,argument->derivative(i),0);
+        return KDL::Vector(0,argument_derivative(i),0);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = KDL::Vector(0,argjac[k],0);
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<KDL::Rotation>::Ptr expr(
-            new RotY_Double(argument->clone())
-        );
+        Expression<KDL::Rotation>::Ptr expr = make_node<RotY_Double>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Rotation>::Ptr rot_y( Expression<double>::Ptr a) {
-    Expression<KDL::Rotation>::Ptr expr(
-        new RotY_Double( a )
-    );
-    return expr;
+inline Expression<KDL::Rotation>::Ptr rot_y( const Expression<double>::Ptr& a) {
+    Expression<KDL::Rotation>::Ptr expr = make_node<RotY_Double>( a );
+    return interned(expr);
 }
 
 // RotZ Double
@@ -231,24 +249,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return KDL::Vector(0,0,argument->derivative(i));
+        return KDL::Vector(0,0,argument_derivative(i));
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = KDL::Vector(0,0,argjac[k]);
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<KDL::Rotation>::Ptr expr(
-            new RotZ_Double(argument->clone())
-        );
+        Expression<KDL::Rotation>::Ptr expr = make_node<RotZ_Double>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Rotation>::Ptr rot_z( Expression<double>::Ptr a) {
-    Expression<KDL::Rotation>::Ptr expr(
-        new RotZ_Double(a)
-    );
-    return expr;
+inline Expression<KDL::Rotation>::Ptr rot_z( const Expression<double>::Ptr& a) {
+    Expression<KDL::Rotation>::Ptr expr = make_node<RotZ_Double>(a);
+    return interned(expr);
 }
 
 //Inverse Rotation
@@ -271,24 +292,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return val.Inverse(-(argument->derivative(i)));
+        return val.Inverse(-(argument_derivative(i)));
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = val.Inverse(-argjac[k]);
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<KDL::Rotation>::Ptr expr(
-            new Inverse_Rotation( argument->clone())
-        );
+        Expression<KDL::Rotation>::Ptr expr = make_node<Inverse_Rotation>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Rotation>::Ptr inv (Expression<KDL::Rotation>::Ptr a) {
-    Expression<KDL::Rotation>::Ptr expr(
-        new Inverse_Rotation(a)
-    );
-    return expr;
+inline Expression<KDL::Rotation>::Ptr inv (const Expression<KDL::Rotation>::Ptr& a) {
+    Expression<KDL::Rotation>::Ptr expr = make_node<Inverse_Rotation>(a);
+    return interned(expr);
 }
 
 //Composition Rotation Rotation
@@ -312,22 +336,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return arg1value*argument2->derivative(i) + argument1->derivative(i);
+        return arg1value*argument2_derivative(i) + argument1_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = arg1value*argjac2[k] + argjac1[k];
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<KDL::Rotation>::Ptr expr(
-            new Composition_RotationRotation( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Rotation>::Ptr expr = make_node<Composition_RotationRotation>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Rotation>::Ptr operator* ( Expression<KDL::Rotation>::Ptr a1, Expression<KDL::Rotation>::Ptr a2 ) {
-    Expression<KDL::Rotation>::Ptr expr(new Composition_RotationRotation( a1, a2 ));
-    return expr;
+inline Expression<KDL::Rotation>::Ptr operator* ( const Expression<KDL::Rotation>::Ptr& a1, const Expression<KDL::Rotation>::Ptr& a2 ) {
+    Expression<KDL::Rotation>::Ptr expr = make_node<Composition_RotationRotation>( a1, a2 );
+    return interned(expr);
 }
 
 //Composition Rotation Vector
@@ -353,22 +382,28 @@ public:
 	}
 
 	virtual KDL::Vector derivative(int i){
-		return argument1->derivative(i) * (arg1value * arg2value) + arg1value*argument2->derivative(i);
+		return argument1_derivative(i) * (arg1value * arg2value) + arg1value*argument2_derivative(i);
+	}
+
+	virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+		argument_jacobian(ndx);
+		KDL::Vector v = arg1value * arg2value;
+		for (size_t k=0;k<ndx.size();++k) {
+			jac[k] = argjac1[k] * v + arg1value*argjac2[k];
+		}
 	}
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Composition_RotationVector( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Composition_RotationVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr operator* ( Expression<KDL::Rotation>::Ptr a1, Expression<KDL::Vector>::Ptr a2 ) {
-	Expression<KDL::Vector>::Ptr expr(new Composition_RotationVector(a1, a2));
-	return expr;
+inline Expression<KDL::Vector>::Ptr operator* ( const Expression<KDL::Rotation>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2 ) {
+	Expression<KDL::Vector>::Ptr expr = make_node<Composition_RotationVector>(a1, a2);
+	return interned(expr);
 }
 
 //UnitX Rotation
@@ -391,24 +426,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-    	return argument->derivative(i) * val;
+    	return argument_derivative(i) * val;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k] * val;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new UnitX_Rotation( argument->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<UnitX_Rotation>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr unit_x ( Expression<KDL::Rotation>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new UnitX_Rotation( a )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr unit_x ( const Expression<KDL::Rotation>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<UnitX_Rotation>( a );
+    return interned(expr);
 }
 
 //UnitY Rotation
@@ -431,24 +469,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-    	return argument->derivative(i) * val;
+    	return argument_derivative(i) * val;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k] * val;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new UnitY_Rotation( argument->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<UnitY_Rotation>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr unit_y ( Expression<KDL::Rotation>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new UnitY_Rotation( a )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr unit_y ( const Expression<KDL::Rotation>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<UnitY_Rotation>( a );
+    return interned(expr);
 }
 
 //UnitZ Rotation
@@ -471,24 +512,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-    	return argument->derivative(i) * val;
+    	return argument_derivative(i) * val;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k] * val;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new UnitZ_Rotation( argument->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<UnitZ_Rotation>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr unit_z ( Expression<KDL::Rotation>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new UnitZ_Rotation( a )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr unit_z ( const Expression<KDL::Rotation>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<UnitZ_Rotation>( a );
+    return interned(expr);
 }
 
 class Construct_Rotation:
@@ -506,25 +550,32 @@ public:
     }
     virtual KDL::Vector derivative(int i) {
         KDL::Rotation R(argument1->value(), argument2->value(), argument3->value());
-        KDL::Rotation Rd(argument1->derivative(i), argument2->derivative(i), argument3->derivative(i));
+        KDL::Rotation Rd(argument1_derivative(i), argument2_derivative(i), argument3_derivative(i));
         KDL::Rotation omegax = Rd*R.Inverse();
         KDL::Vector tmp(  (omegax(2,1)-omegax(1,2))/2.0,  ( omegax(0,2)-omegax(2,0))/2.0, (omegax(1,0)-omegax(0,1))/2.0 );  
         return tmp;
     } 
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        KDL::Rotation Rinv = KDL::Rotation(argument1->value(), argument2->value(), argument3->value()).Inverse();
+        for (size_t k=0;k<ndx.size();++k) {
+            KDL::Rotation omegax = KDL::Rotation(argjac1[k], argjac2[k], argjac3[k])*Rinv;
+            jac[k] = KDL::Vector( (omegax(2,1)-omegax(1,2))/2.0, ( omegax(0,2)-omegax(2,0))/2.0, (omegax(1,0)-omegax(0,1))/2.0 );
+        }
+    }
+
     virtual Expression<Vector>::Ptr derivativeExpression(int i) {
         assert( 0 /*not yet implemented */ );
     }
     virtual TExpr::Ptr clone() {
-        TExpr::Ptr expr( new Construct_Rotation( argument1->clone(), argument2->clone(), argument3->clone()));
+        TExpr::Ptr expr = make_node<Construct_Rotation>( cloned(argument1), cloned(argument2), cloned(argument3));
         return expr;
     }
 };
 
-inline Expression<KDL::Rotation>::Ptr construct_rotation_from_vectors( Expression<KDL::Vector>::Ptr a, Expression<KDL::Vector>::Ptr b, Expression<KDL::Vector>::Ptr c) {
-    Expression<KDL::Rotation>::Ptr expr(
-        new Construct_Rotation(a,b,c) 
-    );
-    return expr;
+inline Expression<KDL::Rotation>::Ptr construct_rotation_from_vectors( const Expression<KDL::Vector>::Ptr& a, const Expression<KDL::Vector>::Ptr& b, const Expression<KDL::Vector>::Ptr& c) {
+    Expression<KDL::Rotation>::Ptr expr = make_node<Construct_Rotation>(a,b,c);
+    return interned(expr);
 }
 
 class Get_Rotation_Vector:
@@ -546,24 +597,24 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-    	return argument->derivative(i);
+    	return argument_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument->jacobian(ndx,jac);
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Get_Rotation_Vector( argument->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Get_Rotation_Vector>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr getRotVec( Expression<KDL::Rotation>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Get_Rotation_Vector( a )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr getRotVec( const Expression<KDL::Rotation>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Get_Rotation_Vector>( a );
+    return interned(expr);
 }
 
 class Get_RPY_Rotation:
@@ -593,7 +644,7 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        Vector omega = argument->derivative(i);
+        Vector omega = argument_derivative(i);
         Vector result;
         result[0] = m00*omega[0] + m01*omega[1] + m02*omega[2];
         result[1] = m10*omega[0] + m11*omega[1] + m12*omega[2];
@@ -601,21 +652,27 @@ public:
     	return result;
     }
 
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            const Vector& omega = argjac[k];
+            jac[k][0] = m00*omega[0] + m01*omega[1] + m02*omega[2];
+            jac[k][1] = m10*omega[0] + m11*omega[1] + m12*omega[2];
+            jac[k][2] = m20*omega[0] + m21*omega[1] + m22*omega[2];
+        }
+    }
+
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Get_RPY_Rotation( argument->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Get_RPY_Rotation>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr getRPY( Expression<KDL::Rotation>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Get_RPY_Rotation( a )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr getRPY( const Expression<KDL::Rotation>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Get_RPY_Rotation>( a );
+    return interned(expr);
 }
 
 
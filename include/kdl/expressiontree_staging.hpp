@@ -0,0 +1,158 @@
+/**
+ * @file expressiontree_staging.hpp
+ * @brief publication of input values by non real-time threads to a real-time thread.
+*
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#ifndef KDL_EXPRESSIONTREE_STAGING_HPP
+#define KDL_EXPRESSIONTREE_STAGING_HPP
+
+#include <kdl/expressiontree_expressions.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+
+namespace KDL {
+
+/**
+ * Passes consistent snapshots of input values from producer threads (sensors, callbacks, ...)
+ * to one consumer thread (e.g. a real-time control loop), without locking the expression graph.
+ *
+ * The set of variables is fixed at construction.  The snapshots are stored in three buffers:
+ *   - producers write values with setInputValue(..) into a staging copy (protected by a mutex that
+ *     is only shared between producers), and publish() copies them into the back buffer and
+ *     atomically exchanges it with the middle buffer.
+ *   - the consumer calls update() at the start of each cycle, which atomically exchanges the
+ *     front buffer with the middle buffer if a new snapshot was published.  Until the next update(),
+ *     values() and rotValues() refer to the front buffer, that is not touched by the producers.
+ * update() and apply(..) never block or allocate memory.  A snapshot always contains the
+ * values of one publish(), and values that were not set since the previous publish() keep their
+ * previous value.
+ *
+ * Usage on the consumer side, with an ExpressionOptimizer prepared for variables() and rotVariables():
+ * \code
+ *   staging.update();
+ *   staging.apply(optimizer);
+ *   expr->value(); ...
+ * \endcode
+ *
+ * \warning there should be only one consumer thread.
+ */
+class InputStaging {
+public:
+    typedef boost::shared_ptr<InputStaging> Ptr;
+
+    /**
+     * \param ndx    variable numbers of the scalar inputs.
+     * \param rotndx variable numbers of the Rotation inputs.
+     * \param initial_values initial value of the scalar inputs (default 0).
+     */
+    explicit InputStaging(const std::vector<int>& ndx,
+                          const std::vector<int>& rotndx=std::vector<int>(),
+                          const std::vector<double>& initial_values=std::vector<double>());
+
+    const std::vector<int>& variables() const {
+        return ndx;
+    }
+
+    const std::vector<int>& rotVariables() const {
+        return rotndx;
+    }
+
+    /**
+     * producer: sets the value of a variable for the next publish().
+     * Variable numbers that are not staged are ignored.
+     */
+    void setInputValue(int variable_number, double val);
+    void setInputValue(int variable_number, const Rotation& val);
+
+    /**
+     * producer: sets all scalar values, in the order of variables().
+     */
+    void setInputValues(const std::vector<double>& values);
+
+    /**
+     * producer: makes the values set until now available to the consumer.
+     */
+    void publish();
+
+    /**
+     * consumer: takes the most recently published snapshot.
+     * \return true if a new snapshot was published since the previous update().
+     */
+    bool update();
+
+    /**
+     * consumer: number of snapshots taken by update().
+     */
+    unsigned long updates() const {
+        return nr_of_updates;
+    }
+
+    /**
+     * consumer: scalar values of the current snapshot, in the order of variables().
+     */
+    const std::vector<double>& values() const {
+        return buffer[front].values;
+    }
+
+    /**
+     * consumer: Rotation values of the current snapshot, in the order of rotVariables().
+     */
+    const std::vector<Rotation>& rotValues() const {
+        return buffer[front].rotvalues;
+    }
+
+    /**
+     * consumer: sets the values of the current snapshot in an optimizer that was prepared for
+     * variables() and rotVariables().
+     */
+    void apply(ExpressionOptimizer& opt) const;
+
+    /**
+     * consumer: sets the values of the current snapshot in an expression.
+     */
+    void apply(ExpressionBase& expr) const;
+
+    virtual ~InputStaging() {}
+private:
+    InputStaging(const InputStaging&);
+    InputStaging& operator=(const InputStaging&);
+
+    struct Snapshot {
+        std::vector<double>   values;
+        std::vector<Rotation> rotvalues;
+    };
+
+    static const unsigned int NEW_SNAPSHOT = 4;  ///< flag in middle: middle was published after the last update()
+
+    std::vector<int>          ndx;
+    std::vector<int>          rotndx;
+    std::map<int,int>         position;     ///< index in values of each scalar variable number
+    std::map<int,int>         rotposition;  ///< index in rotvalues of each Rotation variable number
+    boost::mutex              producer_mutex;
+    Snapshot                  staged;       ///< values set by the producers
+    Snapshot                  buffer[3];
+    unsigned int              back;         ///< buffer owned by the producers
+    boost::atomic<unsigned int> middle;     ///< buffer exchanged between producers and consumer, and NEW_SNAPSHOT flag
+    unsigned int              front;        ///< buffer owned by the consumer
+    unsigned long             nr_of_updates;
+};
+
+} // namespace KDL
+#endif
@@ -56,24 +56,27 @@ public:
     }
 
     virtual KDL::Twist derivative(int i) {
-        return Twist(argument1->derivative(i),argument2->derivative(i));
+        return Twist(argument1_derivative(i),argument2_derivative(i));
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = Twist(argjac1[k],argjac2[k]);
+        }
     }
 
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual Expression<Twist>::Ptr clone() {
-        Expression<KDL::Twist>::Ptr expr(
-            new Twist_VectorVector( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Twist>::Ptr expr = make_node<Twist_VectorVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Twist>::Ptr twist( Expression<KDL::Vector>::Ptr a, Expression<KDL::Vector>::Ptr b) {
-    Expression<KDL::Twist>::Ptr expr(
-        new Twist_VectorVector( a,b )
-    );
-    return expr;
+inline Expression<KDL::Twist>::Ptr twist( const Expression<KDL::Vector>::Ptr& a, const Expression<KDL::Vector>::Ptr& b) {
+    Expression<KDL::Twist>::Ptr expr = make_node<Twist_VectorVector>( a,b );
+    return interned(expr);
 }
 
 
@@ -96,23 +99,26 @@ public:
     }
 
     virtual KDL::Twist derivative(int i) {
-    	return -argument->derivative(i);
+    	return -argument_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = -argjac[k];
+        }
     }
 
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<KDL::Twist>::Ptr expr(
-            new Negate_Twist( argument->clone())
-        );
+        Expression<KDL::Twist>::Ptr expr = make_node<Negate_Twist>( cloned(argument));
         return expr;
     }
 };
-inline Expression<KDL::Twist>::Ptr operator-( Expression<KDL::Twist>::Ptr a) {
-    Expression<KDL::Twist>::Ptr expr(
-        new Negate_Twist( a )
-    );
-    return expr;
+inline Expression<KDL::Twist>::Ptr operator-( const Expression<KDL::Twist>::Ptr& a) {
+    Expression<KDL::Twist>::Ptr expr = make_node<Negate_Twist>( a );
+    return interned(expr);
 }
 
 
@@ -134,24 +140,27 @@ public:
     }
 
     virtual Vector derivative(int i) {
-    	return argument->derivative(i).vel;
+    	return argument_derivative(i).vel;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k].vel;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<Vector>::Ptr expr(
-            new Velocity_Twist( argument->clone())
-        );
+        Expression<Vector>::Ptr expr = make_node<Velocity_Twist>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<Vector>::Ptr transvel( Expression<Twist>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Velocity_Twist( a )
-    );
-    return expr;
+inline Expression<Vector>::Ptr transvel( const Expression<Twist>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Velocity_Twist>( a );
+    return interned(expr);
 }
 
 class RotVelocity_Twist:
@@ -161,7 +170,7 @@ public:
     typedef UnaryExpression<Vector, Twist> UnExpr;
     RotVelocity_Twist() {}
     RotVelocity_Twist(
-                  Expression<Twist>::Ptr arg):
+                  const Expression<Twist>::Ptr& arg):
                 UnExpr("rotvel",arg)
                 {}
 
@@ -170,24 +179,27 @@ public:
     }
 
     virtual Vector derivative(int i) {
-    	return argument->derivative(i).rot;
+    	return argument_derivative(i).rot;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k].rot;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<Vector>::Ptr expr(
-            new RotVelocity_Twist( argument->clone())
-        );
+        Expression<Vector>::Ptr expr = make_node<RotVelocity_Twist>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr rotvel( Expression<KDL::Twist>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new RotVelocity_Twist( a )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr rotvel( const Expression<KDL::Twist>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<RotVelocity_Twist>( a );
+    return interned(expr);
 }
 
 
@@ -209,24 +221,27 @@ public:
     }
 
     virtual KDL::Twist derivative(int i) {
-        return argument1->derivative(i) + argument2->derivative(i);
+        return argument1_derivative(i) + argument2_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac1[k] + argjac2[k];
+        }
     }
 
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Twist>::Ptr expr(
-            new Addition_TwistTwist( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Twist>::Ptr expr = make_node<Addition_TwistTwist>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Twist>::Ptr operator+( Expression<KDL::Twist>::Ptr a1, Expression<KDL::Twist>::Ptr a2) {
-    Expression<KDL::Twist>::Ptr expr(
-        new Addition_TwistTwist( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Twist>::Ptr operator+( const Expression<KDL::Twist>::Ptr& a1, const Expression<KDL::Twist>::Ptr& a2) {
+    Expression<KDL::Twist>::Ptr expr = make_node<Addition_TwistTwist>( a1, a2 );
+    return interned(expr);
 }
 
 //Subtraction Twist Twist
@@ -247,24 +262,27 @@ public:
     }
 
     virtual KDL::Twist derivative(int i) {
-        return argument1->derivative(i) - argument2->derivative(i);
+        return argument1_derivative(i) - argument2_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac1[k] - argjac2[k];
+        }
     }
 
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Twist>::Ptr expr(
-            new Subtraction_TwistTwist( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Twist>::Ptr expr = make_node<Subtraction_TwistTwist>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Twist>::Ptr operator-( Expression<KDL::Twist>::Ptr a1, Expression<KDL::Twist>::Ptr a2) {
-    Expression<KDL::Twist>::Ptr expr(
-        new Subtraction_TwistTwist( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Twist>::Ptr operator-( const Expression<KDL::Twist>::Ptr& a1, const Expression<KDL::Twist>::Ptr& a2) {
+    Expression<KDL::Twist>::Ptr expr = make_node<Subtraction_TwistTwist>( a1, a2 );
+    return interned(expr);
 }
 
 //Composition Rotation Twist
@@ -289,29 +307,38 @@ public:
     }
 
     virtual KDL::Twist derivative(int i) {
-    	KDL::Vector da = argument1->derivative(i);
-    	KDL::Twist db = argument2->derivative(i);
+    	KDL::Vector da = argument1_derivative(i);
+    	KDL::Twist db = argument2_derivative(i);
         return KDL::Twist(
         			arg1value*db.vel + da*(arg1value*arg2value.vel),
         			arg1value * db.rot + da * (arg1value * arg2value.rot)
         		);
     }
 
+    virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+        argument_jacobian(ndx);
+        KDL::Twist t = arg1value*arg2value;
+        for (size_t k=0;k<ndx.size();++k) {
+            const KDL::Vector& da = argjac1[k];
+            const KDL::Twist&  db = argjac2[k];
+            jac[k] = KDL::Twist(
+                        arg1value*db.vel + da*t.vel,
+                        arg1value*db.rot + da*t.rot
+                    );
+        }
+    }
+
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Twist>::Ptr expr(
-            new Composition_RotationTwist( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Twist>::Ptr expr = make_node<Composition_RotationTwist>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Twist>::Ptr operator*( Expression<KDL::Rotation>::Ptr a1, Expression<KDL::Twist>::Ptr a2) {
-    Expression<KDL::Twist>::Ptr expr(
-        new Composition_RotationTwist( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Twist>::Ptr operator*( const Expression<KDL::Rotation>::Ptr& a1, const Expression<KDL::Twist>::Ptr& a2) {
+    Expression<KDL::Twist>::Ptr expr = make_node<Composition_RotationTwist>( a1, a2 );
+    return interned(expr);
 }
 
 //Composition Twist Double
@@ -336,30 +363,31 @@ public:
     }
 
     virtual KDL::Twist derivative(int i) {
-    	return arg1value*argument2->derivative(i) + argument1->derivative(i) * arg2value;
+    	return arg1value*argument2_derivative(i) + argument1_derivative(i) * arg2value;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = arg1value*argjac2[k] + argjac1[k]*arg2value;
+        }
     }
 
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Twist>::Ptr expr(
-            new Multiplication_TwistDouble( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Twist>::Ptr expr = make_node<Multiplication_TwistDouble>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Twist>::Ptr operator*( Expression<KDL::Twist>::Ptr a1, Expression<double>::Ptr a2) {
-    Expression<KDL::Twist>::Ptr expr(
-        new Multiplication_TwistDouble( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Twist>::Ptr operator*( const Expression<KDL::Twist>::Ptr& a1, const Expression<double>::Ptr& a2) {
+    Expression<KDL::Twist>::Ptr expr = make_node<Multiplication_TwistDouble>( a1, a2 );
+    return interned(expr);
 }
-inline Expression<KDL::Twist>::Ptr operator*( Expression<double>::Ptr a1, Expression<KDL::Twist>::Ptr a2) {
-    Expression<KDL::Twist>::Ptr expr(
-        new Multiplication_TwistDouble( a2, a1 )
-    );
-    return expr;
+inline Expression<KDL::Twist>::Ptr operator*( const Expression<double>::Ptr& a1, const Expression<KDL::Twist>::Ptr& a2) {
+    Expression<KDL::Twist>::Ptr expr = make_node<Multiplication_TwistDouble>( a2, a1 );
+    return interned(expr);
 }
 
 //RefPoint Twist Vector
@@ -384,28 +412,35 @@ public:
     }
 
     virtual KDL::Twist derivative(int i) {
-    	KDL::Twist da = argument1->derivative(i);
+    	KDL::Twist da = argument1_derivative(i);
     	return KDL::Twist(
-    			da.vel + da.rot * arg2value + arg1value.rot * argument2->derivative(i),
+    			da.vel + da.rot * arg2value + arg1value.rot * argument2_derivative(i),
     			da.rot
     	);
     }
 
+    virtual void jacobian(const VarIndexSet& ndx, Twist* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            const KDL::Twist& da = argjac1[k];
+            jac[k] = KDL::Twist(
+                        da.vel + da.rot * arg2value + arg1value.rot * argjac2[k],
+                        da.rot
+                    );
+        }
+    }
+
     virtual Expression<Twist>::Ptr derivativeExpression(int i);
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Twist>::Ptr expr(
-            new RefPoint_TwistVector( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Twist>::Ptr expr = make_node<RefPoint_TwistVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Twist>::Ptr ref_point ( Expression<KDL::Twist>::Ptr a1, Expression<KDL::Vector>::Ptr a2) {
-    Expression<KDL::Twist>::Ptr expr(
-        new RefPoint_TwistVector( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Twist>::Ptr ref_point ( const Expression<KDL::Twist>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2) {
+    Expression<KDL::Twist>::Ptr expr = make_node<RefPoint_TwistVector>( a1, a2 );
+    return interned(expr);
 }
 
 /**
@@ -434,19 +469,17 @@ public:
 	}
 
 	virtual KDL::Wrench derivative(int i){
-		return arg1value * argument2->derivative(i) + argument1->derivative(i)*arg2value;
+		return arg1value * argument2_derivative(i) + argument1_derivative(i)*arg2value;
 	}
 
     virtual typename BinExpr::Ptr clone() {
-        Expression<KDL::Wrench>::Ptr expr(
-            new Composition_StiffnessTwist( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Wrench>::Ptr expr = make_node<Composition_StiffnessTwist>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-Expression<KDL::Wrench>::Ptr operator* ( Expression<KDL::Stiffness>::Ptr a1, Expression<KDL::Twist>::Ptr a2 ) {
-	Expression<KDL::Wrench>::Ptr expr(new Composition_StiffnessTwist( a1, a2 ));
+Expression<KDL::Wrench>::Ptr operator* ( const Expression<KDL::Stiffness>::Ptr& a1, const Expression<KDL::Twist>::Ptr& a2 ) {
+	Expression<KDL::Wrench>::Ptr expr = make_node<Composition_StiffnessTwist>( a1, a2 );
 	return expr;
 }
 */
@@ -107,6 +107,14 @@ public:
     virtual void setInputValues(const std::vector<double>& values) {
     }
 
+    /**
+     * setValue(..) and setJacobian(..) do not change any input variable, the
+     * ExpressionOptimizer invalidates the cached nodes above this node on every call.
+     */
+    virtual void addToOptimizer(ExpressionOptimizer& opt) {
+        opt.addVolatile();
+    }
+
     virtual ResultType value() {
         return val;
     }
@@ -157,9 +165,7 @@ public:
      * is cloned, and thus no longer accessible from outside the expression.
      */
     virtual typename Expression<ResultType>::Ptr clone() {
-        typename VariableType<ResultType>::Ptr expr(
-            new VariableType<ResultType>( ndx)
-        );
+        typename VariableType<ResultType>::Ptr expr = make_node< VariableType<ResultType> >( ndx);
         expr->val = val;
         expr->deriv = deriv;
         if (original==NULL) {
@@ -181,9 +187,7 @@ public:
 template <typename T>
 inline typename VariableType<T>::Ptr Variable( const std::vector<int>& ndx) 
 {
-        typename KDL::VariableType<T>::Ptr tmp(
-            new VariableType<T>(  ndx )
-        );
+        typename KDL::VariableType<T>::Ptr tmp = make_node< VariableType<T> >(  ndx );
         return tmp;
 }
 
@@ -334,9 +338,7 @@ public:
      * Cloning also the value and derivative would make no sense, because it would point to a value that nobody can change. 
      *
     virtual typename Expression<ResultType>::Ptr clone() {
-        typename Expression<ResultType>::Ptr expr(
-            new CallbackNode<ResultType>(cb->clone(), ndx)
-        );
+        typename Expression<ResultType>::Ptr expr = make_node< CallbackNode<ResultType> >(cb->clone(), ndx);
         return expr;
     }
 };
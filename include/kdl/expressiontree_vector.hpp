@@ -51,9 +51,9 @@ class Vector_DoubleDoubleDouble:
 public:
 
     Vector_DoubleDoubleDouble(){}
-    Vector_DoubleDoubleDouble(  Expression<double>::Ptr a1, 
-                                Expression<double>::Ptr a2,
-                                Expression<double>::Ptr a3):
+    Vector_DoubleDoubleDouble(  const Expression<double>::Ptr& a1, 
+                                const Expression<double>::Ptr& a2,
+                                const Expression<double>::Ptr& a3):
         TernaryExpression<Vector,double,double,double>("vector",a1,a2,a3) {}
 
     virtual Vector value() {
@@ -61,29 +61,32 @@ public:
     } 
     virtual Vector derivative(int i) {
         return Vector(
-            argument1->derivative(i),
-            argument2->derivative(i),
-            argument3->derivative(i)
+            argument1_derivative(i),
+            argument2_derivative(i),
+            argument3_derivative(i)
         );
     } 
 
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = Vector(argjac1[k],argjac2[k],argjac3[k]);
+        }
+    }
+
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  Expression<Vector>::Ptr clone() {
-         Expression<Vector>::Ptr expr(
-            new Vector_DoubleDoubleDouble(argument1->clone(), argument2->clone(), argument3->clone())
-        );
+         Expression<Vector>::Ptr expr = make_node<Vector_DoubleDoubleDouble>(cloned(argument1), cloned(argument2), cloned(argument3));
         return expr;
     } 
 };
 
-inline Expression<Vector>::Ptr vector( Expression<double>::Ptr a1, 
-                                Expression<double>::Ptr a2,
-                                Expression<double>::Ptr a3) {
-    Expression<Vector>::Ptr expr(
-        new Vector_DoubleDoubleDouble( a1, a2, a3 )
-    );
-    return expr;
+inline Expression<Vector>::Ptr vector( const Expression<double>::Ptr& a1, 
+                                const Expression<double>::Ptr& a2,
+                                const Expression<double>::Ptr& a3) {
+    Expression<Vector>::Ptr expr = make_node<Vector_DoubleDoubleDouble>( a1, a2, a3 );
+    return interned(expr);
 }
 
 
@@ -110,24 +113,27 @@ public:
     }
 
     virtual double derivative(int i) {
-        return dot(arg1value,argument2->derivative(i)) + dot(argument1->derivative(i),arg2value);
+        return dot(arg1value,argument2_derivative(i)) + dot(argument1_derivative(i),arg2value);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = dot(arg1value,argjac2[k]) + dot(argjac1[k],arg2value);
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Dot_VectorVector( argument1->clone(), argument2->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Dot_VectorVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr dot( Expression<KDL::Vector>::Ptr a1, Expression<KDL::Vector>::Ptr a2) {
-    Expression<double>::Ptr expr(
-        new Dot_VectorVector( a1, a2 )
-    );
-    return expr;
+inline Expression<double>::Ptr dot( const Expression<KDL::Vector>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2) {
+    Expression<double>::Ptr expr = make_node<Dot_VectorVector>( a1, a2 );
+    return interned(expr);
 }
 
 //Composition Vector Vector
@@ -152,31 +158,32 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return arg1value * argument2->derivative(i) + argument1->derivative(i) * arg2value;
+        return arg1value * argument2_derivative(i) + argument1_derivative(i) * arg2value;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = arg1value * argjac2[k] + argjac1[k] * arg2value;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new CrossProduct_VectorVector( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<CrossProduct_VectorVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr operator*( Expression<KDL::Vector>::Ptr a1, Expression<KDL::Vector>::Ptr a2) {
-    Expression<KDL::Vector>::Ptr expr(
-        new CrossProduct_VectorVector( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr operator*( const Expression<KDL::Vector>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2) {
+    Expression<KDL::Vector>::Ptr expr = make_node<CrossProduct_VectorVector>( a1, a2 );
+    return interned(expr);
 }
 
-inline Expression<KDL::Vector>::Ptr cross( Expression<KDL::Vector>::Ptr a1, Expression<KDL::Vector>::Ptr a2) {
-    Expression<KDL::Vector>::Ptr expr(
-        new CrossProduct_VectorVector( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr cross( const Expression<KDL::Vector>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2) {
+    Expression<KDL::Vector>::Ptr expr = make_node<CrossProduct_VectorVector>( a1, a2 );
+    return interned(expr);
 }
 
 
@@ -198,24 +205,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return argument1->derivative(i) + argument2->derivative(i);
+        return argument1_derivative(i) + argument2_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac1[k] + argjac2[k];
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Addition_VectorVector( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Addition_VectorVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr operator+( Expression<KDL::Vector>::Ptr a1, Expression<KDL::Vector>::Ptr a2) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Addition_VectorVector( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr operator+( const Expression<KDL::Vector>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Addition_VectorVector>( a1, a2 );
+    return interned(expr);
 }
 
 //Subtraction Vector Vector
@@ -237,24 +247,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return argument1->derivative(i) - argument2->derivative(i);
+        return argument1_derivative(i) - argument2_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac1[k] - argjac2[k];
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Subtraction_VectorVector( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Subtraction_VectorVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr operator-( Expression<KDL::Vector>::Ptr a1, Expression<KDL::Vector>::Ptr a2) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Subtraction_VectorVector( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr operator-( const Expression<KDL::Vector>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Subtraction_VectorVector>( a1, a2 );
+    return interned(expr);
 }
 
 //Negate Vector
@@ -275,24 +288,27 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-    	return -argument->derivative(i);
+    	return -argument_derivative(i);
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = -argjac[k];
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Negate_Vector( argument->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Negate_Vector>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr operator-( Expression<KDL::Vector>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Negate_Vector( a )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr operator-( const Expression<KDL::Vector>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Negate_Vector>( a );
+    return interned(expr);
 }
 
 //Norm Vector
@@ -316,25 +332,29 @@ public:
     }
 
     virtual double derivative(int i) {
-        Vector vald = argument->derivative(i);
+        Vector vald = argument_derivative(i);
         return 2.0*val.x()*vald.x() + 2.0*val.y()*vald.y() + 2.0*val.z()*vald.z();
     }
 
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        Vector v = 2.0*val;
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = dot(v,argjac[k]);
+        }
+    }
+
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new SquaredNorm_Vector( argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<SquaredNorm_Vector>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr squared_norm ( Expression<KDL::Vector>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new SquaredNorm_Vector( a )
-    );
-    return expr;
+inline Expression<double>::Ptr squared_norm ( const Expression<KDL::Vector>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<SquaredNorm_Vector>( a );
+    return interned(expr);
 }
 
 //Norm Vector
@@ -368,24 +388,28 @@ public:
         //      becomes sign(x)*xdot
         //   so in the limit:
         //      sign(x)*xdot + sign(y)*ydot + sign(z)*zdot 
-        return dot(val, argument->derivative(i))/nval;
+        return dot(val, argument_derivative(i))/nval;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        Vector v = val/nval;
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = dot(v,argjac[k]);
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new Norm_Vector( argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<Norm_Vector>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr norm ( Expression<KDL::Vector>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new Norm_Vector( a )
-    );
-    return expr;
+inline Expression<double>::Ptr norm ( const Expression<KDL::Vector>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<Norm_Vector>( a );
+    return interned(expr);
 }
 
 //Multiplication Vector Double
@@ -412,31 +436,32 @@ public:
     }
 
     virtual KDL::Vector derivative(int i) {
-        return arg1value * argument2->derivative(i) + argument1->derivative(i) * arg2value;
+        return arg1value * argument2_derivative(i) + argument1_derivative(i) * arg2value;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = arg1value * argjac2[k] + argjac1[k] * arg2value;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Multiplication_VectorDouble( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Multiplication_VectorDouble>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr operator*( Expression<KDL::Vector>::Ptr a1, Expression<double>::Ptr a2) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Multiplication_VectorDouble( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr operator*( const Expression<KDL::Vector>::Ptr& a1, const Expression<double>::Ptr& a2) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Multiplication_VectorDouble>( a1, a2 );
+    return interned(expr);
 }
 
-inline Expression<KDL::Vector>::Ptr operator*( Expression<double>::Ptr a1, Expression<KDL::Vector>::Ptr a2) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Multiplication_VectorDouble( a2, a1 )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr operator*( const Expression<double>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Multiplication_VectorDouble>( a2, a1 );
+    return interned(expr);
 }
 
 //CoordX Vector
@@ -457,24 +482,27 @@ public:
     }
 
     virtual double derivative(int i) {
-    	return argument->derivative(i)[0];
+    	return argument_derivative(i)[0];
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k][0];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new CoordX_Vector( argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<CoordX_Vector>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr coord_x ( Expression<KDL::Vector>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new CoordX_Vector(a)
-    );
-    return expr;
+inline Expression<double>::Ptr coord_x ( const Expression<KDL::Vector>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<CoordX_Vector>(a);
+    return interned(expr);
 }
 
 //CoordY Vector
@@ -495,24 +523,27 @@ public:
     }
 
     virtual double derivative(int i) {
-    	return argument->derivative(i)[1];
+    	return argument_derivative(i)[1];
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k][1];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new CoordY_Vector(argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<CoordY_Vector>(cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr coord_y ( Expression<KDL::Vector>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new CoordY_Vector(a)
-    );
-    return expr;
+inline Expression<double>::Ptr coord_y ( const Expression<KDL::Vector>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<CoordY_Vector>(a);
+    return interned(expr);
 }
 
 //CoordZ Vector
@@ -533,24 +564,27 @@ public:
     }
 
     virtual double derivative(int i) {
-    	return argument->derivative(i)[2];
+    	return argument_derivative(i)[2];
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, double* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k][2];
+        }
     }
 
     virtual Expression<double>::Ptr derivativeExpression(int i);
 
     virtual  UnExpr::Ptr clone() {
-        Expression<double>::Ptr expr(
-            new CoordZ_Vector( argument->clone())
-        );
+        Expression<double>::Ptr expr = make_node<CoordZ_Vector>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<double>::Ptr coord_z ( Expression<KDL::Vector>::Ptr a) {
-    Expression<double>::Ptr expr(
-        new CoordZ_Vector(a)
-    );
-    return expr;
+inline Expression<double>::Ptr coord_z ( const Expression<KDL::Vector>::Ptr& a) {
+    Expression<double>::Ptr expr = make_node<CoordZ_Vector>(a);
+    return interned(expr);
 }
 
 //Diff Vector Vector
@@ -572,22 +606,27 @@ public:
 	}
 
 	virtual KDL::Vector derivative(int i){
-		return argument2->derivative(i) - argument1->derivative(i);
+		return argument2_derivative(i) - argument1_derivative(i);
+	}
+
+	virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+		argument_jacobian(ndx);
+		for (size_t k=0;k<ndx.size();++k) {
+			jac[k] = argjac2[k] - argjac1[k];
+		}
 	}
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual  BinExpr::Ptr clone() {
-        Expression<KDL::Vector>::Ptr expr(
-            new Diff_VectorVector( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Vector>::Ptr expr = make_node<Diff_VectorVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr diff ( Expression<KDL::Vector>::Ptr a1, Expression<KDL::Vector>::Ptr a2 ) {
-	Expression<KDL::Vector>::Ptr expr(new Diff_VectorVector( a1, a2 ));
-	return expr;
+inline Expression<KDL::Vector>::Ptr diff ( const Expression<KDL::Vector>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2 ) {
+	Expression<KDL::Vector>::Ptr expr = make_node<Diff_VectorVector>( a1, a2 );
+	return interned(expr);
 }
 
 }; //namespace KDL
@@ -54,24 +54,27 @@ public:
     }
 
     virtual Wrench derivative(int i) {
-        return Wrench(argument1->derivative(i),argument2->derivative(i));
+        return Wrench(argument1_derivative(i),argument2_derivative(i));
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Wrench* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = Wrench(argjac1[k],argjac2[k]);
+        }
     }
 
     virtual Expression<Wrench>::Ptr derivativeExpression(int i);
 
     virtual Expression<Wrench>::Ptr clone() {
-        Expression<Wrench>::Ptr expr(
-            new Wrench_VectorVector( argument1->clone(), argument2->clone())
-        );
+        Expression<Wrench>::Ptr expr = make_node<Wrench_VectorVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<Wrench>::Ptr wrench( Expression<KDL::Vector>::Ptr a, Expression<KDL::Vector>::Ptr b) {
-    Expression<KDL::Wrench>::Ptr expr(
-        new Wrench_VectorVector( a,b )
-    );
-    return expr;
+inline Expression<Wrench>::Ptr wrench( const Expression<KDL::Vector>::Ptr& a, const Expression<KDL::Vector>::Ptr& b) {
+    Expression<KDL::Wrench>::Ptr expr = make_node<Wrench_VectorVector>( a,b );
+    return interned(expr);
 }
 
 class Force_Wrench:
@@ -90,24 +93,27 @@ public:
     }
 
     virtual Vector derivative(int i) {
-    	return argument->derivative(i).force;
+    	return argument_derivative(i).force;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k].force;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<Vector>::Ptr expr(
-            new Force_Wrench( argument->clone())
-        );
+        Expression<Vector>::Ptr expr = make_node<Force_Wrench>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<Vector>::Ptr force( Expression<Wrench>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Force_Wrench( a )
-    );
-    return expr;
+inline Expression<Vector>::Ptr force( const Expression<Wrench>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Force_Wrench>( a );
+    return interned(expr);
 }
 
 class Torque_Wrench:
@@ -118,7 +124,7 @@ public:
 public:
     Torque_Wrench(){}
     Torque_Wrench(
-                  Expression<Wrench>::Ptr arg):
+                  const Expression<Wrench>::Ptr& arg):
                 UnExpr("torque",arg)
                 {}
 
@@ -127,24 +133,27 @@ public:
     }
 
     virtual Vector derivative(int i) {
-    	return argument->derivative(i).torque;
+    	return argument_derivative(i).torque;
+    }
+
+    virtual void jacobian(const VarIndexSet& ndx, Vector* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac[k].torque;
+        }
     }
 
     virtual Expression<Vector>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<Vector>::Ptr expr(
-            new Torque_Wrench( argument->clone())
-        );
+        Expression<Vector>::Ptr expr = make_node<Torque_Wrench>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Vector>::Ptr torque( Expression<KDL::Wrench>::Ptr a) {
-    Expression<KDL::Vector>::Ptr expr(
-        new Torque_Wrench( a )
-    );
-    return expr;
+inline Expression<KDL::Vector>::Ptr torque( const Expression<KDL::Wrench>::Ptr& a) {
+    Expression<KDL::Vector>::Ptr expr = make_node<Torque_Wrench>( a );
+    return interned(expr);
 }
 
 
@@ -166,23 +175,26 @@ public:
     }
 
     virtual KDL::Wrench derivative(int i) {
-    	return -argument->derivative(i);
+    	return -argument_derivative(i);
     }
+    virtual void jacobian(const VarIndexSet& ndx, Wrench* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = -argjac[k];
+        }
+    }
+
     virtual Expression<Wrench>::Ptr derivativeExpression(int i);
 
     virtual   UnExpr::Ptr clone() {
-        Expression<KDL::Wrench>::Ptr expr(
-            new Negate_Wrench( argument->clone())
-        );
+        Expression<KDL::Wrench>::Ptr expr = make_node<Negate_Wrench>( cloned(argument));
         return expr;
     }
 };
 
-inline Expression<KDL::Wrench>::Ptr operator-( Expression<KDL::Wrench>::Ptr a) {
-    Expression<KDL::Wrench>::Ptr expr(
-        new Negate_Wrench( a )
-    );
-    return expr;
+inline Expression<KDL::Wrench>::Ptr operator-( const Expression<KDL::Wrench>::Ptr& a) {
+    Expression<KDL::Wrench>::Ptr expr = make_node<Negate_Wrench>( a );
+    return interned(expr);
 }
 
 //Addition Wrench Wrench
@@ -204,24 +216,27 @@ public:
     }
 
     virtual KDL::Wrench derivative(int i) {
-        return argument1->derivative(i) + argument2->derivative(i);
+        return argument1_derivative(i) + argument2_derivative(i);
+    }
+    virtual void jacobian(const VarIndexSet& ndx, Wrench* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac1[k] + argjac2[k];
+        }
     }
+
     virtual Expression<Wrench>::Ptr derivativeExpression(int i);
 
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Wrench>::Ptr expr(
-            new Addition_WrenchWrench( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Wrench>::Ptr expr = make_node<Addition_WrenchWrench>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Wrench>::Ptr operator+( Expression<KDL::Wrench>::Ptr a1, Expression<KDL::Wrench>::Ptr a2) {
-    Expression<KDL::Wrench>::Ptr expr(
-        new Addition_WrenchWrench( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Wrench>::Ptr operator+( const Expression<KDL::Wrench>::Ptr& a1, const Expression<KDL::Wrench>::Ptr& a2) {
+    Expression<KDL::Wrench>::Ptr expr = make_node<Addition_WrenchWrench>( a1, a2 );
+    return interned(expr);
 }
 
 //Subtraction Wrench Wrench
@@ -242,23 +257,26 @@ public:
     }
 
     virtual KDL::Wrench derivative(int i) {
-        return argument1->derivative(i) - argument2->derivative(i);
+        return argument1_derivative(i) - argument2_derivative(i);
+    }
+    virtual void jacobian(const VarIndexSet& ndx, Wrench* jac) {
+        argument_jacobian(ndx);
+        for (size_t k=0;k<ndx.size();++k) {
+            jac[k] = argjac1[k] - argjac2[k];
+        }
     }
+
     virtual Expression<Wrench>::Ptr derivativeExpression(int i);
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Wrench>::Ptr expr(
-            new Subtraction_WrenchWrench( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Wrench>::Ptr expr = make_node<Subtraction_WrenchWrench>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Wrench>::Ptr operator-( Expression<KDL::Wrench>::Ptr a1, Expression<KDL::Wrench>::Ptr a2) {
-    Expression<KDL::Wrench>::Ptr expr(
-        new Subtraction_WrenchWrench( a1, a2 )
-    );
-    return expr;
+inline Expression<KDL::Wrench>::Ptr operator-( const Expression<KDL::Wrench>::Ptr& a1, const Expression<KDL::Wrench>::Ptr& a2) {
+    Expression<KDL::Wrench>::Ptr expr = make_node<Subtraction_WrenchWrench>( a1, a2 );
+    return interned(expr);
 }
 
 //Composition Rotation Wrench
@@ -284,27 +302,38 @@ public:
 	}
 
 	virtual KDL::Wrench derivative(int i){
-		KDL::Vector da = argument1->derivative(i);
-		KDL::Wrench db = argument2->derivative(i);
+		KDL::Vector da = argument1_derivative(i);
+		KDL::Wrench db = argument2_derivative(i);
 		return KDL::Wrench(
 				arg1value * db.force + da*(arg1value*arg2value.force),
 				arg1value * db.torque + da * (arg1value*arg2value.torque)
 		);
 	}
+	virtual void jacobian(const VarIndexSet& ndx, Wrench* jac) {
+		argument_jacobian(ndx);
+		KDL::Wrench w = arg1value*arg2value;
+		for (size_t k=0;k<ndx.size();++k) {
+			const KDL::Vector& da = argjac1[k];
+			const KDL::Wrench& db = argjac2[k];
+			jac[k] = KDL::Wrench(
+						arg1value*db.force + da*w.force,
+						arg1value*db.torque + da*w.torque
+					);
+		}
+	}
+
     virtual Expression<Wrench>::Ptr derivativeExpression(int i);
 
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Wrench>::Ptr expr(
-            new Composition_RotationWrench( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Wrench>::Ptr expr = make_node<Composition_RotationWrench>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Wrench>::Ptr operator* ( Expression<KDL::Rotation>::Ptr a1, Expression<KDL::Wrench>::Ptr a2 ) {
-	Expression<KDL::Wrench>::Ptr expr(new Composition_RotationWrench( a1, a2 ));
-	return expr;
+inline Expression<KDL::Wrench>::Ptr operator* ( const Expression<KDL::Rotation>::Ptr& a1, const Expression<KDL::Wrench>::Ptr& a2 ) {
+	Expression<KDL::Wrench>::Ptr expr = make_node<Composition_RotationWrench>( a1, a2 );
+	return interned(expr);
 }
 
 //Composition Wrench Double
@@ -330,25 +359,30 @@ public:
 	}
 
 	virtual KDL::Wrench derivative(int i){
-		return arg1value*argument2->derivative(i) + argument1->derivative(i)*arg2value;
+		return arg1value*argument2_derivative(i) + argument1_derivative(i)*arg2value;
+	}
+	virtual void jacobian(const VarIndexSet& ndx, Wrench* jac) {
+		argument_jacobian(ndx);
+		for (size_t k=0;k<ndx.size();++k) {
+			jac[k] = arg1value*argjac2[k] + argjac1[k]*arg2value;
+		}
 	}
+
     virtual Expression<Wrench>::Ptr derivativeExpression(int i);
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Wrench>::Ptr expr(
-            new Multiplication_WrenchDouble( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Wrench>::Ptr expr = make_node<Multiplication_WrenchDouble>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Wrench>::Ptr operator* ( Expression<KDL::Wrench>::Ptr a1, Expression<double>::Ptr a2 ) {
-	Expression<KDL::Wrench>::Ptr expr(new Multiplication_WrenchDouble( a1, a2 ));
-	return expr;
+inline Expression<KDL::Wrench>::Ptr operator* ( const Expression<KDL::Wrench>::Ptr& a1, const Expression<double>::Ptr& a2 ) {
+	Expression<KDL::Wrench>::Ptr expr = make_node<Multiplication_WrenchDouble>( a1, a2 );
+	return interned(expr);
 }
-inline Expression<KDL::Wrench>::Ptr operator* ( Expression<double>::Ptr a1, Expression<KDL::Wrench>::Ptr a2 ) {
-	Expression<KDL::Wrench>::Ptr expr(new Multiplication_WrenchDouble( a2, a1 ));
-	return expr;
+inline Expression<KDL::Wrench>::Ptr operator* ( const Expression<double>::Ptr& a1, const Expression<KDL::Wrench>::Ptr& a2 ) {
+	Expression<KDL::Wrench>::Ptr expr = make_node<Multiplication_WrenchDouble>( a2, a1 );
+	return interned(expr);
 }
 
 //RefPoint Wrench Vector
@@ -374,23 +408,30 @@ public:
 	}
 
 	virtual KDL::Wrench derivative(int i){
-		KDL::Wrench da = argument1->derivative(i);
+		KDL::Wrench da = argument1_derivative(i);
 		return KDL::Wrench(	da.force,
-						da.torque + da.force*arg2value + arg1value.force*argument2->derivative(i));
+						da.torque + da.force*arg2value + arg1value.force*argument2_derivative(i));
+	}
+	virtual void jacobian(const VarIndexSet& ndx, Wrench* jac) {
+		argument_jacobian(ndx);
+		for (size_t k=0;k<ndx.size();++k) {
+			const KDL::Wrench& da = argjac1[k];
+			jac[k] = KDL::Wrench( da.force,
+						da.torque + da.force*arg2value + arg1value.force*argjac2[k]);
+		}
 	}
+
     virtual Expression<Wrench>::Ptr derivativeExpression(int i);
 
     virtual   BinExpr::Ptr clone() {
-        Expression<KDL::Wrench>::Ptr expr(
-            new RefPoint_WrenchVector( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Wrench>::Ptr expr = make_node<RefPoint_WrenchVector>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-inline Expression<KDL::Wrench>::Ptr ref_point ( Expression<KDL::Wrench>::Ptr a1, Expression<KDL::Vector>::Ptr a2 ) {
-	Expression<KDL::Wrench>::Ptr expr(new RefPoint_WrenchVector( a1, a2 ));
-	return expr;
+inline Expression<KDL::Wrench>::Ptr ref_point ( const Expression<KDL::Wrench>::Ptr& a1, const Expression<KDL::Vector>::Ptr& a2 ) {
+	Expression<KDL::Wrench>::Ptr expr = make_node<RefPoint_WrenchVector>( a1, a2 );
+	return interned(expr);
 }
 
 /*  **********************************************
@@ -417,7 +458,7 @@ public:
 	}
 
 	virtual KDL::Twist derivative(int i){ //TODO: Check implementation! The old implementation asserts false in the VV case.
-		return arg1value.Inverse(argument2->derivative(i));
+		return arg1value.Inverse(argument2_derivative(i));
 	}
     virtual Expression<Twist>::Ptr derivativeExpression(int i) {
         assert( 0 && "derivativeExpression for InverseStiffnessWrench NOT IMPLEMENTED (YET)");
@@ -425,15 +466,13 @@ public:
 
 
     virtual typename BinExpr::Ptr clone() {
-        Expression<KDL::Twist>::Ptr expr(
-            new Inverse_StiffnessWrench( argument1->clone(), argument2->clone())
-        );
+        Expression<KDL::Twist>::Ptr expr = make_node<Inverse_StiffnessWrench>( cloned(argument1), cloned(argument2));
         return expr;
     }
 };
 
-Expression<KDL::Twist>::Ptr inv ( Expression<KDL::Stiffness>::Ptr a1, Expression<KDL::Wrench>::Ptr a2 ) {
-	Expression<KDL::Twist>::Ptr expr(new Inverse_StiffnessWrench( a1, a2 ));
+Expression<KDL::Twist>::Ptr inv ( const Expression<KDL::Stiffness>::Ptr& a1, const Expression<KDL::Wrench>::Ptr& a2 ) {
+	Expression<KDL::Twist>::Ptr expr = make_node<Inverse_StiffnessWrench>( a1, a2 );
 	return expr;
 }
 **************************************************** */
@@ -0,0 +1,166 @@
+/*
+ * expressiontree_arena.cpp
+ *
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#include <kdl/expressiontree_arena.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <Eigen/Core>
+#include <map>
+#include <string>
+#include <limits>
+#include <cassert>
+
+#ifndef EIGEN_MAX_ALIGN_BYTES
+// Eigen before 3.3
+#define EIGEN_MAX_ALIGN_BYTES 16
+#endif
+
+namespace KDL {
+
+/*
+ * the most demanding alignment of the fundamental types (i.e. alignof(max_align_t)).
+ */
+union MaxAlign {
+    long double ld;
+    long long   ll;
+    double      d;
+    void*       p;
+    void      (*f)();
+};
+
+/// alignment of the blocks returned by an arena, sufficient for any type (including fixed size Eigen types)
+static const size_t arena_alignment =
+    (size_t)EIGEN_MAX_ALIGN_BYTES > boost::alignment_of<MaxAlign>::value ?
+    (size_t)EIGEN_MAX_ALIGN_BYTES : boost::alignment_of<MaxAlign>::value;
+
+/// count of the GraphArena in Storage::live, larger than any number of allocations
+static const long arena_count = std::numeric_limits<long>::max()/2;
+
+GraphArena::Storage::Storage(size_t _chunk_size):
+    next(0),
+    left(0),
+    chunk_size(_chunk_size),
+    nr_of_bytes(0),
+    nr_of_allocations(0),
+    live(arena_count) {
+}
+
+/*
+ * returns n bytes aligned to arena_alignment, which can exceed the alignment of operator new.
+ */
+char* GraphArena::Storage::allocateBlock(size_t n) {
+    char* p = static_cast<char*>(::operator new(n + arena_alignment - 1));
+    blocks.push_back(p);
+    return reinterpret_cast<char*>( (reinterpret_cast<size_t>(p) + arena_alignment - 1) & ~(arena_alignment - 1) );
+}
+
+void* GraphArena::Storage::allocate(size_t n) {
+    n = (n + arena_alignment - 1) & ~(arena_alignment - 1);
+    nr_of_bytes += n;
+    // counted without atomic operation: live is only corrected when the arena is closed.
+    ++nr_of_allocations;
+    if (n > chunk_size/4) {
+        // large blocks get their own chunk, the current chunk is kept.
+        return allocateBlock(n);
+    }
+    if (n > left) {
+        next = allocateBlock(chunk_size);
+        left = chunk_size;
+    }
+    void* p = next;
+    next += n;
+    left -= n;
+    return p;
+}
+
+void GraphArena::Storage::deallocate(void* p) {
+    if (live.fetch_sub(1)==1) {
+        delete this;
+    }
+}
+
+/*
+ * replaces the count of the arena by the number of allocations: live becomes the number of
+ * allocations that are not yet returned.
+ */
+void GraphArena::Storage::close() {
+    long delta = nr_of_allocations - arena_count;
+    if (live.fetch_add(delta)+delta==0) {
+        delete this;
+    }
+}
+
+GraphArena::Storage::~Storage() {
+    for (size_t i=0;i<blocks.size();++i) {
+        ::operator delete(blocks[i]);
+    }
+}
+
+template <typename T>
+static void no_cleanup(T*) {}
+
+static boost::thread_specific_ptr<GraphArena> current_arena(&no_cleanup<GraphArena>);
+
+GraphArena::GraphArena(size_t chunk_size):
+    memory(new Storage(chunk_size)),
+    previous(current_arena.get()) {
+    current_arena.reset(this);
+}
+
+GraphArena::Storage* GraphArena::current() {
+    GraphArena* a = current_arena.get();
+    return a ? a->memory : 0;
+}
+
+GraphArena::~GraphArena() {
+    assert( current_arena.get() == this );
+    current_arena.reset(previous);
+    memory->close();
+}
+
+/*
+ * sizes of the node types created by make_node(..), constructed on first use.
+ */
+struct NodeSizeTable {
+    boost::mutex                  mutex;
+    std::map<std::string, size_t> sizes;
+};
+
+static NodeSizeTable& node_size_table() {
+    static NodeSizeTable table;
+    return table;
+}
+
+bool register_node_size(const std::type_info& type, size_t size) {
+    NodeSizeTable& t = node_size_table();
+    boost::mutex::scoped_lock lock(t.mutex);
+    t.sizes[type.name()] = size;
+    return true;
+}
+
+size_t node_size(const std::type_info& type) {
+    NodeSizeTable& t = node_size_table();
+    boost::mutex::scoped_lock lock(t.mutex);
+    std::map<std::string, size_t>::const_iterator it = t.sizes.find(type.name());
+    return (it==t.sizes.end()) ? 0 : it->second;
+}
+
+} // namespace KDL
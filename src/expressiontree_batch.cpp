@@ -0,0 +1,127 @@
+/*
+ * expressiontree_batch.cpp
+ *
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#include <kdl/expressiontree_batch.hpp>
+#include <algorithm>
+
+namespace KDL {
+
+static const int batch_value_size[] = { 1, 3, 9, 12, 6, 6 };
+static const int batch_deriv_size[] = { 1, 3, 3,  6, 6, 6 };
+
+/*
+ * number of samples in one task.
+ */
+static const int batch_chunk = 64;
+
+/*
+ * task k evaluates the samples k*batch_chunk .. (k+1)*batch_chunk-1, using the
+ * context of the worker.
+ */
+class BatchTask: public TaskPool::Task {
+public:
+    const ExpressionTape&  tape;
+    TapeSlot               slot;
+    const Eigen::MatrixXd& inputs;
+    Eigen::MatrixXd&       values;
+    Eigen::MatrixXd*       jacobians;
+    VarIndexSet            vars;
+    std::vector<EvalContext::Ptr>     ctx;  // context of each worker
+    std::vector< std::vector<double> > x;   // input vector of each worker
+
+    BatchTask(const ExpressionTape& _tape, int output, const Eigen::MatrixXd& _inputs,
+              Eigen::MatrixXd& _values, Eigen::MatrixXd* _jacobians, int nworkers):
+        tape(_tape),
+        slot(_tape.outputs[output]),
+        inputs(_inputs),
+        values(_values),
+        jacobians(_jacobians),
+        ctx(nworkers),
+        x(nworkers, std::vector<double>(_inputs.rows())) {
+        for (int i=0;i<inputs.rows();++i) {
+            vars.push_back(i);
+        }
+        // contexts are created here, since cloning the opaque nodes is not thread-safe:
+        for (int w=0;w<nworkers;++w) {
+            ctx[w] = tape.createContext();
+        }
+    }
+
+    void evaluate(EvalContext& ctx, int k, std::vector<double>& x) {
+        for (int i=0;i<inputs.rows();++i) {
+            x[i] = inputs(i,k);
+        }
+        tape.setInputValues(ctx, x);
+        tape.evaluate(ctx);
+        const double* v = ctx.values() + slot.value;
+        for (int r=0;r<batch_value_size[slot.type];++r) {
+            values(r,k) = v[r];
+        }
+        if (jacobians==0) {
+            return;
+        }
+        int    nd = batch_deriv_size[slot.type];
+        double d[6];
+        for (size_t i=0;i<vars.size();i+=ExpressionTape::lanes) {
+            int n = std::min<int>(ExpressionTape::lanes, vars.size()-i);
+            tape.evaluateDerivatives(ctx, &vars[i], n);
+            for (int l=0;l<n;++l) {
+                ExpressionTape::laneDerivative(ctx, slot, l, d);
+                for (int c=0;c<nd;++c) {
+                    (*jacobians)(c + nd*(i+l), k) = d[c];
+                }
+            }
+        }
+    }
+
+    virtual void run(int k, int w) {
+        int last = std::min<int>((k+1)*batch_chunk, inputs.cols());
+        for (int j=k*batch_chunk;j<last;++j) {
+            evaluate(*ctx[w], j, x[w]);
+        }
+    }
+};
+
+void evaluate_batch(const ExpressionTape& tape, int output, const Eigen::MatrixXd& inputs,
+                    Eigen::MatrixXd& values, Eigen::MatrixXd* jacobians, TaskPool& pool) {
+    const TapeSlot& slot = tape.outputs[output];
+    int N = inputs.cols();
+    if ((values.rows()!=batch_value_size[slot.type]) || (values.cols()!=N)) {
+        values.resize(batch_value_size[slot.type], N);
+    }
+    if ((jacobians!=0) &&
+        ((jacobians->rows()!=batch_deriv_size[slot.type]*inputs.rows()) || (jacobians->cols()!=N))) {
+        jacobians->resize(batch_deriv_size[slot.type]*inputs.rows(), N);
+    }
+    int ntasks = (N+batch_chunk-1)/batch_chunk;
+    BatchTask task(tape, output, inputs, values, jacobians, pool.size());
+    pool.run(task, ntasks);
+}
+
+void evaluate_batch(const ExpressionTape& tape, int output, const Eigen::MatrixXd& inputs,
+                    Eigen::MatrixXd& values, Eigen::MatrixXd* jacobians, int nthreads) {
+    if (nthreads<=0) {
+        nthreads = std::max<int>(1, boost::thread::hardware_concurrency());
+    }
+    TaskPool pool(std::max(1, std::min(nthreads, (int)(inputs.cols()+batch_chunk-1)/batch_chunk)));
+    evaluate_batch(tape, output, inputs, values, jacobians, pool);
+}
+
+} // namespace KDL
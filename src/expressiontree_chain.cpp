@@ -72,7 +72,7 @@ Frame Expression_Chain::value() {
     unsigned int jointndx=0;
     T_base_head = Frame::Identity(); // frame w.r.t. base of head
     for (unsigned int i=0;i<chain.getNrOfSegments();i++) {
-        Segment segment = chain.getSegment(i);
+        const Segment& segment = chain.getSegment(i);
         if (segment.getJoint().getType()!=Joint::None) {
             T_base_jointroot[jointndx] = T_base_head;
             T_base_head                = T_base_head * segment.pose(jval[jointndx]);
@@ -99,7 +99,7 @@ Twist Expression_Chain::derivative(int var_ndx) {
         return jacobian[jointndx];
     }
     int segmentndx = jointndx_to_segmentndx[ jointndx ];
-    Segment segment=chain.getSegment(segmentndx);
+    const Segment& segment = chain.getSegment(segmentndx);
     jacobian[jointndx]     = ( T_base_jointroot[jointndx].M * segment.twist(jval[jointndx],1.0) ).RefPoint( T_base_head.p - T_base_jointtip[jointndx].p);
     cached_deriv[jointndx] = true;
     return jacobian[jointndx];
@@ -179,12 +179,16 @@ Twist Expression_Chain::derivative_dot(int column, const std::vector<double>& jv
 }
 
 Expression<Frame>::Ptr Expression_Chain::clone() {
-    Expression<Frame>::Ptr expr(
-        new Expression_Chain( chain, index_of_first_joint )
-    );
+    Expression<Frame>::Ptr expr = make_node<Expression_Chain>( chain, index_of_first_joint );
     return expr;
 }
 
+size_t Expression_Chain::cacheBytes() const {
+    return jval.capacity()*sizeof(double) + T_base_jointroot.capacity()*sizeof(Frame)
+         + T_base_jointtip.capacity()*sizeof(Frame) + jacobian.capacity()*sizeof(Twist)
+         + cached_deriv.capacity()/8;
+}
+
 Expression<Twist>::Ptr Expression_Chain::derivativeExpression(int i) 
 {
     boost::shared_ptr<Expression_Chain> chain( this );
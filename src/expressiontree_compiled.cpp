@@ -0,0 +1,1755 @@
+/*
+ * expressiontree_compiled.cpp
+ *
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#include <kdl/expressiontree_compiled.hpp>
+#include <kdl/expressiontree_double.hpp>
+#include <kdl/expressiontree_vector.hpp>
+#include <kdl/expressiontree_rotation.hpp>
+#include <kdl/expressiontree_frame.hpp>
+#include <kdl/expressiontree_twist.hpp>
+#include <kdl/expressiontree_wrench.hpp>
+#include <typeinfo>
+#include <string>
+#include <algorithm>
+
+/**
+ * number of derivatives (tangents) that ExpressionTape::evaluateDerivatives(..)
+ * propagates in one pass over the tape.  Use 4 for AVX2 and 8 for AVX-512.
+ * Only defined here: clients read the value through ExpressionTape::lanes.
+ */
+#ifndef EXPRESSIONGRAPH_TAPE_LANES
+#define EXPRESSIONGRAPH_TAPE_LANES 4
+#endif
+
+namespace KDL {
+
+/*
+ * Instruction set of the tape.  OP_CONSTANT and OP_CACHED never appear on the
+ * tape, they are only used during lowering.
+ */
+enum {
+    OP_CONSTANT=0,
+    OP_CACHED,
+    OP_INPUT_DOUBLE,
+    OP_INPUT_ROTATION,
+    OP_OPAQUE_DOUBLE,
+    OP_OPAQUE_VECTOR,
+    OP_OPAQUE_ROTATION,
+    OP_OPAQUE_FRAME,
+    OP_OPAQUE_TWIST,
+    OP_OPAQUE_WRENCH,
+    OP_ADD,
+    OP_SUB,
+    OP_NEGATE,
+    OP_SCALE,
+    OP_MUL,
+    OP_DIV,
+    OP_ATAN2,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_ASIN,
+    OP_ACOS,
+    OP_EXP,
+    OP_LOG,
+    OP_SQRT,
+    OP_ATAN,
+    OP_ABS,
+    OP_SQR,
+    OP_FMOD,
+    OP_COPY,
+    OP_VECTOR,
+    OP_CONCAT,
+    OP_DOT,
+    OP_CROSS,
+    OP_SQUARED_NORM,
+    OP_NORM,
+    OP_ROT,
+    OP_ROTVEC,
+    OP_ROTX,
+    OP_ROTY,
+    OP_ROTZ,
+    OP_INV_ROTATION,
+    OP_COMPOSE_RR,
+    OP_COMPOSE_RV,
+    OP_UNITX,
+    OP_UNITY,
+    OP_UNITZ,
+    OP_CONSTRUCT_ROTATION,
+    OP_GET_ROTVEC,
+    OP_GET_RPY,
+    OP_FRAME,
+    OP_INV_FRAME,
+    OP_COMPOSE_FF,
+    OP_COMPOSE_FV,
+    OP_COMPOSE_R6,
+    OP_REFPOINT_TWIST,
+    OP_REFPOINT_WRENCH,
+    OP_CONDITIONAL,
+    OP_NEAR_ZERO,
+    OP_MAKE_CONSTANT,
+    OP_BLOCKWAVE,
+    OP_COUNT
+};
+
+static const char* opcode_names[OP_COUNT] = {
+    "constant", "cached", "input", "input_rot",
+    "opaque_double", "opaque_vector", "opaque_rotation", "opaque_frame", "opaque_twist", "opaque_wrench",
+    "add", "sub", "negate", "scale", "mul", "div", "atan2",
+    "sin", "cos", "tan", "asin", "acos", "exp", "log", "sqrt", "atan", "abs", "sqr", "fmod",
+    "copy", "vector", "concat", "dot", "cross", "squared_norm", "norm",
+    "rot", "rotVec", "rot_x", "rot_y", "rot_z", "inv_rot", "compose_rr", "compose_rv",
+    "unit_x", "unit_y", "unit_z", "construct_rotation", "getRotVec", "getRPY",
+    "frame", "inv_frame", "compose_ff", "compose_fv", "compose_r6",
+    "ref_point_twist", "ref_point_wrench",
+    "conditional", "near_zero", "make_constant", "blockwave"
+};
+
+static const int value_size[] = { 1, 3, 9, 12, 6, 6 };
+static const int deriv_size[] = { 1, 3, 3,  6, 6, 6 };
+
+/*
+ * Lowering table: for each node type, the opcode, the argument nodes and the
+ * parameters that are stored in the aux part of the instruction.
+ */
+typedef void (*ArgumentsFunction)(ExpressionBase* e, ExpressionBase** args);
+typedef void (*ParametersFunction)(ExpressionBase* e, double* aux);
+
+struct OpcodeEntry {
+    int                 opcode;
+    int                 type;      ///< type of the result
+    int                 nargs;
+    int                 aux_size;
+    int                 voffset;   ///< offset in the value of the first argument (OP_COPY)
+    int                 doffset;   ///< offset in the derivative of the first argument (OP_COPY)
+    ArgumentsFunction   arguments;
+    ParametersFunction  parameters;
+};
+
+typedef std::map<std::string,OpcodeEntry> OpcodeTable;
+
+template <class N>
+static void unary_arguments(ExpressionBase* e, ExpressionBase** a) {
+    a[0] = static_cast<N*>(e)->argument.get();
+}
+
+template <class N>
+static void binary_arguments(ExpressionBase* e, ExpressionBase** a) {
+    a[0] = static_cast<N*>(e)->argument1.get();
+    a[1] = static_cast<N*>(e)->argument2.get();
+}
+
+template <class N>
+static void ternary_arguments(ExpressionBase* e, ExpressionBase** a) {
+    a[0] = static_cast<N*>(e)->argument1.get();
+    a[1] = static_cast<N*>(e)->argument2.get();
+    a[2] = static_cast<N*>(e)->argument3.get();
+}
+
+// diff(a,b) == b-a
+static void diff_arguments(ExpressionBase* e, ExpressionBase** a) {
+    a[0] = static_cast<Diff_VectorVector*>(e)->argument2.get();
+    a[1] = static_cast<Diff_VectorVector*>(e)->argument1.get();
+}
+
+template <class T>
+static void constant_parameters(ExpressionBase* e, double* p) {
+    TapeTrait<T>::store(p, static_cast<ConstantType<T>*>(e)->val);
+}
+
+static void fmod_parameters(ExpressionBase* e, double* p) {
+    p[0] = static_cast<Fmod_Double*>(e)->denominator;
+}
+
+static void rot_parameters(ExpressionBase* e, double* p) {
+    TapeTrait<Vector>::store(p, static_cast<Rot_Double*>(e)->axis);
+}
+
+template <class R>
+static void nearzero_parameters(ExpressionBase* e, double* p) {
+    p[1] = static_cast<NearZero_double<R>*>(e)->tolerance;
+}
+
+template <class R>
+static void blockwave_parameters(ExpressionBase* e, double* p) {
+    BlockWave<R>* n = static_cast<BlockWave<R>*>(e);
+    p[0] = n->period;
+    TapeTrait<R>::store(p+1,                   n->level1);
+    TapeTrait<R>::store(p+1+TapeTrait<R>::size, n->level2);
+}
+
+static void blockwave_double_parameters(ExpressionBase* e, double* p) {
+    BlockWave_double* n = static_cast<BlockWave_double*>(e);
+    p[0] = n->period;
+    p[1] = n->level1;
+    p[2] = n->level2;
+}
+
+template <class N>
+static void define(OpcodeTable& table, int opcode, int type, int nargs, ArgumentsFunction args,
+                   int aux_size=0, ParametersFunction params=0, int voffset=0, int doffset=0) {
+    OpcodeEntry entry;
+    entry.opcode     = opcode;
+    entry.type       = type;
+    entry.nargs      = nargs;
+    entry.aux_size   = aux_size;
+    entry.voffset    = voffset;
+    entry.doffset    = doffset;
+    entry.arguments  = args;
+    entry.parameters = params;
+    table[typeid(N).name()] = entry;
+}
+
+template <class N>
+static void define_unary(OpcodeTable& table, int opcode, int type, int aux_size=0, ParametersFunction params=0) {
+    define<N>(table, opcode, type, 1, &unary_arguments<N>, aux_size, params);
+}
+
+template <class N>
+static void define_binary(OpcodeTable& table, int opcode, int type, int aux_size=0) {
+    define<N>(table, opcode, type, 2, &binary_arguments<N>, aux_size);
+}
+
+template <class N>
+static void define_copy(OpcodeTable& table, int type, int voffset, int doffset) {
+    define<N>(table, OP_COPY, type, 1, &unary_arguments<N>, 0, 0, voffset, doffset);
+}
+
+// node types that exist for every type R:
+template <class R>
+static void define_generic(OpcodeTable& table) {
+    const int type = TapeTrait<R>::type;
+    const int size = TapeTrait<R>::size;
+    define<ConstantType<R> >(table, OP_CONSTANT, type, 0, 0, 0, &constant_parameters<R>);
+    define_unary<CachedType<R> >(table, OP_CACHED, type);
+    define_unary<MakeConstantType<R> >(table, OP_MAKE_CONSTANT, type);
+    define<Conditional_double<R> >(table, OP_CONDITIONAL, type, 3, &ternary_arguments<Conditional_double<R> >, 1);
+    define<NearZero_double<R> >(table, OP_NEAR_ZERO, type, 3, &ternary_arguments<NearZero_double<R> >,
+                                2, &nearzero_parameters<R>);
+    define_unary<BlockWave<R> >(table, OP_BLOCKWAVE, type, 1+2*size, &blockwave_parameters<R>);
+}
+
+static OpcodeTable build_opcode_table() {
+    OpcodeTable table;
+    define_generic<double>(table);
+    define_generic<Vector>(table);
+    define_generic<Rotation>(table);
+    define_generic<Frame>(table);
+    define_generic<Twist>(table);
+    define_generic<Wrench>(table);
+
+    define<InputType>(table, OP_INPUT_DOUBLE, TAPE_DOUBLE, 0, 0);
+    define<InputRotationType>(table, OP_INPUT_ROTATION, TAPE_ROTATION, 0, 0);
+
+    // expressiontree_double.hpp
+    define_binary<Addition_DoubleDouble>(table, OP_ADD, TAPE_DOUBLE);
+    define_binary<Subtraction_DoubleDouble>(table, OP_SUB, TAPE_DOUBLE);
+    define_binary<Multiplication_DoubleDouble>(table, OP_MUL, TAPE_DOUBLE);
+    define_binary<Division_DoubleDouble>(table, OP_DIV, TAPE_DOUBLE);
+    define_binary<Atan2_DoubleDouble>(table, OP_ATAN2, TAPE_DOUBLE, 1);
+    define_unary<Negate_Double>(table, OP_NEGATE, TAPE_DOUBLE);
+    define_unary<Sin_Double>(table, OP_SIN, TAPE_DOUBLE, 1);
+    define_unary<Cos_Double>(table, OP_COS, TAPE_DOUBLE, 1);
+    define_unary<Tan_Double>(table, OP_TAN, TAPE_DOUBLE, 1);
+    define_unary<Asin_Double>(table, OP_ASIN, TAPE_DOUBLE, 1);
+    define_unary<Acos_Double>(table, OP_ACOS, TAPE_DOUBLE, 1);
+    define_unary<Exp_Double>(table, OP_EXP, TAPE_DOUBLE, 1);
+    define_unary<Log_Double>(table, OP_LOG, TAPE_DOUBLE, 1);
+    define_unary<Sqrt_Double>(table, OP_SQRT, TAPE_DOUBLE, 1);
+    define_unary<Atan_Double>(table, OP_ATAN, TAPE_DOUBLE, 1);
+    define_unary<Abs_Double>(table, OP_ABS, TAPE_DOUBLE, 1);
+    define_unary<Sqr_Double>(table, OP_SQR, TAPE_DOUBLE, 1);
+    define_unary<Fmod_Double>(table, OP_FMOD, TAPE_DOUBLE, 1, &fmod_parameters);
+    define_unary<BlockWave_double>(table, OP_BLOCKWAVE, TAPE_DOUBLE, 3, &blockwave_double_parameters);
+
+    // expressiontree_vector.hpp
+    define<Vector_DoubleDoubleDouble>(table, OP_VECTOR, TAPE_VECTOR, 3, &ternary_arguments<Vector_DoubleDoubleDouble>);
+    define_binary<Dot_VectorVector>(table, OP_DOT, TAPE_DOUBLE);
+    define_binary<CrossProduct_VectorVector>(table, OP_CROSS, TAPE_VECTOR);
+    define_binary<Addition_VectorVector>(table, OP_ADD, TAPE_VECTOR);
+    define_binary<Subtraction_VectorVector>(table, OP_SUB, TAPE_VECTOR);
+    define<Diff_VectorVector>(table, OP_SUB, TAPE_VECTOR, 2, &diff_arguments);
+    define_unary<Negate_Vector>(table, OP_NEGATE, TAPE_VECTOR);
+    define_unary<SquaredNorm_Vector>(table, OP_SQUARED_NORM, TAPE_DOUBLE);
+    define_unary<Norm_Vector>(table, OP_NORM, TAPE_DOUBLE);
+    define_binary<Multiplication_VectorDouble>(table, OP_SCALE, TAPE_VECTOR);
+    define_copy<CoordX_Vector>(table, TAPE_DOUBLE, 0, 0);
+    define_copy<CoordY_Vector>(table, TAPE_DOUBLE, 1, 1);
+    define_copy<CoordZ_Vector>(table, TAPE_DOUBLE, 2, 2);
+
+    // expressiontree_rotation.hpp
+    define_unary<Rot_Double>(table, OP_ROT, TAPE_ROTATION, 3, &rot_parameters);
+    define_binary<RotVec_Double>(table, OP_ROTVEC, TAPE_ROTATION);
+    define_unary<RotX_Double>(table, OP_ROTX, TAPE_ROTATION);
+    define_unary<RotY_Double>(table, OP_ROTY, TAPE_ROTATION);
+    define_unary<RotZ_Double>(table, OP_ROTZ, TAPE_ROTATION);
+    define_unary<Inverse_Rotation>(table, OP_INV_ROTATION, TAPE_ROTATION);
+    define_binary<Composition_RotationRotation>(table, OP_COMPOSE_RR, TAPE_ROTATION);
+    define_binary<Composition_RotationVector>(table, OP_COMPOSE_RV, TAPE_VECTOR);
+    define_unary<UnitX_Rotation>(table, OP_UNITX, TAPE_VECTOR);
+    define_unary<UnitY_Rotation>(table, OP_UNITY, TAPE_VECTOR);
+    define_unary<UnitZ_Rotation>(table, OP_UNITZ, TAPE_VECTOR);
+    define<Construct_Rotation>(table, OP_CONSTRUCT_ROTATION, TAPE_ROTATION, 3, &ternary_arguments<Construct_Rotation>);
+    define_unary<Get_Rotation_Vector>(table, OP_GET_ROTVEC, TAPE_VECTOR);
+    define_unary<Get_RPY_Rotation>(table, OP_GET_RPY, TAPE_VECTOR, 6);
+
+    // expressiontree_frame.hpp
+    define_binary<Frame_RotationVector>(table, OP_FRAME, TAPE_FRAME);
+    define_unary<Inverse_Frame>(table, OP_INV_FRAME, TAPE_FRAME);
+    define_binary<Composition_FrameFrame>(table, OP_COMPOSE_FF, TAPE_FRAME);
+    define_binary<Composition_FrameVector>(table, OP_COMPOSE_FV, TAPE_VECTOR);
+    define_copy<Origin_Frame>(table, TAPE_VECTOR, 9, 0);
+    define_copy<Rotation_Frame>(table, TAPE_ROTATION, 0, 3);
+
+    // expressiontree_twist.hpp
+    define_binary<Twist_VectorVector>(table, OP_CONCAT, TAPE_TWIST);
+    define_unary<Negate_Twist>(table, OP_NEGATE, TAPE_TWIST);
+    define_copy<Velocity_Twist>(table, TAPE_VECTOR, 0, 0);
+    define_copy<RotVelocity_Twist>(table, TAPE_VECTOR, 3, 3);
+    define_binary<Addition_TwistTwist>(table, OP_ADD, TAPE_TWIST);
+    define_binary<Subtraction_TwistTwist>(table, OP_SUB, TAPE_TWIST);
+    define_binary<Composition_RotationTwist>(table, OP_COMPOSE_R6, TAPE_TWIST);
+    define_binary<Multiplication_TwistDouble>(table, OP_SCALE, TAPE_TWIST);
+    define_binary<RefPoint_TwistVector>(table, OP_REFPOINT_TWIST, TAPE_TWIST);
+
+    // expressiontree_wrench.hpp
+    define_binary<Wrench_VectorVector>(table, OP_CONCAT, TAPE_WRENCH);
+    define_copy<Force_Wrench>(table, TAPE_VECTOR, 0, 0);
+    define_copy<Torque_Wrench>(table, TAPE_VECTOR, 3, 3);
+    define_unary<Negate_Wrench>(table, OP_NEGATE, TAPE_WRENCH);
+    define_binary<Addition_WrenchWrench>(table, OP_ADD, TAPE_WRENCH);
+    define_binary<Subtraction_WrenchWrench>(table, OP_SUB, TAPE_WRENCH);
+    define_binary<Composition_RotationWrench>(table, OP_COMPOSE_R6, TAPE_WRENCH);
+    define_binary<Multiplication_WrenchDouble>(table, OP_SCALE, TAPE_WRENCH);
+    define_binary<RefPoint_WrenchVector>(table, OP_REFPOINT_WRENCH, TAPE_WRENCH);
+    return table;
+}
+
+/*
+ * the table is filled in one step, during the (thread-safe) initialization of the static,
+ * such that tapes can be compiled concurrently.
+ */
+static const OpcodeTable& opcode_table() {
+    static const OpcodeTable table = build_opcode_table();
+    return table;
+}
+
+/*
+ * type of a node that is not in the lowering table.
+ */
+static int opaque_type(ExpressionBase* e) {
+    if (dynamic_cast<Expression<double>*>(e))   return TAPE_DOUBLE;
+    if (dynamic_cast<Expression<Vector>*>(e))   return TAPE_VECTOR;
+    if (dynamic_cast<Expression<Rotation>*>(e)) return TAPE_ROTATION;
+    if (dynamic_cast<Expression<Frame>*>(e))    return TAPE_FRAME;
+    if (dynamic_cast<Expression<Twist>*>(e))    return TAPE_TWIST;
+    if (dynamic_cast<Expression<Wrench>*>(e))   return TAPE_WRENCH;
+    throw std::invalid_argument("ExpressionTape: cannot compile a node of type "+demangle(typeid(*e).name()));
+}
+
+const int ExpressionTape::lanes = EXPRESSIONGRAPH_TAPE_LANES;
+
+ExpressionTape::ExpressionTape():
+    nr_of_dvalues(0),
+    nr_of_derivs(0) {
+}
+
+TapeSlot ExpressionTape::allocate(int type) {
+    TapeSlot s;
+    s.type  = type;
+    s.value = values.size();
+    s.deriv = nr_of_dvalues;
+    values.resize(values.size() + value_size[type], 0.0);
+    producer.resize(values.size(), -1);
+    nr_of_dvalues += deriv_size[type];
+    return s;
+}
+
+/*
+ * appends instruction k to the list of variable number var.
+ */
+static void add_to_variable(std::vector< std::vector<int> >& lists, int var, int k) {
+    if (var >= (int)lists.size()) {
+        lists.resize(var+1);
+    }
+    if (lists[var].empty() || (lists[var].back()!=k)) {
+        lists[var].push_back(k);
+    }
+}
+
+TapeSlot ExpressionTape::lower(ExpressionBase* e) {
+    std::map<ExpressionBase*,TapeSlot>::iterator it = slots.find(e);
+    if (it!=slots.end()) {
+        return it->second;
+    }
+    const OpcodeTable& table = opcode_table();
+    OpcodeTable::const_iterator entry = table.find(typeid(*e).name());
+    TapeInstruction ins;
+    ins.aux   = 0;
+    ins.index = 0;
+    ins.node  = 0;
+    for (int k=0;k<3;++k) {
+        ins.arg[k]  = 0;
+        ins.darg[k] = 0;
+    }
+    TapeSlot s;
+    int      children[3];
+    int      nr_of_children = 0;
+    if (entry==table.end()) {
+        s          = allocate(opaque_type(e));
+        ins.opcode = OP_OPAQUE_DOUBLE + s.type;
+        ins.node   = e;
+        ins.index  = opaque.size();
+        opaque.push_back(e);
+        opaque_instructions.push_back(instructions.size());
+        VarIndexSet dep;
+        e->dependencies().getVariables(dep);
+        for (size_t j=0;j<dep.size();++j) {
+            add_to_variable(opaque_of, dep[j], instructions.size());
+            // a rotational input at dep[j]-2, dep[j]-1 or dep[j] sets the variable dep[j]:
+            for (int r=std::max(dep[j]-2,0);r<=dep[j];++r) {
+                add_to_variable(opaque_rot_of, r, instructions.size());
+            }
+        }
+    } else if (entry->second.opcode==OP_CACHED) {
+        ExpressionBase* args[3];
+        entry->second.arguments(e,args);
+        s = lower(args[0]);
+        slots[e] = s;
+        return s;
+    } else if (entry->second.opcode==OP_CONSTANT) {
+        s = allocate(entry->second.type);
+        entry->second.parameters(e, &values[s.value]);
+        slots[e] = s;
+        return s;
+    } else {
+        const OpcodeEntry& op = entry->second;
+        ExpressionBase* args[3];
+        if (op.nargs > 0) {
+            op.arguments(e,args);
+        }
+        for (int k=0;k<op.nargs;++k) {
+            TapeSlot a  = lower(args[k]);
+            ins.arg[k]  = a.value;
+            ins.darg[k] = a.deriv;
+            if (producer[a.value]>=0) {
+                children[nr_of_children++] = producer[a.value];
+            }
+        }
+        ins.arg[0]  += op.voffset;
+        ins.darg[0] += op.doffset;
+        s          = allocate(op.type);
+        ins.opcode = op.opcode;
+        ins.aux    = values.size();
+        values.resize(values.size() + op.aux_size, 0.0);
+        if (op.parameters) {
+            op.parameters(e, &values[ins.aux]);
+        }
+        if (op.opcode==OP_INPUT_DOUBLE) {
+            InputType* n = static_cast<InputType*>(e);
+            ins.index      = n->variable_number;
+            values[s.value] = n->value();
+            scalar_inputs.push_back(instructions.size());
+            add_to_variable(scalar_inputs_of, ins.index, instructions.size());
+        } else if (op.opcode==OP_INPUT_ROTATION) {
+            InputRotationType* n = static_cast<InputRotationType*>(e);
+            ins.index      = n->variable_number;
+            TapeTrait<Rotation>::store(&values[s.value], n->value());
+            rot_inputs.push_back(instructions.size());
+            add_to_variable(rot_inputs_of, ins.index, instructions.size());
+        }
+    }
+    ins.vsize   = value_size[s.type];
+    ins.dsize   = deriv_size[s.type];
+    ins.result  = s.value;
+    ins.dresult = s.deriv;
+    producer[s.value] = instructions.size();
+    parents.push_back(std::vector<int>());
+    for (int k=0;k<nr_of_children;++k) {
+        std::vector<int>& p = parents[children[k]];
+        if (std::find(p.begin(),p.end(),(int)instructions.size())==p.end()) {
+            p.push_back(instructions.size());
+        }
+    }
+    instructions.push_back(ins);
+    slots[e] = s;
+    return s;
+}
+
+int ExpressionTape::addOutput(ExpressionBase::Ptr e) {
+    outputs.push_back( lower(e.get()) );
+    roots.push_back(e);
+    // number_of_derivatives() is only defined on Expression<T>:
+    int n = 0;
+    switch (outputs.back().type) {
+        case TAPE_DOUBLE:   n = static_cast<Expression<double>*>(e.get())->number_of_derivatives(); break;
+        case TAPE_VECTOR:   n = static_cast<Expression<Vector>*>(e.get())->number_of_derivatives(); break;
+        case TAPE_ROTATION: n = static_cast<Expression<Rotation>*>(e.get())->number_of_derivatives(); break;
+        case TAPE_FRAME:    n = static_cast<Expression<Frame>*>(e.get())->number_of_derivatives(); break;
+        case TAPE_TWIST:    n = static_cast<Expression<Twist>*>(e.get())->number_of_derivatives(); break;
+        case TAPE_WRENCH:   n = static_cast<Expression<Wrench>*>(e.get())->number_of_derivatives(); break;
+    }
+    nr_of_derivs = std::max(nr_of_derivs, n);
+    return outputs.size()-1;
+}
+
+/*
+ * sizes the buffers of ctx for the current size of the tape.  Values that are already in ctx are kept,
+ * the values of instructions added since the last call are initialized from the initial value buffer.
+ */
+void ExpressionTape::layout(EvalContext& ctx) const {
+    int nv = (int)values.size();
+    int nd = nr_of_dvalues;
+    std::vector<double> data(nv + nd*(2+lanes), 0.0);
+    std::copy(values.begin(), values.end(), data.begin());
+    if (!ctx.data.empty()) {
+        std::copy(ctx.data.begin(), ctx.data.begin()+ctx.nvalues, data.begin());
+    }
+    ctx.data.swap(data);
+    ctx.nvalues = nv;
+    ctx.nderivs = nd;
+    ctx.dirty.assign(instructions.size(), 1);
+    ctx.pending.clear();
+    ctx.pending.reserve(instructions.size());
+}
+
+void ExpressionTape::markDirty(EvalContext& ctx, int k) const {
+    if (ctx.dirty[k]) {
+        // the ancestors of a dirty instruction are always dirty.
+        return;
+    }
+    ctx.dirty[k] = 1;
+    ctx.pending.push_back(k);
+    while (!ctx.pending.empty()) {
+        const std::vector<int>& p = parents[ctx.pending.back()];
+        ctx.pending.pop_back();
+        for (size_t j=0;j<p.size();++j) {
+            if (!ctx.dirty[p[j]]) {
+                ctx.dirty[p[j]] = 1;
+                ctx.pending.push_back(p[j]);
+            }
+        }
+    }
+}
+
+void ExpressionTape::invalidate(EvalContext& ctx) const {
+    std::fill(ctx.dirty.begin(), ctx.dirty.end(), 1);
+}
+
+template <typename T>
+static ExpressionBase::Ptr clone_node(CloneContext& cc, ExpressionBase* e) {
+    ExpressionBase::Ptr c = cc.lookup(e);
+    if (!c) {
+        c = static_cast<Expression<T>*>(e)->clone();
+        cc.insert(e, c);
+    }
+    return c;
+}
+
+EvalContext::Ptr ExpressionTape::createContext() const {
+    EvalContext::Ptr ctx( new EvalContext() );
+    layout(*ctx);
+    CloneContext cc;
+    for (size_t k=0;k<opaque.size();++k) {
+        ExpressionBase::Ptr c;
+        switch (opaque_type(opaque[k])) {
+            case TAPE_DOUBLE:   c = clone_node<double>(cc, opaque[k]);   break;
+            case TAPE_VECTOR:   c = clone_node<Vector>(cc, opaque[k]);   break;
+            case TAPE_ROTATION: c = clone_node<Rotation>(cc, opaque[k]); break;
+            case TAPE_FRAME:    c = clone_node<Frame>(cc, opaque[k]);    break;
+            case TAPE_TWIST:    c = clone_node<Twist>(cc, opaque[k]);    break;
+            case TAPE_WRENCH:   c = clone_node<Wrench>(cc, opaque[k]);   break;
+        }
+        ctx->clones.push_back(c);
+        ctx->nodes.push_back(c.get());
+    }
+    return ctx;
+}
+
+EvalContext& ExpressionTape::context() {
+    if (!default_context) {
+        default_context.reset( new EvalContext() );
+    }
+    if ((default_context->nvalues != (int)values.size()) || (default_context->nderivs != nr_of_dvalues)) {
+        layout(*default_context);
+        default_context->nodes = opaque;
+    }
+    return *default_context;
+}
+
+void ExpressionTape::setInputValue(int variable_number, double val) {
+    setInputValue(context(), variable_number, val);
+}
+
+void ExpressionTape::setInputValue(int variable_number, const Rotation& val) {
+    setInputValue(context(), variable_number, val);
+}
+
+void ExpressionTape::setInputValues(const std::vector<double>& vals) {
+    setInputValues(context(), vals);
+}
+
+void ExpressionTape::setInputValues(const std::vector<int>& ndx, const std::vector<double>& vals) {
+    setInputValues(context(), ndx, vals);
+}
+
+void ExpressionTape::setInputValue(EvalContext& ctx, int variable_number, double val) const {
+    if (variable_number < 0) {
+        return;
+    }
+    double* v = ctx.values();
+    if (variable_number < (int)scalar_inputs_of.size()) {
+        const std::vector<int>& in = scalar_inputs_of[variable_number];
+        for (size_t k=0;k<in.size();++k) {
+            const TapeInstruction& ins = instructions[in[k]];
+            if (v[ins.result]!=val) {
+                v[ins.result] = val;
+                markDirty(ctx, in[k]);
+            }
+        }
+    }
+    if (variable_number < (int)opaque_of.size()) {
+        const std::vector<int>& op = opaque_of[variable_number];
+        for (size_t k=0;k<op.size();++k) {
+            ctx.nodes[instructions[op[k]].index]->setInputValue(variable_number,val);
+            markDirty(ctx, op[k]);
+        }
+    }
+}
+
+void ExpressionTape::setInputValue(EvalContext& ctx, int variable_number, const Rotation& val) const {
+    if (variable_number < 0) {
+        return;
+    }
+    double* v = ctx.values();
+    if (variable_number < (int)rot_inputs_of.size()) {
+        const std::vector<int>& in = rot_inputs_of[variable_number];
+        for (size_t k=0;k<in.size();++k) {
+            const TapeInstruction& ins = instructions[in[k]];
+            if (!std::equal(val.data, val.data+9, v+ins.result)) {
+                TapeTrait<Rotation>::store(v+ins.result, val);
+                markDirty(ctx, in[k]);
+            }
+        }
+    }
+    if (variable_number < (int)opaque_rot_of.size()) {
+        const std::vector<int>& op = opaque_rot_of[variable_number];
+        for (size_t k=0;k<op.size();++k) {
+            ctx.nodes[instructions[op[k]].index]->setInputValue(variable_number,val);
+            markDirty(ctx, op[k]);
+        }
+    }
+}
+
+void ExpressionTape::setInputValues(EvalContext& ctx, const std::vector<double>& vals) const {
+    double* v = ctx.values();
+    for (size_t k=0;k<scalar_inputs.size();++k) {
+        const TapeInstruction& ins = instructions[scalar_inputs[k]];
+        if ((ins.index < (int)vals.size()) && (v[ins.result]!=vals[ins.index])) {
+            v[ins.result] = vals[ins.index];
+            markDirty(ctx, scalar_inputs[k]);
+        }
+    }
+    for (size_t k=0;k<opaque_instructions.size();++k) {
+        const TapeInstruction& ins = instructions[opaque_instructions[k]];
+        if (!ctx.nodes[ins.index]->dependencies().empty()) {
+            ctx.nodes[ins.index]->setInputValues(vals);
+            markDirty(ctx, opaque_instructions[k]);
+        }
+    }
+}
+
+void ExpressionTape::setInputValues(EvalContext& ctx, const std::vector<int>& ndx, const std::vector<double>& vals) const {
+    assert(ndx.size()==vals.size());
+    for (size_t i=0;i<ndx.size();++i) {
+        setInputValue(ctx,ndx[i],vals[i]);
+    }
+}
+
+template <typename T>
+inline void opaque_value(const TapeInstruction& ins, ExpressionBase* node, double* v) {
+    TapeTrait<T>::store(v+ins.result, static_cast<Expression<T>*>(node)->value());
+}
+
+template <typename T>
+inline void opaque_derivative(const TapeInstruction& ins, ExpressionBase* node, double* d, int i) {
+    typedef typename AutoDiffTrait<T>::DerivType DerivType;
+    TapeTrait<DerivType>::store(d+ins.dresult, static_cast<Expression<T>*>(node)->derivative(i));
+}
+
+inline Vector load_vector(const double* p) {
+    return Vector(p[0],p[1],p[2]);
+}
+
+inline void store_vector(double* p, const Vector& v) {
+    p[0] = v[0]; p[1] = v[1]; p[2] = v[2];
+}
+
+inline Rotation load_rotation(const double* p) {
+    return TapeTrait<Rotation>::load(p);
+}
+
+void ExpressionTape::evaluate() {
+    evaluate(context());
+}
+
+void ExpressionTape::evaluate(EvalContext& ctx) const {
+    assert( (ctx.nvalues==(int)values.size()) && (ctx.nderivs==nr_of_dvalues) );
+    if (instructions.empty()) {
+        return;
+    }
+    double* v     = ctx.values();
+    char*   dirty = &ctx.dirty[0];
+    for (std::vector<TapeInstruction>::const_iterator it=instructions.begin();it!=instructions.end();++it,++dirty) {
+        if (!*dirty) {
+            continue;
+        }
+        *dirty = 0;
+        const TapeInstruction& ins = *it;
+        const double* a = v + ins.arg[0];
+        const double* b = v + ins.arg[1];
+        const double* c = v + ins.arg[2];
+        double*       r = v + ins.result;
+        double*       x = v + ins.aux;
+        switch (ins.opcode) {
+            case OP_INPUT_DOUBLE:
+            case OP_INPUT_ROTATION:
+                break;
+            case OP_OPAQUE_DOUBLE:   opaque_value<double>(ins,ctx.nodes[ins.index],v);   break;
+            case OP_OPAQUE_VECTOR:   opaque_value<Vector>(ins,ctx.nodes[ins.index],v);   break;
+            case OP_OPAQUE_ROTATION: opaque_value<Rotation>(ins,ctx.nodes[ins.index],v); break;
+            case OP_OPAQUE_FRAME:    opaque_value<Frame>(ins,ctx.nodes[ins.index],v);    break;
+            case OP_OPAQUE_TWIST:    opaque_value<Twist>(ins,ctx.nodes[ins.index],v);    break;
+            case OP_OPAQUE_WRENCH:   opaque_value<Wrench>(ins,ctx.nodes[ins.index],v);   break;
+            case OP_ADD:
+                for (int k=0;k<ins.vsize;++k) r[k] = a[k] + b[k];
+                break;
+            case OP_SUB:
+                for (int k=0;k<ins.vsize;++k) r[k] = a[k] - b[k];
+                break;
+            case OP_NEGATE:
+                for (int k=0;k<ins.vsize;++k) r[k] = -a[k];
+                break;
+            case OP_SCALE:
+                for (int k=0;k<ins.vsize;++k) r[k] = a[k]*b[0];
+                break;
+            case OP_MUL:
+                r[0] = a[0]*b[0];
+                break;
+            case OP_DIV:
+                r[0] = a[0]/b[0];
+                break;
+            case OP_ATAN2:
+                r[0] = atan2(a[0],b[0]);
+                x[0] = 1.0/(a[0]*a[0]+b[0]*b[0]);
+                break;
+            // unary functions: x[0] contains the partial derivative
+            case OP_SIN:
+                r[0] = sin(a[0]);
+                x[0] = cos(a[0]);
+                break;
+            case OP_COS:
+                r[0] = cos(a[0]);
+                x[0] = -sin(a[0]);
+                break;
+            case OP_TAN: {
+                double cs = cos(a[0]);
+                r[0] = tan(a[0]);
+                x[0] = 1.0/(cs*cs);
+                break;
+            }
+            case OP_ASIN:
+                r[0] = asin(a[0]);
+                x[0] = 1.0/sqrt(1.0-a[0]*a[0]);
+                break;
+            case OP_ACOS:
+                r[0] = acos(a[0]);
+                x[0] = -1.0/sqrt(1.0-a[0]*a[0]);
+                break;
+            case OP_EXP:
+                r[0] = exp(a[0]);
+                x[0] = r[0];
+                break;
+            case OP_LOG:
+                r[0] = log(a[0]);
+                x[0] = 1.0/a[0];
+                break;
+            case OP_SQRT:
+                r[0] = sqrt(a[0]);
+                x[0] = 0.5/r[0];
+                break;
+            case OP_ATAN:
+                r[0] = atan(a[0]);
+                x[0] = 1.0/(1.0+a[0]*a[0]);
+                break;
+            case OP_ABS:
+                r[0] = fabs(a[0]);
+                x[0] = KDL::sign(a[0]);
+                break;
+            case OP_SQR:
+                r[0] = a[0]*a[0];
+                x[0] = 2.0*a[0];
+                break;
+            case OP_FMOD:
+                r[0] = fmod(a[0],x[0]);
+                break;
+            case OP_COPY:
+            case OP_MAKE_CONSTANT:
+                for (int k=0;k<ins.vsize;++k) r[k] = a[k];
+                break;
+            case OP_VECTOR:
+                r[0] = a[0]; r[1] = b[0]; r[2] = c[0];
+                break;
+            case OP_CONCAT:
+                r[0] = a[0]; r[1] = a[1]; r[2] = a[2];
+                r[3] = b[0]; r[4] = b[1]; r[5] = b[2];
+                break;
+            case OP_DOT:
+                r[0] = a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+                break;
+            case OP_CROSS:
+                store_vector(r, load_vector(a)*load_vector(b));
+                break;
+            case OP_SQUARED_NORM:
+                r[0] = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
+                break;
+            case OP_NORM:
+                r[0] = sqrt(a[0]*a[0] + a[1]*a[1] + a[2]*a[2] + 1E-12);
+                break;
+            case OP_ROT:
+                TapeTrait<Rotation>::store(r, Rotation::Rot2(load_vector(x),a[0]));
+                break;
+            case OP_ROTVEC:
+                TapeTrait<Rotation>::store(r, Rotation::Rot2(load_vector(a),b[0]));
+                break;
+            case OP_ROTX:
+                TapeTrait<Rotation>::store(r, Rotation::RotX(a[0]));
+                break;
+            case OP_ROTY:
+                TapeTrait<Rotation>::store(r, Rotation::RotY(a[0]));
+                break;
+            case OP_ROTZ:
+                TapeTrait<Rotation>::store(r, Rotation::RotZ(a[0]));
+                break;
+            case OP_INV_ROTATION:
+                TapeTrait<Rotation>::store(r, load_rotation(a).Inverse());
+                break;
+            case OP_COMPOSE_RR:
+                TapeTrait<Rotation>::store(r, load_rotation(a)*load_rotation(b));
+                break;
+            case OP_COMPOSE_RV:
+                store_vector(r, load_rotation(a)*load_vector(b));
+                break;
+            case OP_UNITX:
+                r[0] = a[0]; r[1] = a[3]; r[2] = a[6];
+                break;
+            case OP_UNITY:
+                r[0] = a[1]; r[1] = a[4]; r[2] = a[7];
+                break;
+            case OP_UNITZ:
+                r[0] = a[2]; r[1] = a[5]; r[2] = a[8];
+                break;
+            case OP_CONSTRUCT_ROTATION:
+                TapeTrait<Rotation>::store(r, Rotation(load_vector(a),load_vector(b),load_vector(c)));
+                break;
+            case OP_GET_ROTVEC:
+                store_vector(r, load_rotation(a).GetRot());
+                break;
+            case OP_GET_RPY: {
+                load_rotation(a).GetRPY(r[0],r[1],r[2]);
+                double ca = cos(r[2]);
+                double sa = sin(r[2]);
+                double cb = cos(r[1]);
+                double sb = sin(r[1]);
+                x[0] = ca/cb;    x[1] = sa/cb;
+                x[2] = -sa;      x[3] = ca;
+                x[4] = ca*sb/cb; x[5] = sa*sb/cb;
+                break;
+            }
+            case OP_FRAME:
+                for (int k=0;k<9;++k) r[k] = a[k];
+                r[9] = b[0]; r[10] = b[1]; r[11] = b[2];
+                break;
+            case OP_INV_FRAME:
+                TapeTrait<Frame>::store(r, TapeTrait<Frame>::load(a).Inverse());
+                break;
+            case OP_COMPOSE_FF:
+                TapeTrait<Frame>::store(r, TapeTrait<Frame>::load(a)*TapeTrait<Frame>::load(b));
+                break;
+            case OP_COMPOSE_FV:
+                store_vector(r, TapeTrait<Frame>::load(a)*load_vector(b));
+                break;
+            case OP_COMPOSE_R6: {
+                Rotation R = load_rotation(a);
+                store_vector(r,   R*load_vector(b));
+                store_vector(r+3, R*load_vector(b+3));
+                break;
+            }
+            case OP_REFPOINT_TWIST:
+                store_vector(r,   load_vector(a) + load_vector(a+3)*load_vector(b));
+                store_vector(r+3, load_vector(a+3));
+                break;
+            case OP_REFPOINT_WRENCH:
+                store_vector(r,   load_vector(a));
+                store_vector(r+3, load_vector(a+3) + load_vector(a)*load_vector(b));
+                break;
+            case OP_CONDITIONAL:
+                x[0] = (a[0] >= 0) ? 1.0 : 0.0;
+                if (x[0]!=0.0) {
+                    for (int k=0;k<ins.vsize;++k) r[k] = b[k];
+                } else {
+                    for (int k=0;k<ins.vsize;++k) r[k] = c[k];
+                }
+                break;
+            case OP_NEAR_ZERO:
+                x[0] = ((-x[1]<=a[0]) && (a[0]<=x[1])) ? 1.0 : 0.0;
+                if (x[0]!=0.0) {
+                    for (int k=0;k<ins.vsize;++k) r[k] = b[k];
+                } else {
+                    for (int k=0;k<ins.vsize;++k) r[k] = c[k];
+                }
+                break;
+            case OP_BLOCKWAVE: {
+                double s = a[0]/x[0];
+                s -= floor(s);
+                const double* level = (s<=0.5) ? x+1 : x+1+ins.vsize;
+                for (int k=0;k<ins.vsize;++k) r[k] = level[k];
+                break;
+            }
+            default:
+                assert(0 && "ExpressionTape: unknown opcode");
+        }
+    }
+}
+
+void ExpressionTape::evaluateDerivative(int i) {
+    evaluateDerivative(context(), i);
+}
+
+void ExpressionTape::evaluateDerivative(EvalContext& ctx, int i) const {
+    assert( (ctx.nvalues==(int)values.size()) && (ctx.nderivs==nr_of_dvalues) );
+    const double* v = ctx.values();
+    double*       d = ctx.derivs();
+    for (std::vector<TapeInstruction>::const_iterator it=instructions.begin();it!=instructions.end();++it) {
+        const TapeInstruction& ins = *it;
+        const double* a  = v + ins.arg[0];
+        const double* b  = v + ins.arg[1];
+        const double* r  = v + ins.result;
+        const double* x  = v + ins.aux;
+        const double* da = d + ins.darg[0];
+        const double* db = d + ins.darg[1];
+        const double* dc = d + ins.darg[2];
+        double*       dr = d + ins.dresult;
+        switch (ins.opcode) {
+            case OP_INPUT_DOUBLE:
+                dr[0] = (ins.index==i) ? 1.0 : 0.0;
+                break;
+            case OP_INPUT_ROTATION:
+                dr[0] = (ins.index==i)   ? 1.0 : 0.0;
+                dr[1] = (ins.index+1==i) ? 1.0 : 0.0;
+                dr[2] = (ins.index+2==i) ? 1.0 : 0.0;
+                break;
+            case OP_OPAQUE_DOUBLE:   opaque_derivative<double>(ins,ctx.nodes[ins.index],d,i);   break;
+            case OP_OPAQUE_VECTOR:   opaque_derivative<Vector>(ins,ctx.nodes[ins.index],d,i);   break;
+            case OP_OPAQUE_ROTATION: opaque_derivative<Rotation>(ins,ctx.nodes[ins.index],d,i); break;
+            case OP_OPAQUE_FRAME:    opaque_derivative<Frame>(ins,ctx.nodes[ins.index],d,i);    break;
+            case OP_OPAQUE_TWIST:    opaque_derivative<Twist>(ins,ctx.nodes[ins.index],d,i);    break;
+            case OP_OPAQUE_WRENCH:   opaque_derivative<Wrench>(ins,ctx.nodes[ins.index],d,i);   break;
+            case OP_ADD:
+                for (int k=0;k<ins.dsize;++k) dr[k] = da[k] + db[k];
+                break;
+            case OP_SUB:
+                for (int k=0;k<ins.dsize;++k) dr[k] = da[k] - db[k];
+                break;
+            case OP_NEGATE:
+                for (int k=0;k<ins.dsize;++k) dr[k] = -da[k];
+                break;
+            case OP_SCALE:
+                for (int k=0;k<ins.dsize;++k) dr[k] = a[k]*db[0] + da[k]*b[0];
+                break;
+            case OP_MUL:
+                dr[0] = a[0]*db[0] + da[0]*b[0];
+                break;
+            case OP_DIV:
+                dr[0] = (da[0]*b[0] - a[0]*db[0])/(b[0]*b[0]);
+                break;
+            case OP_ATAN2:
+                dr[0] = (-a[0]*db[0] + b[0]*da[0])*x[0];
+                break;
+            case OP_SIN:
+            case OP_COS:
+            case OP_TAN:
+            case OP_ASIN:
+            case OP_ACOS:
+            case OP_EXP:
+            case OP_LOG:
+            case OP_SQRT:
+            case OP_ATAN:
+            case OP_ABS:
+            case OP_SQR:
+                dr[0] = x[0]*da[0];
+                break;
+            case OP_FMOD:
+            case OP_COPY:
+            case OP_GET_ROTVEC:
+                for (int k=0;k<ins.dsize;++k) dr[k] = da[k];
+                break;
+            case OP_VECTOR:
+                dr[0] = da[0]; dr[1] = db[0]; dr[2] = dc[0];
+                break;
+            case OP_CONCAT:
+                dr[0] = da[0]; dr[1] = da[1]; dr[2] = da[2];
+                dr[3] = db[0]; dr[4] = db[1]; dr[5] = db[2];
+                break;
+            case OP_DOT:
+                dr[0] = a[0]*db[0] + a[1]*db[1] + a[2]*db[2]
+                      + da[0]*b[0] + da[1]*b[1] + da[2]*b[2];
+                break;
+            case OP_CROSS:
+                store_vector(dr, load_vector(a)*load_vector(db) + load_vector(da)*load_vector(b));
+                break;
+            case OP_SQUARED_NORM:
+                dr[0] = 2.0*(a[0]*da[0] + a[1]*da[1] + a[2]*da[2]);
+                break;
+            case OP_NORM:
+                dr[0] = (a[0]*da[0] + a[1]*da[1] + a[2]*da[2])/r[0];
+                break;
+            case OP_ROT:
+                dr[0] = x[0]*da[0]; dr[1] = x[1]*da[0]; dr[2] = x[2]*da[0];
+                break;
+            case OP_ROTVEC:
+                store_vector(dr, load_vector(a)*db[0] + load_vector(da)*b[0]);
+                break;
+            case OP_ROTX:
+                dr[0] = da[0]; dr[1] = 0.0;   dr[2] = 0.0;
+                break;
+            case OP_ROTY:
+                dr[0] = 0.0;   dr[1] = da[0]; dr[2] = 0.0;
+                break;
+            case OP_ROTZ:
+                dr[0] = 0.0;   dr[1] = 0.0;   dr[2] = da[0];
+                break;
+            case OP_INV_ROTATION:
+                store_vector(dr, load_rotation(a).Inverse(-load_vector(da)));
+                break;
+            case OP_COMPOSE_RR:
+                store_vector(dr, load_rotation(a)*load_vector(db) + load_vector(da));
+                break;
+            case OP_COMPOSE_RV:
+                store_vector(dr, load_vector(da)*load_vector(r) + load_rotation(a)*load_vector(db));
+                break;
+            case OP_UNITX:
+            case OP_UNITY:
+            case OP_UNITZ:
+                store_vector(dr, load_vector(da)*load_vector(r));
+                break;
+            case OP_CONSTRUCT_ROTATION: {
+                Rotation Rd(load_vector(da), load_vector(db), load_vector(dc));
+                Rotation omegax = Rd*load_rotation(r).Inverse();
+                dr[0] = (omegax(2,1)-omegax(1,2))/2.0;
+                dr[1] = (omegax(0,2)-omegax(2,0))/2.0;
+                dr[2] = (omegax(1,0)-omegax(0,1))/2.0;
+                break;
+            }
+            case OP_GET_RPY:
+                dr[0] = x[0]*da[0] + x[1]*da[1];
+                dr[1] = x[2]*da[0] + x[3]*da[1];
+                dr[2] = x[4]*da[0] + x[5]*da[1] + da[2];
+                break;
+            case OP_FRAME:
+                dr[0] = db[0]; dr[1] = db[1]; dr[2] = db[2];
+                dr[3] = da[0]; dr[4] = da[1]; dr[5] = da[2];
+                break;
+            case OP_INV_FRAME: {
+                Rotation M    = load_rotation(a);
+                Vector   p    = load_vector(a+9);
+                Vector   dvel = load_vector(da);
+                Vector   drot = load_vector(da+3);
+                store_vector(dr,   M.Inverse(drot*p - dvel));
+                store_vector(dr+3, -M.Inverse(drot));
+                break;
+            }
+            case OP_COMPOSE_FF: {
+                Rotation M1   = load_rotation(a);
+                Vector   drot = load_vector(da+3);
+                store_vector(dr,   drot*(M1*load_vector(b+9)) + M1*load_vector(db) + load_vector(da));
+                store_vector(dr+3, drot + M1*load_vector(db+3));
+                break;
+            }
+            case OP_COMPOSE_FV: {
+                Rotation M = load_rotation(a);
+                store_vector(dr, load_vector(da+3)*(M*load_vector(b)) + M*load_vector(db) + load_vector(da));
+                break;
+            }
+            case OP_COMPOSE_R6: {
+                Rotation R  = load_rotation(a);
+                Vector   w  = load_vector(da);
+                store_vector(dr,   R*load_vector(db)   + w*load_vector(r));
+                store_vector(dr+3, R*load_vector(db+3) + w*load_vector(r+3));
+                break;
+            }
+            case OP_REFPOINT_TWIST:
+                store_vector(dr,   load_vector(da) + load_vector(da+3)*load_vector(b) + load_vector(a+3)*load_vector(db));
+                store_vector(dr+3, load_vector(da+3));
+                break;
+            case OP_REFPOINT_WRENCH:
+                store_vector(dr,   load_vector(da));
+                store_vector(dr+3, load_vector(da+3) + load_vector(da)*load_vector(b) + load_vector(a)*load_vector(db));
+                break;
+            case OP_CONDITIONAL:
+            case OP_NEAR_ZERO: {
+                const double* src = (x[0]!=0.0) ? db : dc;
+                for (int k=0;k<ins.dsize;++k) dr[k] = src[k];
+                break;
+            }
+            case OP_MAKE_CONSTANT:
+            case OP_BLOCKWAVE:
+                // derivative remains zero.
+                break;
+            default:
+                assert(0 && "ExpressionTape: unknown opcode");
+        }
+    }
+}
+
+/*
+ * Kernels for evaluateDerivatives(..): a block of n components of a derivative consists of n
+ * groups of L lanes, i.e. component c of lane l is at p[c*L+l].  All loops over the lanes have a
+ * fixed length, such that the compiler can vectorize them.
+ */
+static const int L = ExpressionTape::lanes;
+
+/*
+ * Describes the seed of each lane: either lane l is seeded with the single variable vars[l],
+ * or (groups!=0) lane l is seeded with all variables of group number group[l].  In the latter
+ * case colour[i] is the group number of variable i.  Lanes with a negative number are not used.
+ */
+struct LaneSeed {
+    int vars[L];
+    int group[L];
+    const std::vector<int>*         colour;
+    const std::vector<VarIndexSet>* groups;
+
+    double seed(int var, int l) const {
+        if (groups==0) {
+            return (var==vars[l]) ? 1.0 : 0.0;
+        }
+        return ((group[l]>=0) && (var<(int)colour->size()) && ((*colour)[var]==group[l])) ? 1.0 : 0.0;
+    }
+};
+
+template <typename T>
+inline void opaque_lanes(const TapeInstruction& ins, ExpressionBase* node, double* d, const LaneSeed& s) {
+    typedef typename AutoDiffTrait<T>::DerivType DerivType;
+    Expression<T>* n  = static_cast<Expression<T>*>(node);
+    double*        dr = d + ins.dresult*L;
+    double         tmp[6];
+    for (int l=0;l<L;++l) {
+        for (int c=0;c<ins.dsize;++c) tmp[c] = 0.0;
+        if (s.groups==0) {
+            if (s.vars[l] >= 0) {
+                TapeTrait<DerivType>::store(tmp, n->derivative(s.vars[l]));
+            }
+        } else if (s.group[l] >= 0) {
+            // directional derivative: sum of the derivatives towards the variables of the group
+            const VarIndexSet& g = (*s.groups)[s.group[l]];
+            double dv[6];
+            for (size_t k=0;k<g.size();++k) {
+                TapeTrait<DerivType>::store(dv, n->derivative(g[k]));
+                for (int c=0;c<ins.dsize;++c) tmp[c] += dv[c];
+            }
+        }
+        for (int c=0;c<ins.dsize;++c) dr[c*L+l] = tmp[c];
+    }
+}
+
+inline void lanes_zero(double* r, int n) {
+    for (int k=0;k<n*L;++k) r[k] = 0.0;
+}
+
+inline void lanes_copy(double* r, const double* a, int n) {
+    for (int k=0;k<n*L;++k) r[k] = a[k];
+}
+
+inline void lanes_add(double* r, const double* a, int n) {
+    for (int k=0;k<n*L;++k) r[k] += a[k];
+}
+
+/* r = s*a */
+inline void lanes_scale(double* r, double s, const double* a, int n) {
+    for (int k=0;k<n*L;++k) r[k] = s*a[k];
+}
+
+/* r = R*a, with R a rotation matrix (row-major) */
+inline void lanes_rotate(double* r, const double* R, const double* a) {
+    for (int i=0;i<3;++i) {
+        for (int l=0;l<L;++l) {
+            r[i*L+l] = R[3*i]*a[l] + R[3*i+1]*a[L+l] + R[3*i+2]*a[2*L+l];
+        }
+    }
+}
+
+/* r = s*R^T*a, with R a rotation matrix (row-major) */
+inline void lanes_rotate_transpose(double* r, const double* R, const double* a, double s) {
+    for (int i=0;i<3;++i) {
+        for (int l=0;l<L;++l) {
+            r[i*L+l] = s*(R[i]*a[l] + R[3+i]*a[L+l] + R[6+i]*a[2*L+l]);
+        }
+    }
+}
+
+/* r += s*(w x a), with w a vector value */
+inline void lanes_add_cross(double* r, const double* w, const double* a, double s) {
+    const double* ax = a;
+    const double* ay = a+L;
+    const double* az = a+2*L;
+    for (int l=0;l<L;++l) {
+        r[l]     += s*(w[1]*az[l] - w[2]*ay[l]);
+        r[L+l]   += s*(w[2]*ax[l] - w[0]*az[l]);
+        r[2*L+l] += s*(w[0]*ay[l] - w[1]*ax[l]);
+    }
+}
+
+static void propagate_lanes(const ExpressionTape& tape, EvalContext& ctx, const LaneSeed& s) {
+    assert( (ctx.nvalues==(int)tape.values.size()) && (ctx.nderivs==tape.nr_of_dvalues) );
+    const double* v = ctx.values();
+    double*       d = ctx.lane_derivs();
+    const std::vector<TapeInstruction>& instructions = tape.instructions;
+    for (std::vector<TapeInstruction>::const_iterator it=instructions.begin();it!=instructions.end();++it) {
+        const TapeInstruction& ins = *it;
+        const double* a  = v + ins.arg[0];
+        const double* b  = v + ins.arg[1];
+        const double* r  = v + ins.result;
+        const double* x  = v + ins.aux;
+        const double* da = d + ins.darg[0]*L;
+        const double* db = d + ins.darg[1]*L;
+        const double* dc = d + ins.darg[2]*L;
+        double*       dr = d + ins.dresult*L;
+        switch (ins.opcode) {
+            case OP_INPUT_DOUBLE:
+                for (int l=0;l<L;++l) dr[l] = s.seed(ins.index,l);
+                break;
+            case OP_INPUT_ROTATION:
+                for (int c=0;c<3;++c) {
+                    for (int l=0;l<L;++l) dr[c*L+l] = s.seed(ins.index+c,l);
+                }
+                break;
+            case OP_OPAQUE_DOUBLE:   opaque_lanes<double>(ins,ctx.nodes[ins.index],d,s);   break;
+            case OP_OPAQUE_VECTOR:   opaque_lanes<Vector>(ins,ctx.nodes[ins.index],d,s);   break;
+            case OP_OPAQUE_ROTATION: opaque_lanes<Rotation>(ins,ctx.nodes[ins.index],d,s); break;
+            case OP_OPAQUE_FRAME:    opaque_lanes<Frame>(ins,ctx.nodes[ins.index],d,s);    break;
+            case OP_OPAQUE_TWIST:    opaque_lanes<Twist>(ins,ctx.nodes[ins.index],d,s);    break;
+            case OP_OPAQUE_WRENCH:   opaque_lanes<Wrench>(ins,ctx.nodes[ins.index],d,s);   break;
+            case OP_ADD:
+                for (int k=0;k<ins.dsize*L;++k) dr[k] = da[k] + db[k];
+                break;
+            case OP_SUB:
+                for (int k=0;k<ins.dsize*L;++k) dr[k] = da[k] - db[k];
+                break;
+            case OP_NEGATE:
+                for (int k=0;k<ins.dsize*L;++k) dr[k] = -da[k];
+                break;
+            case OP_SCALE:
+                for (int c=0;c<ins.dsize;++c) {
+                    for (int l=0;l<L;++l) dr[c*L+l] = a[c]*db[l] + da[c*L+l]*b[0];
+                }
+                break;
+            case OP_MUL:
+                for (int l=0;l<L;++l) dr[l] = a[0]*db[l] + da[l]*b[0];
+                break;
+            case OP_DIV: {
+                double f = 1.0/(b[0]*b[0]);
+                for (int l=0;l<L;++l) dr[l] = (da[l]*b[0] - a[0]*db[l])*f;
+                break;
+            }
+            case OP_ATAN2:
+                for (int l=0;l<L;++l) dr[l] = (-a[0]*db[l] + b[0]*da[l])*x[0];
+                break;
+            case OP_SIN:
+            case OP_COS:
+            case OP_TAN:
+            case OP_ASIN:
+            case OP_ACOS:
+            case OP_EXP:
+            case OP_LOG:
+            case OP_SQRT:
+            case OP_ATAN:
+            case OP_ABS:
+            case OP_SQR:
+                lanes_scale(dr, x[0], da, 1);
+                break;
+            case OP_FMOD:
+            case OP_COPY:
+            case OP_GET_ROTVEC:
+                lanes_copy(dr, da, ins.dsize);
+                break;
+            case OP_VECTOR:
+                lanes_copy(dr,     da, 1);
+                lanes_copy(dr+L,   db, 1);
+                lanes_copy(dr+2*L, dc, 1);
+                break;
+            case OP_CONCAT:
+                lanes_copy(dr,     da, 3);
+                lanes_copy(dr+3*L, db, 3);
+                break;
+            case OP_DOT:
+                for (int l=0;l<L;++l) {
+                    dr[l] = a[0]*db[l] + a[1]*db[L+l] + a[2]*db[2*L+l]
+                          + da[l]*b[0] + da[L+l]*b[1] + da[2*L+l]*b[2];
+                }
+                break;
+            case OP_CROSS:
+                lanes_zero(dr, 3);
+                lanes_add_cross(dr, a, db, 1.0);
+                lanes_add_cross(dr, b, da, -1.0);
+                break;
+            case OP_SQUARED_NORM:
+                for (int l=0;l<L;++l) dr[l] = 2.0*(a[0]*da[l] + a[1]*da[L+l] + a[2]*da[2*L+l]);
+                break;
+            case OP_NORM: {
+                double f = 1.0/r[0];
+                for (int l=0;l<L;++l) dr[l] = (a[0]*da[l] + a[1]*da[L+l] + a[2]*da[2*L+l])*f;
+                break;
+            }
+            case OP_ROT:
+                for (int c=0;c<3;++c) {
+                    for (int l=0;l<L;++l) dr[c*L+l] = x[c]*da[l];
+                }
+                break;
+            case OP_ROTVEC:
+                for (int c=0;c<3;++c) {
+                    for (int l=0;l<L;++l) dr[c*L+l] = a[c]*db[l] + da[c*L+l]*b[0];
+                }
+                break;
+            case OP_ROTX:
+            case OP_ROTY:
+            case OP_ROTZ: {
+                int axis = ins.opcode - OP_ROTX;
+                lanes_zero(dr, 3);
+                lanes_copy(dr+axis*L, da, 1);
+                break;
+            }
+            case OP_INV_ROTATION:
+                lanes_rotate_transpose(dr, a, da, -1.0);
+                break;
+            case OP_COMPOSE_RR:
+                lanes_rotate(dr, a, db);
+                lanes_add(dr, da, 3);
+                break;
+            case OP_COMPOSE_RV:
+                lanes_rotate(dr, a, db);
+                lanes_add_cross(dr, r, da, -1.0);
+                break;
+            case OP_UNITX:
+            case OP_UNITY:
+            case OP_UNITZ:
+                lanes_zero(dr, 3);
+                lanes_add_cross(dr, r, da, -1.0);
+                break;
+            case OP_CONSTRUCT_ROTATION: {
+                // omega = 1/2 sum_k R.col(k) x Rd.col(k)
+                const double* dcol[3] = { da, db, dc };
+                lanes_zero(dr, 3);
+                for (int k=0;k<3;++k) {
+                    double col[3] = { r[k], r[3+k], r[6+k] };
+                    lanes_add_cross(dr, col, dcol[k], 0.5);
+                }
+                break;
+            }
+            case OP_GET_RPY:
+                for (int l=0;l<L;++l) {
+                    dr[l]     = x[0]*da[l] + x[1]*da[L+l];
+                    dr[L+l]   = x[2]*da[l] + x[3]*da[L+l];
+                    dr[2*L+l] = x[4]*da[l] + x[5]*da[L+l] + da[2*L+l];
+                }
+                break;
+            case OP_FRAME:
+                lanes_copy(dr,     db, 3);
+                lanes_copy(dr+3*L, da, 3);
+                break;
+            case OP_INV_FRAME: {
+                double tmp[3*L];
+                lanes_scale(tmp, -1.0, da, 3);
+                lanes_add_cross(tmp, a+9, da+3*L, -1.0);
+                lanes_rotate_transpose(dr,     a, tmp,     1.0);
+                lanes_rotate_transpose(dr+3*L, a, da+3*L, -1.0);
+                break;
+            }
+            case OP_COMPOSE_FF: {
+                Vector p = load_rotation(a)*load_vector(b+9);
+                lanes_rotate(dr, a, db);
+                lanes_add(dr, da, 3);
+                lanes_add_cross(dr, p.data, da+3*L, -1.0);
+                lanes_rotate(dr+3*L, a, db+3*L);
+                lanes_add(dr+3*L, da+3*L, 3);
+                break;
+            }
+            case OP_COMPOSE_FV: {
+                Vector p = load_rotation(a)*load_vector(b);
+                lanes_rotate(dr, a, db);
+                lanes_add(dr, da, 3);
+                lanes_add_cross(dr, p.data, da+3*L, -1.0);
+                break;
+            }
+            case OP_COMPOSE_R6:
+                lanes_rotate(dr, a, db);
+                lanes_add_cross(dr, r, da, -1.0);
+                lanes_rotate(dr+3*L, a, db+3*L);
+                lanes_add_cross(dr+3*L, r+3, da, -1.0);
+                break;
+            case OP_REFPOINT_TWIST:
+                lanes_copy(dr, da, 6);
+                lanes_add_cross(dr, b, da+3*L, -1.0);
+                lanes_add_cross(dr, a+3, db, 1.0);
+                break;
+            case OP_REFPOINT_WRENCH:
+                lanes_copy(dr, da, 6);
+                lanes_add_cross(dr+3*L, b, da, -1.0);
+                lanes_add_cross(dr+3*L, a, db, 1.0);
+                break;
+            case OP_CONDITIONAL:
+            case OP_NEAR_ZERO:
+                lanes_copy(dr, (x[0]!=0.0) ? db : dc, ins.dsize);
+                break;
+            case OP_MAKE_CONSTANT:
+            case OP_BLOCKWAVE:
+                // derivative remains zero.
+                break;
+            default:
+                assert(0 && "ExpressionTape: unknown opcode");
+        }
+    }
+}
+
+void ExpressionTape::evaluateDerivatives(const int* vars, int n) {
+    evaluateDerivatives(context(), vars, n);
+}
+
+void ExpressionTape::evaluateDerivatives(EvalContext& ctx, const int* vars, int n) const {
+    assert( (0<n) && (n<=L) );
+    LaneSeed s;
+    for (int l=0;l<L;++l) {
+        s.vars[l]  = (l<n) ? vars[l] : -1;
+        s.group[l] = -1;
+    }
+    s.colour = 0;
+    s.groups = 0;
+    propagate_lanes(*this, ctx, s);
+}
+
+void ExpressionTape::evaluateSeededDerivatives(const std::vector<int>& colour, const std::vector<VarIndexSet>& groups,
+                                               int first, int n) {
+    evaluateSeededDerivatives(context(), colour, groups, first, n);
+}
+
+void ExpressionTape::evaluateSeededDerivatives(EvalContext& ctx, const std::vector<int>& colour, const std::vector<VarIndexSet>& groups,
+                                               int first, int n) const {
+    assert( (0<n) && (n<=L) && (first+n<=(int)groups.size()) );
+    LaneSeed s;
+    for (int l=0;l<L;++l) {
+        s.vars[l]  = -1;
+        s.group[l] = (l<n) ? first+l : -1;
+    }
+    s.colour = &colour;
+    s.groups = &groups;
+    propagate_lanes(*this, ctx, s);
+}
+
+template <typename T>
+inline void opaque_adjoint(const TapeInstruction& ins, ExpressionBase* node, const double* g, Eigen::VectorXd& result) {
+    typedef typename AutoDiffTrait<T>::DerivType DerivType;
+    Expression<T>* n = static_cast<Expression<T>*>(node);
+    int nd = std::min<int>(n->number_of_derivatives(), result.size());
+    double dv[6];
+    for (int i=0;i<nd;++i) {
+        TapeTrait<DerivType>::store(dv, n->derivative(i));
+        for (int k=0;k<ins.dsize;++k) {
+            result[i] += g[k]*dv[k];
+        }
+    }
+}
+
+inline void add_vector(double* p, const Vector& v) {
+    p[0] += v[0]; p[1] += v[1]; p[2] += v[2];
+}
+
+/*
+ * Each case is the transpose of the corresponding case in evaluateDerivative():
+ * the adjoint g of the result is accumulated into the adjoints of the arguments.
+ */
+void ExpressionTape::adjoint(int output, const double* seed, Eigen::VectorXd& result) {
+    adjoint(context(), output, seed, result);
+}
+
+void ExpressionTape::adjoint(EvalContext& ctx, int output, const double* seed, Eigen::VectorXd& result) const {
+    assert( (ctx.nvalues==(int)values.size()) && (ctx.nderivs==nr_of_dvalues) );
+    result.setZero(nr_of_derivs);
+    const double* v = ctx.values();
+    double*       d = ctx.adjoints();
+    std::fill(d, d+nr_of_dvalues, 0.0);
+    const TapeSlot& out = outputs[output];
+    for (int k=0;k<deriv_size[out.type];++k) {
+        d[out.deriv+k] = seed[k];
+    }
+    for (std::vector<TapeInstruction>::const_reverse_iterator it=instructions.rbegin();it!=instructions.rend();++it) {
+        const TapeInstruction& ins = *it;
+        const double* a  = v + ins.arg[0];
+        const double* b  = v + ins.arg[1];
+        const double* r  = v + ins.result;
+        const double* x  = v + ins.aux;
+        double*       ga = d + ins.darg[0];
+        double*       gb = d + ins.darg[1];
+        double*       gc = d + ins.darg[2];
+        const double* g  = d + ins.dresult;
+        switch (ins.opcode) {
+            case OP_INPUT_DOUBLE:
+                if (ins.index < result.size()) {
+                    result[ins.index] += g[0];
+                }
+                break;
+            case OP_INPUT_ROTATION:
+                for (int k=0;k<3;++k) {
+                    if (ins.index+k < result.size()) {
+                        result[ins.index+k] += g[k];
+                    }
+                }
+                break;
+            case OP_OPAQUE_DOUBLE:   opaque_adjoint<double>(ins,ctx.nodes[ins.index],g,result);   break;
+            case OP_OPAQUE_VECTOR:   opaque_adjoint<Vector>(ins,ctx.nodes[ins.index],g,result);   break;
+            case OP_OPAQUE_ROTATION: opaque_adjoint<Rotation>(ins,ctx.nodes[ins.index],g,result); break;
+            case OP_OPAQUE_FRAME:    opaque_adjoint<Frame>(ins,ctx.nodes[ins.index],g,result);    break;
+            case OP_OPAQUE_TWIST:    opaque_adjoint<Twist>(ins,ctx.nodes[ins.index],g,result);    break;
+            case OP_OPAQUE_WRENCH:   opaque_adjoint<Wrench>(ins,ctx.nodes[ins.index],g,result);   break;
+            case OP_ADD:
+                for (int k=0;k<ins.dsize;++k) {
+                    ga[k] += g[k];
+                    gb[k] += g[k];
+                }
+                break;
+            case OP_SUB:
+                for (int k=0;k<ins.dsize;++k) {
+                    ga[k] += g[k];
+                    gb[k] -= g[k];
+                }
+                break;
+            case OP_NEGATE:
+                for (int k=0;k<ins.dsize;++k) ga[k] -= g[k];
+                break;
+            case OP_SCALE:
+                for (int k=0;k<ins.dsize;++k) {
+                    ga[k] += g[k]*b[0];
+                    gb[0] += g[k]*a[k];
+                }
+                break;
+            case OP_MUL:
+                ga[0] += g[0]*b[0];
+                gb[0] += g[0]*a[0];
+                break;
+            case OP_DIV:
+                ga[0] += g[0]/b[0];
+                gb[0] -= g[0]*a[0]/(b[0]*b[0]);
+                break;
+            case OP_ATAN2:
+                ga[0] += g[0]*b[0]*x[0];
+                gb[0] -= g[0]*a[0]*x[0];
+                break;
+            case OP_SIN:
+            case OP_COS:
+            case OP_TAN:
+            case OP_ASIN:
+            case OP_ACOS:
+            case OP_EXP:
+            case OP_LOG:
+            case OP_SQRT:
+            case OP_ATAN:
+            case OP_ABS:
+            case OP_SQR:
+                ga[0] += x[0]*g[0];
+                break;
+            case OP_FMOD:
+            case OP_COPY:
+            case OP_GET_ROTVEC:
+                for (int k=0;k<ins.dsize;++k) ga[k] += g[k];
+                break;
+            case OP_VECTOR:
+                ga[0] += g[0]; gb[0] += g[1]; gc[0] += g[2];
+                break;
+            case OP_CONCAT:
+                for (int k=0;k<3;++k) {
+                    ga[k] += g[k];
+                    gb[k] += g[3+k];
+                }
+                break;
+            case OP_DOT:
+                for (int k=0;k<3;++k) {
+                    ga[k] += g[0]*b[k];
+                    gb[k] += g[0]*a[k];
+                }
+                break;
+            case OP_CROSS:
+                add_vector(ga, load_vector(b)*load_vector(g));
+                add_vector(gb, load_vector(g)*load_vector(a));
+                break;
+            case OP_SQUARED_NORM:
+                for (int k=0;k<3;++k) ga[k] += 2.0*g[0]*a[k];
+                break;
+            case OP_NORM:
+                for (int k=0;k<3;++k) ga[k] += g[0]*a[k]/r[0];
+                break;
+            case OP_ROT:
+                ga[0] += x[0]*g[0] + x[1]*g[1] + x[2]*g[2];
+                break;
+            case OP_ROTVEC:
+                gb[0] += a[0]*g[0] + a[1]*g[1] + a[2]*g[2];
+                for (int k=0;k<3;++k) ga[k] += g[k]*b[0];
+                break;
+            case OP_ROTX:
+                ga[0] += g[0];
+                break;
+            case OP_ROTY:
+                ga[0] += g[1];
+                break;
+            case OP_ROTZ:
+                ga[0] += g[2];
+                break;
+            case OP_INV_ROTATION:
+                add_vector(ga, -(load_rotation(a)*load_vector(g)));
+                break;
+            case OP_COMPOSE_RR:
+                add_vector(gb, load_rotation(a).Inverse(load_vector(g)));
+                for (int k=0;k<3;++k) ga[k] += g[k];
+                break;
+            case OP_COMPOSE_RV:
+                add_vector(ga, load_vector(r)*load_vector(g));
+                add_vector(gb, load_rotation(a).Inverse(load_vector(g)));
+                break;
+            case OP_UNITX:
+            case OP_UNITY:
+            case OP_UNITZ:
+                add_vector(ga, load_vector(r)*load_vector(g));
+                break;
+            case OP_CONSTRUCT_ROTATION: {
+                // omegax = Rd*R^T, adjoint of Rd is adjoint(omegax)*R
+                Rotation og(0.0, -g[2]/2.0, g[1]/2.0,
+                            g[2]/2.0, 0.0, -g[0]/2.0,
+                            -g[1]/2.0, g[0]/2.0, 0.0);
+                Rotation Rd = og*load_rotation(r);
+                add_vector(ga, Rd.UnitX());
+                add_vector(gb, Rd.UnitY());
+                add_vector(gc, Rd.UnitZ());
+                break;
+            }
+            case OP_GET_RPY:
+                ga[0] += x[0]*g[0] + x[2]*g[1] + x[4]*g[2];
+                ga[1] += x[1]*g[0] + x[3]*g[1] + x[5]*g[2];
+                ga[2] += g[2];
+                break;
+            case OP_FRAME:
+                for (int k=0;k<3;++k) {
+                    gb[k] += g[k];
+                    ga[k] += g[3+k];
+                }
+                break;
+            case OP_INV_FRAME: {
+                Rotation M = load_rotation(a);
+                Vector   u = M*load_vector(g);
+                add_vector(ga,   -u);
+                add_vector(ga+3, load_vector(a+9)*u - M*load_vector(g+3));
+                break;
+            }
+            case OP_COMPOSE_FF: {
+                Rotation M1 = load_rotation(a);
+                Vector   gv = load_vector(g);
+                Vector   gr = load_vector(g+3);
+                add_vector(ga,   gv);
+                add_vector(ga+3, (M1*load_vector(b+9))*gv + gr);
+                add_vector(gb,   M1.Inverse(gv));
+                add_vector(gb+3, M1.Inverse(gr));
+                break;
+            }
+            case OP_COMPOSE_FV: {
+                Rotation M  = load_rotation(a);
+                Vector   gv = load_vector(g);
+                add_vector(ga,   gv);
+                add_vector(ga+3, (M*load_vector(b))*gv);
+                add_vector(gb,   M.Inverse(gv));
+                break;
+            }
+            case OP_COMPOSE_R6: {
+                Rotation R  = load_rotation(a);
+                Vector   g0 = load_vector(g);
+                Vector   g1 = load_vector(g+3);
+                add_vector(gb,   R.Inverse(g0));
+                add_vector(gb+3, R.Inverse(g1));
+                add_vector(ga,   load_vector(r)*g0 + load_vector(r+3)*g1);
+                break;
+            }
+            case OP_REFPOINT_TWIST: {
+                Vector gv = load_vector(g);
+                add_vector(ga,   gv);
+                add_vector(ga+3, load_vector(b)*gv + load_vector(g+3));
+                add_vector(gb,   gv*load_vector(a+3));
+                break;
+            }
+            case OP_REFPOINT_WRENCH: {
+                Vector gt = load_vector(g+3);
+                add_vector(ga,   load_vector(g) + load_vector(b)*gt);
+                add_vector(ga+3, gt);
+                add_vector(gb,   gt*load_vector(a));
+                break;
+            }
+            case OP_CONDITIONAL:
+            case OP_NEAR_ZERO: {
+                double* dst = (x[0]!=0.0) ? gb : gc;
+                for (int k=0;k<ins.dsize;++k) dst[k] += g[k];
+                break;
+            }
+            case OP_MAKE_CONSTANT:
+            case OP_BLOCKWAVE:
+                break;
+            default:
+                assert(0 && "ExpressionTape: unknown opcode");
+        }
+    }
+}
+
+void gradient( const Expression<double>::Ptr& e, Eigen::VectorXd& result ) {
+    ExpressionTape tape;
+    int output = tape.addOutput(e);
+    tape.evaluate();
+    tape.gradient(output, result);
+}
+
+void ExpressionTape::print(std::ostream& os) const {
+    os << "tape with " << instructions.size() << " instructions, "
+       << values.size() << " values and " << nr_of_dvalues << " derivatives\n";
+    for (size_t k=0;k<instructions.size();++k) {
+        const TapeInstruction& ins = instructions[k];
+        os << k << "\t" << opcode_names[ins.opcode]
+           << "\tresult=" << ins.result
+           << "\targs=(" << ins.arg[0] << "," << ins.arg[1] << "," << ins.arg[2] << ")";
+        if ((ins.opcode==OP_INPUT_DOUBLE) || (ins.opcode==OP_INPUT_ROTATION)) {
+            os << "\tvar=" << ins.index;
+        }
+        os << "\n";
+    }
+}
+
+} // namespace KDL
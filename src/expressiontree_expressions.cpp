@@ -25,6 +25,8 @@
 
 
 #include <kdl/expressiontree_expressions.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 #include <algorithm>
 #include <iterator>
 
@@ -32,7 +34,17 @@ using namespace std;
 
 namespace KDL {
 
+ExpressionOptimizer::ExpressionOptimizer():
+    volatile_nodes(0),
+    updates(0),
+    initialized(false),
+    bound_values(0),
+    bound_rotvalues(0) {
+    always_group.epoch.reset(new CacheEpoch(this));
+}
+
 void ExpressionOptimizer::prepare(const std::vector<int>& inputvarnr, const std::vector<int>& rotinputvarnr) {
+    unbind();
     inputset.clear();   
 
     inputs.resize(inputvarnr.size());
@@ -52,7 +64,15 @@ void ExpressionOptimizer::prepare(const std::vector<int>& inputvarnr, const std:
     }
 
     cached.clear();
-    v_cached.clear();
+    groups.clear();
+    group_index.clear();
+    always_group = CacheGroup();
+    always_group.epoch.reset(new CacheEpoch(this));
+    position_groups.assign(inputvarnr.size()+rotinputvarnr.size(), std::vector<int>());
+    last_values.assign(inputvarnr.size(), 0.0);
+    last_rotvalues.assign(rotinputvarnr.size(), Rotation::Identity());
+    changed.assign(inputvarnr.size()+rotinputvarnr.size(), 0);
+    initialized = false;
 }
 
 
@@ -66,6 +86,12 @@ void ExpressionOptimizer::addInput(InputType* obj) {
     for (size_t i=0;i<inputvarnr.size();++i) {
         if (inputvarnr[i]==obj->variable_number) {
             inputs[i].push_front(obj);
+            if (bound_values) {
+                obj->binding = bound_values + i;
+            } else if (initialized) {
+                // registered after setInputValues(..), which skips unchanged values:
+                obj->val = last_values[i];
+            }
             //cout << "input " << obj->variable_number << " added \n";
             break;
         }
@@ -76,117 +102,427 @@ void ExpressionOptimizer::addInput(InputRotationType* obj) {
     for (size_t i=0;i<rotinputvarnr.size();++i) {
         if (rotinputvarnr[i]==obj->variable_number) {
             rotinputs[i].push_front(obj);
+            if (bound_rotvalues) {
+                obj->binding = bound_rotvalues + i;
+            } else if (initialized) {
+                obj->val = last_rotvalues[i];
+            }
             //cout << "input " << obj->variable_number << " added \n";
             break;
         }
     }
 }
 
-void ExpressionOptimizer::addCached(CachedExpression* obj) {
+void ExpressionOptimizer::addCached(CachedExpression* obj, bool always) {
+    if (cached.find(obj)!=cached.end()) {
+        return;
+    }
+    if (always) {
+        cached.insert( obj );
+        if (!obj->attachEpoch(always_group.epoch)) {
+            always_group.v_cached.push_back( obj );
+        }
+        obj->invalidate_cache();
+        return;
+    }
     InputSet dependency;
     obj->getDependencies( dependency );
-    //cout << "cached dependency: ";
-    //copy(dependency.begin(), dependency.end(), ostream_iterator<int>(cout, " "));
-    //cout << "\n";
-    for (InputSet::iterator it=dependency.begin();it!=dependency.end();++it) {
-        if (inputset.find( *it )!= inputset.end() ) {
-            if (cached.find(obj)==cached.end()) {
-                cached.insert( obj );  
-                v_cached.push_back( obj );
+    // positions of the prepared variables that obj depends on:
+    std::vector<int> positions;
+    for (size_t i=0;i<inputvarnr.size();++i) {
+        if (dependency.find(inputvarnr[i])!=dependency.end()) {
+            positions.push_back((int)i);
+        }
+    }
+    for (size_t i=0;i<rotinputvarnr.size();++i) {
+        int v = rotinputvarnr[i];
+        if ((dependency.find(v)!=dependency.end()) || (dependency.find(v+1)!=dependency.end()) ||
+            (dependency.find(v+2)!=dependency.end())) {
+            positions.push_back((int)(inputvarnr.size()+i));
+        }
+    }
+    if (positions.empty()) {
+        return;
+    }
+    cached.insert( obj );
+    std::map<std::vector<int>, int>::iterator it = group_index.find(positions);
+    if (it==group_index.end()) {
+        int g = (int)groups.size();
+        it = group_index.insert(std::make_pair(positions,g)).first;
+        groups.push_back(CacheGroup());
+        groups.back().positions   = positions;
+        groups.back().epoch.reset(new CacheEpoch(this));
+        groups.back().last_update = updates;
+        for (size_t k=0;k<positions.size();++k) {
+            position_groups[positions[k]].push_back(g);
+        }
+    }
+    CacheGroup& group = groups[it->second];
+    if (!obj->attachEpoch(group.epoch)) {
+        group.v_cached.push_back( obj );
+    }
+    // the cache can hold results for other input values than the current ones:
+    obj->invalidate_cache();
+}
+
+void ExpressionOptimizer::setInputValue(size_t i, double value) {
+    if (initialized && (last_values[i]==value)) {
+        return;
+    }
+    last_values[i] = value;
+    changed[i]     = 1;
+    for (ListInput::iterator it=inputs[i].begin(); it != inputs[i].end(); ++it ) {
+        (*it)->val = value;
+    }
+}
+
+void ExpressionOptimizer::setInputValue(size_t i, const Rotation& value) {
+    if (initialized && std::equal(value.data, value.data+9, last_rotvalues[i].data)) {
+        return;
+    }
+    last_rotvalues[i]              = value;
+    changed[inputvarnr.size()+i]   = 1;
+    for (ListRotInput::iterator it=rotinputs[i].begin(); it != rotinputs[i].end(); ++it ) {
+        (*it)->val = value;
+    }
+}
+
+/*
+ * invalidates the groups that depend on a changed variable (once per group), and resets the changes.
+ */
+void ExpressionOptimizer::invalidateChanged() {
+    ++updates;
+    always_group.epoch->advance();
+    for (std::vector<CachedExpression*>::iterator it=always_group.v_cached.begin();it!=always_group.v_cached.end();++it)
+        (*it)->invalidate_cache();
+    for (size_t p=0;p<changed.size();++p) {
+        if (!changed[p]) {
+            continue;
+        }
+        changed[p] = 0;
+        const std::vector<int>& pg = position_groups[p];
+        for (size_t k=0;k<pg.size();++k) {
+            CacheGroup& group = groups[pg[k]];
+            if (group.last_update==updates) {
+                continue;
             }
-            //cout << "cached " << obj->cached_name << " added \n";
-            break;
+            group.last_update = updates;
+            group.epoch->advance();
+            for (std::vector<CachedExpression*>::iterator it=group.v_cached.begin();it!=group.v_cached.end();++it)
+                (*it)->invalidate_cache();
         }
     }
+    initialized = true;
 }
 
-void ExpressionOptimizer::setInputValues(const std::vector<double>& values) {
-    assert( values.size() == inputvarnr.size() );
+void ExpressionOptimizer::bind(const double* values, const Rotation* rotvalues) {
+    assert( (values!=0) || inputvarnr.empty() );
+    assert( (rotvalues!=0) || rotinputvarnr.empty() );
+    bound_values    = values;
+    bound_rotvalues = rotvalues;
     for (size_t i=0; i< inputvarnr.size(); ++i) {
-        //cout << "nr of input objects for "<< i << " variable in the list " << inputs[i].size() << endl;
-        double value = values[i];
         for (ListInput::iterator it=inputs[i].begin(); it != inputs[i].end(); ++it ) {
-            //cout << "set input value \n"<< endl;
-            (*it)->val = value;
+            (*it)->binding = bound_values + i;
         }
     }
-
-    // invalidate the appropriate caches:
-    for (std::vector<CachedExpression*>::iterator   it=v_cached.begin();it!=v_cached.end();++it)  
-        (*it)->invalidate_cache();
+    for (size_t i=0; i< rotinputvarnr.size(); ++i) {
+        for (ListRotInput::iterator it=rotinputs[i].begin(); it != rotinputs[i].end(); ++it ) {
+            (*it)->binding = bound_rotvalues + i;
+        }
+    }
+    // the values of the buffer are all new:
+    initialized = false;
 }
 
-void ExpressionOptimizer::setInputValues(const std::vector<double>& values, const std::vector<Rotation>& rotvalues) {
-    assert( values.size() == inputvarnr.size() );
-    assert( rotvalues.size() == rotinputvarnr.size() );
-
+void ExpressionOptimizer::unbind() {
+    if ((bound_values==0) && (bound_rotvalues==0)) {
+        // nothing to do, and the registered input objects are not necessarily alive anymore.
+        return;
+    }
     for (size_t i=0; i< inputvarnr.size(); ++i) {
-        double value = values[i];
-        //cout << "nr of input objects for "<< i << " variable in the list " << inputs[i].size() << endl;
         for (ListInput::iterator it=inputs[i].begin(); it != inputs[i].end(); ++it ) {
-            //cout << "set input value \n"<< endl;
-            (*it)->val = value;
+            if (bound_values) {
+                (*it)->val = bound_values[i];
+            }
+            (*it)->binding = 0;
         }
     }
-
     for (size_t i=0; i< rotinputvarnr.size(); ++i) {
-        //cout << "nr of input objects for "<< i << " variable in the list " << inputs[i].size() << endl;
-        const Rotation& value = rotvalues[i];
         for (ListRotInput::iterator it=rotinputs[i].begin(); it != rotinputs[i].end(); ++it ) {
-            //cout << "set input value \n"<< endl;
-            (*it)->val = value;
+            if (bound_rotvalues) {
+                (*it)->val = bound_rotvalues[i];
+            }
+            (*it)->binding = 0;
         }
     }
+    bound_values    = 0;
+    bound_rotvalues = 0;
+}
 
-    // invalidate the appropriate caches:
-    for (std::vector<CachedExpression*>::iterator   it=v_cached.begin();it!=v_cached.end();++it)  
-        (*it)->invalidate_cache();
+ExpressionOptimizer::~ExpressionOptimizer() {
+    unbind();
 }
 
+void ExpressionOptimizer::update() {
+    // bind(..) has to be called before update():
+    assert( (bound_values!=0) || inputvarnr.empty() );
+    assert( (bound_rotvalues!=0) || rotinputvarnr.empty() );
+    for (size_t i=0; i< inputvarnr.size(); ++i) {
+        if (!initialized || (last_values[i]!=bound_values[i])) {
+            last_values[i] = bound_values[i];
+            changed[i]     = 1;
+        }
+    }
+    for (size_t i=0; i< rotinputvarnr.size(); ++i) {
+        const Rotation& R = bound_rotvalues[i];
+        if (!initialized || !std::equal(R.data, R.data+9, last_rotvalues[i].data)) {
+            last_rotvalues[i]            = R;
+            changed[inputvarnr.size()+i] = 1;
+        }
+    }
+    invalidateChanged();
+}
 
-void ExpressionOptimizer::setInputValues(const Eigen::VectorXd& values) {
-    assert( values.rows() == (int)inputvarnr.size() );
+void ExpressionOptimizer::setInputValues(const std::vector<double>& values) {
+    assert( values.size() == inputvarnr.size() );
     for (size_t i=0; i< inputvarnr.size(); ++i) {
-        double value = values[i];
-        //cout << "nr of input objects for "<< i << " variable in the list " << inputs[i].size() << endl;
-        for (ListInput::iterator it=inputs[i].begin(); it != inputs[i].end(); ++it ) {
-            //cout << "set input value \n"<< endl;
-            (*it)->val = value;
+        setInputValue(i, values[i]);
+    }
+    invalidateChanged();
+}
+
+/*
+ * the symbol table of NodeName, constructed on first use such that it is available while static
+ * expressions are constructed.  Names can be interned from several threads (e.g. by clone()).
+ *
+ * The names are stored in blocks that are never moved or freed, and the table of blocks has a
+ * fixed size, such that lookup(..) does not need the mutex: a name is complete before its number
+ * is handed out, and is never modified afterwards.
+ */
+struct SymbolTable {
+    enum { block_size = 1024, max_blocks = 4096 };
+
+    boost::mutex                                   mutex;
+    std::string*                                   blocks[max_blocks];
+    unsigned int                                   size;
+    boost::unordered_map<std::string,unsigned int> index;
+
+    SymbolTable():
+        size(0) {
+        std::fill(blocks, blocks+max_blocks, (std::string*)0);
+        add(std::string());
+    }
+
+    /*
+     * appends s, to be called with the mutex locked.
+     */
+    unsigned int add(const std::string& s) {
+        if (size >= (unsigned int)block_size*max_blocks) {
+            throw std::length_error("NodeName: too many distinct names");
+        }
+        if (size % block_size == 0) {
+            blocks[size/block_size] = new std::string[block_size];
         }
+        blocks[size/block_size][size%block_size] = s;
+        index[s] = size;
+        return size++;
     }
 
-    // invalidate the appropriate caches:
-    for (std::vector<CachedExpression*>::iterator   it=v_cached.begin();it!=v_cached.end();++it)  
-        (*it)->invalidate_cache();
+    const std::string& operator[](unsigned int id) const {
+        return blocks[id/block_size][id%block_size];
+    }
+};
+
+static SymbolTable& symbol_table() {
+    static SymbolTable table;
+    return table;
 }
 
+unsigned int NodeName::intern(const std::string& s) {
+    SymbolTable& t = symbol_table();
+    boost::mutex::scoped_lock lock(t.mutex);
+    boost::unordered_map<std::string,unsigned int>::const_iterator it = t.index.find(s);
+    if (it!=t.index.end()) {
+        return it->second;
+    }
+    return t.add(s);
+}
 
-void ExpressionOptimizer::setInputValues(const Eigen::VectorXd& values, const std::vector<Rotation>& rotvalues) {
-    assert( (size_t) values.size() == (size_t) inputvarnr.size() );
-    assert( (size_t) rotvalues.size() == (size_t) rotinputvarnr.size() );
+const std::string& NodeName::lookup(unsigned int id) {
+    // no lock, see SymbolTable:
+    return symbol_table()[id];
+}
 
-    for (size_t i=0; i< inputvarnr.size(); ++i) {
-        double value = values[i];
-        //cout << "nr of input objects for "<< i << " variable in the list " << inputs[i].size() << endl;
-        for (ListInput::iterator it=inputs[i].begin(); it != inputs[i].end(); ++it ) {
-            //cout << "set input value \n"<< endl;
-            (*it)->val = value;
+size_t NodeName::numberOfSymbols() {
+    SymbolTable& t = symbol_table();
+    boost::mutex::scoped_lock lock(t.mutex);
+    return t.size;
+}
+
+size_t NodeName::symbolBytes(unsigned int symbol) {
+    return sizeof(std::string) + symbol_table()[symbol].capacity();
+}
+
+namespace detail {
+
+/*
+ * for each thread, the nodes that are already written to its .dot file.  write_dotfile_init() removes
+ * a node again, and the set is emptied at the start and the end of each .dot file.
+ */
+static boost::thread_specific_ptr< std::set<const void*> > dotfile_written_of_thread;
+
+static std::set<const void*>& dotfile_written() {
+    if (!dotfile_written_of_thread.get()) {
+        dotfile_written_of_thread.reset(new std::set<const void*>());
+    }
+    return *dotfile_written_of_thread;
+}
+
+bool dotfile_mark_written(const void* node) {
+    return dotfile_written().insert(node).second;
+}
+
+void dotfile_clear_written(const void* node) {
+    dotfile_written().erase(node);
+}
+
+void dotfile_clear_all() {
+    if (dotfile_written_of_thread.get()) {
+        dotfile_written_of_thread->clear();
+    }
+}
+
+} // namespace detail
+
+/*
+ * the current builder of each thread, not owned by the thread_specific_ptr.
+ */
+template <typename T>
+static void no_cleanup(T*) {}
+
+static boost::thread_specific_ptr<GraphBuilder> current_builder(&no_cleanup<GraphBuilder>);
+
+GraphBuilder::GraphBuilder():
+    nr_of_hits(0),
+    previous(current_builder.get()) {
+    current_builder.reset(this);
+}
+
+GraphBuilder* GraphBuilder::current() {
+    return current_builder.get();
+}
+
+GraphBuilder::~GraphBuilder() {
+    assert( current_builder.get() == this );
+    current_builder.reset(previous);
+}
+
+ExpressionBase::Ptr GraphBuilder::intern(const ExpressionBase::Ptr& e) {
+    key.clear();
+    if (!e->getStructuralKey(key)) {
+        return e;
+    }
+    std::pair<Table::iterator,bool> r = table.insert(std::make_pair(key,e));
+    if (!r.second) {
+        ++nr_of_hits;
+    }
+    return r.first->second;
+}
+
+static boost::thread_specific_ptr<CloneContext> current_clone_context(&no_cleanup<CloneContext>);
+
+CloneContext::CloneContext(bool _share_constants):
+    share_constants(_share_constants),
+    nr_of_shared(0),
+    previous(current_clone_context.get()) {
+    current_clone_context.reset(this);
+}
+
+bool CloneContext::isShared(ExpressionBase* e) {
+    return share_constants && e->isStateless();
+}
+
+CloneContext* CloneContext::current() {
+    return current_clone_context.get();
+}
+
+CloneContext::~CloneContext() {
+    assert( current_clone_context.get() == this );
+    current_clone_context.reset(previous);
+}
+
+ExpressionBase::Ptr CloneContext::lookup(ExpressionBase* e) const {
+    boost::unordered_map<ExpressionBase*, ExpressionBase::Ptr>::const_iterator it = nodes.find(e);
+    if (it==nodes.end()) {
+        return ExpressionBase::Ptr();
+    }
+    return it->second;
+}
+
+void CloneContext::insert(ExpressionBase* e, const ExpressionBase::Ptr& clone) {
+    if (clone.get()==e) {
+        ++nr_of_shared;
+    }
+    nodes[e] = clone;
+}
+
+boost::shared_ptr<MIMO> CloneContext::lookup(MIMO* m) const {
+    boost::unordered_map<MIMO*, boost::shared_ptr<MIMO> >::const_iterator it = mimos.find(m);
+    if (it==mimos.end()) {
+        return boost::shared_ptr<MIMO>();
+    }
+    return it->second;
+}
+
+void CloneContext::insert(MIMO* m, const boost::shared_ptr<MIMO>& clone) {
+    mimos[m] = clone;
+}
+
+void jacobian_sparsity(const std::vector<ExpressionBase::Ptr>& exprs, const VarIndexSet& ndx,
+                       std::vector< std::pair<int,int> >& pattern) {
+    pattern.clear();
+    for (size_t r=0;r<exprs.size();++r) {
+        const DependencySet& dep = exprs[r]->dependencies();
+        for (size_t c=0;c<ndx.size();++c) {
+            if (dep.contains(ndx[c])) {
+                pattern.push_back(std::make_pair((int)r,(int)c));
+            }
         }
     }
+}
 
+void ExpressionOptimizer::setInputValues(const std::vector<double>& values, const std::vector<Rotation>& rotvalues) {
+    assert( values.size() == inputvarnr.size() );
+    assert( rotvalues.size() == rotinputvarnr.size() );
+    for (size_t i=0; i< inputvarnr.size(); ++i) {
+        setInputValue(i, values[i]);
+    }
     for (size_t i=0; i< rotinputvarnr.size(); ++i) {
-        const Rotation& value = rotvalues[i];
-        //cout << "nr of input objects for "<< i << " variable in the list " << inputs[i].size() << endl;
-        for (ListRotInput::iterator it=rotinputs[i].begin(); it != rotinputs[i].end(); ++it ) {
-            //cout << "set input value \n"<< endl;
-            (*it)->val = value; 
-        }
+        setInputValue(i, rotvalues[i]);
     }
+    invalidateChanged();
+}
 
 
-    // invalidate the appropriate caches:
-    for (std::vector<CachedExpression*>::iterator   it=v_cached.begin();it!=v_cached.end();++it)  
-        (*it)->invalidate_cache();
+void ExpressionOptimizer::setInputValues(const Eigen::VectorXd& values) {
+    assert( values.rows() == (int)inputvarnr.size() );
+    for (size_t i=0; i< inputvarnr.size(); ++i) {
+        setInputValue(i, values[i]);
+    }
+    invalidateChanged();
+}
+
+
+void ExpressionOptimizer::setInputValues(const Eigen::VectorXd& values, const std::vector<Rotation>& rotvalues) {
+    assert( (size_t) values.size() == (size_t) inputvarnr.size() );
+    assert( (size_t) rotvalues.size() == (size_t) rotinputvarnr.size() );
+    for (size_t i=0; i< inputvarnr.size(); ++i) {
+        setInputValue(i, values[i]);
+    }
+    for (size_t i=0; i< rotinputvarnr.size(); ++i) {
+        setInputValue(i, rotvalues[i]);
+    }
+    invalidateChanged();
 }
 
 
@@ -0,0 +1,597 @@
+/*
+ * expressiontree_graph.cpp
+ *
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#include <kdl/expressiontree_graph.hpp>
+#include <kdl/expressiontree_chain.hpp>
+#include <kdl/expressiontree_mimo.hpp>
+#include <boost/unordered_map.hpp>
+#include <algorithm>
+#include <set>
+#include <typeinfo>
+
+namespace KDL {
+
+/*
+ * the nodes of an expression graph, children before parents.
+ */
+struct GraphNode {
+    ExpressionBase::Ptr expr;
+    std::vector<int>    children;   // with multiplicity, e.g. twice for a*a
+    int                 parents;    // number of references from other nodes
+};
+
+class ChildCollector: public ArgumentVisitor {
+public:
+    std::vector<ExpressionBase::Ptr> children;
+    virtual void visitNode(const ExpressionBase::Ptr& arg) {
+        children.push_back(arg);
+    }
+};
+
+typedef boost::unordered_map<ExpressionBase*, int> NodeIndex;
+
+/*
+ * depth-first traversal without recursion, such that deep graphs do not overflow the stack.
+ */
+static void build_graph(const std::vector<ExpressionBase::Ptr>& roots, std::vector<GraphNode>& nodes, NodeIndex& index) {
+    nodes.clear();
+    index.clear();
+    std::vector< std::pair<ExpressionBase::Ptr, std::vector<ExpressionBase::Ptr> > > stack;
+    for (size_t r=0;r<roots.size();++r) {
+        if (index.find(roots[r].get())!=index.end()) {
+            continue;
+        }
+        ChildCollector c;
+        roots[r]->visitArguments(c);
+        stack.push_back(std::make_pair(roots[r],c.children));
+        index[roots[r].get()] = -1;
+        while (!stack.empty()) {
+            std::vector<ExpressionBase::Ptr>& todo = stack.back().second;
+            if (!todo.empty()) {
+                ExpressionBase::Ptr child = todo.back();
+                todo.pop_back();
+                if (index.find(child.get())==index.end()) {
+                    index[child.get()] = -1;
+                    ChildCollector cc;
+                    child->visitArguments(cc);
+                    stack.push_back(std::make_pair(child,cc.children));
+                }
+                continue;
+            }
+            GraphNode n;
+            n.expr    = stack.back().first;
+            n.parents = 0;
+            stack.pop_back();
+            ChildCollector cc;
+            n.expr->visitArguments(cc);
+            for (size_t i=0;i<cc.children.size();++i) {
+                n.children.push_back(index[cc.children[i].get()]);
+            }
+            index[n.expr.get()] = (int)nodes.size();
+            nodes.push_back(n);
+        }
+    }
+    for (size_t k=0;k<nodes.size();++k) {
+        for (size_t i=0;i<nodes[k].children.size();++i) {
+            nodes[nodes[k].children[i]].parents++;
+        }
+    }
+}
+
+static bool is_cache(ExpressionBase* e) {
+    return dynamic_cast<CachedExpression*>(e)!=0;
+}
+
+static bool is_expensive(ExpressionBase* e) {
+    return (dynamic_cast<Expression_Chain*>(e)!=0) || (dynamic_cast<MIMO_Output<double>*>(e)!=0);
+}
+
+/*
+ * number of evaluations of non-cache nodes when value() is called once on each root.
+ * Counted as a double, since it grows exponentially with the depth of a graph without caches.
+ */
+static double count_evaluations(const std::vector<ExpressionBase::Ptr>& roots, const std::vector<GraphNode>& nodes, NodeIndex& index) {
+    std::vector<double> count(nodes.size(),0.0);
+    for (size_t r=0;r<roots.size();++r) {
+        count[index[roots[r].get()]] += 1.0;
+    }
+    double total = 0.0;
+    for (int k=(int)nodes.size()-1;k>=0;--k) {
+        double calls = count[k];
+        if (is_cache(nodes[k].expr.get())) {
+            calls = std::min(calls,1.0);
+        } else {
+            total += calls;
+        }
+        for (size_t i=0;i<nodes[k].children.size();++i) {
+            count[nodes[k].children[i]] += calls;
+        }
+    }
+    return total;
+}
+
+/*
+ * replaces the arguments that have an entry in wrapper by a (shared) cached version.
+ */
+class CacheInserter: public ArgumentVisitor {
+public:
+    typedef boost::unordered_map<ExpressionBase*, ExpressionBase::Ptr> Wrappers;
+    Wrappers&       wrapper;
+    ExpressionBase* parent;
+    size_t          inserted;
+
+    CacheInserter(Wrappers& _wrapper):
+        wrapper(_wrapper), parent(0), inserted(0) {}
+
+    template <typename T>
+    void replace(boost::shared_ptr< Expression<T> >& arg) {
+        typename Wrappers::iterator it = wrapper.find(arg.get());
+        if (it==wrapper.end()) {
+            return;
+        }
+        if (!it->second) {
+            it->second = cached<T>(arg);
+            ++inserted;
+        }
+        if (it->second.get()!=parent) {
+            arg = boost::static_pointer_cast< Expression<T> >(it->second);
+        }
+    }
+
+    virtual void visit(boost::shared_ptr< Expression<double> >& arg)   { replace(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Vector> >& arg)   { replace(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Rotation> >& arg) { replace(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Frame> >& arg)    { replace(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Twist> >& arg)    { replace(arg); }
+    virtual void visit(boost::shared_ptr< Expression<Wrench> >& arg)   { replace(arg); }
+};
+
+AutoCacheReport auto_cache(const std::vector<ExpressionBase::Ptr>& roots) {
+    AutoCacheReport report;
+    std::vector<GraphNode> nodes;
+    NodeIndex              index;
+    build_graph(roots, nodes, index);
+    report.nodes              = nodes.size();
+    report.evaluations_before = count_evaluations(roots, nodes, index);
+
+    CacheInserter::Wrappers wrapper;
+    for (size_t k=0;k<nodes.size();++k) {
+        const GraphNode& n = nodes[k];
+        if (n.parents==0 || is_cache(n.expr.get())) {
+            continue;
+        }
+        bool shared    = (n.parents > 1) && !n.children.empty();
+        bool expensive = is_expensive(n.expr.get());
+        if (n.parents > 1) {
+            report.shared_nodes++;
+        }
+        if (expensive) {
+            report.expensive_nodes++;
+        }
+        if (shared || expensive) {
+            wrapper[n.expr.get()] = ExpressionBase::Ptr();
+        }
+    }
+    // reuse existing caches: a CachedType is a cache with exactly one argument
+    for (size_t k=0;k<nodes.size();++k) {
+        const GraphNode& n = nodes[k];
+        if (is_cache(n.expr.get()) && (n.children.size()==1)) {
+            CacheInserter::Wrappers::iterator it = wrapper.find(nodes[n.children[0]].expr.get());
+            if ((it!=wrapper.end()) && !it->second) {
+                it->second = n.expr;
+            }
+        }
+    }
+
+    CacheInserter inserter(wrapper);
+    for (size_t k=0;k<nodes.size();++k) {
+        inserter.parent = nodes[k].expr.get();
+        nodes[k].expr->visitArguments(inserter);
+    }
+    report.inserted = inserter.inserted;
+
+    build_graph(roots, nodes, index);
+    report.evaluations_after = count_evaluations(roots, nodes, index);
+    return report;
+}
+
+AutoCacheReport auto_cache(const ExpressionBase::Ptr& root) {
+    return auto_cache(std::vector<ExpressionBase::Ptr>(1,root));
+}
+
+MemoryReport memory_report(const std::vector<ExpressionBase::Ptr>& roots) {
+    MemoryReport report;
+    std::vector<GraphNode> nodes;
+    NodeIndex              index;
+    build_graph(roots, nodes, index);
+    report.nodes = nodes.size();
+    std::set<unsigned int> symbols;
+    for (size_t k=0;k<nodes.size();++k) {
+        ExpressionBase* e = nodes[k].expr.get();
+        size_t size = node_size(typeid(*e));
+        if (size==0) {
+            report.unknown_nodes++;
+        }
+        MemoryReport::TypeUsage& usage = report.types[demangle(typeid(*e).name())];
+        usage.nodes++;
+        usage.bytes           += size;
+        report.node_bytes     += size;
+        report.cache_bytes    += e->cacheBytes();
+        report.metadata_bytes += sizeof(NodeName) + sizeof(DependencySet) + e->dependencies().heapBytes();
+        if (symbols.insert(e->name.symbol()).second) {
+            report.metadata_bytes += NodeName::symbolBytes(e->name.symbol());
+        }
+    }
+    return report;
+}
+
+MemoryReport memory_report(const ExpressionBase::Ptr& root) {
+    return memory_report(std::vector<ExpressionBase::Ptr>(1,root));
+}
+
+static MIMO* mimo_of(ExpressionBase* e) {
+    MIMO_Output<double>* o = dynamic_cast<MIMO_Output<double>*>(e);
+    return o!=0 ? o->mimo.get() : 0;
+}
+
+/*
+ * value() of the top node of a task.
+ */
+template <typename T>
+class TypedEvaluation: public ParallelEvaluator::Evaluation {
+public:
+    typename Expression<T>::Ptr expr;
+    TypedEvaluation(const typename Expression<T>::Ptr& _expr):
+        expr(_expr) {}
+    virtual void run() {
+        expr->value();
+    }
+    virtual ExpressionBase::Ptr expression() const {
+        return expr;
+    }
+};
+
+template <typename T>
+static bool make_evaluation(const ExpressionBase::Ptr& e, ParallelEvaluator::Evaluation::Ptr& result) {
+    typename Expression<T>::Ptr t = boost::dynamic_pointer_cast< Expression<T> >(e);
+    if (t) {
+        result.reset( new TypedEvaluation<T>(t) );
+    }
+    return t.get()!=0;
+}
+
+static ParallelEvaluator::Evaluation::Ptr make_evaluation(const ExpressionBase::Ptr& e) {
+    ParallelEvaluator::Evaluation::Ptr result;
+    make_evaluation<double>(e,result)   || make_evaluation<Vector>(e,result) ||
+    make_evaluation<Rotation>(e,result) || make_evaluation<Frame>(e,result)  ||
+    make_evaluation<Twist>(e,result)    || make_evaluation<Wrench>(e,result);
+    return result;
+}
+
+/*
+ * the graph of ParallelEvaluator: the nodes of build_graph(..), extended with the inputs of the
+ * MIMO blocks and one node (without expression) for each MIMO block.  A MIMO_Output refers to the node
+ * of its MIMO block, which refers to the inputs of the block.
+ */
+struct SchedulingGraph {
+    std::vector<GraphNode> nodes;
+    NodeIndex              index;
+    std::vector<MIMO*>     mimos;
+    std::vector<double>    cost;      // estimated cost of each node
+    std::vector<bool>      readonly;  // node without arguments and without state
+    std::vector<bool>      caching;   // node that caches its own value
+    std::vector<int>       stamp;
+    std::vector<int>       refs;
+    int                    current;
+
+    SchedulingGraph(const std::vector<ExpressionBase::Ptr>& roots, const ParallelCostModel& model):
+        current(0) {
+        std::vector<ExpressionBase::Ptr> all(roots);
+        boost::unordered_map<MIMO*,int>  mimo_index;
+        size_t before;
+        do {
+            before = mimos.size();
+            build_graph(all, nodes, index);
+            for (size_t k=0;k<nodes.size();++k) {
+                MIMO* m = mimo_of(nodes[k].expr.get());
+                if ((m!=0) && (mimo_index.find(m)==mimo_index.end())) {
+                    mimo_index[m] = (int)mimos.size();
+                    mimos.push_back(m);
+                    all.insert(all.end(), m->inputDouble.begin(), m->inputDouble.end());
+                    all.insert(all.end(), m->inputFrame.begin(),  m->inputFrame.end());
+                    all.insert(all.end(), m->inputTwist.begin(),  m->inputTwist.end());
+                }
+            }
+        } while (mimos.size()!=before);
+
+        int n = (int)nodes.size();
+        for (size_t j=0;j<mimos.size();++j) {
+            GraphNode g;
+            MIMO* m = mimos[j];
+            for (size_t i=0;i<m->inputDouble.size();++i) {
+                g.children.push_back(index[m->inputDouble[i].get()]);
+            }
+            for (size_t i=0;i<m->inputFrame.size();++i) {
+                g.children.push_back(index[m->inputFrame[i].get()]);
+            }
+            for (size_t i=0;i<m->inputTwist.size();++i) {
+                g.children.push_back(index[m->inputTwist[i].get()]);
+            }
+            nodes.push_back(g);
+        }
+        for (int k=0;k<n;++k) {
+            MIMO* m = mimo_of(nodes[k].expr.get());
+            if (m!=0) {
+                nodes[k].children.push_back(n + mimo_index[m]);
+            }
+        }
+        for (size_t k=0;k<nodes.size();++k) {
+            nodes[k].parents = 0;
+        }
+        for (size_t k=0;k<nodes.size();++k) {
+            for (size_t i=0;i<nodes[k].children.size();++i) {
+                nodes[nodes[k].children[i]].parents++;
+            }
+        }
+
+        cost.resize(nodes.size());
+        readonly.resize(nodes.size());
+        caching.resize(nodes.size());
+        for (size_t k=0;k<nodes.size();++k) {
+            ExpressionBase* e = nodes[k].expr.get();
+            bool chain = (e!=0) && (dynamic_cast<Expression_Chain*>(e)!=0);
+            bool cache = (e!=0) && is_cache(e);
+            bool leaf  = nodes[k].children.empty();
+            readonly[k] = (e!=0) && leaf && !chain && !cache;
+            caching[k]  = cache || chain || (mimo_of(e)!=0);
+            if (e==0) {
+                cost[k] = model.mimo;
+            } else if (chain) {
+                cost[k] = model.chain;
+            } else if (cache) {
+                cost[k] = leaf ? model.callback : 0.0;
+            } else if (readonly[k]) {
+                cost[k] = 0.0;
+            } else {
+                cost[k] = model.node;
+            }
+        }
+        stamp.assign(nodes.size(),-1);
+        refs.assign(nodes.size(),0);
+    }
+
+    /*
+     * collects the nodes reachable from v (including v).
+     */
+    void closure(int v, std::vector<int>& result) {
+        ++current;
+        result.clear();
+        result.push_back(v);
+        stamp[v] = current;
+        for (size_t j=0;j<result.size();++j) {
+            const std::vector<int>& children = nodes[result[j]].children;
+            for (size_t i=0;i<children.size();++i) {
+                if (stamp[children[i]]!=current) {
+                    stamp[children[i]] = current;
+                    result.push_back(children[i]);
+                }
+            }
+        }
+    }
+
+    /*
+     * true if all nodes in c (the closure of c[0]), except c[0] and the readonly nodes, are
+     * only referenced from within c.
+     */
+    bool independent(const std::vector<int>& c) {
+        for (size_t j=0;j<c.size();++j) {
+            refs[c[j]] = 0;
+        }
+        for (size_t j=0;j<c.size();++j) {
+            const std::vector<int>& children = nodes[c[j]].children;
+            for (size_t i=0;i<children.size();++i) {
+                refs[children[i]]++;
+            }
+        }
+        for (size_t j=1;j<c.size();++j) {
+            if (!readonly[c[j]] && (refs[c[j]]!=nodes[c[j]].parents)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/*
+ * the largest candidates strictly below v: the search does not continue below a candidate.
+ */
+static void largest_candidates(SchedulingGraph& g, const std::vector<bool>& candidate, int v, std::vector<int>& result) {
+    result.clear();
+    ++g.current;
+    std::vector<int> todo(g.nodes[v].children);
+    while (!todo.empty()) {
+        int w = todo.back();
+        todo.pop_back();
+        if (g.stamp[w]==g.current) {
+            continue;
+        }
+        g.stamp[w] = g.current;
+        if (candidate[w]) {
+            result.push_back(w);
+        } else {
+            todo.insert(todo.end(), g.nodes[w].children.begin(), g.nodes[w].children.end());
+        }
+    }
+}
+
+struct CostGreater {
+    const std::vector<double>& cost;
+    CostGreater(const std::vector<double>& _cost):cost(_cost) {}
+    bool operator()(int a, int b) const {
+        return cost[a] > cost[b];
+    }
+};
+
+ParallelEvaluator::ParallelEvaluator(const std::vector<ExpressionBase::Ptr>& roots, const TaskPool::Ptr& _pool,
+                                     double threshold, const ParallelCostModel& model):
+    pool(_pool),
+    total_cost(0) {
+    SchedulingGraph g(roots, model);
+    int n = (int)g.nodes.size();
+
+    // candidates: heavy independent subgraphs with an expression on top
+    std::vector<double> subgraph_cost(n,0.0);
+    std::vector<bool>   candidate(n,false);
+    std::vector<int>    c;
+    for (int k=0;k<n;++k) {
+        total_cost += g.cost[k];
+        g.closure(k,c);
+        for (size_t j=0;j<c.size();++j) {
+            subgraph_cost[k] += g.cost[c[j]];
+        }
+        candidate[k] = g.nodes[k].expr && (subgraph_cost[k] >= threshold) && g.independent(c);
+    }
+
+    // split the roots, and subgraphs that contain at least two candidates:
+    std::vector<int>  todo;
+    std::vector<int>  selected;
+    std::vector<bool> chosen(n,false);
+    for (size_t r=0;r<roots.size();++r) {
+        int k = g.index[roots[r].get()];
+        if (candidate[k] && g.caching[k]) {
+            todo.push_back(k);
+        } else {
+            largest_candidates(g, candidate, k, c);
+            todo.insert(todo.end(), c.begin(), c.end());
+        }
+    }
+    while (!todo.empty()) {
+        int k = todo.back();
+        todo.pop_back();
+        if (chosen[k]) {
+            continue;
+        }
+        largest_candidates(g, candidate, k, c);
+        if (c.size() >= 2) {
+            todo.insert(todo.end(), c.begin(), c.end());
+        } else {
+            chosen[k] = true;
+            selected.push_back(k);
+        }
+    }
+    std::stable_sort(selected.begin(), selected.end(), CostGreater(subgraph_cost));
+
+    // the top node of a task should cache its value, reuse an existing CachedType parent:
+    CacheInserter::Wrappers wrapper;
+    for (size_t j=0;j<selected.size();++j) {
+        if (!g.caching[selected[j]]) {
+            wrapper[g.nodes[selected[j]].expr.get()] = ExpressionBase::Ptr();
+        }
+    }
+    for (int k=0;k<n;++k) {
+        const GraphNode& node = g.nodes[k];
+        if (node.expr && is_cache(node.expr.get()) && (node.children.size()==1) && (g.nodes[node.children[0]].parents==1)) {
+            CacheInserter::Wrappers::iterator it = wrapper.find(g.nodes[node.children[0]].expr.get());
+            if (it!=wrapper.end()) {
+                it->second = node.expr;
+            }
+        }
+    }
+    CacheInserter inserter(wrapper);
+    for (int k=0;k<n;++k) {
+        if (g.nodes[k].expr) {
+            inserter.parent = g.nodes[k].expr.get();
+            g.nodes[k].expr->visitArguments(inserter);
+        }
+    }
+    inserter.parent = 0;
+    for (size_t j=0;j<g.mimos.size();++j) {
+        for (size_t i=0;i<g.mimos[j]->inputDouble.size();++i) {
+            inserter.visit(g.mimos[j]->inputDouble[i]);
+        }
+        for (size_t i=0;i<g.mimos[j]->inputFrame.size();++i) {
+            inserter.visit(g.mimos[j]->inputFrame[i]);
+        }
+        for (size_t i=0;i<g.mimos[j]->inputTwist.size();++i) {
+            inserter.visit(g.mimos[j]->inputTwist[i]);
+        }
+    }
+    for (size_t j=0;j<selected.size();++j) {
+        ExpressionBase::Ptr e = g.nodes[selected[j]].expr;
+        CacheInserter::Wrappers::iterator it = wrapper.find(e.get());
+        if (it!=wrapper.end()) {
+            e = it->second;
+        }
+        tasks.push_back(make_evaluation(e));
+        task_cost.push_back(subgraph_cost[selected[j]]);
+    }
+}
+
+/*
+ * task k of the pool evaluates task k of the evaluator.
+ */
+class EvaluationTask: public TaskPool::Task {
+public:
+    const std::vector<ParallelEvaluator::Evaluation::Ptr>& tasks;
+    EvaluationTask(const std::vector<ParallelEvaluator::Evaluation::Ptr>& _tasks):
+        tasks(_tasks) {}
+    virtual void run(int k, int w) {
+        tasks[k]->run();
+    }
+};
+
+void ParallelEvaluator::evaluate() {
+    if (tasks.size() < 2) {
+        return;
+    }
+    EvaluationTask t(tasks);
+    pool->run(t, (int)tasks.size());
+}
+
+ExpressionBase::Ptr ParallelEvaluator::task(int k) const {
+    return tasks[k]->expression();
+}
+
+std::ostream& operator << (std::ostream& os, const AutoCacheReport& r) {
+    os << "auto_cache: " << r.nodes << " nodes, "
+       << r.shared_nodes << " shared, "
+       << r.expensive_nodes << " expensive, "
+       << r.inserted << " caches inserted, "
+       << r.evaluations_before << " -> " << r.evaluations_after << " evaluations ("
+       << r.redundantEvaluationsRemoved() << " redundant evaluations removed)";
+    return os;
+}
+
+std::ostream& operator << (std::ostream& os, const MemoryReport& r) {
+    os << "memory_report: " << r.nodes << " nodes, "
+       << r.node_bytes << " bytes in nodes, "
+       << r.cache_bytes << " bytes in caches, "
+       << r.metadata_bytes << " bytes of metadata";
+    if (r.unknown_nodes!=0) {
+        os << ", " << r.unknown_nodes << " nodes of unknown size";
+    }
+    os << "\n";
+    for (std::map<std::string, MemoryReport::TypeUsage>::const_iterator it=r.types.begin();it!=r.types.end();++it) {
+        os << "    " << it->first << " : " << it->second.nodes << " nodes, " << it->second.bytes << " bytes\n";
+    }
+    return os;
+}
+
+} // namespace KDL
@@ -0,0 +1,455 @@
+/*
+ * expressiontree_jacobian.cpp
+ *
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#include <kdl/expressiontree_jacobian.hpp>
+#include <algorithm>
+
+namespace KDL {
+
+/**
+ * number of rows and components of a derivative of type T, as used by JacobianAssembler.
+ */
+template <typename T>
+struct JacobianRowTrait {
+};
+
+template <>
+struct JacobianRowTrait<double> {
+    static const int rows = 1;
+    static double component(double d, int r) {
+        return d;
+    }
+};
+
+template <>
+struct JacobianRowTrait<Vector> {
+    static const int rows = 3;
+    static double component(const Vector& d, int r) {
+        return d(r);
+    }
+};
+
+template <>
+struct JacobianRowTrait<Twist> {
+    static const int rows = 6;
+    static double component(const Twist& d, int r) {
+        return r < 3 ? d.vel(r) : d.rot(r-3);
+    }
+};
+
+template <typename T>
+class JacobianBlock: public JacobianAssembler::Block {
+public:
+    typedef typename AutoDiffTrait<T>::DerivType DerivType;
+    typedef JacobianRowTrait<DerivType> Trait;
+
+    typename Expression<T>::Ptr expr;
+    std::vector<DerivType>      jac;
+
+    JacobianBlock(const typename Expression<T>::Ptr& _expr):
+        expr(_expr) {}
+
+    virtual void evaluate() {
+        expr->value();
+    }
+
+    virtual void compute() {
+        if (!vars.empty()) {
+            expr->jacobian(vars,&jac[0]);
+        }
+    }
+
+    virtual void write(Eigen::MatrixXd& J) const {
+        for (int r=0;r<Trait::rows;++r) {
+            for (size_t k=0;k<cols.size();++k) {
+                J(row+r,cols[k]) = Trait::component(jac[k],r);
+            }
+        }
+    }
+
+    virtual void write(double* nz) const {
+        for (int r=0;r<Trait::rows;++r) {
+            for (size_t k=0;k<cols.size();++k) {
+                *nz++ = Trait::component(jac[k],r);
+            }
+        }
+    }
+};
+
+JacobianAssembler::JacobianAssembler(const VarIndexSet& _ndx):
+    ndx(_ndx),
+    nrows(0),
+    nnz(0) {}
+
+void JacobianAssembler::addBlock(const boost::shared_ptr<Block>& b, ExpressionBase::Ptr e, int blockrows) {
+    tape.reset();
+    contexts.clear();
+    b->expression = e;
+    const DependencySet& dep = e->dependencies();
+    for (size_t c=0;c<ndx.size();++c) {
+        if (dep.contains(ndx[c])) {
+            b->vars.push_back(ndx[c]);
+            b->cols.push_back((int)c);
+        }
+    }
+    b->row    = nrows;
+    b->nrows  = blockrows;
+    b->offset = nnz;
+    nrows    += blockrows;
+    nnz      += blockrows*(int)b->cols.size();
+    blocks.push_back(b);
+}
+
+int JacobianAssembler::add(const Expression<double>::Ptr& e) {
+    int row = nrows;
+    boost::shared_ptr< JacobianBlock<double> > b( new JacobianBlock<double>(e) );
+    addBlock(b, e, 1);
+    b->jac.resize(b->vars.size());
+    return row;
+}
+
+int JacobianAssembler::add(const Expression<Vector>::Ptr& e) {
+    int row = nrows;
+    boost::shared_ptr< JacobianBlock<Vector> > b( new JacobianBlock<Vector>(e) );
+    addBlock(b, e, 3);
+    b->jac.resize(b->vars.size());
+    return row;
+}
+
+int JacobianAssembler::add(const Expression<Rotation>::Ptr& e) {
+    int row = nrows;
+    boost::shared_ptr< JacobianBlock<Rotation> > b( new JacobianBlock<Rotation>(e) );
+    addBlock(b, e, 3);
+    b->jac.resize(b->vars.size());
+    return row;
+}
+
+int JacobianAssembler::add(const Expression<Frame>::Ptr& e) {
+    int row = nrows;
+    boost::shared_ptr< JacobianBlock<Frame> > b( new JacobianBlock<Frame>(e) );
+    addBlock(b, e, 6);
+    b->jac.resize(b->vars.size());
+    return row;
+}
+
+/*
+ * Greedy colouring of the column intersection graph, columns in order of decreasing
+ * (estimated) degree.  Two columns are adjacent when a block depends on both.
+ */
+struct DegreeGreater {
+    const std::vector<int>& degree;
+    DegreeGreater(const std::vector<int>& _degree):degree(_degree) {}
+    bool operator()(int a, int b) const {
+        return degree[a] > degree[b];
+    }
+};
+
+void JacobianAssembler::compress() {
+    int ncols = (int)ndx.size();
+    std::vector< std::vector<int> > blocks_of_col(ncols);
+    std::vector<int> degree(ncols,0);
+    for (size_t i=0;i<blocks.size();++i) {
+        const std::vector<int>& cols = blocks[i]->cols;
+        for (size_t k=0;k<cols.size();++k) {
+            blocks_of_col[cols[k]].push_back((int)i);
+            degree[cols[k]] += (int)cols.size()-1;
+        }
+    }
+    std::vector<int> order(ncols);
+    for (int c=0;c<ncols;++c) {
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(),order.end(),DegreeGreater(degree));
+
+    colour.assign(ncols,-1);
+    std::vector<int> forbidden(ncols,-1);  // forbidden[g]==c if colour g is used by a neighbour of c
+    int ncolours = 0;
+    for (int k=0;k<ncols;++k) {
+        int c = order[k];
+        if (blocks_of_col[c].empty()) {
+            continue;
+        }
+        for (size_t i=0;i<blocks_of_col[c].size();++i) {
+            const std::vector<int>& cols = blocks[blocks_of_col[c][i]]->cols;
+            for (size_t j=0;j<cols.size();++j) {
+                if (colour[cols[j]]>=0) {
+                    forbidden[colour[cols[j]]] = c;
+                }
+            }
+        }
+        int g = 0;
+        while (forbidden[g]==c) {
+            ++g;
+        }
+        colour[c] = g;
+        ncolours  = std::max(ncolours,g+1);
+    }
+
+    groups.assign(ncolours,VarIndexSet());
+    int maxvar = -1;
+    for (int c=0;c<ncols;++c) {
+        maxvar = std::max(maxvar,ndx[c]);
+    }
+    var_colour.assign(maxvar+1,-1);
+    for (int c=0;c<ncols;++c) {
+        if (colour[c]>=0) {
+            groups[colour[c]].push_back(ndx[c]);
+            var_colour[ndx[c]] = colour[c];
+        }
+    }
+
+    ExpressionTape::Ptr t( new ExpressionTape() );
+    for (size_t i=0;i<blocks.size();++i) {
+        t->addOutput(blocks[i]->expression);
+    }
+    tape = t;
+    createWorkers();
+}
+
+void JacobianAssembler::setTaskPool(const TaskPool::Ptr& _pool) {
+    pool = _pool;
+    createWorkers();
+}
+
+void JacobianAssembler::createWorkers() {
+    contexts.clear();
+    if (!tape || !pool) {
+        return;
+    }
+    for (int w=1;w<pool->size();++w) {
+        contexts.push_back(tape->createContext());
+    }
+    synced.assign(pool->size(),0);
+}
+
+/*
+ * context of worker w, with the values of the last evaluate().
+ * The value buffer (including the inputs) of the default context is copied. With opaque nodes,
+ * the tape is evaluated again such that the clones of the opaque nodes have their value.
+ */
+EvalContext& JacobianAssembler::worker(int w) {
+    if (w==0) {
+        return tape->context();
+    }
+    EvalContext& ctx = *contexts[w-1];
+    if (!synced[w]) {
+        const EvalContext& src = tape->context();
+        std::copy(src.data.begin(), src.data.begin()+src.nvalues, ctx.data.begin());
+        if (!tape->opaque.empty()) {
+            tape->invalidate(ctx);
+            tape->evaluate(ctx);
+        }
+        synced[w] = 1;
+    }
+    return ctx;
+}
+
+void JacobianAssembler::setInputValue(int variable_number, double val) {
+    if (tape) {
+        tape->setInputValue(variable_number,val);
+        if (!tape->opaque.empty()) {
+            for (size_t k=0;k<contexts.size();++k) {
+                tape->setInputValue(*contexts[k],variable_number,val);
+            }
+        }
+    } else {
+        for (size_t i=0;i<blocks.size();++i) {
+            blocks[i]->expression->setInputValue(variable_number,val);
+        }
+    }
+}
+
+void JacobianAssembler::setInputValue(int variable_number, const Rotation& val) {
+    if (tape) {
+        tape->setInputValue(variable_number,val);
+        if (!tape->opaque.empty()) {
+            for (size_t k=0;k<contexts.size();++k) {
+                tape->setInputValue(*contexts[k],variable_number,val);
+            }
+        }
+    } else {
+        for (size_t i=0;i<blocks.size();++i) {
+            blocks[i]->expression->setInputValue(variable_number,val);
+        }
+    }
+}
+
+void JacobianAssembler::setInputValues(const std::vector<double>& values) {
+    if (tape) {
+        tape->setInputValues(values);
+        if (!tape->opaque.empty()) {
+            for (size_t k=0;k<contexts.size();++k) {
+                tape->setInputValues(*contexts[k],values);
+            }
+        }
+    } else {
+        for (size_t i=0;i<blocks.size();++i) {
+            blocks[i]->expression->setInputValues(values);
+        }
+    }
+}
+
+void JacobianAssembler::setInputValues(const std::vector<int>& _ndx, const std::vector<double>& values) {
+    if (tape) {
+        tape->setInputValues(_ndx,values);
+        if (!tape->opaque.empty()) {
+            for (size_t k=0;k<contexts.size();++k) {
+                tape->setInputValues(*contexts[k],_ndx,values);
+            }
+        }
+    } else {
+        for (size_t i=0;i<blocks.size();++i) {
+            blocks[i]->expression->setInputValues(_ndx,values);
+        }
+    }
+}
+
+void JacobianAssembler::evaluate() {
+    if (tape) {
+        tape->evaluate();
+        std::fill(synced.begin(), synced.end(), 0);
+    } else {
+        for (size_t i=0;i<blocks.size();++i) {
+            blocks[i]->evaluate();
+        }
+    }
+}
+
+/*
+ * copies the derivatives in the lanes of colours first..first+n-1 to J (when J!=0)
+ * or to the non-zeros nz of a sparse Jacobian.  Within a block, each colour corresponds
+ * to at most one column.
+ */
+void JacobianAssembler::decompress(const EvalContext& ctx, int first, int n, Eigen::MatrixXd* J, double* nz) {
+    double d[6];
+    for (size_t i=0;i<blocks.size();++i) {
+        const Block& b = *blocks[i];
+        const TapeSlot& slot = tape->outputs[i];
+        int p = (int)b.cols.size();
+        for (int k=0;k<p;++k) {
+            int l = colour[b.cols[k]] - first;
+            if ((0<=l) && (l<n)) {
+                ExpressionTape::laneDerivative(ctx, slot, l, d);
+                for (int r=0;r<b.nrows;++r) {
+                    if (J!=0) {
+                        (*J)(b.row+r,b.cols[k]) = d[r];
+                    } else {
+                        nz[b.offset + r*p + k] = d[r];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void JacobianAssembler::computeColours(EvalContext& ctx, int first, int n, Eigen::MatrixXd* J, double* nz) {
+    tape->evaluateSeededDerivatives(ctx, var_colour, groups, first, n);
+    decompress(ctx, first, n, J, nz);
+}
+
+/*
+ * task k computes colours k*lanes .. (k+1)*lanes-1.  Different tasks write different
+ * columns of J, i.e. different non-zeros.
+ */
+class ColourTask: public TaskPool::Task {
+public:
+    JacobianAssembler& assembler;
+    Eigen::MatrixXd*   J;
+    double*            nz;
+
+    ColourTask(JacobianAssembler& _assembler, Eigen::MatrixXd* _J, double* _nz):
+        assembler(_assembler), J(_J), nz(_nz) {}
+
+    virtual void run(int k, int w) {
+        int first = k*ExpressionTape::lanes;
+        int n     = std::min<int>(ExpressionTape::lanes, assembler.groups.size()-first);
+        assembler.computeColours(assembler.worker(w), first, n, J, nz);
+    }
+};
+
+void JacobianAssembler::compressedJacobian(Eigen::MatrixXd* J, double* nz) {
+    int ntasks = ((int)groups.size() + ExpressionTape::lanes - 1)/ExpressionTape::lanes;
+    if (!pool) {
+        for (int k=0;k<ntasks;++k) {
+            int first = k*ExpressionTape::lanes;
+            computeColours(tape->context(), first, std::min<int>(ExpressionTape::lanes, groups.size()-first), J, nz);
+        }
+        return;
+    }
+    ColourTask task(*this, J, nz);
+    pool->run(task, ntasks);
+}
+
+void JacobianAssembler::sparsity(std::vector< std::pair<int,int> >& pattern) const {
+    pattern.clear();
+    pattern.reserve(nnz);
+    for (size_t i=0;i<blocks.size();++i) {
+        const Block& b = *blocks[i];
+        for (int r=0;r<b.nrows;++r) {
+            for (size_t k=0;k<b.cols.size();++k) {
+                pattern.push_back(std::make_pair(b.row+r,b.cols[k]));
+            }
+        }
+    }
+}
+
+void JacobianAssembler::initialize(Eigen::MatrixXd& J) const {
+    J.setZero(nrows, (int)ndx.size());
+}
+
+void JacobianAssembler::initialize(SparseJacobian& J) const {
+    std::vector< std::pair<int,int> > pattern;
+    sparsity(pattern);
+    std::vector< Eigen::Triplet<double> > triplets;
+    triplets.reserve(pattern.size());
+    for (size_t i=0;i<pattern.size();++i) {
+        triplets.push_back(Eigen::Triplet<double>(pattern[i].first,pattern[i].second,0.0));
+    }
+    J.resize(nrows, (int)ndx.size());
+    J.setFromTriplets(triplets.begin(),triplets.end());
+    J.makeCompressed();
+}
+
+void JacobianAssembler::jacobian(Eigen::MatrixXd& J) {
+    assert( (J.rows()==nrows) && (J.cols()==(int)ndx.size()) );
+    if (tape) {
+        compressedJacobian(&J, 0);
+        return;
+    }
+    for (size_t i=0;i<blocks.size();++i) {
+        blocks[i]->compute();
+        blocks[i]->write(J);
+    }
+}
+
+void JacobianAssembler::jacobian(SparseJacobian& J) {
+    assert( (J.rows()==nrows) && (J.cols()==(int)ndx.size()) && (J.nonZeros()==nnz) && J.isCompressed() );
+    double* nz = J.valuePtr();
+    if (tape) {
+        compressedJacobian(0, nz);
+        return;
+    }
+    for (size_t i=0;i<blocks.size();++i) {
+        blocks[i]->compute();
+        blocks[i]->write(nz + blocks[i]->offset);
+    }
+}
+
+} // namespace KDL
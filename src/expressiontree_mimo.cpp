@@ -17,15 +17,24 @@
 */
 
 #include <kdl/expressiontree_mimo.hpp>
+#include <stdexcept>
 namespace KDL {
 
-MIMO::MIMO() {}
+MIMO::MIMO():
+            has_outputs(false) {}
 
 MIMO::MIMO( const std::string& _name):
+            has_outputs(false),
             name(_name),
             cached(false)
 {}
 
+void MIMO::checkInputsMutable(const std::string& method) const {
+    if (has_outputs) {
+        throw std::logic_error(method + ": the inputs of a MIMO cannot change after an output is created");
+    }
+}
+
 
 void MIMO::setInputValues(const std::vector<double>& values) {
         for (size_t i=0;i<inputDouble.size();++i) {
@@ -232,7 +241,9 @@ Expression<Twist>::Ptr MIMO::subExpression_Twist(const std::string& name) {
 }
 
 void MIMO::addToOptimizer(ExpressionOptimizer& opt) {
-    CachedExpression::addToOptimizer(opt);
+    // a MIMO can have a state that is not determined by its inputs (e.g. a sensor):
+    opt.addVolatile();
+    opt.addCached(this, true);
     for (size_t i=0;i<inputDouble.size();++i) {
         inputDouble[i]->addToOptimizer(opt);
     }
@@ -368,6 +379,14 @@ void MIMO::write_dotfile_init() {
 } 
 
 MIMO::Ptr MIMO::getClone(int count) {
+    CloneContext* ctx = CloneContext::current();
+    if (ctx!=0) {
+        MIMO::Ptr c = ctx->lookup(this);
+        if (c) {
+            return c;
+        }
+    }
+    // outputs that are cloned separately (e.g. y1->clone() and y2->clone()) share the count-th clone:
     if (count >= (int)queue_of_clones.size()) {
         queue_of_clones.resize(count+1);
     }
@@ -376,6 +395,9 @@ MIMO::Ptr MIMO::getClone(int count) {
         tmp =  this->clone();
         queue_of_clones[count] = tmp;
     }
+    if (ctx!=0) {
+        ctx->insert(this, tmp);
+    }
     return tmp; 
 }  
 
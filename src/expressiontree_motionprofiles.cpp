@@ -153,6 +153,7 @@ MotionProfileTrapezoidal::MotionProfileTrapezoidal():
 }
 
 void MotionProfileTrapezoidal::setProgressExpression(const Expression<double>::Ptr& s) {
+    checkInputsMutable("MotionProfileTrapezoidal::setProgressExpression");
     inputDouble[ idx_progrvar] = s;
 }
 Expression<double>::Ptr MotionProfileTrapezoidal::getProgressExpression() {
@@ -160,6 +161,7 @@ Expression<double>::Ptr MotionProfileTrapezoidal::getProgressExpression() {
 }
 
 void MotionProfileTrapezoidal::addOutput( const Expression<double>::Ptr& startv, const Expression<double>::Ptr& endv, const Expression<double>::Ptr& maxvel, const Expression<double>::Ptr& maxacc) {
+    checkInputsMutable("MotionProfileTrapezoidal::addOutput");
     inputDouble.push_back( maxvel );
     inputDouble.push_back( maxacc );
     inputDouble.push_back( startv );
@@ -203,16 +205,16 @@ void MotionProfileTrapezoidal::compute() {
 
 MIMO::Ptr MotionProfileTrapezoidal::clone() {
     MotionProfileTrapezoidal::Ptr tmp =
-        boost::make_shared< MotionProfileTrapezoidal > ();
+        make_node< MotionProfileTrapezoidal > ();
     tmp->setProgressExpression( 
-            getProgressExpression()->clone() 
+            cloned(getProgressExpression()) 
     );
     for (int i=0;i<nrOfOutputs();++i) {
         tmp->addOutput( 
-                getStartValue(i)->clone(), 
-                getEndValue(i)->clone(), 
-                getMaxVelocity(i)->clone(), 
-                getMaxAcceleration(i)->clone() );
+                cloned(getStartValue(i)), 
+                cloned(getEndValue(i)), 
+                cloned(getMaxVelocity(i)), 
+                cloned(getMaxAcceleration(i)) );
     }
     return tmp;
 }  
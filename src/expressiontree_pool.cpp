@@ -0,0 +1,119 @@
+/*
+ * expressiontree_pool.cpp
+ *
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#include <kdl/expressiontree_pool.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace KDL {
+
+TaskPool::TaskPool(int nthreads):
+    nworkers(nthreads),
+    task(0),
+    ntasks(0),
+    next(0),
+    busy(0),
+    generation(0),
+    stop(false) {
+    if (nworkers<=0) {
+        nworkers = std::max<int>(1, boost::thread::hardware_concurrency());
+    }
+    for (int w=1;w<nworkers;++w) {
+        threads.create_thread( boost::bind(&TaskPool::worker, this, w) );
+    }
+}
+
+/*
+ * executes tasks of the current job until there are none left.
+ */
+void TaskPool::work(int w) {
+    while (true) {
+        int k;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            if (next >= ntasks) {
+                return;
+            }
+            k = next++;
+        }
+        task->run(k, w);
+    }
+}
+
+void TaskPool::worker(int w) {
+    unsigned int seen = 0;
+    while (true) {
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            while (!stop && (generation==seen)) {
+                start.wait(lock);
+            }
+            if (stop) {
+                return;
+            }
+            seen = generation;
+            ++busy;
+        }
+        work(w);
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            if (--busy==0) {
+                done.notify_all();
+            }
+        }
+    }
+}
+
+void TaskPool::run(Task& t, int n) {
+    if (n<=0) {
+        return;
+    }
+    if ((nworkers==1) || (n==1)) {
+        for (int k=0;k<n;++k) {
+            t.run(k, 0);
+        }
+        return;
+    }
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        task   = &t;
+        ntasks = n;
+        next   = 0;
+        ++generation;
+    }
+    start.notify_all();
+    work(0);
+    boost::mutex::scoped_lock lock(mutex);
+    while (busy > 0) {
+        done.wait(lock);
+    }
+    task = 0;
+}
+
+TaskPool::~TaskPool() {
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        stop = true;
+    }
+    start.notify_all();
+    threads.join_all();
+}
+
+} // namespace KDL
@@ -0,0 +1,101 @@
+/*
+ * expressiontree_realtime.cpp
+ *
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#include <kdl/expressiontree_realtime.hpp>
+#include <boost/atomic.hpp>
+#include <cassert>
+
+namespace KDL {
+
+static boost::atomic<int> allocation_guards(0);
+static bool               allocation_hook = false;
+
+// innermost guard of this thread.  Not a boost::thread_specific_ptr, since setting it allocates
+// memory, which the enclosing guards would see.
+static __thread AllocationGuard* current_guard = 0;
+
+AllocationGuard::AllocationGuard(Mode _mode):
+    mode(_mode),
+    count(0),
+    previous(current_guard) {
+    current_guard = this;
+    ++allocation_guards;
+}
+
+unsigned long AllocationGuard::allocations() const {
+    return count;
+}
+
+bool AllocationGuard::hooked() {
+    return allocation_hook;
+}
+
+bool AllocationGuard::install() {
+    allocation_hook = true;
+    return true;
+}
+
+void AllocationGuard::notify() {
+    if (allocation_guards.load(boost::memory_order_relaxed) > 0) {
+        for (AllocationGuard* g = current_guard; g!=0; g = g->previous) {
+            ++g->count;
+            if (g->mode==ABORT) {
+                std::abort();
+            }
+        }
+    }
+}
+
+AllocationGuard::~AllocationGuard() {
+    assert( current_guard == this );
+    current_guard = previous;
+    --allocation_guards;
+}
+
+template <typename T>
+static bool prepare_typed(const ExpressionBase::Ptr& e, const VarIndexSet& ndx) {
+    typename Expression<T>::Ptr expr = boost::dynamic_pointer_cast< Expression<T> >(e);
+    if (!expr) {
+        return false;
+    }
+    expr->value();
+    std::vector<typename AutoDiffTrait<T>::DerivType> jac(ndx.size());
+    if (!ndx.empty()) {
+        expr->jacobian(ndx, &jac[0]);
+    }
+    for (size_t k=0;k<ndx.size();++k) {
+        expr->derivative(ndx[k]);
+    }
+    return true;
+}
+
+void prepare_realtime(const ExpressionBase::Ptr& expr, const VarIndexSet& ndx) {
+    prepare_typed<double>(expr,ndx)   || prepare_typed<Vector>(expr,ndx) ||
+    prepare_typed<Rotation>(expr,ndx) || prepare_typed<Frame>(expr,ndx)  ||
+    prepare_typed<Twist>(expr,ndx)    || prepare_typed<Wrench>(expr,ndx);
+}
+
+void prepare_realtime(const ExpressionBase::Ptr& expr) {
+    VarIndexSet ndx;
+    expr->dependencies().getVariables(ndx);
+    prepare_realtime(expr, ndx);
+}
+
+} // namespace KDL
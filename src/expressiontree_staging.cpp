@@ -0,0 +1,105 @@
+/*
+ * expressiontree_staging.cpp
+ *
+* expressiongraph library
+*
+* Copyright 2014 Erwin Aertbelien - KU Leuven - Dep. of Mechanical Engineering
+*
+* Licensed under the EUPL, Version 1.1 only (the "Licence");
+* You may not use this work except in compliance with the Licence.
+* You may obtain a copy of the Licence at:
+*
+* http://ec.europa.eu/idabc/eupl
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the Licence is distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the Licence for the specific language governing permissions and
+* limitations under the Licence.
+*/
+
+#include <kdl/expressiontree_staging.hpp>
+
+namespace KDL {
+
+InputStaging::InputStaging(const std::vector<int>& _ndx, const std::vector<int>& _rotndx,
+                           const std::vector<double>& initial_values):
+    ndx(_ndx),
+    rotndx(_rotndx),
+    back(0),
+    middle(1),
+    front(2),
+    nr_of_updates(0) {
+    for (size_t i=0;i<ndx.size();++i) {
+        position[ndx[i]] = (int)i;
+    }
+    for (size_t i=0;i<rotndx.size();++i) {
+        rotposition[rotndx[i]] = (int)i;
+    }
+    staged.values.assign(ndx.size(), 0.0);
+    for (size_t i=0;(i<initial_values.size()) && (i<ndx.size());++i) {
+        staged.values[i] = initial_values[i];
+    }
+    staged.rotvalues.assign(rotndx.size(), Rotation::Identity());
+    for (int b=0;b<3;++b) {
+        buffer[b] = staged;
+    }
+}
+
+void InputStaging::setInputValue(int variable_number, double val) {
+    std::map<int,int>::const_iterator it = position.find(variable_number);
+    if (it!=position.end()) {
+        boost::mutex::scoped_lock lock(producer_mutex);
+        staged.values[it->second] = val;
+    }
+}
+
+void InputStaging::setInputValue(int variable_number, const Rotation& val) {
+    std::map<int,int>::const_iterator it = rotposition.find(variable_number);
+    if (it!=rotposition.end()) {
+        boost::mutex::scoped_lock lock(producer_mutex);
+        staged.rotvalues[it->second] = val;
+    }
+}
+
+void InputStaging::setInputValues(const std::vector<double>& values) {
+    assert( values.size()==ndx.size() );
+    boost::mutex::scoped_lock lock(producer_mutex);
+    std::copy(values.begin(), values.end(), staged.values.begin());
+}
+
+void InputStaging::publish() {
+    boost::mutex::scoped_lock lock(producer_mutex);
+    Snapshot& b = buffer[back];
+    std::copy(staged.values.begin(), staged.values.end(), b.values.begin());
+    std::copy(staged.rotvalues.begin(), staged.rotvalues.end(), b.rotvalues.begin());
+    // release: the consumer sees the contents of b when it takes it.
+    back = middle.exchange(back | NEW_SNAPSHOT, boost::memory_order_acq_rel) & ~NEW_SNAPSHOT;
+}
+
+bool InputStaging::update() {
+    if ((middle.load(boost::memory_order_relaxed) & NEW_SNAPSHOT)==0) {
+        return false;
+    }
+    // acquire: the contents of the new front buffer are visible after the exchange.
+    front = middle.exchange(front, boost::memory_order_acq_rel) & ~NEW_SNAPSHOT;
+    ++nr_of_updates;
+    return true;
+}
+
+void InputStaging::apply(ExpressionOptimizer& opt) const {
+    if (rotndx.empty()) {
+        opt.setInputValues(values());
+    } else {
+        opt.setInputValues(values(), rotValues());
+    }
+}
+
+void InputStaging::apply(ExpressionBase& expr) const {
+    expr.setInputValues(ndx, values());
+    if (!rotndx.empty()) {
+        expr.setInputValues(rotndx, rotValues());
+    }
+}
+
+} // namespace KDL
@@ -43,17 +43,8 @@ namespace KDL {
 
 template <typename T>
 inline int getDep( int i, typename Expression<T>::Ptr argument1, typename Expression<T>::Ptr argument2) {
-        //std::cout << "multiplication between " << std::endl;
-        //argument1->print(std::cout);std::cout << std::endl;
-        //argument2->print(std::cout);std::cout << std::endl;
-        std::set<int> vset1;
-        argument1->getDependencies(vset1);
-        bool depend1 = vset1.count(i)>0;
-        //std::cout << depend1 << std::endl;
-        std::set<int> vset2;
-        argument2->getDependencies(vset2);
-        bool depend2 = vset2.count(i)>0;
-        //std::cout << depend2 << std::endl;
+        bool depend1 = argument1->dependencies().contains(i);
+        bool depend2 = argument2->dependencies().contains(i);
         if (!depend1 && !depend2) {
             return 1;
         } else if (!depend1) {
@@ -66,17 +57,8 @@ inline int getDep( int i, typename Expression<T>::Ptr argument1, typename Expres
 }
 template <typename T1,typename T2>
 inline int getDep2( int i, typename Expression<T1>::Ptr argument1, typename Expression<T2>::Ptr argument2) {
-        //std::cout << "multiplication between " << std::endl;
-        //argument1->print(std::cout);std::cout << std::endl;
-        //argument2->print(std::cout);std::cout << std::endl;
-        std::set<int> vset1;
-        argument1->getDependencies(vset1);
-        bool depend1 = vset1.count(i)>0;
-        //std::cout << depend1 << std::endl;
-        std::set<int> vset2;
-        argument2->getDependencies(vset2);
-        bool depend2 = vset2.count(i)>0;
-        //std::cout << depend2 << std::endl;
+        bool depend1 = argument1->dependencies().contains(i);
+        bool depend2 = argument2->dependencies().contains(i);
         if (!depend1 && !depend2) {
             return 1;
         } else if (!depend1) {
@@ -89,16 +71,12 @@ inline int getDep2( int i, typename Expression<T1>::Ptr argument1, typename Expr
 }
 template<typename T>
 bool isDepOn(int i, typename Expression<T>::Ptr a) {
-        std::set<int> vset;
-        a->getDependencies(vset);
-        return vset.count(i)>0;
+        return a->dependencies().contains(i);
 }
 
 template <typename T>
 inline int getDep( int i, typename Expression<T>::Ptr argument1) {
-        std::set<int> vset1;
-        argument1->getDependencies(vset1);
-        bool depend1 = vset1.count(i)>0;
+        bool depend1 = argument1->dependencies().contains(i);
         if (!depend1) {
             return 1;
         } else {
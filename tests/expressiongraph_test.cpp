@@ -7,11 +7,15 @@
 
 
 #include <kdl/expressiontree.hpp>
+#include <kdl/expressiontree_motionprofiles.hpp>
+#include <kdl/expressiontree_matrix.hpp>
 #include "expressiongraph_test.hpp"
 
 
 using namespace KDL;
 
+EXPRESSIONGRAPH_ALLOCATION_HOOK
+
 
 TEST(ExpressionTree, Scalars) {
         std::vector<int> ndx; 
@@ -333,6 +337,177 @@ TEST_F(MonsterExpression, ExpressionOptimizer) {
 
 }
 
+TEST(ExpressionOptimizer, EpochInvalidation) {
+        std::vector<int> ndx;
+        ndx.push_back(0);
+        ndx.push_back(1);
+        boost::shared_ptr< CachedType<double> > c( new CachedType<double>(sin(input(0))*input(1),"c") );
+        Expression<double>::Ptr e = c*c;
+        ExpressionOptimizer opt;
+        opt.prepare(ndx);
+        e->addToOptimizer(opt);
+        EXPECT_TRUE( c->shared_epoch );
+        // a second optimizer cannot attach, and invalidates the cache explicitly:
+        ExpressionOptimizer opt2;
+        opt2.prepare(ndx);
+        e->addToOptimizer(opt2);
+        std::vector<double> x(2);
+        for (int k=0;k<4;++k) {
+            x[0] = 0.1*k;
+            x[1] = 1.0 + k;
+            double expected = sin(x[0])*x[1];
+            if (k%2==0) {
+                opt.setInputValues(x);
+            } else {
+                opt2.setInputValues(x);
+            }
+            EXPECT_NEAR( e->value(), expected*expected, 1E-12 );
+            EXPECT_NEAR( e->derivative(0), 2*expected*cos(x[0])*x[1], 1E-12 );
+            EXPECT_NEAR( e->derivative(1), 2*expected*sin(x[0]), 1E-12 );
+        }
+        // setInputValue on the graph itself still invalidates the cache:
+        e->setInputValue(1, 2.0);
+        EXPECT_NEAR( e->value(), sqr(sin(x[0])*2.0), 1E-12 );
+        EXPECT_NEAR( e->derivative(0), 2*sin(x[0])*2.0*cos(x[0])*2.0, 1E-12 );
+}
+
+TEST(ExpressionOptimizer, PerVariableInvalidation) {
+        std::vector<int> ndx;
+        ndx.push_back(0);
+        ndx.push_back(1);
+        ndx.push_back(2);
+        std::vector<int> rotndx;
+        rotndx.push_back(3);
+        boost::shared_ptr< CachedType<double> > c0( new CachedType<double>(sin(input(0))*input(2),"c0") );
+        boost::shared_ptr< CachedType<double> > c1( new CachedType<double>(cos(input(1)),"c1") );
+        boost::shared_ptr< CachedType<Vector> > c2( new CachedType<Vector>(inputRot(3)*Constant(Vector(1,0,0)),"c2") );
+        Expression<double>::Ptr e = c0*c1 + dot(c2,Constant(Vector(0,1,0)));
+        ExpressionOptimizer opt;
+        opt.prepare(ndx,rotndx);
+        e->addToOptimizer(opt);
+        std::vector<double> x(3);
+        x[0] = 0.1; x[1] = 0.2; x[2] = 0.3;
+        std::vector<Rotation> R(1,Rotation::RotZ(0.4));
+        opt.setInputValues(x,R);
+        EXPECT_NEAR( e->value(), sin(x[0])*x[2]*cos(x[1]) + sin(0.4), 1E-12 );
+        EXPECT_NEAR( e->derivative(1), -sin(x[0])*x[2]*sin(x[1]), 1E-12 );
+        unsigned long v0 = c0->valueEpoch(), v1 = c1->valueEpoch(), v2 = c2->valueEpoch();
+        unsigned long d1 = c1->derivEpoch();
+        // unchanged values do not invalidate any cache:
+        opt.setInputValues(x,R);
+        EXPECT_EQ( c0->valueEpoch(), v0 );
+        EXPECT_EQ( c1->valueEpoch(), v1 );
+        EXPECT_EQ( c2->valueEpoch(), v2 );
+        // only the caches that depend on a changed variable are invalidated:
+        x[2] = 0.5;
+        opt.setInputValues(x,R);
+        EXPECT_NE( c0->valueEpoch(), v0 );
+        EXPECT_EQ( c1->valueEpoch(), v1 );
+        EXPECT_EQ( c1->derivEpoch(), d1 );
+        EXPECT_EQ( c2->valueEpoch(), v2 );
+        EXPECT_NEAR( e->value(), sin(x[0])*x[2]*cos(x[1]) + sin(0.4), 1E-12 );
+        EXPECT_NEAR( e->derivative(0), cos(x[0])*x[2]*cos(x[1]), 1E-12 );
+        EXPECT_NEAR( e->derivative(1), -sin(x[0])*x[2]*sin(x[1]), 1E-12 );
+        v0 = c0->valueEpoch();
+        R[0] = Rotation::RotZ(0.6);
+        opt.setInputValues(x,R);
+        EXPECT_EQ( c0->valueEpoch(), v0 );
+        EXPECT_EQ( c1->valueEpoch(), v1 );
+        EXPECT_NE( c2->valueEpoch(), v2 );
+        EXPECT_NEAR( e->value(), sin(x[0])*x[2]*cos(x[1]) + sin(0.6), 1E-12 );
+        EXPECT_NEAR( e->derivative(5), cos(0.6), 1E-12 );
+        // a new prepare(..) regroups the caches:
+        opt.prepare(ndx,rotndx);
+        e->addToOptimizer(opt);
+        x[1] = 0.7;
+        opt.setInputValues(x,R);
+        EXPECT_NEAR( e->value(), sin(x[0])*x[2]*cos(x[1]) + sin(0.6), 1E-12 );
+}
+
+TEST(ExpressionOptimizer, LateRegistration) {
+        std::vector<int> ndx;
+        ndx.push_back(0);
+        ndx.push_back(1);
+        std::vector<int> rotndx;
+        rotndx.push_back(2);
+        Expression<double>::Ptr e1 = cached<double>(sin(input(0)))*input(1);
+        ExpressionOptimizer opt;
+        opt.prepare(ndx,rotndx);
+        e1->addToOptimizer(opt);
+        std::vector<double> x(2);
+        x[0] = 0.1; x[1] = 0.2;
+        std::vector<Rotation> R(1,Rotation::RotZ(0.4));
+        opt.setInputValues(x,R);
+        EXPECT_NEAR( e1->value(), sin(x[0])*x[1], 1E-12 );
+        // inputs and caches registered after setInputValues(..) get the current values,
+        // also when these do not change anymore:
+        boost::shared_ptr< CachedType<double> > c( new CachedType<double>(cos(input(1)),"c") );
+        c->value();
+        Expression<double>::Ptr e2 = c + input(0) + coord_y(inputRot(2)*Constant(Vector(1,0,0)));
+        e2->addToOptimizer(opt);
+        opt.setInputValues(x,R);
+        EXPECT_NEAR( e2->value(), cos(x[1]) + x[0] + sin(0.4), 1E-12 );
+        EXPECT_NEAR( e2->derivative(1), -sin(x[1]), 1E-12 );
+}
+
+TEST(ExpressionOptimizer, BoundInputs) {
+        std::vector<int> ndx;
+        ndx.push_back(2);
+        ndx.push_back(0);
+        std::vector<int> rotndx;
+        rotndx.push_back(3);
+        Expression<double>::Ptr c0 = cached<double>(sin(input(0))*input(2));
+        Expression<double>::Ptr e  = c0*dot(inputRot(3)*Constant(Vector(1,0,0)),Constant(Vector(0,1,0)));
+        ExpressionOptimizer opt;
+        opt.prepare(ndx,rotndx);
+        e->addToOptimizer(opt);
+        Eigen::VectorXd q(2);
+        Rotation R[1];
+        opt.bind(q,R);
+        std::vector<double> x(6,0.0);
+        for (int k=0;k<4;++k) {
+            q[0] = 0.1*k + 0.2;       // variable 2
+            q[1] = (k < 2) ? 0.5 : -0.5;  // variable 0
+            R[0] = Rotation::RotZ(0.3*k);
+            opt.update();
+            x[2] = q[0];
+            x[0] = q[1];
+            double expected = sin(x[0])*x[2]*sin(0.3*k);
+            EXPECT_NEAR( e->value(), expected, 1E-12 );
+            EXPECT_NEAR( e->derivative(0), cos(x[0])*x[2]*sin(0.3*k), 1E-12 );
+            EXPECT_NEAR( e->derivative(2), sin(x[0])*sin(0.3*k), 1E-12 );
+        }
+        // after unbind(), the inputs keep the last values of the buffer:
+        double last = e->value();
+        opt.unbind();
+        q[0] = 10.0;
+        EXPECT_NEAR( e->value(), last, 1E-12 );
+        opt.setInputValues(q, std::vector<Rotation>(1,R[0]));
+        EXPECT_NEAR( e->value(), sin(x[0])*10.0*sin(0.9), 1E-12 );
+        // a clone of bound inputs gets the values of the buffer:
+        opt.bind(q,R);
+        q[0] = 0.4;
+        R[0] = Rotation::RotZ(0.2);
+        opt.update();
+        Expression<double>::Ptr e2 = e->clone();
+        EXPECT_NEAR( e2->value(), sin(x[0])*0.4*sin(0.2), 1E-12 );
+        opt.unbind();   // q and R are destroyed before opt
+        // a bound optimizer unbinds the inputs when it is destroyed:
+        {
+            ExpressionOptimizer opt2;
+            opt2.prepare(ndx,rotndx);
+            e2->addToOptimizer(opt2);
+            Eigen::VectorXd q2(2);
+            q2[0] = 0.6;
+            q2[1] = x[0];
+            Rotation R2[1] = { Rotation::RotZ(0.1) };
+            opt2.bind(q2,R2);
+            opt2.update();
+            EXPECT_NEAR( e2->value(), sin(x[0])*0.6*sin(0.1), 1E-12 );
+        }
+        EXPECT_NEAR( e2->value(), sin(x[0])*0.6*sin(0.1), 1E-12 );
+}
+
 TEST(RotationalInputs, Simple) {
     Expression<Rotation>::Ptr e = inputRot(0);
     CHECK_ROT_WITH_NUM( e );
@@ -445,6 +620,29 @@ TEST(VariableType, Optimizer) {
 
     }
 
+TEST(VariableType, OptimizerSameInputs) {
+    // only the value of the variable changes, the input values given to the optimizer remain the same:
+    std::vector<int> ndx;
+    ndx.push_back(0);
+    ndx.push_back(1);
+    VariableType<double>::Ptr a = Variable<double>(0,1);
+    Expression<double>::Ptr expr = cached<double>(sin(a))*input(1);
+
+    ExpressionOptimizer opt;
+    opt.prepare(ndx);
+    expr->addToOptimizer(opt);
+    std::vector<double> arg(2);
+    arg[0] = 0.3;
+    arg[1] = 0.7;
+    for (int k=0;k<3;++k) {
+        a->setValue(0.2*k);
+        a->setJacobian(0,1.0);
+        opt.setInputValues(arg);
+        EXPECT_NEAR( expr->value(), sin(0.2*k)*arg[1], 1E-12 );
+        EXPECT_NEAR( expr->derivative(0), cos(0.2*k)*arg[1], 1E-12 );
+    }
+}
+
 TEST(VariableType, Consistency) {
     // build up two equivalent expressions a and b
     // we will manually fill in the values for a such that it corresponds to b
@@ -482,6 +680,1175 @@ TEST(VariableType, Consistency) {
     EXPECT_NEAR( expr_a->derivative(3), expr_b->derivative(3), 1E-8 );
 }
 
+TEST(CompiledExpression, Scalars) {
+        std::vector<int> ndx; 
+        ndx.push_back(0);ndx.push_back(2);ndx.push_back(3);
+        Expression<double>::Ptr a = random<double>(ndx);
+        Expression<double>::Ptr b = random<double>(ndx);
+        CHECK_COMPILED( -a );
+        CHECK_COMPILED( sin(a)*cos(b)+tan(a) );
+        CHECK_COMPILED( exp(a)/asin(a/Constant(10.0))-acos(b/Constant(10.0)) );
+        CHECK_COMPILED( log(a*a)+sqr(b)+sqrt(a*a+Constant(0.001)) );
+        CHECK_COMPILED( abs(a)-atan(b)+atan2(a,b) );
+        CHECK_COMPILED( fmod(a,0.3) );
+        CHECK_COMPILED( conditional<double>(a,b,a*b) );
+        CHECK_COMPILED( near_zero<double>(a,0.1,b,a*b) );
+        CHECK_COMPILED( make_constant<double>(a)*b );
+}
+
+TEST(CompiledExpression, Geometry) {
+        std::vector<int> ndx; 
+        ndx.push_back(0);ndx.push_back(2);ndx.push_back(3);
+        Expression<Vector>::Ptr   v1 = random<Vector>(ndx);
+        Expression<Vector>::Ptr   v2 = random<Vector>(ndx);
+        Expression<double>::Ptr   s  = random<double>(ndx);
+        Expression<Rotation>::Ptr R1 = random<Rotation>(ndx);
+        Expression<Rotation>::Ptr R2 = random<Rotation>(ndx);
+        Expression<Frame>::Ptr    F1 = random<Frame>(ndx);
+        Expression<Frame>::Ptr    F2 = random<Frame>(ndx);
+        Expression<Twist>::Ptr    t  = random<Twist>(ndx);
+        Expression<Wrench>::Ptr   w  = random<Wrench>(ndx);
+
+        CHECK_COMPILED( dot(v1,v2)*norm(v1*v2)+squared_norm(v1) );
+        CHECK_COMPILED( diff(v1,v2)*s - v1 + s*v2 );
+        CHECK_COMPILED( coord_x(v1)+coord_y(v2)*coord_z(v1) );
+        CHECK_COMPILED( rot(Vector(1,2,3),s)*rot_x(s)*inv(R1*R2)*rot_y(s)*rot_z(s) );
+        CHECK_COMPILED( unit_x(R1)+unit_y(R2)*unit_z(R1)+R1*v1 );
+        CHECK_COMPILED( getRotVec(R1*rotVec(v1,s)) );
+        CHECK_COMPILED( getRPY(R1) );
+        CHECK_COMPILED( inv(F1)*F2*frame(R1,v1) );
+        CHECK_COMPILED( origin(F1*F2)+F1*v2 );
+        CHECK_COMPILED( rotation(inv(F1)) );
+        CHECK_COMPILED( ref_point(R1*(t+twist(v1,v2))*s-t,v1) );
+        CHECK_COMPILED( transvel(t)+rotvel(-t) );
+        CHECK_COMPILED( ref_point(R1*(w+wrench(v1,v2))*s-w,v1) );
+        CHECK_COMPILED( force(w)+torque(-w) );
+}
+
+TEST(CompiledExpression, RotationalInputs) {
+        Expression<double>::Ptr e = dot( Constant(Vector(0,0,1)), inputRot(0)*KDL::vector(input(4),Constant(0.0),input(3))) ;
+        CHECK_COMPILED( e );
+        CHECK_COMPILED( inputRot(3)*inputRot(0)*inputRot(3) );
+}
+
+TEST(CompiledExpression, OpaqueNodes) {
+        std::vector<int> ndx;
+        ndx.push_back(0); 
+        ndx.push_back(2); 
+        VariableType<double>::Ptr a = Variable<double>(ndx); 
+        a->setValue(0.3);
+        a->setJacobian(0,1.5);
+        a->setJacobian(1,-0.5);
+        Expression<double>::Ptr e = sin(input(0))*a + cached<double>(a*input(2));
+        CHECK_COMPILED( e );
+}
+
+TEST(CompiledExpression, EvalContexts) {
+        std::vector<int> ndx;
+        ndx.push_back(0);
+        ndx.push_back(2);
+        VariableType<double>::Ptr a = Variable<double>(ndx);
+        a->setValue(0.3);
+        a->setJacobian(0,1.5);
+        a->setJacobian(1,-0.5);
+        Expression<double>::Ptr e = sin(input(0))*a + cached<double>(a*input(2)) + cos(input(1));
+        CompiledExpression<double> c = compile(e);
+        EvalContext::Ptr ctx1 = c.createContext();
+        EvalContext::Ptr ctx2 = c.createContext();
+        std::vector<double> x1(3), x2(3);
+        for (int i=0;i<3;++i) {
+            x1[i] = 0.1*i + 0.2;
+            x2[i] = -0.3*i + 0.1;
+        }
+        c.setInputValues(*ctx1, x1);
+        c.setInputValues(*ctx2, x2);
+        // the contexts have their own copy of the (opaque) VariableType node:
+        a->setValue(0.9);
+        c.setInputValues(x2);
+        e->setInputValues(x2);
+        EXPECT_NEAR( c.value(), e->value(), 1E-12 );
+        double v2 = c.value(*ctx2);
+        double v1 = c.value(*ctx1);
+        a->setValue(0.3);
+        e->setInputValues(x1);
+        EXPECT_NEAR( v1, e->value(), 1E-12 );
+        for (int i=0;i<3;++i) {
+            EXPECT_NEAR( c.derivative(*ctx1,i), e->derivative(i), 1E-12 );
+        }
+        VarIndexSet vars;
+        vars.push_back(0);
+        vars.push_back(1);
+        vars.push_back(2);
+        double jac[3];
+        c.jacobian(*ctx1, vars, jac);
+        Eigen::VectorXd g;
+        c.gradient(*ctx1, g);
+        for (int i=0;i<3;++i) {
+            EXPECT_NEAR( jac[i], e->derivative(i), 1E-12 );
+            EXPECT_NEAR( g[i],   e->derivative(i), 1E-12 );
+        }
+        e->setInputValues(x2);
+        EXPECT_NEAR( v2, e->value(), 1E-12 );
+        EXPECT_NEAR( c.derivative(*ctx2,1), e->derivative(1), 1E-12 );
+}
+
+TEST(CompiledExpression, IncrementalEvaluation) {
+        // fast branch, depending on input 0, and a slow branch (e.g. an object pose), depending on input 1:
+        Expression<Frame>::Ptr  fast = frame(rot_z(input(0)), KDL::vector(cos(input(0)),sin(input(0)),Constant(0.0)));
+        Expression<Vector>::Ptr slow = KDL::vector(input(1)*input(1),exp(input(1)),Constant(0.5));
+        Expression<double>::Ptr e    = norm(fast*slow);
+        CompiledExpression<double> c = compile(e);
+        ExpressionTape& tape = *c.tape;
+        EvalContext&    ctx  = tape.context();
+        std::vector<double> x(2);
+        x[0] = 0.2;
+        x[1] = 0.4;
+        c.setInputValues(x);
+        e->setInputValues(x);
+        EXPECT_NEAR( c.value(), e->value(), 1E-12 );
+        EXPECT_EQ( std::count(ctx.dirty.begin(),ctx.dirty.end(),1), 0 );
+        // unchanged values do not mark anything:
+        c.setInputValues(x);
+        EXPECT_EQ( std::count(ctx.dirty.begin(),ctx.dirty.end(),1), 0 );
+        // only the slow branch and the path to the output are dirty:
+        x[1] = 0.7;
+        c.setInputValue(1,x[1]);
+        int n = std::count(ctx.dirty.begin(),ctx.dirty.end(),1);
+        EXPECT_GT( n, 0 );
+        EXPECT_LT( n, (int)tape.instructions.size() );
+        for (size_t k=0;k<tape.scalar_inputs.size();++k) {
+            int i = tape.scalar_inputs[k];
+            EXPECT_EQ( ctx.dirty[i], tape.instructions[i].index==1 ? 1 : 0 );
+        }
+        e->setInputValues(x);
+        EXPECT_NEAR( c.value(), e->value(), 1E-12 );
+        EXPECT_NEAR( c.derivative(0), e->derivative(0), 1E-12 );
+        EXPECT_NEAR( c.derivative(1), e->derivative(1), 1E-12 );
+        x[0] = -0.3;
+        c.setInputValue(0,x[0]);
+        e->setInputValues(x);
+        EXPECT_NEAR( c.value(), e->value(), 1E-12 );
+        EXPECT_NEAR( c.derivative(0), e->derivative(0), 1E-12 );
+}
+
+TEST(CompiledExpression, OpaqueInputs) {
+        Chain chain;
+        chain.addSegment(Segment(Joint(Joint::RotZ), Frame(Vector(0,0,0.3))));
+        chain.addSegment(Segment(Joint(Joint::RotY), Frame(Vector(0.4,0,0))));
+        // the kinematic chain is evaluated by calling back into the expression graph:
+        Expression<Frame>::Ptr  F = kinematic_chain(chain,1);
+        Expression<double>::Ptr e = coord_x(F*(inputRot(3)*KDL::vector(input(0),Constant(0.1),Constant(0.2))));
+        CompiledExpression<double> c = compile(e);
+        ExpressionTape& tape = *c.tape;
+        EvalContext&    ctx  = tape.context();
+        ASSERT_EQ( tape.opaque_instructions.size(), 1u );
+        int chain_ins = tape.opaque_instructions[0];
+        std::vector<double> x(7, 0.3);
+        c.setInputValues(x);
+        e->setInputValues(x);
+        EXPECT_NEAR( c.value(), e->value(), 1E-12 );
+        // a variable of the input vector does not reach the chain:
+        c.setInputValue(0, 0.5);
+        e->setInputValue(0, 0.5);
+        EXPECT_EQ( ctx.dirty[chain_ins], 0 );
+        EXPECT_NEAR( c.value(), e->value(), 1E-12 );
+        // a joint of the chain does:
+        c.setInputValue(2, -0.4);
+        e->setInputValue(2, -0.4);
+        EXPECT_EQ( ctx.dirty[chain_ins], 1 );
+        EXPECT_NEAR( c.value(), e->value(), 1E-12 );
+        EXPECT_NEAR( c.derivative(2), e->derivative(2), 1E-12 );
+        // variables that nothing depends on:
+        c.setInputValue(6, 1.0);
+        c.setInputValue(100, 1.0);
+        EXPECT_EQ( std::count(ctx.dirty.begin(),ctx.dirty.end(),1), 0 );
+        // the rotational input:
+        c.setInputValue(3, Rotation::RotX(0.7));
+        e->setInputValue(3, Rotation::RotX(0.7));
+        EXPECT_EQ( ctx.dirty[chain_ins], 0 );
+        EXPECT_NEAR( c.value(), e->value(), 1E-12 );
+        EXPECT_NEAR( c.derivative(4), e->derivative(4), 1E-12 );
+}
+
+TEST(CompiledExpression, BatchEvaluation) {
+        Expression<Frame>::Ptr F = frame(rot_x(input(0))*rot_z(input(1)), KDL::vector(input(2)*input(0),Constant(0.1),sin(input(1))));
+        Expression<double>::Ptr s = dot(F*Constant(Vector(1,2,3)), KDL::vector(input(0),input(1),input(2)));
+        int N = 300;
+        Eigen::MatrixXd X(3,N);
+        for (int k=0;k<N;++k) {
+            for (int i=0;i<3;++i) {
+                X(i,k) = sin(0.1*k + i);
+            }
+        }
+        Eigen::MatrixXd values, jacobians, svalues;
+        evaluate_batch(F, X, values, jacobians, 4);
+        evaluate_batch(s, X, svalues, 3);
+        ASSERT_EQ( values.rows(), 12 );
+        ASSERT_EQ( jacobians.rows(), 18 );
+        ASSERT_EQ( svalues.rows(), 1 );
+        std::vector<double> x(3);
+        for (int k=0;k<N;++k) {
+            for (int i=0;i<3;++i) {
+                x[i] = X(i,k);
+            }
+            F->setInputValues(x);
+            s->setInputValues(x);
+            EXPECT_TRUE( Equal(TapeTrait<Frame>::load(&values(0,k)), F->value(), 1E-12) );
+            EXPECT_NEAR( svalues(0,k), s->value(), 1E-12 );
+            for (int i=0;i<3;++i) {
+                EXPECT_TRUE( Equal(TapeTrait<Twist>::load(&jacobians(6*i,k)), F->derivative(i), 1E-12) );
+            }
+        }
+}
+
+TEST_F(MonsterExpression, Gradient) {
+        setArbitraryInput<double>( expr );
+        expr->value();
+        Eigen::VectorXd g;
+        gradient(expr, g);
+        ASSERT_EQ( g.size(), expr->number_of_derivatives() );
+        for (int i=0;i<g.size();++i) {
+            EXPECT_NEAR( g[i], expr->derivative(i), 1E-8 );
+        }
+}
+
+TEST_F(MonsterExpression, CompiledExpression) {
+        CHECK_COMPILED( expr );
+        // shared subexpressions are only lowered once:
+        CompiledExpression<double> c = compile(expr);
+        EXPECT_LT( c.tape->instructions.size(), 60u );
+}
+
+TEST(Jacobian, Scalars) {
+        std::vector<int> ndx; 
+        ndx.push_back(0);ndx.push_back(2);ndx.push_back(3);
+        Expression<double>::Ptr a = random<double>(ndx);
+        Expression<double>::Ptr b = random<double>(ndx);
+        CHECK_JACOBIAN( -a );
+        CHECK_JACOBIAN( sin(a)*cos(b)+tan(a) );
+        CHECK_JACOBIAN( exp(a)/asin(a/Constant(10.0))-acos(b/Constant(10.0)) );
+        CHECK_JACOBIAN( log(a*a)+sqr(b)+sqrt(a*a+Constant(0.001)) );
+        CHECK_JACOBIAN( abs(a)-atan(b)+atan2(a,b) );
+        CHECK_JACOBIAN( fmod(a,0.3) );
+        CHECK_JACOBIAN( conditional<double>(a,b,a*b) );
+        CHECK_JACOBIAN( near_zero<double>(a,0.1,b,a*b) );
+        CHECK_JACOBIAN( make_constant<double>(a)*b );
+}
+
+TEST(Jacobian, Geometry) {
+        std::vector<int> ndx; 
+        ndx.push_back(0);ndx.push_back(2);ndx.push_back(3);
+        Expression<Vector>::Ptr   v1 = random<Vector>(ndx);
+        Expression<Vector>::Ptr   v2 = random<Vector>(ndx);
+        Expression<double>::Ptr   s  = random<double>(ndx);
+        Expression<Rotation>::Ptr R1 = random<Rotation>(ndx);
+        Expression<Rotation>::Ptr R2 = random<Rotation>(ndx);
+        Expression<Frame>::Ptr    F1 = random<Frame>(ndx);
+        Expression<Frame>::Ptr    F2 = random<Frame>(ndx);
+        Expression<Twist>::Ptr    t  = random<Twist>(ndx);
+        Expression<Wrench>::Ptr   w  = random<Wrench>(ndx);
+
+        CHECK_JACOBIAN( dot(v1,v2)*norm(v1*v2)+squared_norm(v1) );
+        CHECK_JACOBIAN( diff(v1,v2)*s - v1 + s*v2 );
+        CHECK_JACOBIAN( coord_x(v1)+coord_y(v2)*coord_z(v1) );
+        CHECK_JACOBIAN( rot(Vector(1,2,3),s)*rot_x(s)*inv(R1*R2)*rot_y(s)*rot_z(s) );
+        CHECK_JACOBIAN( unit_x(R1)+unit_y(R2)*unit_z(R1)+R1*v1 );
+        CHECK_JACOBIAN( getRotVec(R1*rotVec(v1,s)) );
+        CHECK_JACOBIAN( getRPY(R1) );
+        CHECK_JACOBIAN( construct_rotation_from_vectors(unit_x(R1),unit_y(R1),unit_z(R1))*R2 );
+        CHECK_JACOBIAN( inv(F1)*F2*frame(R1,v1) );
+        CHECK_JACOBIAN( origin(F1*F2)+F1*v2 );
+        CHECK_JACOBIAN( rotation(inv(F1)) );
+        CHECK_JACOBIAN( ref_point(R1*(t+twist(v1,v2))*s-t,v1) );
+        CHECK_JACOBIAN( transvel(t)+rotvel(-t) );
+        CHECK_JACOBIAN( ref_point(R1*(w+wrench(v1,v2))*s-w,v1) );
+        CHECK_JACOBIAN( force(w)+torque(-w) );
+}
+
+TEST(Jacobian, RotationalInputs) {
+        Expression<double>::Ptr e = dot( Constant(Vector(0,0,1)), inputRot(0)*KDL::vector(input(4),Constant(0.0),input(3))) ;
+        CHECK_JACOBIAN( e );
+        CHECK_JACOBIAN( inputRot(3)*inputRot(0)*inputRot(3) );
+}
+
+TEST_F(MonsterExpression, Jacobian) {
+        CHECK_JACOBIAN( expr );
+        // the cached blocks are invalidated by setInputValue:
+        VarIndexSet ndx;
+        ndx.push_back(0);ndx.push_back(2);ndx.push_back(3);
+        std::vector<double> jac(ndx.size());
+        expr->setInputValue(0,0.1);
+        expr->value();
+        expr->jacobian(ndx,&jac[0]);
+        expr->setInputValue(0,0.7);
+        expr->value();
+        expr->jacobian(ndx,&jac[0]);
+        for (size_t k=0;k<ndx.size();++k) {
+            EXPECT_NEAR( jac[k], expr->derivative(ndx[k]), 1E-10 );
+        }
+}
+TEST(DependencySet, Operations) {
+        DependencySet a;
+        EXPECT_TRUE( a.empty() );
+        a.insert(3);
+        a.insert(70);
+        a.insert(500);
+        a.insert(200);
+        a.insert(500);
+        EXPECT_FALSE( a.empty() );
+        EXPECT_TRUE( a.contains(3) );
+        EXPECT_TRUE( a.contains(70) );
+        EXPECT_TRUE( a.contains(200) );
+        EXPECT_TRUE( a.contains(500) );
+        EXPECT_FALSE( a.contains(4) );
+        EXPECT_FALSE( a.contains(201) );
+        EXPECT_FALSE( a.contains(-1) );
+        DependencySet b;
+        b.insert(4);
+        b.insert(300);
+        EXPECT_FALSE( a.intersects(b) );
+        b.insert(200);
+        EXPECT_TRUE( a.intersects(b) );
+        a |= b;
+        std::vector<int> ndx;
+        a.getVariables(ndx);
+        int expected[] = {3,4,70,200,300,500};
+        ASSERT_EQ( ndx.size(), 6u );
+        for (int k=0;k<6;++k) {
+            EXPECT_EQ( ndx[k], expected[k] );
+        }
+        std::set<int> vset(expected,expected+6);
+        EXPECT_TRUE( DependencySet(vset)==a );
+}
+
+TEST_F(MonsterExpression, Dependencies) {
+        std::set<int> vset;
+        expr->getDependencies(vset);
+        EXPECT_TRUE( DependencySet(vset)==expr->dependencies() );
+        Expression<Vector>::Ptr e = inputRot(3)*KDL::vector(input(1),Constant(0.0),input(140));
+        vset.clear();
+        e->getDependencies(vset);
+        EXPECT_TRUE( DependencySet(vset)==e->dependencies() );
+        EXPECT_TRUE( e->dependencies().contains(5) );
+        EXPECT_FALSE( e->dependencies().contains(6) );
+        EXPECT_TRUE( isConstant<double>( sin(Constant(1.0))*cos(Constant(2.0)) ) );
+}
+
+TEST(Sparsity, JacobianPattern) {
+        // two independent chains of variables and a constraint coupling them:
+        Expression<Vector>::Ptr p1 = KDL::vector(cos(input(0))+sin(input(1)), input(2)*input(1), Constant(0.2));
+        Expression<Vector>::Ptr p2 = rot_z(input(7))*KDL::vector(input(8),Constant(0.0),Constant(0.5));
+        std::vector<ExpressionBase::Ptr> exprs;
+        exprs.push_back(p1);
+        exprs.push_back(p2);
+        exprs.push_back(dot(p1,p2));
+        VarIndexSet ndx;
+        for (int i=0;i<10;++i) {
+            ndx.push_back(i);
+        }
+        std::vector< std::pair<int,int> > pattern;
+        jacobian_sparsity(exprs,ndx,pattern);
+        int expected[][2] = {{0,0},{0,1},{0,2},{1,7},{1,8},{2,0},{2,1},{2,2},{2,7},{2,8}};
+        ASSERT_EQ( pattern.size(), 10u );
+        for (int k=0;k<10;++k) {
+            EXPECT_EQ( pattern[k].first,  expected[k][0] );
+            EXPECT_EQ( pattern[k].second, expected[k][1] );
+        }
+        std::vector<double> x(10,0.3);
+        Expression<double>::Ptr e = dot(p1,p2);
+        e->setInputValues(x);
+        e->value();
+        std::vector<double> jac(ndx.size());
+        e->jacobian(ndx,&jac[0]);
+        for (int i=0;i<10;++i) {
+            EXPECT_NEAR( jac[i], e->derivative(i), 1E-12 );
+            if (!e->dependencies().contains(i)) {
+                EXPECT_EQ( e->derivative(i), 0.0 );
+            }
+        }
+        for (int i=0;i<10;++i) {
+            EXPECT_NEAR( jac[i], numerical_derivative<double>(e,i,0.3), 1E-5 );
+        }
+}
+
+TEST(Sparsity, JacobianAssembler) {
+        Expression<double>::Ptr   s = input(0)*input(1)+sin(input(2));
+        Expression<Vector>::Ptr   v = KDL::vector(input(3),cos(input(4)),Constant(1.0));
+        Expression<Rotation>::Ptr R = rot_x(input(5))*rot_z(input(0));
+        Expression<Frame>::Ptr    F = frame(rot_y(input(6)), KDL::vector(input(7),input(2),Constant(0.0)));
+        VarIndexSet ndx;
+        for (int i=7;i>=0;--i) {
+            ndx.push_back(i);
+        }
+        JacobianAssembler assembler(ndx);
+        EXPECT_EQ( assembler.add(s), 0 );
+        EXPECT_EQ( assembler.add(v), 1 );
+        EXPECT_EQ( assembler.add(R), 4 );
+        EXPECT_EQ( assembler.add(F), 7 );
+        EXPECT_EQ( assembler.rows(), 13 );
+        EXPECT_EQ( assembler.cols(), 8 );
+        EXPECT_EQ( assembler.nonZeros(), 3 + 3*2 + 3*2 + 6*3 );
+
+        std::vector<double> x(8);
+        for (int i=0;i<8;++i) {
+            x[i] = 0.1*i+0.2;
+        }
+        s->setInputValues(x); s->value();
+        v->setInputValues(x); v->value();
+        R->setInputValues(x); R->value();
+        F->setInputValues(x); F->value();
+        Eigen::MatrixXd Jd;
+        SparseJacobian  Js;
+        assembler.initialize(Jd);
+        assembler.initialize(Js);
+        assembler.jacobian(Jd);
+        assembler.jacobian(Js);
+
+        Eigen::MatrixXd J(13,8);
+        for (int c=0;c<8;++c) {
+            int i = ndx[c];
+            J(0,c) = s->derivative(i);
+            Vector dv = v->derivative(i);
+            Vector dR = R->derivative(i);
+            Twist  dF = F->derivative(i);
+            for (int r=0;r<3;++r) {
+                J(1+r,c)  = dv(r);
+                J(4+r,c)  = dR(r);
+                J(7+r,c)  = dF.vel(r);
+                J(10+r,c) = dF.rot(r);
+            }
+        }
+        EXPECT_TRUE( Jd.isApprox(J,1E-12) );
+        EXPECT_TRUE( Eigen::MatrixXd(Js).isApprox(J,1E-12) );
+        EXPECT_EQ( Js.nonZeros(), assembler.nonZeros() );
+}
+
+TEST(Sparsity, CompressedJacobian) {
+        // banded problem with a rotational input and an opaque (VariableType) node:
+        int nvar = 40;
+        VarIndexSet ndx;
+        for (int i=0;i<nvar;++i) {
+            ndx.push_back(i);
+        }
+        ndx.push_back(50);
+        ndx.push_back(51);
+        ndx.push_back(52);
+        std::vector<int> varndx;
+        varndx.push_back(20);
+        varndx.push_back(21);
+        VariableType<double>::Ptr a = Variable<double>(varndx);
+        a->setValue(0.7);
+        a->setJacobian(0,1.5);
+        a->setJacobian(1,-0.5);
+        JacobianAssembler plain(ndx);
+        JacobianAssembler compressed(ndx);
+        for (int k=0;k<nvar-2;++k) {
+            Expression<double>::Ptr e = sin(input(k))*input(k+1) + input(k+2)*input(k+2);
+            plain.add(e);
+            compressed.add(e);
+        }
+        Expression<Vector>::Ptr v = inputRot(50)*KDL::vector(input(0),Constant(1.0),input(nvar-1));
+        plain.add(v);
+        compressed.add(v);
+        Expression<Frame>::Ptr F = frame(rot_x(a), KDL::vector(input(19),a,Constant(0.0)));
+        plain.add(F);
+        compressed.add(F);
+        compressed.compress();
+        EXPECT_TRUE( compressed.isCompressed() );
+        EXPECT_FALSE( plain.isCompressed() );
+        EXPECT_LT( compressed.numberOfColours(), 8 );
+
+        std::vector<double> x(50);
+        for (int i=0;i<50;++i) {
+            x[i] = 0.05*i+0.1;
+        }
+        Rotation R = Rotation::RPY(0.1,0.2,0.3);
+        plain.setInputValues(x);
+        plain.setInputValue(50,R);
+        plain.evaluate();
+        compressed.setInputValues(x);
+        compressed.setInputValue(50,R);
+        compressed.evaluate();
+
+        Eigen::MatrixXd J1, J2;
+        SparseJacobian  J3;
+        plain.initialize(J1);
+        compressed.initialize(J2);
+        compressed.initialize(J3);
+        plain.jacobian(J1);
+        compressed.jacobian(J2);
+        compressed.jacobian(J3);
+        EXPECT_TRUE( J1.isApprox(J2,1E-12) );
+        EXPECT_TRUE( J1.isApprox(Eigen::MatrixXd(J3),1E-12) );
+        // rotational velocity of rot_x(a) towards variables 20 and 21:
+        EXPECT_NEAR( J2(nvar-2+3+3, 20), 1.5, 1E-12 );
+        EXPECT_NEAR( J2(nvar-2+3+3, 21), -0.5, 1E-12 );
+}
+
+TEST(Sparsity, ParallelJacobian) {
+        int nvar = 60;
+        std::vector<int> ndx;
+        for (int i=0;i<nvar;++i) {
+            ndx.push_back(i);
+        }
+        ndx.push_back(70);
+        std::vector<int> varndx;
+        varndx.push_back(70);
+        VariableType<double>::Ptr a = Variable<double>(varndx);
+        a->setValue(0.3);
+        a->setJacobian(0,2.0);
+        // every constraint depends on all variables, i.e. one colour per column:
+        JacobianAssembler serial(ndx), parallel(ndx);
+        for (int j=0;j<5;++j) {
+            Expression<double>::Ptr e = a*Constant((double)j);
+            for (int k=0;k<nvar;++k) {
+                e = e + sin(input(k)+Constant(0.1*j))*input((k+j)%nvar);
+            }
+            Expression<Vector>::Ptr v = KDL::vector(e, cos(e), e*a);
+            serial.add(v);
+            parallel.add(v);
+        }
+        serial.compress();
+        parallel.setTaskPool(TaskPool::Ptr(new TaskPool(4)));
+        parallel.compress();
+        EXPECT_EQ( parallel.numberOfColours(), nvar+1 );
+
+        std::vector<double> x(nvar);
+        for (int i=0;i<nvar;++i) {
+            x[i] = 0.01*i-0.2;
+        }
+        Eigen::MatrixXd J1, J2;
+        SparseJacobian  J3;
+        serial.initialize(J1);
+        parallel.initialize(J2);
+        parallel.initialize(J3);
+        for (int cycle=0;cycle<3;++cycle) {
+            x[cycle] += 0.5;
+            serial.setInputValues(x);
+            serial.evaluate();
+            parallel.setInputValues(x);
+            parallel.evaluate();
+            serial.jacobian(J1);
+            parallel.jacobian(J2);
+            parallel.jacobian(J3);
+            EXPECT_TRUE( (J1.array()==J2.array()).all() );
+            EXPECT_TRUE( (J1.array()==Eigen::MatrixXd(J3).array()).all() );
+        }
+        // a different number of workers gives the same result:
+        parallel.setTaskPool(TaskPool::Ptr(new TaskPool(3)));
+        parallel.evaluate();
+        parallel.jacobian(J2);
+        EXPECT_TRUE( (J1.array()==J2.array()).all() );
+        // derivative of e = a*1 + ... towards variable 70:
+        EXPECT_NEAR( J1(3,nvar), 2.0, 1E-12 );
+}
+
+TEST(GraphBuilder, SharesIdenticalNodes) {
+        Expression<Vector>::Ptr v = KDL::vector(input(0),sin(input(1)),Constant(2.0));
+        EXPECT_NE( coord_x(v).get(), coord_x(v).get() );
+        Expression<double>::Ptr plain = coord_x(v)*coord_x(v) + coord_y(v)*coord_y(v);
+        {
+            GraphBuilder builder;
+            EXPECT_EQ( GraphBuilder::current(), &builder );
+            Expression<Vector>::Ptr tmp = KDL::vector(input(0),sin(input(1)),Constant(2.0));
+            EXPECT_EQ( tmp.get(), KDL::vector(input(0),sin(input(1)),Constant(2.0)).get() );
+            EXPECT_EQ( coord_x(tmp).get(), coord_x(tmp).get() );
+            EXPECT_EQ( Constant(2.0).get(), Constant(2.0).get() );
+            EXPECT_NE( Constant(2.0).get(), Constant(3.0).get() );
+            EXPECT_NE( input(0).get(), input(1).get() );
+            EXPECT_EQ( inputRot(3).get(), inputRot(3).get() );
+            EXPECT_NE( rot(Vector(1,0,0),input(0)).get(), rot(Vector(0,1,0),input(0)).get() );
+            EXPECT_NE( fmod(input(0),1.0).get(), fmod(input(0),2.0).get() );
+            EXPECT_NE( cached<double>(input(0)).get(), cached<double>(input(0)).get() );
+            size_t hits = builder.hits();
+            Expression<double>::Ptr e = coord_x(tmp)*coord_x(tmp) + coord_y(tmp)*coord_y(tmp);
+            EXPECT_EQ( builder.hits(), hits+3 );  // coord_x(tmp) twice, coord_y(tmp) once
+            {
+                // a nested builder has its own table:
+                GraphBuilder nested;
+                EXPECT_EQ( GraphBuilder::current(), &nested );
+                EXPECT_NE( coord_x(tmp).get(), coord_x(v).get() );
+                EXPECT_EQ( nested.size(), 2u );
+            }
+            EXPECT_EQ( GraphBuilder::current(), &builder );
+            std::vector<double> x(2);
+            x[0] = 0.3;
+            x[1] = -0.7;
+            e->setInputValues(x);
+            plain->setInputValues(x);
+            EXPECT_DOUBLE_EQ( e->value(), plain->value() );
+            EXPECT_DOUBLE_EQ( e->derivative(0), plain->derivative(0) );
+            EXPECT_DOUBLE_EQ( e->derivative(1), plain->derivative(1) );
+        }
+        EXPECT_TRUE( GraphBuilder::current()==0 );
+}
+
+static void current_builder_of_thread(GraphBuilder** result) {
+        *result = GraphBuilder::current();
+}
+
+TEST(GraphBuilder, ThreadLocal) {
+        GraphBuilder builder;
+        GraphBuilder* other = &builder;
+        boost::thread t(boost::bind(&current_builder_of_thread, &other));
+        t.join();
+        // another thread does not see the builder of this thread:
+        EXPECT_TRUE( other==0 );
+        EXPECT_EQ( GraphBuilder::current(), &builder );
+}
+
+TEST(GraphArena, AllocatesNodes) {
+        std::vector<double> x(2);
+        x[0] = 0.3;
+        x[1] = -0.7;
+        Expression<Vector>::Ptr v = KDL::vector(input(0),sin(input(1)),Constant(2.0));
+        Expression<double>::Ptr plain = cached<double>(dot(v,v))*coord_x(rot_z(input(1))*v);
+        plain->setInputValues(x);
+        EXPECT_TRUE( !GraphArena::current() );
+        Expression<double>::Ptr e;
+        GraphArena::Storage* storage = 0;
+        {
+            GraphArena arena(4096);
+            EXPECT_EQ( GraphArena::current(), arena.storage() );
+            storage = arena.storage();
+            Expression<Vector>::Ptr w = KDL::vector(input(0),sin(input(1)),Constant(2.0));
+            size_t n = arena.allocated();
+            EXPECT_GT( n, 0u );
+            e = cached<double>(dot(w,w))*coord_x(rot_z(input(1))*w);
+            EXPECT_GT( arena.allocated(), n );
+            EXPECT_LE( arena.chunks(), 2u );
+            {
+                GraphArena nested;
+                EXPECT_EQ( GraphArena::current(), nested.storage() );
+            }
+            EXPECT_EQ( GraphArena::current(), arena.storage() );
+        }
+        EXPECT_TRUE( !GraphArena::current() );
+        // the nodes keep the memory of the arena alive:
+        EXPECT_GT( storage->allocated(), 0u );
+        e->setInputValues(x);
+        EXPECT_DOUBLE_EQ( e->value(), plain->value() );
+        EXPECT_DOUBLE_EQ( e->derivative(0), plain->derivative(0) );
+        EXPECT_DOUBLE_EQ( e->derivative(1), plain->derivative(1) );
+        // outside an arena, the nodes are allocated on the heap:
+        Expression<double>::Ptr c = e->clone();
+        e.reset();
+        c->setInputValues(x);
+        EXPECT_DOUBLE_EQ( c->value(), plain->value() );
+}
+
+static void arena_of_thread(bool* has_arena) {
+        *has_arena = GraphArena::current();
+}
+
+TEST(GraphArena, ThreadLocalAndAligned) {
+        GraphArena arena;
+        bool other = true;
+        boost::thread t(boost::bind(&arena_of_thread, &other));
+        t.join();
+        // another thread does not allocate from the arena of this thread:
+        EXPECT_FALSE( other );
+        EXPECT_EQ( GraphArena::current(), arena.storage() );
+        for (int k=1;k<40;++k) {
+            void* p = arena.storage()->allocate(k);
+            EXPECT_EQ( reinterpret_cast<size_t>(p) % 16, 0u );   // fixed size Eigen types
+            arena.storage()->deallocate(p);
+        }
+}
+
+/*
+ * builds two roots that share subexpressions, without cached(..) except for one node.
+ */
+static void build_shared_graph(Expression<double>::Ptr& e, Expression<double>::Ptr& f) {
+        Expression<double>::Ptr q = input(1);
+        Expression<double>::Ptr s = input(0)*Constant(0.3) + q*q;
+        Expression<double>::Ptr u = sin(s)*cos(s);
+        e = u*u + s*cached<double>(s);
+        f = u + Constant(1.0);
+}
+
+TEST(GraphPasses, AutoCache) {
+        Expression<double>::Ptr e,f,e_ref,f_ref;
+        build_shared_graph(e,f);
+        build_shared_graph(e_ref,f_ref);
+        std::vector<ExpressionBase::Ptr> roots;
+        roots.push_back(e);
+        roots.push_back(f);
+        AutoCacheReport report = auto_cache(roots);
+        EXPECT_EQ( report.nodes, 15u );
+        EXPECT_EQ( report.shared_nodes, 3u );  // q, s and u
+        EXPECT_EQ( report.inserted, 1u );      // u, s reuses the existing cache
+        EXPECT_DOUBLE_EQ( report.evaluations_before, 70.0 );
+        EXPECT_DOUBLE_EQ( report.evaluations_after, 15.0 );
+        EXPECT_DOUBLE_EQ( report.redundantEvaluationsRemoved(), 55.0 );
+        for (int k=0;k<3;++k) {
+            std::vector<double> x(2);
+            x[0] = 0.3*k - 0.2;
+            x[1] = 0.7 - 0.4*k;
+            e->setInputValues(x);
+            f->setInputValues(x);
+            e_ref->setInputValues(x);
+            f_ref->setInputValues(x);
+            EXPECT_DOUBLE_EQ( e->value(), e_ref->value() );
+            EXPECT_DOUBLE_EQ( f->value(), f_ref->value() );
+            for (int i=0;i<2;++i) {
+                EXPECT_DOUBLE_EQ( e->derivative(i), e_ref->derivative(i) );
+                EXPECT_DOUBLE_EQ( f->derivative(i), f_ref->derivative(i) );
+            }
+        }
+        // a second pass has nothing left to do:
+        report = auto_cache(roots);
+        EXPECT_EQ( report.inserted, 0u );
+        EXPECT_DOUBLE_EQ( report.redundantEvaluationsRemoved(), 0.0 );
+}
+
+static void dotfile_of_thread(Expression<double>::Ptr e, std::string* result) {
+        std::ostringstream os;
+        e->write_dotfile(os);
+        *result = os.str();
+}
+
+TEST(GraphPasses, MemoryReport) {
+        Expression<double>::Ptr e,f;
+        build_shared_graph(e,f);
+        std::vector<ExpressionBase::Ptr> roots;
+        roots.push_back(e);
+        roots.push_back(f);
+        MemoryReport report = memory_report(roots);
+        EXPECT_EQ( report.nodes, 15u );
+        EXPECT_EQ( report.unknown_nodes, 0u );
+        size_t nodes = 0;
+        size_t bytes = 0;
+        for (std::map<std::string, MemoryReport::TypeUsage>::const_iterator it=report.types.begin();it!=report.types.end();++it) {
+            nodes += it->second.nodes;
+            bytes += it->second.bytes;
+        }
+        EXPECT_EQ( nodes, report.nodes );
+        EXPECT_EQ( bytes, report.node_bytes );
+        MemoryReport::TypeUsage inputs = report.types[demangle(typeid(InputType).name())];
+        EXPECT_EQ( inputs.nodes, 2u );
+        EXPECT_EQ( inputs.bytes, 2*sizeof(InputType) );
+        // the cache keeps the derivatives towards both variables:
+        EXPECT_GE( report.cache_bytes, 2*(sizeof(double)+sizeof(unsigned long)) );
+        EXPECT_GT( report.metadata_bytes, report.nodes*sizeof(NodeName) );
+        EXPECT_EQ( memory_report(f).nodes, 11u );
+
+        // nodes with the same name share one symbol:
+        EXPECT_EQ( input(3)->name.symbol(), input(3)->name.symbol() );
+        EXPECT_NE( input(3)->name.symbol(), input(4)->name.symbol() );
+        EXPECT_EQ( input(3)->name, std::string("input(3)") );
+        // and can be assigned from a string:
+        Expression<double>::Ptr q = input(3);
+        q->name = "q3";
+        EXPECT_EQ( q->name, std::string("q3") );
+        q->name = std::string("input(4)");
+        EXPECT_EQ( q->name.symbol(), input(4)->name.symbol() );
+
+        // a shared leaf is written once to a .dot file:
+        std::ostringstream os;
+        e->write_dotfile(os);
+        std::string dot = os.str();
+        std::string label = "label=\"input(1)\"";
+        size_t pos = dot.find(label);
+        ASSERT_NE( pos, std::string::npos );
+        EXPECT_EQ( dot.find(label,pos+1), std::string::npos );
+
+        // the marks of the written nodes are kept per thread, and removed at the end of the file:
+        std::string dot_of_other;
+        boost::thread t(boost::bind(&dotfile_of_thread, e, &dot_of_other));
+        t.join();
+        EXPECT_EQ( dot_of_other, dot );
+        std::ostringstream os2;
+        write_dotfile_start(os2);
+        e->write_dotfile_init();
+        e->write_dotfile_update(os2);
+        write_dotfile_end(os2);
+        std::ostringstream os3;
+        write_dotfile_start(os3);
+        e->write_dotfile_update(os3);
+        write_dotfile_end(os3);
+        EXPECT_EQ( os3.str(), os2.str() );
+}
+
+TEST(GraphPasses, ClonePreservesSharing) {
+        Expression<double>::Ptr x = input(0);
+        Expression<double>::Ptr c = cached<double>(sin(x));
+        Expression<double>::Ptr e = c*c;
+        for (int i=0;i<16;++i) {
+            e = e + e;       // a tree clone would have 2^16 nodes
+        }
+        Expression<double>::Ptr e2;
+        {
+            CloneContext ctx;
+            e2 = cloned(e);
+            EXPECT_EQ( ctx.size(), 20u );
+            EXPECT_EQ( cloned(e).get(), e2.get() );
+        }
+        // the sharing and the placement of the cache are preserved:
+        Expression<double>::Ptr a = e2;
+        for (int i=0;i<16;++i) {
+            BinaryExpression<double,double,double>* b = dynamic_cast<BinaryExpression<double,double,double>*>(a.get());
+            ASSERT_TRUE( b!=0 );
+            EXPECT_EQ( b->argument1.get(), b->argument2.get() );
+            a = b->argument1;
+        }
+        BinaryExpression<double,double,double>* m = dynamic_cast<BinaryExpression<double,double,double>*>(a.get());
+        ASSERT_TRUE( m!=0 );
+        EXPECT_EQ( m->argument1.get(), m->argument2.get() );
+        EXPECT_TRUE( dynamic_cast<CachedType<double>*>(m->argument1.get())!=0 );
+        EXPECT_NE( m->argument1.get(), c.get() );
+
+        // both graphs are independent:
+        e->setInputValue(0, 0.3);
+        e2->setInputValue(0, -0.4);
+        EXPECT_NEAR( e->value(),  std::pow(2.0,16)*sin(0.3)*sin(0.3), 1E-3 );
+        EXPECT_NEAR( e2->value(), std::pow(2.0,16)*sin(-0.4)*sin(-0.4), 1E-3 );
+        EXPECT_NEAR( e2->derivative(0), std::pow(2.0,16)*2*sin(-0.4)*cos(-0.4), 1E-3 );
+}
+
+TEST(GraphPasses, ClonedWithoutContext) {
+        Expression<double>::Ptr x = input(0);
+        Expression<double>::Ptr c = cached<double>(sin(x));
+        Expression<double>::Ptr e = c*c + c;
+        // cloned(..) without a CloneContext uses a temporary one, the shared cache is cloned once:
+        Expression<double>::Ptr e2 = cloned(e);
+        EXPECT_TRUE( !CloneContext::current() );
+        BinaryExpression<double,double,double>* s = dynamic_cast<BinaryExpression<double,double,double>*>(e2.get());
+        ASSERT_TRUE( s!=0 );
+        BinaryExpression<double,double,double>* m = dynamic_cast<BinaryExpression<double,double,double>*>(s->argument1.get());
+        ASSERT_TRUE( m!=0 );
+        EXPECT_EQ( m->argument1.get(), m->argument2.get() );
+        EXPECT_EQ( m->argument1.get(), s->argument2.get() );
+        EXPECT_NE( s->argument2.get(), c.get() );
+        EXPECT_EQ( memory_report(e2).nodes, memory_report(e).nodes );
+
+        e2->setInputValue(0, 0.3);
+        EXPECT_NEAR( e2->value(), sin(0.3)*sin(0.3)+sin(0.3), 1E-10 );
+        EXPECT_NEAR( e2->derivative(0), (2*sin(0.3)+1)*cos(0.3), 1E-10 );
+}
+
+TEST(GraphPasses, CloneSharesConstants) {
+        Expression<Frame>::Ptr base = Constant(Frame(Rotation::RPY(0.1,0.2,0.3),Vector(0.1,0.2,0.3)));
+        Expression<Frame>::Ptr tool = Constant(Frame(Vector(0,0,0.3)));
+        Expression<Frame>::Ptr e = base*frame(rot_x(input(0)),KDL::vector(input(1),Constant(0.0),Constant(0.5)))*tool;
+        std::vector<Expression<Frame>::Ptr> workers;
+        for (int k=0;k<4;++k) {
+            CloneContext ctx(true);
+            workers.push_back( cloned(e) );
+            EXPECT_EQ( ctx.shared(), 4u );   // base, tool and the two constant coordinates
+            EXPECT_LT( ctx.shared(), ctx.size() );
+        }
+        std::vector<double> x(2);
+        x[0] = 0.3;
+        x[1] = -0.2;
+        e->setInputValues(x);
+        Frame F = e->value();
+        for (size_t k=0;k<workers.size();++k) {
+            EXPECT_NE( workers[k].get(), e.get() );
+            BinaryExpression<Frame,Frame,Frame>* b  = dynamic_cast<BinaryExpression<Frame,Frame,Frame>*>(e.get());
+            BinaryExpression<Frame,Frame,Frame>* bk = dynamic_cast<BinaryExpression<Frame,Frame,Frame>*>(workers[k].get());
+            ASSERT_TRUE( (b!=0) && (bk!=0) );
+            EXPECT_EQ( bk->argument2.get(), b->argument2.get() );   // the constant tool frame
+            EXPECT_NE( bk->argument1.get(), b->argument1.get() );
+            x[0] = 0.1*k;
+            workers[k]->setInputValues(x);
+        }
+        // the workers do not influence each other nor the original:
+        EXPECT_TRUE( Equal(e->value(), F) );
+        for (size_t k=0;k<workers.size();++k) {
+            x[0] = 0.1*k;
+            e->setInputValues(x);
+            EXPECT_TRUE( Equal(workers[k]->value(), e->value()) );
+        }
+}
+
+static Expression<double>::Ptr build_branch(int var, int depth) {
+        Expression<double>::Ptr e = input(var);
+        for (int j=0;j<depth;++j) {
+            e = sin(e)*input(var+1) + Constant(0.1*j);
+        }
+        return e;
+}
+
+TEST(GraphPasses, ParallelEvaluator) {
+        // two independent branches of cost 60 and a shared input:
+        Expression<double>::Ptr e     = build_branch(0,20)*build_branch(2,20) + input(0);
+        Expression<double>::Ptr e_ref = build_branch(0,20)*build_branch(2,20) + input(0);
+        // a third branch and a branch that shares a cached node with it:
+        Expression<double>::Ptr c     = cached<double>(build_branch(4,20));
+        Expression<double>::Ptr f     = c*build_branch(0,5) + cos(c);
+        Expression<double>::Ptr c_ref = cached<double>(build_branch(4,20));
+        Expression<double>::Ptr f_ref = c_ref*build_branch(0,5) + cos(c_ref);
+        std::vector<ExpressionBase::Ptr> roots;
+        roots.push_back(e);
+        roots.push_back(f);
+
+        TaskPool::Ptr pool(new TaskPool(3));
+        ParallelEvaluator small(roots, pool, 1000);
+        EXPECT_EQ( small.numberOfTasks(), 0 );
+
+        ParallelEvaluator evaluator(roots, pool, 50);
+        ASSERT_EQ( evaluator.numberOfTasks(), 3 );
+        int reused = 0;
+        for (int k=0;k<evaluator.numberOfTasks();++k) {
+            EXPECT_GE( evaluator.taskCost(k), 50 );
+            EXPECT_TRUE( dynamic_cast<CachedExpression*>(evaluator.task(k).get())!=0 );
+            reused += evaluator.task(k)==c;
+        }
+        EXPECT_EQ( reused, 1 );    // the existing cache is used, the branches of e are cached
+        EXPECT_GE( evaluator.totalCost(), evaluator.taskCost(0)+evaluator.taskCost(1)+evaluator.taskCost(2) );
+        for (int k=0;k<3;++k) {
+            std::vector<double> x(6);
+            for (int i=0;i<6;++i) {
+                x[i] = 0.1*i + 0.2*k;
+            }
+            e->setInputValues(x);
+            f->setInputValues(x);
+            e_ref->setInputValues(x);
+            f_ref->setInputValues(x);
+            evaluator.evaluate();
+            EXPECT_DOUBLE_EQ( e->value(), e_ref->value() );
+            EXPECT_DOUBLE_EQ( f->value(), f_ref->value() );
+            for (int i=0;i<6;++i) {
+                EXPECT_DOUBLE_EQ( e->derivative(i), e_ref->derivative(i) );
+                EXPECT_DOUBLE_EQ( f->derivative(i), f_ref->derivative(i) );
+            }
+        }
+}
+
+static void stage_pairs(InputStaging* staging, int n) {
+        for (int k=1;k<=n;++k) {
+            staging->setInputValue(3, (double)k);
+            staging->setInputValue(7, -(double)k);
+            staging->publish();
+        }
+}
+
+TEST(InputStaging, ConsistentSnapshots) {
+        std::vector<int> ndx, rotndx;
+        ndx.push_back(3);
+        ndx.push_back(7);
+        rotndx.push_back(10);
+        std::vector<double> init(2, 0.5);
+        InputStaging staging(ndx, rotndx, init);
+        EXPECT_FALSE( staging.update() );
+        EXPECT_EQ( staging.values()[1], 0.5 );
+
+        Expression<double>::Ptr e = input(3)*Constant(2.0) - input(7) + coord_x(inputRot(10)*Constant(Vector(1.0,0.0,0.0)));
+        staging.setInputValue(3, 1.0);
+        staging.setInputValue(10, Rotation::RotZ(0.3));
+        staging.setInputValue(11, 9.0);   // not staged
+        EXPECT_FALSE( staging.update() );
+        staging.publish();
+        staging.setInputValue(7, 4.0);    // not yet published
+        EXPECT_TRUE( staging.update() );
+        EXPECT_FALSE( staging.update() );
+        staging.apply(*e);
+        EXPECT_NEAR( e->value(), 2.0 - 0.5 + cos(0.3), 1E-12 );
+        staging.publish();
+        EXPECT_TRUE( staging.update() );
+        staging.apply(*e);
+        EXPECT_NEAR( e->value(), 2.0 - 4.0 + cos(0.3), 1E-12 );
+
+        // the consumer only sees complete snapshots, in order:
+        int n = 20000;
+        InputStaging shared(ndx);
+        boost::thread producer(boost::bind(&stage_pairs, &shared, n));
+        double last = 0.0;
+        bool consistent = true, ordered = true;
+        while (last < n) {
+            if (shared.update()) {
+                consistent = consistent && (shared.values()[0] == -shared.values()[1]);
+                ordered    = ordered && (shared.values()[0] > last);
+                last       = shared.values()[0];
+            } else {
+                boost::this_thread::yield();
+            }
+        }
+        producer.join();
+        EXPECT_TRUE( consistent );
+        EXPECT_TRUE( ordered );
+        EXPECT_EQ( last, (double)n );
+        EXPECT_GE( shared.updates(), 1u );
+}
+
+TEST(RealTime, AllocationGuard) {
+        ASSERT_TRUE( AllocationGuard::hooked() );
+        AllocationGuard guard;
+        std::vector<double>* v = new std::vector<double>(10);
+        delete v;
+        EXPECT_EQ( guard.allocations(), 2u );
+}
+
+TEST(RealTime, Scalars) {
+        std::vector<int> ndx;
+        ndx.push_back(0);ndx.push_back(2);ndx.push_back(3);
+        Expression<double>::Ptr a = random<double>(ndx);
+        Expression<double>::Ptr b = random<double>(ndx);
+        CHECK_REALTIME( -a );
+        CHECK_REALTIME( sin(a)*cos(b)+tan(a) );
+        CHECK_REALTIME( exp(a)/asin(a/Constant(10.0))-acos(b/Constant(10.0)) );
+        CHECK_REALTIME( log(a*a)+sqr(b)+sqrt(a*a+Constant(0.001)) );
+        CHECK_REALTIME( abs(a)-atan(b)+atan2(a,b) );
+        CHECK_REALTIME( fmod(a,0.3) );
+        CHECK_REALTIME( conditional<double>(a,b,a*b) );
+        CHECK_REALTIME( near_zero<double>(a,0.1,b,a*b) );
+        CHECK_REALTIME( make_constant<double>(a)*b );
+        CHECK_REALTIME( cached<double>(a*b)+cached<double>(sin(a)) );
+        CHECK_REALTIME( maximum(a,b)+minimum(a,b)+saturate(a,-0.5,0.5) );
+}
+
+TEST(RealTime, Geometry) {
+        std::vector<int> ndx;
+        ndx.push_back(0);ndx.push_back(2);ndx.push_back(3);
+        Expression<Vector>::Ptr   v1 = random<Vector>(ndx);
+        Expression<Vector>::Ptr   v2 = random<Vector>(ndx);
+        Expression<double>::Ptr   s  = random<double>(ndx);
+        Expression<Rotation>::Ptr R1 = random<Rotation>(ndx);
+        Expression<Rotation>::Ptr R2 = random<Rotation>(ndx);
+        Expression<Frame>::Ptr    F1 = random<Frame>(ndx);
+        Expression<Frame>::Ptr    F2 = random<Frame>(ndx);
+        Expression<Twist>::Ptr    t  = random<Twist>(ndx);
+        Expression<Wrench>::Ptr   w  = random<Wrench>(ndx);
+
+        CHECK_REALTIME( dot(v1,v2)*norm(v1*v2)+squared_norm(v1) );
+        CHECK_REALTIME( diff(v1,v2)*s - v1 + s*v2 );
+        CHECK_REALTIME( coord_x(v1)+coord_y(v2)*coord_z(v1) );
+        CHECK_REALTIME( rot(Vector(1,2,3),s)*rot_x(s)*inv(R1*R2)*rot_y(s)*rot_z(s) );
+        CHECK_REALTIME( unit_x(R1)+unit_y(R2)*unit_z(R1)+R1*v1 );
+        CHECK_REALTIME( getRotVec(R1*rotVec(v1,s)) );
+        CHECK_REALTIME( getRPY(R1) );
+        CHECK_REALTIME( construct_rotation_from_vectors(unit_x(R1),unit_y(R1),unit_z(R1))*R2 );
+        CHECK_REALTIME( inv(F1)*F2*frame(R1,v1) );
+        CHECK_REALTIME( origin(F1*F2)+F1*v2 );
+        CHECK_REALTIME( rotation(inv(F1)) );
+        CHECK_REALTIME( ref_point(R1*(t+twist(v1,v2))*s-t,v1) );
+        CHECK_REALTIME( transvel(t)+rotvel(-t) );
+        CHECK_REALTIME( ref_point(R1*(w+wrench(v1,v2))*s-w,v1) );
+        CHECK_REALTIME( force(w)+torque(-w) );
+        CHECK_REALTIME( cached<Frame>(F1)*cached<Vector>(v1) );
+        CHECK_REALTIME( cross(v1,v2) );
+}
+
+TEST(RealTime, InputsAndVariables) {
+        std::vector<int> ndx;
+        ndx.push_back(0);ndx.push_back(2);ndx.push_back(3);
+        VariableType<double>::Ptr a = Variable<double>(ndx);
+        a->setValue(0.3);
+        a->setJacobian(1,2.0);
+        CHECK_REALTIME( sin(a)*input(0) + input(4) );
+        CHECK_REALTIME( inputRot(5)*KDL::vector(input(4),Constant(0.0),input(3)) );
+        CHECK_REALTIME( inputRot(3)*inputRot(0)*inputRot(3) );
+}
+
+TEST(RealTime, KinematicChain) {
+        // names longer than the small string buffer, such that copying a segment allocates:
+        Chain chain;
+        chain.addSegment(Segment("base_segment_with_a_long_name", Joint("first_joint_with_a_long_name",Joint::RotZ), Frame(Vector(0,0,0.3))));
+        chain.addSegment(Segment("fixed_segment_with_a_long_name", Joint(Joint::None), Frame(Rotation::RotX(0.3))));
+        chain.addSegment(Segment("second_segment_with_a_long_name", Joint("second_joint_with_a_long_name",Joint::RotY), Frame(Vector(0.4,0,0))));
+        chain.addSegment(Segment("third_segment_with_a_long_name", Joint("third_joint_with_a_long_name",Joint::TransX), Frame(Vector(0,0.1,0))));
+        CHECK_REALTIME( kinematic_chain(chain,1) );
+        CHECK_REALTIME( kinematic_chain(chain,0)*KDL::vector(input(0),Constant(0.0),Constant(0.1)) );
+        CHECK_REALTIME( inv(kinematic_chain(chain,2))*cached<Frame>(kinematic_chain(chain,0)) );
+}
+
+TEST(RealTime, MotionProfile) {
+        MotionProfileTrapezoidal::Ptr mp = create_motionprofile_trapezoidal();
+        mp->setProgressExpression(input(0));
+        mp->addOutput(input(1), Constant(3.0), Constant(1.0), Constant(0.5));
+        mp->addOutput(input(3), Constant(2.0), Constant(0.8), Constant(0.8));
+        Expression<double>::Ptr output1  = get_output_profile(mp,0);
+        Expression<double>::Ptr output2  = get_output_profile(mp,1);
+        Expression<double>::Ptr duration = get_duration(mp);
+        CHECK_REALTIME( output1 );
+        CHECK_REALTIME( output1*output2 + duration );
+        CHECK_REALTIME( sin(output2)*input(4) );
+}
+
+TEST(RealTime, Matrices) {
+        typedef Eigen::Matrix<double,3,3> Mat;
+        std::vector<int> ndx;
+        ndx.push_back(0);ndx.push_back(2);
+        VariableType<Mat>::Ptr a = Variable<Mat>(ndx);
+        a->setValue(Mat::Identity()*0.5);
+        a->setJacobian(0,Mat::Ones());
+        a->setJacobian(1,Mat::Identity());
+        Mat B;
+        B << 1,2,3,
+             4,5,2,
+            -1,3,2;
+        Expression<Mat>::Ptr b = Constant<Mat>(B);
+        CHECK_REALTIME( get_element<3,3>(1,2, addition<3,3>(multiply<3,3,3>(a,b),b)) );
+        CHECK_REALTIME( get_element<3,3>(0,0, cached<Mat>(multiply<3,3,3>(a,a)))*input(1) );
+}
+
+TEST_F(MonsterExpression, RealTime) {
+        CHECK_REALTIME( expr );
+        // the optimizer path:
+        ExpressionOptimizer opt;
+        opt.prepare(ndx);
+        expr->addToOptimizer(opt);
+        std::vector<double> values(3, 0.1);
+        opt.setInputValues(values);
+        prepare_realtime(expr);
+        {
+            AllocationGuard guard;
+            for (int k=0;k<3;++k) {
+                values[k] = 0.2*k;
+                opt.setInputValues(values);
+                expr->value();
+                for (int i=0;i<4;++i) {
+                    expr->derivative(i);
+                }
+            }
+            EXPECT_EQ( guard.allocations(), 0u );
+        }
+        // the compiled version:
+        CompiledExpression<double> c = compile(expr);
+        std::vector<double> jac(ndx.size());
+        c.setInputValues(ndx,values);
+        c.value();
+        c.jacobian(ndx,&jac[0]);
+        {
+            AllocationGuard guard;
+            c.setInputValues(ndx,values);
+            c.value();
+            c.derivative(2);
+            c.jacobian(ndx,&jac[0]);
+            EXPECT_EQ( guard.allocations(), 0u );
+        }
+}
+
+TEST(DependencySet, DeepExpression) {
+        // the dependencies of each node are computed from those of its arguments,
+        // building the expression is linear in its size:
+        Expression<double>::Ptr e = input(0);
+        for (int i=1;i<5000;++i) {
+            e = e + input(i % 300)*Constant(0.5);
+        }
+        EXPECT_TRUE( e->dependencies().contains(0) );
+        EXPECT_TRUE( e->dependencies().contains(299) );
+        EXPECT_FALSE( e->dependencies().contains(300) );
+        std::vector<int> ndx;
+        e->dependencies().getVariables(ndx);
+        EXPECT_EQ( ndx.size(), 300u );
+}
+
+TEST(DependencySet, FrozenMIMOInputs) {
+        // the dependency set of e is determined when e is built, the inputs of the MIMO
+        // cannot change anymore afterwards:
+        MotionProfileTrapezoidal::Ptr mp = create_motionprofile_trapezoidal();
+        mp->setProgressExpression(input(1));
+        mp->addOutput(input(2), Constant(3.0), Constant(1.0), Constant(0.5));
+        Expression<double>::Ptr e = get_output_profile(mp,0)*input(0);
+        EXPECT_TRUE( e->dependencies().contains(1) );
+        EXPECT_TRUE( e->dependencies().contains(2) );
+        EXPECT_THROW( mp->setProgressExpression(input(5)), std::logic_error );
+        EXPECT_THROW( mp->addOutput(input(6), Constant(1.0), Constant(1.0), Constant(0.5)), std::logic_error );
+        EXPECT_FALSE( mp->getProgressExpression()->dependencies().contains(5) );
+        EXPECT_EQ( mp->nrOfOutputs(), 1 );
+}
 
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv){
@@ -311,6 +311,177 @@ template <class T>
     EXPECT_PRED_FORMAT1(CheckNumericalRot, a );
 
 
+/** 
+ * A predicate format to check a compiled expression against the original expression graph:
+ * Evaluation is for arbitrary input values, the value and all derivatives are compared.
+ */
+template <class T>
+::testing::AssertionResult CheckCompiled(        
+                                               const char* mstr,
+                                               boost::shared_ptr< Expression<T> > e
+                                               ) {
+    typedef typename AutoDiffTrait<T>::DerivType Td;
+    double tol = 1E-10;
+    CompiledExpression<T> c = compile(e);
+    typedef std::set<int> Set;
+    Set scalardep;
+    Set rotdep;
+    e->getScalarDependencies(scalardep);
+    for (Set::iterator it=scalardep.begin();it!=scalardep.end();++it) {
+        double arg;
+        random(arg);
+        e->setInputValue(*it, arg);
+        c.setInputValue(*it, arg);
+    }
+    e->getRotDependencies(rotdep);
+    for (Set::iterator it=rotdep.begin();it!=rotdep.end();++it) {
+        Rotation arg;
+        random(arg);
+        e->setInputValue(*it, arg);
+        c.setInputValue(*it, arg);
+    }
+    T v1 = e->value();
+    T v2 = c.value();
+    if (!Equal(v1,v2,tol)) {
+        std::stringstream os;
+        os << "value of compiled expression differs for " << mstr << " : \n";  
+        os << "expression graph:\n" << v1 << "\n"; 
+        os << "compiled expression:\n" << v2 << "\n"; 
+        return ::testing::AssertionFailure() << os.str();
+    }
+    // reverse mode with an arbitrary seed:
+    double seed[6];
+    for (int k=0;k<6;++k) {
+        random(seed[k]);
+    }
+    Eigen::VectorXd adj;
+    c.tape->adjoint(c.output, seed, adj);
+    for (int i=0;i<e->number_of_derivatives();++i) {
+        Td d1 = e->derivative(i);
+        Td d2 = c.derivative(i);
+        if (!Equal(d1,d2,tol)) {
+            std::stringstream os;
+            os << "derivative of compiled expression differs for " << mstr << " : \n";  
+            os << "derivative towards variable " << i << "\n";
+            os << "expression graph:\n" << d1 << "\n"; 
+            os << "compiled expression:\n" << d2 << "\n"; 
+            return ::testing::AssertionFailure() << os.str();
+        }
+        double dv[6];
+        TapeTrait<Td>::store(dv,d1);
+        double expected = 0.0;
+        for (int k=0;k<TapeTrait<Td>::size;++k) {
+            expected += seed[k]*dv[k];
+        }
+        if (fabs(expected-adj[i]) > 1E-8) {
+            std::stringstream os;
+            os << "reverse mode derivative of compiled expression differs for " << mstr << " : \n";  
+            os << "derivative towards variable " << i << "\n";
+            os << "forward mode:\n" << expected << "\n"; 
+            os << "reverse mode:\n" << adj[i] << "\n"; 
+            return ::testing::AssertionFailure() << os.str();
+        }
+    }
+    // multiple derivatives per pass, with a partially filled last pass:
+    VarIndexSet ndx;
+    for (int i=e->number_of_derivatives()+1;i>=0;--i) {
+        ndx.push_back(i);
+    }
+    std::vector<Td> jac(ndx.size());
+    c.jacobian(ndx,&jac[0]);
+    for (size_t k=0;k<ndx.size();++k) {
+        Td d = e->derivative(ndx[k]);
+        if (!Equal(d,jac[k],tol)) {
+            std::stringstream os;
+            os << "jacobian of compiled expression differs for " << mstr << " : \n";  
+            os << "derivative towards variable " << ndx[k] << "\n";
+            os << "expression graph:\n" << d << "\n"; 
+            os << "compiled expression:\n" << jac[k] << "\n"; 
+            return ::testing::AssertionFailure() << os.str();
+        }
+    }
+    return ::testing::AssertionSuccess();
+}
+
+#define CHECK_COMPILED( a ) \
+    EXPECT_PRED_FORMAT1(CheckCompiled, a );
+
+/**
+ * checks whether jacobian(ndx,..) corresponds to derivative(i), for
+ * an index set in reverse order that also contains variables the expression does not depend on.
+ */
+template <typename T>
+::testing::AssertionResult CheckJacobian(        
+                                               const char* mstr,
+                                               boost::shared_ptr< Expression<T> > e
+                                               ) {
+    typedef typename AutoDiffTrait<T>::DerivType Td;
+    double tol = 1E-10;
+    setArbitraryInput<T>( e );
+    e->value();
+    int n = e->number_of_derivatives();
+    VarIndexSet ndx;
+    for (int i=n+1;i>=0;--i) {
+        ndx.push_back(i);
+    }
+    std::vector<Td> jac(ndx.size());
+    e->jacobian(ndx,&jac[0]);
+    for (size_t k=0;k<ndx.size();++k) {
+        Td d = e->derivative(ndx[k]);
+        if (!Equal(d,jac[k],tol)) {
+            std::stringstream os;
+            os << "jacobian differs from derivative for " << mstr << " : \n";  
+            os << "derivative towards variable " << ndx[k] << "\n";
+            os << "derivative:\n" << d << "\n"; 
+            os << "jacobian:\n" << jac[k] << "\n"; 
+            return ::testing::AssertionFailure() << os.str();
+        }
+    }
+    return ::testing::AssertionSuccess();
+}
+
+#define CHECK_JACOBIAN( a ) \
+    EXPECT_PRED_FORMAT1(CheckJacobian, a );
+
+/**
+ * checks that, after prepare_realtime(..), setting the inputs and evaluating value(),
+ * derivative(i) and jacobian(ndx,..) does not allocate memory.
+ */
+template <typename T>
+::testing::AssertionResult CheckRealtime(
+                                               const char* mstr,
+                                               boost::shared_ptr< Expression<T> > e
+                                               ) {
+    typedef typename AutoDiffTrait<T>::DerivType Td;
+    setArbitraryInput<T>( e );
+    VarIndexSet ndx;
+    e->dependencies().getVariables(ndx);
+    std::vector<Td>     jac(ndx.size()+1);
+    std::vector<double> x(e->number_of_derivatives(), 0.3);
+    std::vector<int>    xndx(ndx);
+    std::vector<double> xval(ndx.size(), 0.2);
+    prepare_realtime(e, ndx);
+    unsigned long n;
+    {
+        AllocationGuard guard;
+        e->setInputValues(x);
+        e->setInputValues(xndx,xval);
+        e->value();
+        for (size_t k=0;k<ndx.size();++k) {
+            e->derivative(ndx[k]);
+        }
+        e->jacobian(ndx,&jac[0]);
+        n = guard.allocations();
+    }
+    if (n!=0) {
+        return ::testing::AssertionFailure() << mstr << " allocates memory " << n << " times";
+    }
+    return ::testing::AssertionSuccess();
+}
+
+#define CHECK_REALTIME( a ) \
+    EXPECT_PRED_FORMAT1(CheckRealtime, a );
+
 
 
 } // namespace KDL 